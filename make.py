@@ -43,6 +43,17 @@ class compiler_unit:
 			self.wdk_incpath:list[str]=[s.format(**tmp_dict) for s in definition["wdk_incpath"]]
 			self.sdk_incpath:list[str]=[s.format(**tmp_dict) for s in definition["sdk_incpath"]]
 			self.wdk_libpath:list[str]=[s.format(**tmp_dict) for s in definition["wdk_libpath.amd64"]]
+		elif self.family=="gcc":
+			# Tools
+			self.cc:str=definition["cc"]
+			self.ar:str=definition["ar"]
+			self.cc_flag:list[str]=definition["cc_flags"]
+			self.as_flag:list[str]=definition["as_flags"]
+			self.library_output:str=definition["library_output"]
+			# There are no kernel-mode headers in user-mode toolchains.
+			self.wdk_incpath:list[str]=[]
+			self.sdk_incpath:list[str]=definition["sdk_incpath"]
+			self.wdk_libpath:list[str]=[]
 		self.libc_incpath:str=definition["libc_incpath"]
 		self.libc_incpath=self.libc_incpath.format(**tmp_dict)
 		self.os:str=definition["os"]
@@ -68,7 +79,7 @@ class compiler_unit:
 
 class object_unit:
 	# Each object unit represents a source file. (*.c or *.asm)
-	def __init__(self,file_name:str,compiler:compiler_unit,file_type:str,output_dir:str,includes:list[str],flags:list[str]):
+	def __init__(self,file_name:str,compiler:compiler_unit,file_type:str,output_dir:str,includes:list[str],flags:list[str],optimize:bool=False):
 		self.file_name:str=file_name
 		self.compiler=compiler
 		self.cmd:list[str]=[]
@@ -96,6 +107,7 @@ class object_unit:
 					self.cmd.append(compiler.preproc_def_flag.format(flag.format(**dict_pool)))
 				for flag in compiler.cl_flag:
 					self.cmd.append(flag.format(**dict_pool))
+				self.cmd+=compiler.opt_flags if optimize else compiler.noopt_flags
 				self.cmd.append(compiler.assembly_output.format(**dict_pool))
 				self.cmd.append(compiler.object_output.format(**dict_pool))
 			elif file_type=="Asm":
@@ -118,6 +130,24 @@ class object_unit:
 				self.cmd.append(file_name)
 			else:
 				print("Unknown file type: {}".format(file_type))
+		elif compiler.family=="gcc":
+			if file_type=="C" or file_type=="Asm":
+				self.cmd.append(compiler.cc)
+				self.cmd.append(file_name)
+				for inc in includes:
+					self.cmd.append(compiler.include_flag.format(inc))
+				for flag in flags:
+					self.cmd.append(compiler.preproc_def_flag.format(flag.format(**dict_pool)))
+				if file_type=="C":
+					for flag in compiler.cc_flag:
+						self.cmd.append(flag.format(**dict_pool))
+					self.cmd+=compiler.opt_flags if optimize else compiler.noopt_flags
+				else:
+					for flag in compiler.as_flag:
+						self.cmd.append(flag.format(**dict_pool))
+				self.cmd.append(compiler.object_output.format(**dict_pool))
+			else:
+				print("Unknown file type: {}".format(file_type))
 		else:
 			print("Unknown compiler family: {}!".format(compiler.family))
 	
@@ -219,7 +249,7 @@ class manifest_unit:
 
 class executable_unit:
 	def __init__(self,manifest:manifest_unit,compiler:compiler_unit,output_dict:dict,optimize:bool=False):
-		file_type_dict:dict={"win-drv":"sys","win-stalib":"lib","uefi-app":"efi","uefi-rtdrv":"efi"}
+		file_type_dict:dict={"win-drv":"sys","win-stalib":"lib","uefi-app":"efi","uefi-rtdrv":"efi","linux-exe":"","linux-stalib":"a"}
 		self.optimize:bool=optimize
 		self._internal_dict:dict={}
 		self._internal_dict["opt"]="fre" if self.optimize else "chk"
@@ -245,9 +275,13 @@ class executable_unit:
 		self.compiler:compiler_unit=compiler
 		self.manifest:manifest_unit=manifest
 		self.objects:list[object_unit]=[]
+		os.makedirs(self.intermediate_dir,exist_ok=True)
 		self.initialize_objects(manifest)
 		self.cmd:list[str]=[]
-		file_type_dict:dict={"C":"obj","Asm":"obj","Res":"res"}
+		if compiler.family=="gcc":
+			file_type_dict:dict={"C":"o","Asm":"o"}
+		else:
+			file_type_dict:dict={"C":"obj","Asm":"obj","Res":"res"}
 		if compiler.family=="msvc":
 			if self.file_type=="win-stalib":
 				self.cmd.append("lib")
@@ -273,6 +307,26 @@ class executable_unit:
 				self.cmd.append(compiler.symbol_output.format(**self._internal_dict))
 				self.cmd.append(compiler.binary_output.format(**self._internal_dict))
 				self.cmd.append(compiler.entry_point.format(self.entry_point))
+		elif compiler.family=="gcc":
+			if self.file_type=="linux-stalib":
+				self.cmd.append(compiler.ar)
+				self.cmd+=compiler.lib_flags
+				self.cmd.append(compiler.library_output.format(**self._internal_dict))
+				for obj in self.objects:
+					out_fn="{}{}{}.{}".format(self.intermediate_dir,os.sep,obj.target_name,file_type_dict[obj.file_type])
+					self.cmd.append(out_fn)
+			else:
+				self.cmd.append(compiler.cc)
+				for obj in self.objects:
+					out_fn="{}{}{}.{}".format(self.intermediate_dir,os.sep,obj.target_name,file_type_dict[obj.file_type])
+					self.cmd.append(out_fn)
+				# Libraries must follow the objects that reference them.
+				for lib in self.libraries:
+					lib_fn="{}{}{}".format(self.output_dir,os.sep,lib)
+					self.cmd.append(lib_fn)
+				self.cmd+=self.external_libraries
+				self.cmd+=compiler.linker_flags
+				self.cmd.append(compiler.binary_output.format(**self._internal_dict))
 
 	def initialize_objects(self,manifest:manifest_unit)->None:
 		# C Sources
@@ -289,12 +343,12 @@ class executable_unit:
 					includes+=self.compiler.sdk_incpath
 				else:
 					print("Unknown platform-per-file: {}".format(manifest.platform_per_file[src_fn]))
-			self.objects.append(object_unit(src,self.compiler,"C",self.intermediate_dir,includes,cflags))
+			self.objects.append(object_unit(src,self.compiler,"C",self.intermediate_dir,includes,cflags,self.optimize))
 		# Assembly Sources
 		for src in manifest.asm_sources:
 			aflags=manifest.aflags.copy()
 			src_fn=os.path.split(src)[-1]
-			self.objects.append(object_unit(src,self.compiler,"Asm",self.intermediate_dir,manifest.c_includes,aflags))
+			self.objects.append(object_unit(src,self.compiler,"Asm",self.intermediate_dir,manifest.c_includes,aflags,self.optimize))
 		# Resource Sources
 		for src in manifest.rc_sources:
 			cflags=manifest.cflags.copy()
@@ -327,6 +381,7 @@ class executable_unit:
 			obj.build()
 			obj.wait()
 			print(obj.stdout_text,end='')
+			print(obj.stderr_text,end='')
 		self.link()
 
 	def parallel_build(self):
@@ -335,12 +390,14 @@ class executable_unit:
 		for obj in self.objects:
 			obj.wait()
 			print(obj.stdout_text,end='')
+			print(obj.stderr_text,end='')
 		self.link()
 
 def main()->None:
 	global verbose
 	i=1
 	parallel_compilation:bool=False
+	optimize:bool=False
 	platform:str="win7x64"
 	target:str="hypervisor"
 	while i<len(sys.argv):
@@ -348,6 +405,8 @@ def main()->None:
 			parallel_compilation=True
 		elif sys.argv[i]=="/v":
 			verbose=True
+		elif sys.argv[i]=="/o":
+			optimize=True
 		elif sys.argv[i]=="/platform":
 			i+=1
 			platform=sys.argv[i]
@@ -379,7 +438,7 @@ def main()->None:
 	outputs_dict:dict=preset["outputs"]
 	if target in outputs_dict:
 		out_dict=outputs_dict[target]
-		executable=executable_unit(manifest,compiler,out_dict)
+		executable=executable_unit(manifest,compiler,out_dict,optimize)
 		if parallel_compilation:
 			executable.parallel_build()
 		else:
@@ -388,7 +447,7 @@ def main()->None:
 		print("Target {} is unknown!".format(target))
 
 if __name__=="__main__":
-	if platform.system()!="Windows":
+	if platform.system()!="Windows" and platform.system()!="Linux":
 		print("{} is unsupported!".format(platform.system()))
 		exit()
 	t1:float=time.time()
@@ -0,0 +1,96 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark harness for NoirVisor's
+  hypervisor-independent core running in user mode.
+
+  Usage: benchmark [suite-name]...
+  If no suites are specified, all suites will be run.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench.c
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "bench.h"
+
+noir_bench_suite_entry noir_bench_suites[]=
+{
+	{"avl",noir_bench_avl},
+	{"bitmap",noir_bench_bitmap},
+	{"rmt",noir_bench_rmt},
+	{"crc32c",noir_bench_crc32c},
+	{"trace",noir_bench_trace},
+	{"npt",noir_bench_npt},
+	{"nested",noir_bench_nested},
+	{"snpt",noir_bench_snpt},
+	{"emulator",noir_bench_emulator}
+};
+
+u64 noir_bench_seed=0x9E3779B97F4A7C15;
+
+u64 noir_bench_time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (u64)ts.tv_sec*1000000000+(u64)ts.tv_nsec;
+}
+
+// Use xorshift64 so that results are reproducible between runs.
+u64 noir_bench_random()
+{
+	noir_bench_seed^=noir_bench_seed<<13;
+	noir_bench_seed^=noir_bench_seed>>7;
+	noir_bench_seed^=noir_bench_seed<<17;
+	return noir_bench_seed;
+}
+
+void noir_bench_report(const char* name,u64 ops,u64 ns)
+{
+	printf("%-44s %12.2f ns/op %12llu ops\n",name,ops?(double)ns/(double)ops:0.0,ops);
+}
+
+void noir_bench_report_throughput(const char* name,u64 bytes,u64 ns)
+{
+	printf("%-44s %12.3f GB/s %12llu bytes\n",name,ns?(double)bytes/(double)ns:0.0,bytes);
+}
+
+void noir_bench_report_memory(const char* name,i64 bytes)
+{
+	printf("%-44s %12.2f KiB\n",name,(double)bytes/1024.0);
+}
+
+int main(int argc,char* argv[])
+{
+	struct rusage ru;
+	for(u32 i=0;i<sizeof(noir_bench_suites)/sizeof(noir_bench_suite_entry);i++)
+	{
+		bool selected=argc<2;
+		for(int j=1;j<argc;j++)
+			if(strcmp(argv[j],noir_bench_suites[i].name)==0)
+				selected=true;
+		if(selected)
+		{
+			const i64 base=noir_allocated_bytes;
+			char name[64];
+			noir_allocated_peak_bytes=base;
+			printf("========== %s ==========\n",noir_bench_suites[i].name);
+			noir_bench_suites[i].routine();
+			snprintf(name,sizeof(name),"%s: peak allocation",noir_bench_suites[i].name);
+			noir_bench_report_memory(name,noir_allocated_peak_bytes-base);
+		}
+	}
+	getrusage(RUSAGE_SELF,&ru);
+	printf("Maximum Resident Set Size: %ld KiB\n",ru.ru_maxrss);
+	fflush(stdout);
+	noir_report_memory_introspection_counter();
+	return 0;
+}
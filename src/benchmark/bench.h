@@ -0,0 +1,47 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This header file defines the micro-benchmark harness for NoirVisor's
+  hypervisor-independent core running in user mode.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench.h
+*/
+
+#include <nvdef.h>
+
+typedef void (*noir_bench_suite)(void);
+
+typedef struct _noir_bench_suite_entry
+{
+	const char* name;
+	noir_bench_suite routine;
+}noir_bench_suite_entry,*noir_bench_suite_entry_p;
+
+// Harness functions
+u64 noir_bench_time_ns();
+u64 noir_bench_random();
+void noir_bench_report(const char* name,u64 ops,u64 ns);
+void noir_bench_report_throughput(const char* name,u64 bytes,u64 ns);
+void noir_bench_report_memory(const char* name,i64 bytes);
+
+// Suites
+void noir_bench_avl();
+void noir_bench_bitmap();
+void noir_bench_rmt();
+void noir_bench_crc32c();
+void noir_bench_trace();
+void noir_bench_npt();
+void noir_bench_nested();
+void noir_bench_snpt();
+void noir_bench_emulator();
+
+// Memory Introspection Counters from the POSIX layer.
+extern i64v noir_allocated_bytes;
+extern i64v noir_allocated_peak_bytes;
+void noir_report_memory_introspection_counter();
@@ -0,0 +1,380 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark suites for Development Kits,
+  Reverse-Mapping Table, Code Integrity and Trace Rings.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench_core.c
+*/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <debug.h>
+#include "bench.h"
+
+bool noir_initialize_ci(bool soft_ci,bool hard_ci);
+void noir_finalize_ci();
+noir_status noir_configure_qemu_debug_console(u16 port);
+u32 stdcall noir_crc32_page_std(void* page);
+u32 stdcall noir_crc32_page_slice8(void* page);
+u32 stdcall noir_crc32_page_sse(void* page);
+u32 stdcall noir_crc32_page_clmul(void* page);
+bool fastcall noir_check_sse42();
+bool fastcall noir_check_pclmulqdq();
+
+// AVL-Tree
+typedef struct _noir_bench_avl_node
+{
+	avl_node avl;
+	u64 key;
+}noir_bench_avl_node,*noir_bench_avl_node_p;
+
+i32 static cdecl noir_bench_avl_sorting_comparator(const void* a,const void* b)
+{
+	const noir_bench_avl_node_p x=(const noir_bench_avl_node_p)a;
+	const noir_bench_avl_node_p y=(const noir_bench_avl_node_p)b;
+	return x->key>y->key?1:(x->key<y->key?-1:0);
+}
+
+i32 static cdecl noir_bench_avl_search_comparator(avl_node_p node,const void* item)
+{
+	const noir_bench_avl_node_p x=(const noir_bench_avl_node_p)node;
+	const u64 key=*(const u64*)item;
+	return key>x->key?1:(key<x->key?-1:0);
+}
+
+void noir_bench_avl()
+{
+	const u32 counts[]={1024,65536,1048576};
+	for(u32 c=0;c<sizeof(counts)/sizeof(u32);c++)
+	{
+		const u32 n=counts[c];
+		noir_bench_avl_node_p nodes=noir_alloc_nonpg_memory(sizeof(noir_bench_avl_node)*n);
+		if(nodes)
+		{
+			avl_node_p root=null;
+			char name[64];
+			u64 t1,t2,found=0;
+			for(u32 i=0;i<n;i++)nodes[i].key=noir_bench_random();
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<n;i++)root=noir_insert_avl_node(root,&nodes[i].avl,noir_bench_avl_sorting_comparator);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"avl: insert (%u nodes)",n);
+			noir_bench_report(name,n,t2-t1);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<n;i++)
+				found+=noir_search_avl_node(root,&nodes[(i*7919)%n].key,noir_bench_avl_search_comparator)!=null;
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"avl: search (%u nodes)",n);
+			noir_bench_report(name,n,t2-t1);
+			if(found!=n)printf("avl: only %llu of %u nodes are found!\n",found,n);
+			noir_free_nonpg_memory(nodes);
+		}
+	}
+}
+
+// Bitmap
+// Worst cases of the summary bitmap: only the last bit is clear or set.
+void static noir_bench_summary_bitmap()
+{
+	const u32 max_bits=1<<20;
+	for(u32 bits=64;bits<=max_bits;bits<<=2)
+	{
+		noir_summary_bitmap sb;
+		if(noir_initialize_summary_bitmap(&sb,bits))
+		{
+			const u32 iterations=(max_bits/bits)*64;
+			u32 sum=0;
+			char name[64];
+			u64 t1,t2;
+			noir_set_summary_bitmap_range(&sb,0,bits);
+			noir_reset_summary_bitmap(&sb,bits-1);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)sum+=noir_find_clear_summary_bit(&sb);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: summary find clear bit (%u bits)",bits);
+			noir_bench_report(name,iterations,t2-t1);
+			noir_reset_summary_bitmap_range(&sb,0,bits);
+			noir_set_summary_bitmap(&sb,bits-1);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)sum+=noir_find_set_summary_bit(&sb);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: summary find set bit (%u bits)",bits);
+			noir_bench_report(name,iterations,t2-t1);
+			if(sum!=(bits-1)*iterations*2)printf("bitmap: incorrect summary scan result!\n");
+			noir_reset_summary_bitmap(&sb,bits-1);
+			if(noir_find_set_summary_bit(&sb)!=0xffffffff)printf("bitmap: summary is not updated!\n");
+			noir_finalize_summary_bitmap(&sb);
+		}
+	}
+}
+
+void noir_bench_bitmap()
+{
+	const u32 max_bits=1<<20;
+	u64p bitmap=noir_alloc_nonpg_memory(max_bits>>3);
+	if(bitmap)
+	{
+		for(u32 bits=64;bits<=max_bits;bits<<=2)
+		{
+			const u32 iterations=(max_bits/bits)*64;
+			u32 sum=0;
+			char name[64];
+			u64 t1,t2;
+			// Worst case: only the last bit is clear.
+			noir_stosb(bitmap,0xff,bits>>3);
+			noir_btr(bitmap,bits-1);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)sum+=noir_find_clear_bit(bitmap,bits);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: find clear bit (%u bits)",bits);
+			noir_bench_report(name,iterations,t2-t1);
+			// Worst case: only the last bit is set.
+			noir_stosb(bitmap,0,bits>>3);
+			noir_bts(bitmap,bits-1);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)sum+=noir_find_set_bit(bitmap,bits);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: find set bit (%u bits)",bits);
+			noir_bench_report(name,iterations,t2-t1);
+			sum+=noir_find_last_set_bit(bitmap,bits);
+			if(sum!=(bits-1)*(iterations*2+1))printf("bitmap: incorrect scan result!\n");
+			// Count the set bits of a fully populated bitmap.
+			noir_stosb(bitmap,0xff,bits>>3);
+			sum=0;
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)sum+=noir_count_set_bits(bitmap,bits);
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: count set bits (%u bits)",bits);
+			noir_bench_report(name,iterations,t2-t1);
+			if(sum!=bits*iterations)printf("bitmap: incorrect population count!\n");
+			// Set and reset unaligned ranges spanning almost the whole bitmap.
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<iterations;i++)
+			{
+				noir_reset_bitmap_range(bitmap,1,bits-2);
+				noir_set_bitmap_range(bitmap,1,bits-2);
+			}
+			t2=noir_bench_time_ns();
+			snprintf(name,sizeof(name),"bitmap: set & reset range (%u bits)",bits);
+			noir_bench_report(name,iterations*2,t2-t1);
+			noir_reset_bitmap_range(bitmap,3,bits-5);
+			if(noir_count_set_bits(bitmap,bits)!=5 || noir_find_clear_bit(bitmap,bits)!=3 || noir_find_last_set_bit(bitmap,bits)!=bits-1)
+				printf("bitmap: incorrect range operation!\n");
+		}
+		noir_free_nonpg_memory(bitmap);
+	}
+	noir_bench_summary_bitmap();
+}
+
+// Reverse-Mapping Table
+// Synthesize a memory map with holes, similar to what firmwares would report.
+#define noir_bench_rmt_ranges		8
+#define noir_bench_rmt_range_size	0x20000000
+#define noir_bench_rmt_range_gap	0x8000000
+
+u64 static noir_bench_rmt_random_hpa()
+{
+	const u64 r=noir_bench_random();
+	const u64 range=r%noir_bench_rmt_ranges;
+	const u64 page=(r>>8)%page_count(noir_bench_rmt_range_size);
+	return range*(noir_bench_rmt_range_size+noir_bench_rmt_range_gap)+page_mult(page)+0x200000;
+}
+
+void noir_bench_rmt()
+{
+	noir_rmt_directory_entry_p rmt_dir;
+	hvm_p->rmd.directory.virt=noir_alloc_contd_memory(page_size);
+	rmt_dir=(noir_rmt_directory_entry_p)hvm_p->rmd.directory.virt;
+	if(rmt_dir)
+	{
+		const u32 n=1<<22;
+		u64 t1,t2,found=0;
+		hvm_p->rmd.dir_count=0;
+		for(u32 i=0;i<noir_bench_rmt_ranges;i++)
+		{
+			const u64 start=(u64)i*(noir_bench_rmt_range_size+noir_bench_rmt_range_gap)+0x200000;
+			rmt_dir[i].hpa_start=start;
+			rmt_dir[i].hpa_end=start+noir_bench_rmt_range_size;
+			rmt_dir[i].table.virt=noir_alloc_contd_memory(page_count(noir_bench_rmt_range_size)*sizeof(noir_rmt_entry));
+			if(rmt_dir[i].table.virt==null)goto cleanup;
+			hvm_p->rmd.dir_count++;
+		}
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<n;i++)found+=nvc_get_rmt_entry(noir_bench_rmt_random_hpa())!=null;
+		t2=noir_bench_time_ns();
+		noir_bench_report("rmt: get entry (random HPA, binary search)",n,t2-t1);
+		if(found!=n)printf("rmt: only %llu of %u entries are found!\n",found,n);
+		if(!nvc_build_rmt_index())printf("rmt: failed to build the index!\n");
+		found=0;
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<n;i++)found+=nvc_get_rmt_entry(noir_bench_rmt_random_hpa())!=null;
+		t2=noir_bench_time_ns();
+		noir_bench_report("rmt: get entry (random HPA)",n,t2-t1);
+		if(found!=n)printf("rmt: only %llu of %u entries are found!\n",found,n);
+		// HPAs in the gaps must not be found.
+		if(nvc_get_rmt_entry(noir_bench_rmt_range_size+0x200000) || nvc_get_rmt_entry(0x1FF000))printf("rmt: HPA out of range is found!\n");
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<n;i++)nvc_configure_reverse_mapping(noir_bench_rmt_random_hpa(),page_mult(i),2,false,noir_nsv_rmt_insecure_guest);
+		t2=noir_bench_time_ns();
+		noir_bench_report("rmt: configure (random HPA)",n,t2-t1);
+		{
+			// Validate 2MiB-sized contiguous runs.
+			u64 hpa[512],gpa[512];
+			const u32 runs=n>>9;
+			u32 passed=0;
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<runs;i++)
+			{
+				const u64 base=noir_bench_rmt_random_hpa()&~0x1FFFFF;
+				for(u32 j=0;j<512;j++)
+				{
+					hpa[j]=base+page_mult(j);
+					gpa[j]=page_mult(j);
+				}
+				passed+=nvc_validate_rmt_reassignment(hpa,gpa,512,2,false,noir_nsv_rmt_insecure_guest);
+			}
+			t2=noir_bench_time_ns();
+			noir_bench_report("rmt: validate (per page, 2MiB runs)",runs<<9,t2-t1);
+			if(passed!=runs)printf("rmt: only %u of %u runs are validated!\n",passed,runs);
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<runs;i++)
+			{
+				const u64 base=noir_bench_rmt_random_hpa()&~0x1FFFFF;
+				for(u32 j=0;j<512;j++)hpa[j]=base+page_mult(j);
+				nvc_configure_reverse_mapping_batch(hpa,gpa,512,2,false,noir_nsv_rmt_insecure_guest);
+			}
+			t2=noir_bench_time_ns();
+			noir_bench_report("rmt: configure (per page, 2MiB runs)",runs<<9,t2-t1);
+		}
+cleanup:
+		for(u32 i=0;i<hvm_p->rmd.dir_count;i++)
+			noir_free_contd_memory(rmt_dir[i].table.virt,page_count(noir_bench_rmt_range_size)*sizeof(noir_rmt_entry));
+		noir_free_contd_memory(rmt_dir,page_size);
+		if(hvm_p->rmd.index.virt)noir_free_contd_memory(hvm_p->rmd.index.virt,hvm_p->rmd.index_count<<2);
+		hvm_p->rmd.directory.virt=null;
+		hvm_p->rmd.index.virt=null;
+		hvm_p->rmd.dir_count=0;
+	}
+}
+
+// CRC32C for Code Integrity
+u32 static noir_bench_crc32c_kernel(const char* name,noir_crc32_page_func kernel,u8p buffer,u32 pages,u32 rounds)
+{
+	char report_name[64];
+	u32 crc=0;
+	u64 t1,t2;
+	t1=noir_bench_time_ns();
+	for(u32 r=0;r<rounds;r++)
+		for(u32 i=0;i<pages;i++)
+			crc+=kernel(&buffer[page_mult(i)]);
+	t2=noir_bench_time_ns();
+	snprintf(report_name,sizeof(report_name),"crc32c: %s",name);
+	noir_bench_report_throughput(report_name,page_mult((u64)pages*rounds),t2-t1);
+	return crc;
+}
+
+void noir_bench_crc32c()
+{
+	const u32 pages=4096,rounds=16;
+	u8p buffer=noir_alloc_contd_memory(page_mult(pages));
+	void** page_list=noir_alloc_nonpg_memory(sizeof(void*)*pages);
+	u32p crc_list=noir_alloc_nonpg_memory(sizeof(u32)*pages);
+	if(buffer && page_list && crc_list)
+	{
+		if(noir_initialize_ci(true,false))
+		{
+			u32 crc,expected;
+			u64 t1,t2;
+			for(u32 i=0;i<page_mult(pages);i++)buffer[i]=(u8)noir_bench_random();
+			// Compare all kernels. They must yield identical digests.
+			expected=noir_bench_crc32c_kernel("byte-wise table",noir_crc32_page_std,buffer,pages,1)*rounds;
+			crc=noir_bench_crc32c_kernel("slice-by-8",noir_crc32_page_slice8,buffer,pages,rounds);
+			if(crc!=expected)printf("crc32c: slice-by-8 digest mismatches!\n");
+			if(noir_check_sse42())
+			{
+				crc=noir_bench_crc32c_kernel("sse4.2 serial",noir_crc32_page_sse,buffer,pages,rounds);
+				if(crc!=expected)printf("crc32c: sse4.2 serial digest mismatches!\n");
+				if(noir_check_pclmulqdq())
+				{
+					crc=noir_bench_crc32c_kernel("sse4.2 3-way + pclmulqdq",noir_crc32_page_clmul,buffer,pages,rounds);
+					if(crc!=expected)printf("crc32c: sse4.2 3-way digest mismatches!\n");
+				}
+			}
+			crc=noir_bench_crc32c_kernel("selected kernel",noir_crc32_page,buffer,pages,rounds);
+			if(crc!=expected)printf("crc32c: selected kernel digest mismatches!\n");
+			// Batch interface, hashing pages in random order like a dirty-page sweep.
+			for(u32 i=0;i<pages;i++)page_list[i]=&buffer[page_mult((i*2654435761u)%pages)];
+			crc=0;
+			t1=noir_bench_time_ns();
+			for(u32 r=0;r<rounds;r++)
+			{
+				noir_crc32_pages(page_list,crc_list,pages);
+				for(u32 i=0;i<pages;i++)crc+=crc_list[i];
+			}
+			t2=noir_bench_time_ns();
+			noir_bench_report_throughput("crc32c: batch (selected)",page_mult((u64)pages*rounds),t2-t1);
+			if(crc!=expected)printf("crc32c: batch digest mismatches!\n");
+			printf("crc32c: digest 0x%08X\n",crc);
+			noir_finalize_ci();
+		}
+	}
+	if(crc_list)noir_free_nonpg_memory(crc_list);
+	if(page_list)noir_free_nonpg_memory(page_list);
+	if(buffer)noir_free_contd_memory(buffer,page_mult(pages));
+}
+
+// Trace Rings
+void noir_bench_trace()
+{
+	// The POSIX debug port writes to stderr. Discard the output.
+	const int stderr_fd=dup(STDERR_FILENO);
+	const int null_fd=open("/dev/null",O_WRONLY);
+	dup2(null_fd,STDERR_FILENO);
+	if(noir_configure_qemu_debug_console(0x402)==noir_success && nvd_initialize_trace_rings())
+	{
+		const u32 rounds=1024,batch=noir_trace_ring_records>>1;
+		u64 t1,t2,record_ns=0,drain_ns=0,drained=0,dropped;
+		for(u32 r=0;r<rounds;r++)
+		{
+			t1=noir_bench_time_ns();
+			for(u32 i=0;i<batch;i++)nvd_tracef("VM-Exit Code: 0x%X, rip=0x%llX, round=%u\n",i&0xff,page_mult((u64)i),r);
+			t2=noir_bench_time_ns();
+			record_ns+=t2-t1;
+			drained+=nvd_drain_trace_rings();
+			drain_ns+=noir_bench_time_ns()-t2;
+		}
+		noir_bench_report("trace: record (lock-free)",rounds*batch,record_ns);
+		noir_bench_report("trace: drain (per record)",drained,drain_ns);
+		// Compare with formatting and writing synchronously.
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<batch*16;i++)nvd_printf("VM-Exit Code: 0x%X, rip=0x%llX, round=%u\n",i&0xff,page_mult((u64)i),rounds);
+		t2=noir_bench_time_ns();
+		noir_bench_report("trace: nvd_printf (locked)",batch*16,t2-t1);
+		// Overflow the ring without draining.
+		dropped=nvd_query_dropped_trace_records();
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<noir_trace_ring_records*4;i++)nvd_tracef("VM-Exit Code: 0x%X\n",i&0xff);
+		t2=noir_bench_time_ns();
+		noir_bench_report("trace: record (ring overflowed)",noir_trace_ring_records*4,t2-t1);
+		dropped=nvd_query_dropped_trace_records()-dropped;
+		nvd_finalize_trace_rings();
+		printf("trace: %llu records are drained, %llu records are dropped.\n",drained,dropped);
+	}
+	nvdbg.medium_type=noir_debug_unknown_medium;
+	dup2(stderr_fd,STDERR_FILENO);
+	close(null_fd);
+	close(stderr_fd);
+}
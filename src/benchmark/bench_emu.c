@@ -0,0 +1,157 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark suite for the Instruction Emulator.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench_emu.c
+*/
+
+#include <stdio.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include "bench.h"
+
+void NoirInitializeDisassembler();
+noir_status nvc_emu_decode_memory_access(noir_cvm_virtual_cpu_p vcpu);
+
+// Typical MMIO instructions in 64-bit mode.
+u8 noir_bench_emu_samples[][15]=
+{
+	{0x89,0x08},						// mov [rax],ecx
+	{0x8B,0x4C,0x98,0x10},				// mov ecx,[rax+rbx*4+0x10]
+	{0x48,0x89,0x83,0x00,0x03,0x00,0x00},	// mov [rbx+0x300],rax
+	{0xC7,0x00,0x78,0x56,0x34,0x12},	// mov dword ptr [rax],0x12345678
+	{0x66,0x89,0x10},					// mov [rax],dx
+	{0x88,0x18}							// mov [rax],bl
+};
+
+// MMIO instruction streams replayed by the benchmark.
+// Each stream is recorded as the instruction bytes of the register accesses issued by a device driver.
+u8 noir_bench_emu_nic_stream[][15]=
+{
+	{0x8B,0x83,0xC0,0x00,0x00,0x00},				// mov eax,[rbx+0xC0]		Read ICR.
+	{0xC7,0x83,0xD8,0x00,0x00,0x00,0xFF,0xFF,0xFF,0xFF},	// mov dword ptr [rbx+0xD8],0xFFFFFFFF	Write IMC.
+	{0x8B,0x43,0x08},								// mov eax,[rbx+0x8]		Read STATUS.
+	{0x89,0x8B,0x18,0x38,0x00,0x00},				// mov [rbx+0x3818],ecx		Write TDT.
+	{0x89,0x93,0x18,0x28,0x00,0x00},				// mov [rbx+0x2818],edx		Write RDT.
+	{0x89,0x83,0xD0,0x00,0x00,0x00}					// mov [rbx+0xD0],eax		Write IMS.
+};
+
+u8 noir_bench_emu_ahci_stream[][15]=
+{
+	{0x8B,0x87,0x38,0x01,0x00,0x00},				// mov eax,[rdi+0x138]		Read PxCI.
+	{0x8B,0x87,0x10,0x01,0x00,0x00},				// mov eax,[rdi+0x110]		Read PxIS.
+	{0x89,0x87,0x10,0x01,0x00,0x00},				// mov [rdi+0x110],eax		Clear PxIS.
+	{0x44,0x89,0x87,0x38,0x01,0x00,0x00},			// mov [rdi+0x138],r8d		Issue commands.
+	{0xC7,0x47,0x08,0x01,0x00,0x00,0x00}			// mov dword ptr [rdi+0x8],1	Clear IS.
+};
+
+u8 noir_bench_emu_uart_stream[][15]=
+{
+	{0x8A,0x46,0x05},								// mov al,[rsi+0x5]			Read LSR.
+	{0x88,0x0E},									// mov [rsi],cl				Write THR.
+	{0x8A,0x46,0x05},								// mov al,[rsi+0x5]			Read LSR.
+	{0x88,0x16}										// mov [rsi],dl				Write THR.
+};
+
+typedef struct _noir_bench_emu_stream
+{
+	const char* name;
+	u8 (*instructions)[15];
+	u32 count;
+}noir_bench_emu_stream,*noir_bench_emu_stream_p;
+
+noir_bench_emu_stream noir_bench_emu_streams[]=
+{
+	{"nic",noir_bench_emu_nic_stream,sizeof(noir_bench_emu_nic_stream)/15},
+	{"ahci",noir_bench_emu_ahci_stream,sizeof(noir_bench_emu_ahci_stream)/15},
+	{"uart",noir_bench_emu_uart_stream,sizeof(noir_bench_emu_uart_stream)/15}
+};
+
+u64 static noir_bench_emu_replay(noir_cvm_virtual_cpu_p vcpu,noir_bench_emu_stream_p stream,u32 n)
+{
+	u32 decoded=0;
+	u64 t1,t2;
+	t1=noir_bench_time_ns();
+	for(u32 i=0;i<n;i++)
+	{
+		noir_movsb(vcpu->exit_context.memory_access.instruction_bytes,stream->instructions[i%stream->count],15);
+		vcpu->exit_context.memory_access.flags.decoded=false;
+		nvc_emu_decode_memory_access(vcpu);
+		decoded+=vcpu->exit_context.memory_access.flags.decoded;
+	}
+	t2=noir_bench_time_ns();
+	if(decoded!=n)printf("emulator: only %u of %u instructions are decoded!\n",decoded,n);
+	return t2-t1;
+}
+
+void static noir_bench_emulator_replay(noir_cvm_virtual_cpu_p vcpu)
+{
+	noir_cvm_virtual_machine_p vm=noir_alloc_nonpg_memory(sizeof(noir_cvm_virtual_machine));
+	if(vm)
+	{
+		const u32 n=1<<20;
+		vcpu->vm=vm;
+		for(u32 i=0;i<sizeof(noir_bench_emu_streams)/sizeof(noir_bench_emu_stream);i++)
+		{
+			noir_bench_emu_stream_p stream=&noir_bench_emu_streams[i];
+			char name[64];
+			u64 ns;
+			// Replay without the decoded-instruction cache.
+			vm->decode_cache=null;
+			ns=noir_bench_emu_replay(vcpu,stream,n);
+			snprintf(name,sizeof(name),"emulator: replay %s stream (no cache)",stream->name);
+			noir_bench_report(name,n,ns);
+			// Replay with a cold decoded-instruction cache.
+			vm->decode_cache=noir_alloc_nonpg_memory(sizeof(noir_cvm_decode_cache));
+			if(vm->decode_cache)
+			{
+				noir_stosb(&vcpu->statistics.decode_cache,0,sizeof(vcpu->statistics.decode_cache));
+				ns=noir_bench_emu_replay(vcpu,stream,n);
+				snprintf(name,sizeof(name),"emulator: replay %s stream (cache)",stream->name);
+				noir_bench_report(name,n,ns);
+				printf("emulator: %s stream cache hit rate: %.2f%% (%llu hits, %llu misses)\n",stream->name,(double)vcpu->statistics.decode_cache.hits*100.0/(double)n,vcpu->statistics.decode_cache.hits,vcpu->statistics.decode_cache.misses);
+				noir_free_nonpg_memory(vm->decode_cache);
+			}
+		}
+		vcpu->vm=null;
+		noir_free_nonpg_memory(vm);
+	}
+}
+
+void noir_bench_emulator()
+{
+	noir_cvm_virtual_cpu_p vcpu=noir_alloc_nonpg_memory(sizeof(noir_cvm_virtual_cpu));
+	if(vcpu)
+	{
+		const u32 samples=sizeof(noir_bench_emu_samples)/sizeof(noir_bench_emu_samples[0]);
+		const u32 n=1<<20;
+		u32 decoded=0;
+		u64 t1,t2;
+		NoirInitializeDisassembler();
+		vcpu->exit_context.intercept_code=cv_memory_access;
+		vcpu->exit_context.cs.attrib=0x209b;		// 64-bit code segment.
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<n;i++)
+		{
+			noir_movsb(vcpu->exit_context.memory_access.instruction_bytes,noir_bench_emu_samples[i%samples],15);
+			vcpu->exit_context.memory_access.flags.decoded=false;
+			nvc_emu_decode_memory_access(vcpu);
+			decoded+=vcpu->exit_context.memory_access.flags.decoded;
+		}
+		t2=noir_bench_time_ns();
+		noir_bench_report("emulator: decode memory access",n,t2-t1);
+		if(decoded!=n)printf("emulator: only %u of %u instructions are decoded!\n",decoded,n);
+		noir_bench_emulator_replay(vcpu);
+		noir_free_nonpg_memory(vcpu);
+	}
+}
@@ -0,0 +1,181 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark suite for the Nested Paging
+  manager of Customizable VM for AMD-V.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench_npt.c
+*/
+
+#include <stdio.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <amd64.h>
+#include "../svm_core/svm_npt.h"
+#include "bench.h"
+
+// Map 64GiB of synthetic GPA space with 4KiB pages.
+#define noir_bench_npt_gpa_size		0x1000000000
+
+// Simulate the hardware setting accessing bits on random pages.
+u32 static noir_bench_npt_touch_pages(noir_svm_custom_npt_manager_p nptm,u64 pages,u32 count)
+{
+	u32 touched=0;
+	for(u32 i=0;i<count;i++)
+	{
+		amd64_addr_translator trans;
+		amd64_npt_pte_p pte;
+		trans.value=page_4kb_mult(noir_bench_random()%pages);
+		pte=&nptm->pdpte.index[trans.pml4e_offset]->pde_index[trans.pdpte_offset]->pte_index[trans.pde_offset]->virt[trans.pte_offset];
+		touched+=!pte->accessed;
+		pte->accessed=true;
+		if(i&1)pte->dirty=true;
+	}
+	return touched;
+}
+
+void static noir_bench_npt_harvest(noir_svm_custom_npt_manager_p nptm,u64 pages)
+{
+	const u32 bitmap_size=(u32)(pages>>2);
+	u64p bitmap=noir_alloc_nonpg_memory(bitmap_size);
+	if(bitmap)
+	{
+		const u32 touched=noir_bench_npt_touch_pages(nptm,pages,1<<16);
+		u64 t1,t2,harvested=0;
+		noir_status st;
+		// Query the whole GPA space without clearing.
+		t1=noir_bench_time_ns();
+		st=nvc_svmc_harvest_gpa_accessing_bits(nptm,0,(u32)pages,bitmap,false);
+		t2=noir_bench_time_ns();
+		noir_bench_report("npt: harvest accessing bits (per page, query)",pages,t2-t1);
+		// Query and clear the whole GPA space in one pass.
+		t1=noir_bench_time_ns();
+		st|=nvc_svmc_harvest_gpa_accessing_bits(nptm,0,(u32)pages,bitmap,true);
+		t2=noir_bench_time_ns();
+		noir_bench_report("npt: harvest accessing bits (per page, query & clear)",pages,t2-t1);
+		for(u32 i=0;i<(u32)(pages>>5);i++)harvested+=__builtin_popcountll(bitmap[i]&0x5555555555555555);
+		if(harvested!=touched)printf("npt: %llu pages are harvested, but %u pages are touched!\n",harvested,touched);
+		// Nothing should be left after clearing.
+		st|=nvc_svmc_harvest_gpa_accessing_bits(nptm,0,(u32)pages,bitmap,false);
+		for(u32 i=0;i<(u32)(pages>>5);i++)
+		{
+			if(bitmap[i])
+			{
+				printf("npt: accessing bits are not cleared!\n");
+				break;
+			}
+		}
+		if(st!=noir_success)printf("npt: harvesting failed!\n");
+		// Compare with querying a single page at a time.
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<(u32)pages;i+=16)st|=nvc_svmc_harvest_gpa_accessing_bits(nptm,page_4kb_mult((u64)i),1,bitmap,false);
+		t2=noir_bench_time_ns();
+		noir_bench_report("npt: harvest accessing bits (single page)",pages>>4,t2-t1);
+		noir_free_nonpg_memory(bitmap);
+	}
+}
+
+u64 static noir_bench_npt_translate(noir_svm_custom_npt_manager_p nptm,u64 pages,u32 count)
+{
+	u64 found=0;
+	for(u32 i=0;i<count;i++)
+	{
+		const u64 gpa=page_4kb_mult(noir_bench_random()%pages);
+		u64 hpa;
+		found+=nvc_svmc_get_physical_mapping(nptm,gpa,&hpa,true,true,true) && hpa==gpa+0x100000000;
+	}
+	return found;
+}
+
+// Walk the NPT through physical addresses as the processor would do.
+u64 static noir_bench_npt_walk(noir_svm_custom_npt_manager_p nptm,u64 gpa)
+{
+	amd64_npt_general_entry_p table=(amd64_npt_general_entry_p)nptm->ncr3.virt;
+	for(u32 level=4;level;level--)
+	{
+		const u32 shift=page_4kb_shift+(level-1)*9;
+		amd64_npt_general_entry entry=table[(gpa>>shift)&0x1FF];
+		if(!entry.present)return maxu64;
+		if(level==1 || (level<4 && entry.psize))return (entry.value&noir_npt_pte_base_bits&~(((u64)1<<shift)-1))|(gpa&(((u64)1<<shift)-1));
+		table=noir_find_virt_by_phys(page_4kb_mult((u64)entry.base));
+	}
+	return maxu64;
+}
+
+// Merge the contiguous mappings into 1GiB pages, then split one of them again.
+void static noir_bench_npt_promote(noir_svm_custom_npt_manager_p nptm,u64 pages)
+{
+	const u32 n=1<<22;
+	noir_cvm_mapping_attributes map_attrib={0};
+	u64 t1,t2,found;
+	u32 promoted;
+	map_attrib.present=map_attrib.write=map_attrib.execute=map_attrib.user=true;
+	map_attrib.caching=noir_cvm_memory_wb;
+	t1=noir_bench_time_ns();
+	promoted=nvc_svmc_promote_page_maps(nptm);
+	t2=noir_bench_time_ns();
+	noir_bench_report("npt: promote to large pages (per table)",promoted,t2-t1);
+	if(promoted!=(u32)(pages>>9)+(u32)(pages>>18))printf("npt: only %u tables are promoted!\n",promoted);
+	t1=noir_bench_time_ns();
+	found=noir_bench_npt_translate(nptm,pages,n);
+	t2=noir_bench_time_ns();
+	noir_bench_report("npt: get physical mapping (random GPA, 1GiB pages)",n,t2-t1);
+	if(found!=n)printf("npt: only %llu of %u GPAs are translated after promotion!\n",found,n);
+	// Remapping a 4KiB page splits the 1GiB page without losing the rest of it.
+	if(nvc_svmc_reserve_npt_tables(nptm,1)!=noir_success)printf("npt: failed to reserve tables!\n");
+	if(nvc_svmc_set_page_map(nptm,0x40201000,0x140201000,map_attrib)!=noir_success)printf("npt: failed to split 1GiB page!\n");
+	found=noir_bench_npt_translate(nptm,pages,n);
+	if(found!=n)printf("npt: only %llu of %u GPAs are translated after splitting!\n",found,n);
+	// Tables recycled from promotion must be referenced by their physical addresses.
+	if(noir_bench_npt_walk(nptm,0x40201000)!=0x140201000 || noir_bench_npt_walk(nptm,0x40202000)!=0x140202000)printf("npt: split pages are not walked correctly!\n");
+	// Unmapping relies on the sizes of leaf entries.
+	if(nvc_svmc_get_page_map_size(nptm,0x40201000)!=0 || nvc_svmc_get_page_map_size(nptm,0x40400000)!=1)printf("npt: sizes of split pages are incorrect!\n");
+	if(nvc_svmc_promote_page_maps(nptm)!=2)printf("npt: split pages are not promoted again!\n");
+	if(nvc_svmc_get_page_map_size(nptm,0x40201000)!=2)printf("npt: size of the promoted page is incorrect!\n");
+}
+
+void noir_bench_npt()
+{
+	noir_svm_custom_npt_manager nptm={0};
+	if(nvc_svmc_initialize_npt_manager(&nptm)==noir_success)
+	{
+		const u64 pages=page_4kb_count(noir_bench_npt_gpa_size);
+		const u32 n=1<<22;
+		noir_cvm_mapping_attributes map_attrib={0};
+		noir_status st=noir_success;
+		u64 t1,t2,found=0;
+		map_attrib.present=map_attrib.write=map_attrib.execute=map_attrib.user=true;
+		map_attrib.caching=noir_cvm_memory_wb;
+		st=nvc_svmc_reserve_npt_tables(&nptm,(u32)pages);
+		t1=noir_bench_time_ns();
+		for(u64 i=0;i<pages && st==noir_success;i++)
+			st=nvc_svmc_set_page_map(&nptm,page_4kb_mult(i),page_4kb_mult(i)+0x100000000,map_attrib);
+		t2=noir_bench_time_ns();
+		noir_bench_report("npt: map 4KiB page (64GiB GPA space)",pages,t2-t1);
+		if(st!=noir_success)printf("npt: mapping failed! Status=0x%X\n",st);
+		t1=noir_bench_time_ns();
+		for(u32 i=0;i<n;i++)
+		{
+			const u64 gpa=page_4kb_mult(noir_bench_random()%pages);
+			u64 hpa;
+			found+=nvc_svmc_get_physical_mapping(&nptm,gpa,&hpa,true,true,true) && hpa==gpa+0x100000000;
+		}
+		t2=noir_bench_time_ns();
+		noir_bench_report("npt: get physical mapping (random GPA)",n,t2-t1);
+		if(found!=n)printf("npt: only %llu of %u GPAs are translated!\n",found,n);
+		noir_bench_npt_harvest(&nptm,pages);
+		noir_bench_npt_promote(&nptm,pages);
+		nvc_svmc_finalize_npt_manager(&nptm);
+		// Reserved allocations fail instead of refilling the arena.
+		if(noir_arena_alloc_reserved_page(&nptm.arena,null) || noir_arena_alloc_reserved_object(&nptm.arena))printf("npt: drained arena is refilled!\n");
+	}
+}
@@ -0,0 +1,131 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark suite for the VMCB synchronization
+  of nested virtualization for AMD-V.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench_nvcpu.c
+*/
+
+#include <stdio.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <amd64.h>
+#include "../svm_core/svm_vmcb.h"
+#include "../svm_core/svm_def.h"
+#include "bench.h"
+
+// Set the interceptions like a nested hypervisor running a long-mode guest with shadow paging.
+void static noir_bench_nested_intercept_all(void* vmcb_c)
+{
+	noir_svm_vmwrite32(vmcb_c,intercept_access_cr,0x001D0000);
+	noir_svm_vmwrite32(vmcb_c,intercept_access_dr,0x00800000);
+	noir_svm_vmwrite32(vmcb_c,intercept_exceptions,1<<amd64_page_fault);
+	noir_svm_vmwrite32(vmcb_c,intercept_instruction1,(1<<nvc_svm_intercept_vector1_lidt)|(1<<nvc_svm_intercept_vector1_lgdt)|(1<<nvc_svm_intercept_vector1_lldt)|(1<<nvc_svm_intercept_vector1_ltr));
+	noir_svm_vmwrite64(vmcb_c,guest_efer,amd64_efer_lme_bit|amd64_efer_lma_bit|amd64_efer_svme_bit);
+}
+
+// Measure the round trip of nested VM-Entry and VM-Exit, excluding the vmrun instruction.
+u64 static noir_bench_nested_round_trip(noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p node,u32 n)
+{
+	void* vmcb_t=node->vmcb_t.virt;
+	void* vmcb_c=node->vmcb_c.virt;
+	u64 t1,t2;
+	// The first entry copies all states.
+	node->flags.clean=false;
+	nvc_svm_switch_to_nested_vcpu(null,vcpu,node);
+	nvc_svm_switch_from_nested_vcpu(null,vcpu);
+	noir_svm_vmwrite32(vmcb_c,vmcb_clean_bits,0xffffffff);
+	t1=noir_bench_time_ns();
+	for(u32 i=0;i<n;i++)
+	{
+		nvc_svm_switch_to_nested_vcpu(null,vcpu,node);
+		// Simulate the nested guest running.
+		noir_svm_vmwrite64(vmcb_t,guest_rip,(u64)i);
+		nvc_svm_switch_from_nested_vcpu(null,vcpu);
+	}
+	t2=noir_bench_time_ns();
+	if(noir_svm_vmread64(vmcb_c,guest_rip)!=(u64)(n-1))printf("nested: guest state is not copied back!\n");
+	return t2-t1;
+}
+
+// Cycle through a working set of nested VMCBs. The cache is thrashed if the set is larger than its capacity.
+void static noir_bench_nested_lookup(noir_svm_nested_vcpu_p nvcpu,u32 working_set,u32 n)
+{
+	noir_svm_nested_vcpu_cache_statistics stat=nvcpu->statistics;
+	u64 t1,t2;
+	char title[64];
+	t1=noir_bench_time_ns();
+	for(u32 i=0;i<n;i++)
+	{
+		const u64 gpa=page_4kb_mult((u64)(i%working_set)+0x10000);
+		if(nvc_svm_get_nested_vcpu_node(nvcpu,gpa)->vmcb_c.phys!=gpa)
+		{
+			printf("nested: VMCB cache returned a wrong node!\n");
+			break;
+		}
+	}
+	t2=noir_bench_time_ns();
+	snprintf(title,sizeof(title),"nested: VMCB cache lookup (%u VMCBs)",working_set);
+	noir_bench_report(title,n,t2-t1);
+	printf("\thits: %llu, misses: %llu, evictions: %llu\n",nvcpu->statistics.hits-stat.hits,nvcpu->statistics.misses-stat.misses,nvcpu->statistics.evictions-stat.evictions);
+	// Cycling through more VMCBs than capacity is the worst case of LRU: only the VMCBs left from the last round could hit.
+	if(working_set<=nvcpu->capacity && nvcpu->statistics.misses-stat.misses>working_set)printf("nested: VMCB cache misses too often!\n");
+	if(working_set>nvcpu->capacity && nvcpu->statistics.hits-stat.hits>nvcpu->capacity)printf("nested: VMCB cache hits unexpectedly!\n");
+}
+
+void noir_bench_nested()
+{
+	noir_svm_vcpu_p vcpu=noir_alloc_nonpg_memory(sizeof(noir_svm_vcpu));
+	void* stack=noir_alloc_nonpg_memory(nvc_stack_size);
+	void* vmcb_l1=noir_alloc_nonpg_memory(page_size);
+	void* vmcb_c=noir_alloc_nonpg_memory(page_size);
+	if(vcpu && stack && vmcb_l1 && vmcb_c)
+	{
+		if(nvc_svm_initialize_nested_vcpu_cache(&vcpu->nested_hvm,noir_svm_cached_nested_vmcb)==noir_success)
+		{
+			const u32 n=1<<20;
+			noir_svm_nested_vcpu_node_p node;
+			noir_svm_initial_stack_p loader_stack;
+			nvc_svm_npt_control npt_ctrl;
+			u64 t;
+			vcpu->hv_stack=stack;
+			vcpu->vmcb.virt=vmcb_l1;
+			vcpu->vmcb.phys=(u64)vmcb_l1;
+			node=nvc_svm_get_nested_vcpu_node(&vcpu->nested_hvm,(u64)vmcb_c);
+			loader_stack=noir_svm_get_loader_stack(stack);
+			loader_stack->nested_vcpu=node;
+			// The nested hypervisor enables NPT.
+			npt_ctrl.value=0;
+			npt_ctrl.enable_npt=1;
+			noir_svm_vmwrite64(vmcb_c,npt_control,npt_ctrl.value);
+			// Without interceptions, the nested guest could modify any state except LBRs.
+			t=noir_bench_nested_round_trip(vcpu,node,n);
+			noir_bench_report("nested: round trip (no interceptions)",n,t);
+			if(node->dirty.value!=0x6F)printf("nested: dirty groups are 0x%X without interceptions!\n",node->dirty.value);
+			// With interceptions, fewer states are copied back on VM-Exit.
+			noir_bench_nested_intercept_all(vmcb_c);
+			t=noir_bench_nested_round_trip(vcpu,node,n);
+			noir_bench_report("nested: round trip (intercept state changes)",n,t);
+			if(node->dirty.value)printf("nested: dirty groups are 0x%X with interceptions!\n",node->dirty.value);
+			// Look up nested VMCBs with working sets below and above the capacity.
+			noir_bench_nested_lookup(&vcpu->nested_hvm,noir_svm_cached_nested_vmcb>>1,n);
+			noir_bench_nested_lookup(&vcpu->nested_hvm,noir_svm_cached_nested_vmcb,n);
+			noir_bench_nested_lookup(&vcpu->nested_hvm,noir_svm_cached_nested_vmcb<<1,n);
+			nvc_svm_finalize_nested_vcpu_cache(&vcpu->nested_hvm);
+		}
+	}
+	if(vcpu)noir_free_nonpg_memory(vcpu);
+	if(stack)noir_free_nonpg_memory(stack);
+	if(vmcb_l1)noir_free_nonpg_memory(vmcb_l1);
+	if(vmcb_c)noir_free_nonpg_memory(vmcb_c);
+}
@@ -0,0 +1,371 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the micro-benchmark suite for the Shadow NPT engine
+  of nested virtualization for AMD-V.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /benchmark/bench_snpt.c
+*/
+
+#include <stdio.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <amd64.h>
+#include "../svm_core/svm_npt.h"
+#include "bench.h"
+
+/*
+  The synthetic L1 NPT lives in the first 1MiB of L1 GPA space.
+  The synthetic L0 NPT maps the GPA to GPA+4GiB of HPA, with 4KiB pages
+  below 2GiB and 2MiB pages above. GPAs from 16GiB are not backed.
+
+  NGPA Range					L1 Mapping				Shadow
+  0x00000000-0x03FFFFFF			4KiB pages to 1GiB		4KiB pages
+  0x40000000-0x47FFFFFF			2MiB pages to 2GiB		2MiB pages
+  0x50000000-0x51FFFFFF			2MiB pages to 256MiB	4KiB fragments
+  0x60000000-0x601FFFFF			2MiB page to 16GiB		Host faults
+  0x100000000-0x13FFFFFFF		1GiB page to 4GiB		2MiB pages
+*/
+#define noir_bench_snpt_l1_pages		256
+#define noir_bench_snpt_hpa_offset		0x100000000
+#define noir_bench_snpt_l0_limit		0x400000000
+#define noir_bench_snpt_l0_readonly		0x30000000
+#define noir_bench_snpt_4kb_region		0x4000000
+
+// Special 4KiB pages in L1 NPT.
+#define noir_bench_snpt_readonly_ngpa	0x1000000
+#define noir_bench_snpt_clean_ngpa		0x2000000
+#define noir_bench_snpt_host_ngpa		0x3000000
+#define noir_bench_snpt_absent_ngpa		0x70000000
+
+#define noir_bench_snpt_index(l,x)		(((x)>>(page_4kb_shift+((l)-1)*9))&0x1FF)
+#define noir_bench_snpt_level_size(l)	((u64)1<<(page_4kb_shift+((l)-1)*9))
+
+typedef struct _noir_bench_snpt_context
+{
+	u8p memory;
+	u64 protected[noir_bench_snpt_l1_pages>>6];
+	u32 next_table;
+}noir_bench_snpt_context,*noir_bench_snpt_context_p;
+
+bool static noir_bench_snpt_l0_translate(void* context,u64 gpa,amd64_npt_general_entry_p entry,u32p size_shift)
+{
+	if(gpa>=noir_bench_snpt_l0_limit)return false;
+	entry->value=0;
+	entry->present=true;
+	entry->write=page_2mb_count(gpa)!=page_2mb_count(noir_bench_snpt_l0_readonly);
+	entry->user=true;
+	entry->base=page_4kb_count(gpa+noir_bench_snpt_hpa_offset);
+	*size_shift=gpa<0x80000000?page_4kb_shift:page_2mb_shift;
+	return true;
+}
+
+void static* noir_bench_snpt_l1_map(void* context,u64 gpa)
+{
+	noir_bench_snpt_context_p ctx=(noir_bench_snpt_context_p)context;
+	if(gpa>=page_4kb_mult(noir_bench_snpt_l1_pages))return null;
+	return &ctx->memory[page_4kb_base(gpa)];
+}
+
+bool static noir_bench_snpt_l0_protect(void* context,u64 gpa,bool protect)
+{
+	noir_bench_snpt_context_p ctx=(noir_bench_snpt_context_p)context;
+	const u64 page=page_4kb_count(gpa);
+	if(page>=noir_bench_snpt_l1_pages)return false;
+	if(protect)
+		ctx->protected[page>>6]|=1ull<<(page&63);
+	else
+		ctx->protected[page>>6]&=~(1ull<<(page&63));
+	return true;
+}
+
+bool static noir_bench_snpt_is_protected(noir_bench_snpt_context_p ctx,u64 gpa)
+{
+	const u64 page=page_4kb_count(gpa);
+	return (ctx->protected[page>>6]>>(page&63))&1;
+}
+
+u32 static noir_bench_snpt_protected_pages(noir_bench_snpt_context_p ctx)
+{
+	u32 count=0;
+	for(u32 i=0;i<noir_bench_snpt_l1_pages>>6;i++)count+=__builtin_popcountll(ctx->protected[i]);
+	return count;
+}
+
+// Map a page of the given level into the synthetic L1 NPT.
+void static noir_bench_snpt_l1_set(noir_bench_snpt_context_p ctx,u64 ngpa,u64 gpa,u8 level,u64 attributes)
+{
+	amd64_npt_general_entry_p table=(amd64_npt_general_entry_p)ctx->memory;
+	for(u8 l=4;l>level;l--)
+	{
+		amd64_npt_general_entry_p entry=&table[noir_bench_snpt_index(l,ngpa)];
+		if(!entry->present)entry->value=page_4kb_mult(ctx->next_table++)|7;
+		table=(amd64_npt_general_entry_p)&ctx->memory[page_4kb_mult((u64)entry->base)];
+	}
+	table[noir_bench_snpt_index(level,ngpa)].value=gpa|attributes|(level>1?0x80:0);
+}
+
+// Walk the synthetic L1 NPT. Returns the leaf entry so that it could be rewritten.
+amd64_npt_general_entry_p static noir_bench_snpt_l1_walk(noir_bench_snpt_context_p ctx,u64 ngpa,u64p gpa)
+{
+	amd64_npt_general_entry_p table=(amd64_npt_general_entry_p)ctx->memory;
+	for(u8 level=4;level;level--)
+	{
+		amd64_npt_general_entry_p entry=&table[noir_bench_snpt_index(level,ngpa)];
+		if(!entry->present)return null;
+		if(level==1 || entry->psize)
+		{
+			const u64 size=noir_bench_snpt_level_size(level);
+			*gpa=(entry->value&noir_npt_pte_base_bits&~(size-1))|(ngpa&(size-1));
+			return entry;
+		}
+		table=(amd64_npt_general_entry_p)&ctx->memory[page_4kb_mult((u64)entry->base)];
+	}
+	return null;
+}
+
+// Walk the shadow NPT as the processor would do. Returns the HPA, or maxu64 if not present.
+u64 static noir_bench_snpt_walk(noir_svm_shadow_npt_manager_p snpt,u64 ngpa,u8p leaf_level,bool* writable)
+{
+	amd64_npt_general_entry_p table=snpt->root->virt;
+	*writable=true;
+	for(u8 level=4;level;level--)
+	{
+		amd64_npt_general_entry entry=table[noir_bench_snpt_index(level,ngpa)];
+		if(!entry.present)return maxu64;
+		*writable&=entry.write;
+		if(level==1 || entry.psize)
+		{
+			const u64 size=noir_bench_snpt_level_size(level);
+			*leaf_level=level;
+			return (entry.value&noir_npt_pte_base_bits&~(size-1))|(ngpa&(size-1));
+		}
+		table=noir_find_virt_by_phys(page_4kb_mult((u64)entry.base));
+	}
+	return maxu64;
+}
+
+noir_svm_snpt_fault_result static noir_bench_snpt_fault(noir_svm_shadow_npt_manager_p snpt,u64 ngpa,bool write,amd64_npt_fault_code_p fault)
+{
+	fault->value=0;
+	fault->user=true;
+	fault->write=write;
+	fault->npf_addr=true;
+	return nvc_svm_snpt_handle_fault(snpt,ngpa,fault);
+}
+
+// Fault on the NGPA, then check the shadow against the composition of synthetic L1 and L0 NPT.
+bool static noir_bench_snpt_check(noir_bench_snpt_context_p ctx,noir_svm_shadow_npt_manager_p snpt,u64 ngpa,u8 expected_level)
+{
+	amd64_npt_fault_code fault;
+	u64 gpa,hpa;
+	u8 level;
+	bool writable;
+	if(noir_bench_snpt_fault(snpt,ngpa,false,&fault)!=noir_svm_snpt_fault_resolved)
+	{
+		printf("snpt: fault at NGPA 0x%llX is not resolved!\n",ngpa);
+		return false;
+	}
+	noir_bench_snpt_l1_walk(ctx,ngpa,&gpa);
+	hpa=noir_bench_snpt_walk(snpt,ngpa,&level,&writable);
+	if(hpa!=gpa+noir_bench_snpt_hpa_offset || level!=expected_level)
+	{
+		printf("snpt: NGPA 0x%llX is shadowed to HPA 0x%llX at level %u, expected 0x%llX at level %u!\n",ngpa,hpa,level,gpa+noir_bench_snpt_hpa_offset,expected_level);
+		return false;
+	}
+	return true;
+}
+
+void static noir_bench_snpt_print_statistics(noir_svm_shadow_npt_manager_p snpt)
+{
+	noir_svm_shadow_npt_statistics_p stat=&snpt->statistics;
+	printf("\tfills: %llu, reflects: %llu, host faults: %llu, evictions: %llu, resyncs: %llu, resets: %llu\n",stat->fills,stat->reflects,stat->host_faults,stat->evictions,stat->resyncs,stat->resets);
+}
+
+// Check the composition of every kind of mappings.
+void static noir_bench_snpt_compose(noir_bench_snpt_context_p ctx,noir_svm_shadow_npt_manager_p snpt)
+{
+	amd64_npt_fault_code fault;
+	u64 hpa;
+	u8 level;
+	bool writable;
+	for(u64 ngpa=0;ngpa<noir_bench_snpt_4kb_region;ngpa+=0x3000)
+		if(ngpa!=noir_bench_snpt_host_ngpa && !noir_bench_snpt_check(ctx,snpt,ngpa,1))return;
+	for(u64 ngpa=0x40000000;ngpa<0x48000000;ngpa+=0x123000)
+		if(!noir_bench_snpt_check(ctx,snpt,ngpa,2))return;
+	for(u64 ngpa=0x50000000;ngpa<0x52000000;ngpa+=0x45000)
+		if(!noir_bench_snpt_check(ctx,snpt,ngpa,1))return;
+	for(u64 ngpa=0x100000000;ngpa<0x140000000;ngpa+=0x1234000)
+		if(!noir_bench_snpt_check(ctx,snpt,ngpa,2))return;
+	// Violations in L1 NPT are reflected to L1.
+	if(noir_bench_snpt_fault(snpt,noir_bench_snpt_absent_ngpa,false,&fault)!=noir_svm_snpt_fault_reflect || fault.present)
+		printf("snpt: absent page is not reflected as not-present!\n");
+	if(noir_bench_snpt_fault(snpt,noir_bench_snpt_readonly_ngpa,true,&fault)!=noir_svm_snpt_fault_reflect || !fault.present)
+		printf("snpt: writing read-only page is not reflected as protection violation!\n");
+	// Violations in L0 NPT are handled by NoirVisor.
+	if(noir_bench_snpt_fault(snpt,noir_bench_snpt_host_ngpa,true,&fault)!=noir_svm_snpt_fault_host)
+		printf("snpt: writing page read-only in L0 is not a host fault!\n");
+	if(noir_bench_snpt_fault(snpt,0x60000000,false,&fault)!=noir_svm_snpt_fault_host)
+		printf("snpt: accessing page unbacked in L0 is not a host fault!\n");
+	// Clean pages are write-protected until the nested guest writes them.
+	noir_bench_snpt_check(ctx,snpt,noir_bench_snpt_clean_ngpa,1);
+	noir_bench_snpt_walk(snpt,noir_bench_snpt_clean_ngpa,&level,&writable);
+	if(writable)printf("snpt: clean page is writable in shadow!\n");
+	noir_bench_snpt_fault(snpt,noir_bench_snpt_clean_ngpa,true,&fault);
+	hpa=noir_bench_snpt_walk(snpt,noir_bench_snpt_clean_ngpa,&level,&writable);
+	if(!writable || hpa==maxu64)printf("snpt: written page is not writable in shadow!\n");
+	if(!noir_bench_snpt_l1_walk(ctx,noir_bench_snpt_clean_ngpa,&hpa)->dirty)printf("snpt: dirty bit is not set in L1 NPT!\n");
+	noir_bench_snpt_print_statistics(snpt);
+}
+
+// L1 rewrites a leaf entry. The shadow must follow it after the TLB is flushed.
+void static noir_bench_snpt_resync(noir_bench_snpt_context_p ctx,noir_svm_shadow_npt_manager_p snpt)
+{
+	const u64 ngpa=0x5000;
+	const u64 resyncs=snpt->statistics.resyncs;
+	amd64_npt_general_entry_p entry;
+	u64 gpa,table;
+	u8 level;
+	bool writable;
+	noir_bench_snpt_check(ctx,snpt,ngpa,1);
+	entry=noir_bench_snpt_l1_walk(ctx,ngpa,&gpa);
+	table=(u64)((u8p)entry-ctx->memory);
+	if(!noir_bench_snpt_is_protected(ctx,table))printf("snpt: shadowed L1 table is not write-protected!\n");
+	// Writing the L1 table traps into NoirVisor.
+	if(!nvc_svm_snpt_handle_table_write(snpt,table))printf("snpt: write to shadowed L1 table is not handled!\n");
+	if(noir_bench_snpt_is_protected(ctx,table))printf("snpt: L1 table is not unprotected after write!\n");
+	entry->value=0x20000000|0x67;
+	// Further writes do not trap.
+	if(nvc_svm_snpt_handle_table_write(snpt,table))printf("snpt: unsynchronized L1 table is handled twice!\n");
+	// L1 flushes the TLB.
+	nvc_svm_snpt_synchronize(snpt);
+	if(noir_bench_snpt_walk(snpt,ngpa,&level,&writable)!=maxu64)printf("snpt: stale translation survived synchronization!\n");
+	if(snpt->statistics.resyncs==resyncs)printf("snpt: no tables are resynchronized!\n");
+	noir_bench_snpt_check(ctx,snpt,ngpa,1);
+	if(!noir_bench_snpt_is_protected(ctx,table))printf("snpt: L1 table is not write-protected again!\n");
+	// Restore the mapping for following tests.
+	entry->value=(0x40000000+ngpa)|0x67;
+	nvc_svm_snpt_handle_table_write(snpt,table);
+	nvc_svm_snpt_synchronize(snpt);
+}
+
+// L1 rewrites a leaf entry on another processor. The write is posted to this shadow.
+void static noir_bench_snpt_remote_write(noir_bench_snpt_context_p ctx,noir_svm_shadow_npt_manager_p snpt)
+{
+	const u64 ngpa=0x5000;
+	amd64_npt_general_entry_p entry;
+	u64 gpa,table;
+	u8 level;
+	bool writable;
+	noir_bench_snpt_check(ctx,snpt,ngpa,1);
+	entry=noir_bench_snpt_l1_walk(ctx,ngpa,&gpa);
+	table=(u64)((u8p)entry-ctx->memory);
+	// The other processor removes the protection and posts the write.
+	noir_bench_snpt_l0_protect(ctx,table,false);
+	nvc_svm_snpt_post_table_write(snpt,table+8);
+	entry->value=0x20000000|0x67;
+	if(noir_bench_snpt_walk(snpt,ngpa,&level,&writable)==maxu64)printf("snpt: posted write dropped translation before synchronization!\n");
+	nvc_svm_snpt_synchronize(snpt);
+	if(noir_bench_snpt_walk(snpt,ngpa,&level,&writable)!=maxu64)printf("snpt: stale translation survived posted write!\n");
+	noir_bench_snpt_check(ctx,snpt,ngpa,1);
+	if(!noir_bench_snpt_is_protected(ctx,table))printf("snpt: L1 table is not write-protected after posted write!\n");
+	// Too many posted writes invalidate all shadows.
+	entry->value=(0x40000000+ngpa)|0x67;
+	for(u32 i=0;i<=noir_svm_shadow_npt_remote_writes;i++)nvc_svm_snpt_post_table_write(snpt,0);
+	nvc_svm_snpt_synchronize(snpt);
+	if(noir_bench_snpt_walk(snpt,ngpa,&level,&writable)!=maxu64)printf("snpt: stale translation survived overflowed posts!\n");
+	if(snpt->remote_writes.count || snpt->remote_writes.overflow)printf("snpt: posted writes are not drained!\n");
+	noir_bench_snpt_check(ctx,snpt,ngpa,1);
+}
+
+// Touch a page in each L1 page table, so that the pool is drained if it is small.
+void static noir_bench_snpt_fill(noir_bench_snpt_context_p ctx,noir_svm_shadow_npt_manager_p snpt,const char* title)
+{
+	const u32 n=1<<16;
+	amd64_npt_fault_code fault;
+	u64 t1,t2;
+	u8 level;
+	bool writable;
+	nvc_svm_snpt_reset(snpt);
+	nvc_svm_snpt_switch_root(snpt,0);
+	t1=noir_bench_time_ns();
+	for(u32 i=0;i<n;i++)noir_bench_snpt_fault(snpt,page_4kb_mult((u64)((i>>5)&511))+page_2mb_mult((u64)(i&31)),false,&fault);
+	t2=noir_bench_time_ns();
+	noir_bench_report(title,n,t2-t1);
+	noir_bench_snpt_print_statistics(snpt);
+	// The most recently filled translation must be present.
+	if(noir_bench_snpt_walk(snpt,page_4kb_mult((u64)(((n-1)>>5)&511))+page_2mb_mult(31),&level,&writable)==maxu64)printf("snpt: recently filled translation is lost!\n");
+}
+
+void static noir_bench_snpt_run(noir_bench_snpt_context_p ctx,u32 capacity)
+{
+	noir_svm_shadow_npt_manager_p snpt=noir_alloc_nonpg_memory(sizeof(noir_svm_shadow_npt_manager));
+	if(snpt)
+	{
+		if(nvc_svm_snpt_initialize(snpt,capacity)==noir_success)
+		{
+			char title[64];
+			u32 hashed=0;
+			snpt->translate=noir_bench_snpt_l0_translate;
+			snpt->map=noir_bench_snpt_l1_map;
+			snpt->protect=noir_bench_snpt_l0_protect;
+			snpt->context=ctx;
+			nvc_svm_snpt_switch_root(snpt,0);
+			if(capacity>=noir_svm_shadow_npt_pages)
+			{
+				noir_bench_snpt_compose(ctx,snpt);
+				noir_bench_snpt_resync(ctx,snpt);
+				noir_bench_snpt_remote_write(ctx,snpt);
+			}
+			snprintf(title,sizeof(title),"snpt: fill shadow (%u tables)",capacity);
+			noir_bench_snpt_fill(ctx,snpt,title);
+			if(capacity<32 && snpt->statistics.evictions==0)printf("snpt: small pool is not recycled!\n");
+			// Each L1 table being shadowed is write-protected.
+			for(u32 i=0;i<capacity;i++)hashed+=snpt->pool[i].hashed && !snpt->pool[i].unsync;
+			if(noir_bench_snpt_protected_pages(ctx)>hashed)printf("snpt: %u L1 tables are protected, but only %u are shadowed!\n",noir_bench_snpt_protected_pages(ctx),hashed);
+			// Resetting the shadow unprotects all L1 tables.
+			nvc_svm_snpt_reset(snpt);
+			if(noir_bench_snpt_protected_pages(ctx))printf("snpt: L1 tables are protected after reset!\n");
+			nvc_svm_snpt_finalize(snpt);
+		}
+		noir_free_nonpg_memory(snpt);
+	}
+}
+
+void noir_bench_snpt()
+{
+	noir_bench_snpt_context_p ctx=noir_alloc_nonpg_memory(sizeof(noir_bench_snpt_context));
+	if(ctx)
+	{
+		ctx->memory=noir_alloc_nonpg_memory(page_4kb_mult(noir_bench_snpt_l1_pages));
+		if(ctx->memory)
+		{
+			// The PML4 of L1 NPT is at GPA zero.
+			ctx->next_table=1;
+			for(u64 ngpa=0;ngpa<noir_bench_snpt_4kb_region;ngpa+=page_4kb_size)
+				noir_bench_snpt_l1_set(ctx,ngpa,0x40000000+ngpa,1,0x67);
+			noir_bench_snpt_l1_set(ctx,noir_bench_snpt_readonly_ngpa,0x40000000+noir_bench_snpt_readonly_ngpa,1,0x65);
+			noir_bench_snpt_l1_set(ctx,noir_bench_snpt_clean_ngpa,0x40000000+noir_bench_snpt_clean_ngpa,1,0x27);
+			noir_bench_snpt_l1_set(ctx,noir_bench_snpt_host_ngpa,noir_bench_snpt_l0_readonly,1,0x67);
+			for(u64 ngpa=0x40000000;ngpa<0x48000000;ngpa+=page_2mb_size)
+				noir_bench_snpt_l1_set(ctx,ngpa,ngpa+0x40000000,2,0x67);
+			for(u64 ngpa=0x50000000;ngpa<0x52000000;ngpa+=page_2mb_size)
+				noir_bench_snpt_l1_set(ctx,ngpa,ngpa-0x40000000,2,0x67);
+			noir_bench_snpt_l1_set(ctx,0x60000000,noir_bench_snpt_l0_limit,2,0x67);
+			noir_bench_snpt_l1_set(ctx,0x100000000,0x100000000,3,0x67);
+			noir_bench_snpt_run(ctx,noir_svm_shadow_npt_pages);
+			noir_bench_snpt_run(ctx,16);
+			noir_free_nonpg_memory(ctx->memory);
+		}
+		noir_free_nonpg_memory(ctx);
+	}
+}
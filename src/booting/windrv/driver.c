@@ -204,6 +204,60 @@ NTSTATUS NoirVisorDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 			st=STATUS_SUCCESS;
 			break;
 		}
+		case IOCTL_CvmHarvestGpaAdMap:
+		{
+			PNOIR_QUERY_ADBITMAP_CONTEXT Param=(PNOIR_QUERY_ADBITMAP_CONTEXT)InputBuffer;
+			*(PULONG32)OutputBuffer=NoirQueryAndClearGpaAccessingBitmap(Param->VirtualMachine,Param->GpaStart,Param->NumberOfPages,(PVOID)Param->BitmapBuffer,Param->BitmapLength);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmPromotePageMaps:
+		{
+			CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
+			PULONG32 Promoted=(PULONG32)((ULONG_PTR)OutputBuffer+4);
+			*(PULONG32)OutputBuffer=NoirPromotePageMappings(VmHandle,Promoted);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmCreatePioDevice:
+		{
+			PNOIR_PIO_DEVICE_CONTEXT Param=(PNOIR_PIO_DEVICE_CONTEXT)InputBuffer;
+			*(PULONG32)OutputBuffer=NoirCreatePioDevice(Param->VirtualMachine,Param->Model,Param->Port);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmReadPioDevice:
+		{
+			PNOIR_PIO_DEVICE_CONTEXT Param=(PNOIR_PIO_DEVICE_CONTEXT)InputBuffer;
+			PULONG32 ReadSize=(PULONG32)((ULONG_PTR)OutputBuffer+4);
+			*(PULONG32)OutputBuffer=NoirReadPioDeviceOutput(Param->VirtualMachine,Param->Port,(PVOID)Param->Buffer,Param->BufferLength,ReadSize);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmRegisterCoalescedMmio:
+		{
+			PNOIR_COALESCED_MMIO_ZONE_CONTEXT Param=(PNOIR_COALESCED_MMIO_ZONE_CONTEXT)InputBuffer;
+			*(PULONG32)OutputBuffer=NoirRegisterCoalescedMmioZone(Param->VirtualMachine,Param->Gpa,Param->Size);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmUnregisterCoalescedMmio:
+		{
+			PNOIR_COALESCED_MMIO_ZONE_CONTEXT Param=(PNOIR_COALESCED_MMIO_ZONE_CONTEXT)InputBuffer;
+			*(PULONG32)OutputBuffer=NoirUnregisterCoalescedMmioZone(Param->VirtualMachine,Param->Gpa,Param->Size);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmLoadCpuidModel:
+		{
+			PNOIR_CPUID_MODEL_CONTEXT Param=(PNOIR_CPUID_MODEL_CONTEXT)InputBuffer;
+			st=STATUS_SUCCESS;
+			if(InputSize<FIELD_OFFSET(NOIR_CPUID_MODEL_CONTEXT,Entries) || Param->Count>NOIR_CPUID_MODEL_LIMIT || InputSize<FIELD_OFFSET(NOIR_CPUID_MODEL_CONTEXT,Entries)+Param->Count*sizeof(NOIR_CPUID_ENTRY))
+				*(PULONG32)OutputBuffer=NOIR_INVALID_PARAMETER;
+			else
+				*(PULONG32)OutputBuffer=NoirLoadCpuidModel(Param->VirtualMachine,Param->Entries,Param->Count);
+			break;
+		}
 		case IOCTL_CvmCreateVmEx:
 		{
 			PULONG32 Input=(PULONG32)InputBuffer;
@@ -254,7 +308,13 @@ NTSTATUS NoirVisorDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 				CVM_HANDLE VmHandle=*(PCVM_HANDLE)InputBuffer;
 				ULONG32 VpIndex=*(PULONG32)((ULONG_PTR)InputBuffer+sizeof(CVM_HANDLE));
 				PVOID ExitContext=(PVOID)((ULONG_PTR)OutputBuffer+sizeof(ULONG64));
-				*(PULONG32)OutputBuffer=NoirRunVirtualProcessor(VmHandle,VpIndex,ExitContext);
+				// Register sets are optional. They are used only if the buffers can hold them.
+				PVOID ImportSet=NULL,ExportSet=NULL;
+				if(InputSize>=sizeof(ULONG64)*2+sizeof(NOIR_REGISTER_VALUES))
+					ImportSet=(PVOID)((ULONG_PTR)InputBuffer+sizeof(ULONG64)*2);
+				if(OutputSize>=sizeof(ULONG64)+noir_cvm_exit_context_size+sizeof(NOIR_REGISTER_VALUES))
+					ExportSet=(PVOID)((ULONG_PTR)ExitContext+noir_cvm_exit_context_size);
+				*(PULONG32)OutputBuffer=NoirRunVirtualProcessorEx(VmHandle,VpIndex,ExitContext,ImportSet,ExportSet);
 			}
 			break;
 		}
@@ -325,6 +385,70 @@ NTSTATUS NoirVisorDispatchIoControl(IN PDEVICE_OBJECT DeviceObject,IN PIRP Irp)
 			st=STATUS_SUCCESS;
 			break;
 		}
+		case IOCTL_CvmSetVcpuCpuidOverrides:
+		{
+			PNOIR_CPUID_MODEL_CONTEXT Param=(PNOIR_CPUID_MODEL_CONTEXT)InputBuffer;
+			st=STATUS_SUCCESS;
+			if(InputSize<FIELD_OFFSET(NOIR_CPUID_MODEL_CONTEXT,Entries) || Param->Count>NOIR_CPUID_OVERRIDE_LIMIT || InputSize<FIELD_OFFSET(NOIR_CPUID_MODEL_CONTEXT,Entries)+Param->Count*sizeof(NOIR_CPUID_ENTRY))
+				*(PULONG32)OutputBuffer=NOIR_INVALID_PARAMETER;
+			else
+				*(PULONG32)OutputBuffer=NoirSetVirtualProcessorCpuidOverrides(Param->VirtualMachine,Param->VpIndex,Param->Entries,Param->Count);
+			break;
+		}
+		case IOCTL_CvmSetVcpuExportSet:
+		{
+			PNOIR_EXPORT_SET_CONTEXT Context=(PNOIR_EXPORT_SET_CONTEXT)InputBuffer;
+			*(PULONG32)OutputBuffer=NoirSetVirtualProcessorExportSet(Context->VirtualMachine,Context->VpIndex,Context->InterceptCode,Context->RegisterNames,Context->RegisterCount);
+			st=STATUS_SUCCESS;
+			break;
+		}
+		case IOCTL_CvmCompleteMemoryAccess:
+		{
+			st=STATUS_SUCCESS;
+			if(InputSize<sizeof(NOIR_COMPLETE_MEMORY_ACCESS_CONTEXT) || OutputSize<sizeof(ULONG64)+sizeof(NOIR_MEMORY_ACCESS_RESULT))
+				st=STATUS_INSUFFICIENT_RESOURCES;
+			else
+			{
+				// Input and output share the same buffer. Save the input first.
+				NOIR_COMPLETE_MEMORY_ACCESS_CONTEXT Context=*(PNOIR_COMPLETE_MEMORY_ACCESS_CONTEXT)InputBuffer;
+				PVOID Result=(PVOID)((ULONG_PTR)OutputBuffer+sizeof(ULONG64));
+				*(PULONG32)OutputBuffer=NoirCompleteMemoryAccess(Context.VirtualMachine,Context.VpIndex,Context.Data,Result);
+			}
+			break;
+		}
+		case IOCTL_CvmAccessGuestMemory:
+		{
+			PNOIR_GUEST_MEMORY_VECTOR_CONTEXT Context=(PNOIR_GUEST_MEMORY_VECTOR_CONTEXT)InputBuffer;
+			st=STATUS_SUCCESS;
+			if(InputSize<FIELD_OFFSET(NOIR_GUEST_MEMORY_VECTOR_CONTEXT,Descriptors) || OutputSize<InputSize)
+				st=STATUS_INSUFFICIENT_RESOURCES;
+			else if(Context->Count>NOIR_GUEST_MEMORY_VECTOR_LIMIT || InputSize<FIELD_OFFSET(NOIR_GUEST_MEMORY_VECTOR_CONTEXT,Descriptors[Context->Count]))
+				*(PULONG32)OutputBuffer=NOIR_INVALID_PARAMETER;
+			else
+			{
+				const CVM_HANDLE VirtualMachine=Context->VirtualMachine;
+				const ULONG32 Count=Context->Count;
+				const ULONG_PTR DataArea=(ULONG_PTR)&Context->Descriptors[Count];
+				const ULONG64 DataSize=(ULONG64)InputSize-FIELD_OFFSET(NOIR_GUEST_MEMORY_VECTOR_CONTEXT,Descriptors[Count]);
+				NOIR_STATUS Status=NOIR_SUCCESS;
+				// Every buffer must reside in the data area. Convert offsets into pointers.
+				for(ULONG32 i=0;i<Count;i++)
+				{
+					PNOIR_GUEST_MEMORY_DESCRIPTOR Desc=&Context->Descriptors[i];
+					if(Desc->Buffer>DataSize || Desc->Size>DataSize-Desc->Buffer)
+						Status=NOIR_INVALID_PARAMETER;
+					else
+						Desc->Buffer+=DataArea;
+				}
+				if(Status==NOIR_SUCCESS)Status=NoirAccessGuestMemoryVector(VirtualMachine,Context->VpIndex,Context->Descriptors,Count);
+				// Do not leak kernel addresses to the caller. Convert pointers back into offsets.
+				for(ULONG32 i=0;i<Count;i++)
+					if(Context->Descriptors[i].Buffer>=DataArea)
+						Context->Descriptors[i].Buffer-=DataArea;
+				*(PULONG32)OutputBuffer=Status;
+			}
+			break;
+		}
 		default:
 		{
 			break;
@@ -61,6 +61,13 @@ typedef ULONG32 NOIR_STATUS;
 #define IOCTL_CvmQueryGpaAdMap	CTL_CODE_GEN(0x883)
 #define IOCTL_CvmClearGpaAdBit	CTL_CODE_GEN(0x884)
 #define IOCTL_CvmCreateVmEx		CTL_CODE_GEN(0x885)
+#define IOCTL_CvmHarvestGpaAdMap	CTL_CODE_GEN(0x886)
+#define IOCTL_CvmCreatePioDevice	CTL_CODE_GEN(0x887)
+#define IOCTL_CvmReadPioDevice	CTL_CODE_GEN(0x888)
+#define IOCTL_CvmRegisterCoalescedMmio	CTL_CODE_GEN(0x889)
+#define IOCTL_CvmUnregisterCoalescedMmio	CTL_CODE_GEN(0x88A)
+#define IOCTL_CvmLoadCpuidModel	CTL_CODE_GEN(0x88B)
+#define IOCTL_CvmPromotePageMaps	CTL_CODE_GEN(0x88C)
 #define IOCTL_CvmQueryHvStatus	CTL_CODE_GEN(0x88F)
 #define IOCTL_CvmCreateVcpu		CTL_CODE_GEN(0x890)
 #define IOCTL_CvmDeleteVcpu		CTL_CODE_GEN(0x891)
@@ -73,6 +80,10 @@ typedef ULONG32 NOIR_STATUS;
 #define IOCTL_CvmQueryVcpuStats	CTL_CODE_GEN(0x898)
 #define IOCTL_CvmViewVcpuReg2	CTL_CODE_GEN(0x899)
 #define IOCTL_CvmEditVcpuReg2	CTL_CODE_GEN(0x89A)
+#define IOCTL_CvmSetVcpuExportSet	CTL_CODE_GEN(0x89B)
+#define IOCTL_CvmSetVcpuCpuidOverrides	CTL_CODE_GEN(0x89C)
+#define IOCTL_CvmCompleteMemoryAccess	CTL_CODE_GEN(0x89D)
+#define IOCTL_CvmAccessGuestMemory	CTL_CODE_GEN(0x89E)
 
 // Layered Hypervisor Functions
 typedef ULONG64 CVM_HANDLE;
@@ -108,6 +119,63 @@ typedef struct _NOIR_QUERY_ADBITMAP_CONTEXT
 	ULONG32 NumberOfPages;
 }NOIR_QUERY_ADBITMAP_CONTEXT,*PNOIR_QUERY_ADBITMAP_CONTEXT;
 
+typedef enum _NOIR_CVM_PIO_DEVICE_MODEL
+{
+	NoirCvmPioDeviceSink,
+	NoirCvmPioDeviceDebugConsole,
+	NoirCvmPioDeviceUart16550,
+	NoirCvmMaximumPioDeviceModel
+}NOIR_CVM_PIO_DEVICE_MODEL,*PNOIR_CVM_PIO_DEVICE_MODEL;
+
+typedef struct _NOIR_PIO_DEVICE_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG64 Buffer;
+	ULONG32 BufferLength;
+	NOIR_CVM_PIO_DEVICE_MODEL Model;
+	USHORT Port;
+}NOIR_PIO_DEVICE_CONTEXT,*PNOIR_PIO_DEVICE_CONTEXT;
+
+typedef struct _NOIR_COALESCED_MMIO_ZONE_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG64 Gpa;
+	ULONG64 Size;
+}NOIR_COALESCED_MMIO_ZONE_CONTEXT,*PNOIR_COALESCED_MMIO_ZONE_CONTEXT;
+
+// The CPUID model holds no more than 1024 entries. Each vCPU can have no more than 8 overrides.
+#define NOIR_CPUID_MODEL_LIMIT		1024
+#define NOIR_CPUID_OVERRIDE_LIMIT	8
+
+typedef struct _NOIR_CPUID_ENTRY
+{
+	ULONG32 Leaf;
+	ULONG32 Subleaf;
+	union
+	{
+		struct
+		{
+			ULONG64 Active:1;
+			ULONG64 HasSubleaf:1;
+			ULONG64 Reserved:62;
+		};
+		ULONG64 Value;
+	}Options;
+	ULONG32 Eax;
+	ULONG32 Ebx;
+	ULONG32 Ecx;
+	ULONG32 Edx;
+}NOIR_CPUID_ENTRY,*PNOIR_CPUID_ENTRY;
+
+// Entries are appended after this structure.
+typedef struct _NOIR_CPUID_MODEL_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG32 VpIndex;
+	ULONG32 Count;
+	NOIR_CPUID_ENTRY Entries[1];
+}NOIR_CPUID_MODEL_CONTEXT,*PNOIR_CPUID_MODEL_CONTEXT;
+
 typedef enum _NOIR_CVM_REGISTER_TYPE
 {
 	NoirCvmGeneralPurposeRegister,
@@ -148,6 +216,74 @@ typedef struct _NOIR_VIEW_EDIT_REGISTER_CONTEXT2
 	NOIR_STATUS *Status;
 }NOIR_VIEW_EDIT_REGISTER_CONTEXT2,*PNOIR_VIEW_EDIT_REGISTER_CONTEXT2;
 
+// Register sets can only hold registers with no more than 8 bytes.
+#define NOIR_REGISTER_SET_LIMIT		8
+
+// This structure is optionally appended after the input and the output of IOCTL_CvmRunVcpu.
+typedef struct _NOIR_REGISTER_VALUES
+{
+	ULONG32 Count;
+	ULONG32 Reserved;
+	ULONG32 Names[NOIR_REGISTER_SET_LIMIT];
+	ULONG64 Values[NOIR_REGISTER_SET_LIMIT];
+}NOIR_REGISTER_VALUES,*PNOIR_REGISTER_VALUES;
+
+typedef struct _NOIR_EXPORT_SET_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG32 VpIndex;
+	ULONG32 InterceptCode;
+	ULONG32 RegisterCount;
+	ULONG32 Reserved;
+	ULONG32 RegisterNames[NOIR_REGISTER_SET_LIMIT];
+}NOIR_EXPORT_SET_CONTEXT,*PNOIR_EXPORT_SET_CONTEXT;
+
+typedef struct _NOIR_COMPLETE_MEMORY_ACCESS_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG32 VpIndex;
+	ULONG32 Reserved;
+	ULONG64 Data;
+}NOIR_COMPLETE_MEMORY_ACCESS_CONTEXT,*PNOIR_COMPLETE_MEMORY_ACCESS_CONTEXT;
+
+// This structure follows the status in the output of IOCTL_CvmCompleteMemoryAccess.
+typedef struct _NOIR_MEMORY_ACCESS_RESULT
+{
+	ULONG64 WriteValue;
+	ULONG64 RepeatCount;
+	ULONG64 OtherAddress;
+	LONG64 Stride;
+	ULONG32 WriteRequired:1;
+	ULONG32 String:1;
+	ULONG32 Reserved:30;
+}NOIR_MEMORY_ACCESS_RESULT,*PNOIR_MEMORY_ACCESS_RESULT;
+
+#define NOIR_GUEST_MEMORY_VECTOR_LIMIT	256
+
+// Layout must match noir_cvm_guest_memory_descriptor.
+// In IOCTL_CvmAccessGuestMemory, Buffer is an offset into the data area following the descriptors.
+typedef struct _NOIR_GUEST_MEMORY_DESCRIPTOR
+{
+	ULONG64 GuestAddress;
+	ULONG64 Buffer;
+	ULONG32 Size;
+	ULONG32 WriteOp:1;
+	ULONG32 UseVa:1;
+	ULONG32 NpFault:1;
+	ULONG32 Reserved:29;
+	NOIR_STATUS Status;
+	ULONG32 ErrorCode;
+}NOIR_GUEST_MEMORY_DESCRIPTOR,*PNOIR_GUEST_MEMORY_DESCRIPTOR;
+
+// The output of IOCTL_CvmAccessGuestMemory has the same layout, with the status replacing the VM handle.
+typedef struct _NOIR_GUEST_MEMORY_VECTOR_CONTEXT
+{
+	CVM_HANDLE VirtualMachine;
+	ULONG32 VpIndex;
+	ULONG32 Count;
+	NOIR_GUEST_MEMORY_DESCRIPTOR Descriptors[1];
+}NOIR_GUEST_MEMORY_VECTOR_CONTEXT,*PNOIR_GUEST_MEMORY_VECTOR_CONTEXT;
+
 NOIR_STATUS NoirQueryHypervisorStatus(IN ULONG64 StatusType,OUT PULONG64 Status);
 NOIR_STATUS NoirCreateVirtualMachine(OUT PCVM_HANDLE VirtualMachine);
 NOIR_STATUS NoirCreateVirtualMachineEx(OUT PCVM_HANDLE VirtualMachine,IN ULONG32 Properties);
@@ -157,6 +293,14 @@ NOIR_STATUS NoirReleaseVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32
 NOIR_STATUS NoirSetMapping(IN CVM_HANDLE VirtualMachine,IN PNOIR_ADDRESS_MAPPING MappingInformation);
 NOIR_STATUS NoirQueryGpaAccessingBitmap(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
 NOIR_STATUS NoirClearGpaAccessingBits(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages);
+NOIR_STATUS NoirPromotePageMappings(IN CVM_HANDLE VirtualMachine,OUT PULONG32 Promoted);
+NOIR_STATUS NoirQueryAndClearGpaAccessingBitmap(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
+NOIR_STATUS NoirCreatePioDevice(IN CVM_HANDLE VirtualMachine,IN ULONG32 Model,IN USHORT Port);
+NOIR_STATUS NoirReadPioDeviceOutput(IN CVM_HANDLE VirtualMachine,IN USHORT Port,OUT PVOID Buffer,IN ULONG32 BufferSize,OUT PULONG32 ReadSize);
+NOIR_STATUS NoirRegisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS NoirUnregisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS NoirLoadCpuidModel(IN CVM_HANDLE VirtualMachine,IN PVOID Entries,IN ULONG32 Count);
+NOIR_STATUS NoirSetVirtualProcessorCpuidOverrides(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN PVOID Entries,IN ULONG32 Count);
 NOIR_STATUS NoirViewVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirEditVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,IN PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirViewVirtualProcessorRegisters2(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN PULONG32 RegisterNames,IN ULONG32 RegisterCount,IN ULONG32 RegisterSize,OUT PVOID Buffer);
@@ -165,6 +309,10 @@ NOIR_STATUS NoirQueryVirtualProcessorStatistics(IN CVM_HANDLE VirtualMachine,IN
 NOIR_STATUS NoirSetEventInjection(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 InjectedEvent);
 NOIR_STATUS NoirSetVirtualProcessorOptions(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 OptionType,IN ULONG32 Options);
 NOIR_STATUS NoirRunVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext);
+NOIR_STATUS NoirRunVirtualProcessorEx(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext,IN PVOID ImportSet OPTIONAL,OUT PVOID ExportSet OPTIONAL);
+NOIR_STATUS NoirSetVirtualProcessorExportSet(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 InterceptCode,IN PULONG32 RegisterNames,IN ULONG32 RegisterCount);
+NOIR_STATUS NoirCompleteMemoryAccess(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 Data,OUT PVOID Result);
+NOIR_STATUS NoirAccessGuestMemoryVector(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN OUT PVOID Descriptors,IN ULONG32 Count);
 NOIR_STATUS NoirRescindVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
 
 void NoirInitializeDisassembler();
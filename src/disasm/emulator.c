@@ -17,6 +17,7 @@
 #include <nvstatus.h>
 #include <noirhvm.h>
 #include <nv_intrin.h>
+#include <amd64.h>
 #include <Zydis/Zydis.h>
 #include "emulator.h"
 
@@ -50,7 +51,7 @@ ZydisDecodedOperand* nvc_emu_get_explicit_operand(ZydisDecodedInstruction *Instr
 u64 static nvc_emu_calculate_absolute_address(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *Instruction,ZydisDecodedOperand *Operand)
 {
 	// Address width may not be full.
-	u64 addr_mask=(1ui64<<Instruction->address_width)-1;
+	u64 addr_mask=((u64)1<<Instruction->address_width)-1;
 	// Generally, an memory operand is referenced by the following format:
 	// AbsoluteAddress=SegmentBase+BaseRegister+IndexRegister*ScalingFactor+Displacement
 	// None of them are required to be present.
@@ -81,20 +82,14 @@ u64 static nvc_emu_calculate_absolute_address(noir_cvm_virtual_cpu_p vcpu,ZydisD
 	return abs_addr&addr_mask;
 }
 
-void static nvc_emu_decode_instruction_mov(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *instruction,ZydisDecodedOperand operands[])
+void static nvc_emu_decode_operand(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *instruction,ZydisDecodedOperand *op)
 {
 	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
-	// For mov instruction, the first operand is destination and the second operand is source.
-	// Get the first operand for MMIO reads and second operand for MMIO writes.
-	ZydisDecodedOperand* target_op=&operands[mem_ctxt->access.write];
-	ZydisDecodedOperand* counter_op=&operands[1-mem_ctxt->access.write];
-	mem_ctxt->flags.operand_size=target_op->size>>3;
-	// Decode the operand for MMIO operation.
-	switch(target_op->type)
+	switch(op->type)
 	{
 		case ZYDIS_OPERAND_TYPE_REGISTER:
 		{
-			ZydisRegister reg=target_op->reg.value;
+			ZydisRegister reg=op->reg.value;
 			if(reg>=ZYDIS_REGISTER_AL && reg<=ZYDIS_REGISTER_R15)
 			{
 				// General-Purpose Registers...
@@ -151,14 +146,14 @@ void static nvc_emu_decode_instruction_mov(noir_cvm_virtual_cpu_p vcpu,ZydisDeco
 		case ZYDIS_OPERAND_TYPE_MEMORY:
 		{
 			mem_ctxt->flags.operand_class=noir_cvm_operand_class_memory;
-			mem_ctxt->operand.mem=nvc_emu_calculate_absolute_address(vcpu,instruction,target_op);
+			mem_ctxt->operand.mem=nvc_emu_calculate_absolute_address(vcpu,instruction,op);
 			break;
 		}
 		case ZYDIS_OPERAND_TYPE_POINTER:
 		{
 			mem_ctxt->flags.operand_class=noir_cvm_operand_class_farptr;
-			mem_ctxt->operand.far.segment=target_op->ptr.segment;
-			mem_ctxt->operand.far.offset=target_op->ptr.offset;
+			mem_ctxt->operand.far.segment=op->ptr.segment;
+			mem_ctxt->operand.far.offset=op->ptr.offset;
 			mem_ctxt->operand.far.reserved0=0;
 			mem_ctxt->operand.far.reserved1=0;
 			break;
@@ -166,8 +161,8 @@ void static nvc_emu_decode_instruction_mov(noir_cvm_virtual_cpu_p vcpu,ZydisDeco
 		case ZYDIS_OPERAND_TYPE_IMMEDIATE:
 		{
 			mem_ctxt->flags.operand_class=noir_cvm_operand_class_immediate;
-			mem_ctxt->operand.imm.is_signed=target_op->imm.is_signed;
-			mem_ctxt->operand.imm.u=target_op->imm.value.u;
+			mem_ctxt->operand.imm.is_signed=op->imm.is_signed;
+			mem_ctxt->operand.imm.u=op->imm.value.u;
 			break;
 		}
 		default:
@@ -178,59 +173,538 @@ void static nvc_emu_decode_instruction_mov(noir_cvm_virtual_cpu_p vcpu,ZydisDeco
 	}
 }
 
+void static nvc_emu_decode_instruction_mov(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *instruction,ZydisDecodedOperand operands[])
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	// For mov instruction, the first operand is destination and the second operand is source.
+	// Get the first operand for MMIO reads and second operand for MMIO writes.
+	ZydisDecodedOperand* target_op=&operands[mem_ctxt->access.write];
+	mem_ctxt->flags.operand_size=target_op->size>>3;
+	mem_ctxt->flags.register_size=mem_ctxt->flags.operand_size;
+	mem_ctxt->flags.mmio_destination=mem_ctxt->access.write;
+	// Decode the operand for MMIO operation.
+	nvc_emu_decode_operand(vcpu,instruction,target_op);
+}
+
+// For two-operand instructions other than mov, the MMIO operand is the explicit memory operand.
+void static nvc_emu_decode_instruction_binary(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *instruction,ZydisDecodedOperand operands[])
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	const u32 m=operands[0].type!=ZYDIS_OPERAND_TYPE_MEMORY;
+	ZydisDecodedOperand* target_op=&operands[1-m];
+	mem_ctxt->flags.operand_size=operands[m].size>>3;
+	mem_ctxt->flags.mmio_destination=m==0;
+	// Immediate numbers are extended to the size of the memory operand.
+	if(target_op->type==ZYDIS_OPERAND_TYPE_REGISTER)
+		mem_ctxt->flags.register_size=target_op->size>>3;
+	else
+		mem_ctxt->flags.register_size=mem_ctxt->flags.operand_size;
+	nvc_emu_decode_operand(vcpu,instruction,target_op);
+}
+
+// For string instructions, operands are implicit. The element size is the operand width.
+void static nvc_emu_decode_instruction_string(noir_cvm_virtual_cpu_p vcpu,ZydisDecodedInstruction *instruction,ZydisDecodedOperand operands[])
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	mem_ctxt->flags.operand_size=instruction->operand_width>>3;
+	mem_ctxt->flags.register_size=mem_ctxt->flags.operand_size;
+	mem_ctxt->flags.repeat=(instruction->attributes&ZYDIS_ATTRIB_HAS_REP)!=0;
+	mem_ctxt->flags.address_size=instruction->address_width>>5;
+	if(mem_ctxt->flags.instruction_code==noir_cvm_instruction_code_stos)
+	{
+		// The source of stos is always al/ax/eax/rax.
+		mem_ctxt->flags.mmio_destination=true;
+		mem_ctxt->flags.operand_class=noir_cvm_operand_class_gpr;
+		mem_ctxt->flags.operand_code=0;
+	}
+	else
+	{
+		// For movs, the operand is the address on the other side.
+		// Writing to MMIO means the other side is the source.
+		for(ZyanU8 i=0;i<instruction->operand_count;i++)
+		{
+			if(operands[i].type==ZYDIS_OPERAND_TYPE_MEMORY)
+			{
+				const bool source=(operands[i].actions&ZYDIS_OPERAND_ACTION_READ)!=0;
+				if(source==mem_ctxt->access.write)
+				{
+					mem_ctxt->flags.operand_class=noir_cvm_operand_class_memory;
+					mem_ctxt->operand.mem=nvc_emu_calculate_absolute_address(vcpu,instruction,&operands[i]);
+				}
+			}
+		}
+		mem_ctxt->flags.mmio_destination=mem_ctxt->access.write;
+	}
+}
+
+noir_cvm_decode_cache_entry_p static nvc_emu_get_decode_cache_entry(noir_cvm_decode_cache_p cache,u64p key)
+{
+	u64 h=(key[0]^(key[1]*0x9E3779B97F4A7C15))*0xC2B2AE3D27D4EB4F;
+	return &cache->entries[(h^(h>>29))%noir_cvm_decode_cache_entries];
+}
+
+bool static nvc_emu_lookup_decode_cache(noir_cvm_decode_cache_p cache,u64p key,noir_cvm_memory_access_context_p mem_ctxt,u32p length)
+{
+	noir_cvm_decode_cache_entry_p entry=nvc_emu_get_decode_cache_entry(cache,key);
+	const i32 seq=entry->sequence;
+	// Sequence zero indicates the entry is empty. Odd sequence indicates the entry is being written.
+	if(seq!=0 && (seq&1)==0)
+	{
+		u64 k0,k1,flags,op0,op1;
+		u32 len;
+		// Do not load the contents before the sequence.
+		noir_compiler_barrier();
+		k0=entry->key.qwords[0];
+		k1=entry->key.qwords[1];
+		flags=entry->flags;
+		op0=entry->operand[0];
+		op1=entry->operand[1];
+		len=entry->length;
+		noir_compiler_barrier();
+		// The entry could be overwritten by another vCPU when we are reading it.
+		if(entry->sequence==seq && k0==key[0] && k1==key[1])
+		{
+			u64p operand=(u64p)&mem_ctxt->operand;
+			mem_ctxt->flags.value=flags;
+			operand[0]=op0;
+			operand[1]=op1;
+			*length=len;
+			return true;
+		}
+	}
+	return false;
+}
+
+void static nvc_emu_insert_decode_cache(noir_cvm_decode_cache_p cache,u64p key,noir_cvm_memory_access_context_p mem_ctxt,u32 length)
+{
+	noir_cvm_decode_cache_entry_p entry=nvc_emu_get_decode_cache_entry(cache,key);
+	const i32 seq=entry->sequence;
+	// Do not wait if another vCPU is writing the entry.
+	if((seq&1)==0 && noir_locked_cmpxchg(&entry->sequence,seq+1,seq)==seq)
+	{
+		u64p operand=(u64p)&mem_ctxt->operand;
+		entry->key.qwords[0]=key[0];
+		entry->key.qwords[1]=key[1];
+		entry->flags=mem_ctxt->flags.value;
+		entry->operand[0]=operand[0];
+		entry->operand[1]=operand[1];
+		entry->length=length;
+		noir_compiler_barrier();
+		// Skip sequence zero when it wraps around, which is reserved for empty entries.
+		entry->sequence=seq+2?seq+2:2;
+	}
+}
+
 noir_status nvc_emu_decode_memory_access(noir_cvm_virtual_cpu_p vcpu)
 {
 	noir_status st=noir_invalid_parameter;
 	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
 	if(vcpu->exit_context.intercept_code==cv_memory_access && mem_ctxt->access.execute==false)
 	{
+		noir_cvm_decode_cache_p cache=vcpu->vm?vcpu->vm->decode_cache:null;
 		ZydisDecodedInstruction ZyIns;
 		ZydisDecodedOperand ZyOps[ZYDIS_MAX_OPERAND_COUNT];
 		ZydisDecoder *SelectedDecoder;
 		ZyanStatus zst;
+		u64 key[2];
+		u32 length;
+		u8 mode;
 		st=noir_unsuccessful;
 		if(noir_bt(&vcpu->exit_context.cs.attrib,13))		// Long Mode?
+		{
 			SelectedDecoder=&ZyDec64;
+			mode=2;
+		}
 		else if(noir_bt(&vcpu->exit_context.cs.attrib,14))	// Default-Big?
+		{
 			SelectedDecoder=&ZyDec32;
+			mode=1;
+		}
 		else
+		{
 			SelectedDecoder=&ZyDec16;
-		zst=ZydisDecoderDecodeFull(SelectedDecoder,vcpu->exit_context.memory_access.instruction_bytes,15,&ZyIns,ZyOps);
-		if(ZYAN_SUCCESS(zst))
+			mode=0;
+		}
+		// The key is composed of the instruction bytes and the CPU mode.
+		noir_movsb(key,mem_ctxt->instruction_bytes,15);
+		((u8p)key)[15]=mode;
+		if(cache && nvc_emu_lookup_decode_cache(cache,key,mem_ctxt,&length))
 		{
-			// Decode the identity of the MMIO instruction
-			switch(ZyIns.mnemonic)
+			vcpu->statistics.decode_cache.hits++;
+			st=noir_success;
+		}
+		else
+		{
+			if(cache)vcpu->statistics.decode_cache.misses++;
+			zst=ZydisDecoderDecodeFull(SelectedDecoder,mem_ctxt->instruction_bytes,15,&ZyIns,ZyOps);
+			if(ZYAN_SUCCESS(zst))
 			{
-				case ZYDIS_MNEMONIC_MOV:
-				{
-					mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_mov;
-					nvc_emu_decode_instruction_mov(vcpu,&ZyIns,ZyOps);
-					break;
-				}
-				default:
+				// Decode the identity of the MMIO instruction
+				mem_ctxt->flags.value=0;
+				switch(ZyIns.mnemonic)
 				{
-					mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_unknown;
-					break;
+					case ZYDIS_MNEMONIC_MOV:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_mov;
+						nvc_emu_decode_instruction_mov(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_MOVZX:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_movzx;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_MOVSX:
+					case ZYDIS_MNEMONIC_MOVSXD:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_movsx;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_AND:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_and;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_OR:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_or;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_XOR:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_xor;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_TEST:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_test;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_CMP:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_cmp;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_XCHG:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_xchg;
+						nvc_emu_decode_instruction_binary(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_MOVSD:
+					{
+						// Do not confuse with SSE2 movsd instruction.
+						if(ZyOps[0].type!=ZYDIS_OPERAND_TYPE_MEMORY || ZyOps[1].type!=ZYDIS_OPERAND_TYPE_MEMORY)
+						{
+							mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_unknown;
+							break;
+						}
+					}
+					case ZYDIS_MNEMONIC_MOVSB:
+					case ZYDIS_MNEMONIC_MOVSW:
+					case ZYDIS_MNEMONIC_MOVSQ:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_movs;
+						nvc_emu_decode_instruction_string(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					case ZYDIS_MNEMONIC_STOSB:
+					case ZYDIS_MNEMONIC_STOSW:
+					case ZYDIS_MNEMONIC_STOSD:
+					case ZYDIS_MNEMONIC_STOSQ:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_stos;
+						nvc_emu_decode_instruction_string(vcpu,&ZyIns,ZyOps);
+						break;
+					}
+					default:
+					{
+						mem_ctxt->flags.instruction_code=noir_cvm_instruction_code_unknown;
+						break;
+					}
 				}
+				// Mark the decoder has completed operation.
+				mem_ctxt->flags.decoded=true;
+				length=ZyIns.length;
+				// Memory operands depend on the registers. Do not cache them.
+				if(cache && mem_ctxt->flags.operand_class!=noir_cvm_operand_class_memory)
+					nvc_emu_insert_decode_cache(cache,key,mem_ctxt,length);
+				st=noir_success;
 			}
+			else
+			{
+				char ins_byte_str[48];
+				for(u8 j=0;j<15;j++)
+					nv_snprintf(&ins_byte_str[j*3],sizeof(ins_byte_str)-(j*3),"%02X ",vcpu->exit_context.memory_access.instruction_bytes[j]);
+				nvd_printf("[CVM MMIO] Failed to decode %u-bit instruction! Instruction Bytes: %s\n",16<<mode,ins_byte_str);
+				noir_int3();
+			}
+		}
+		if(st==noir_success)
+		{
 			// Decode Next-Rip.
-			vcpu->exit_context.vcpu_state.instruction_length=ZyIns.length;
-			vcpu->exit_context.next_rip=vcpu->exit_context.rip+ZyIns.length;
+			vcpu->exit_context.vcpu_state.instruction_length=length;
+			vcpu->exit_context.next_rip=vcpu->exit_context.rip+length;
 			// Reset the higher 32 bits of the advanced rip if the guest is not in long mode.
-			if(noir_bt(&vcpu->exit_context.cs.selector,13)==false)vcpu->exit_context.next_rip&=maxu32;
-			// Mark the decoder has completed operation.
-			mem_ctxt->flags.decoded=true;
+			if(mode!=2)vcpu->exit_context.next_rip&=maxu32;
 		}
-		else
+	}
+	return st;
+}
+
+u64 static nvc_emu_size_mask(u32 size)
+{
+	return size>=8?maxu64:((u64)1<<(size<<3))-1;
+}
+
+bool static nvc_emu_parity(u64 value)
+{
+	// Parity flag is set if the lowest byte has even number of set bits.
+	u8 b=(u8)value;
+	b^=b>>4;
+	b^=b>>2;
+	b^=b>>1;
+	return (b&1)==0;
+}
+
+// Flags for and, or, xor and test instructions. The AF flag is undefined and is left unchanged.
+u64 static nvc_emu_logic_flags(u64 rflags,u64 result,u32 size)
+{
+	const u64 mask=nvc_emu_size_mask(size);
+	rflags&=~(((u64)1<<amd64_rflags_cf)|((u64)1<<amd64_rflags_pf)|((u64)1<<amd64_rflags_zf)|((u64)1<<amd64_rflags_sf)|((u64)1<<amd64_rflags_of));
+	result&=mask;
+	rflags|=(u64)nvc_emu_parity(result)<<amd64_rflags_pf;
+	rflags|=(u64)(result==0)<<amd64_rflags_zf;
+	rflags|=((result>>((size<<3)-1))&1)<<amd64_rflags_sf;
+	return rflags;
+}
+
+// Flags for cmp instruction, which is a subtraction without saving the result.
+u64 static nvc_emu_subtract_flags(u64 rflags,u64 minuend,u64 subtrahend,u32 size)
+{
+	const u64 mask=nvc_emu_size_mask(size);
+	const u32 sign=(size<<3)-1;
+	u64 result;
+	minuend&=mask;
+	subtrahend&=mask;
+	result=(minuend-subtrahend)&mask;
+	rflags&=~(((u64)1<<amd64_rflags_cf)|((u64)1<<amd64_rflags_pf)|((u64)1<<amd64_rflags_af)|((u64)1<<amd64_rflags_zf)|((u64)1<<amd64_rflags_sf)|((u64)1<<amd64_rflags_of));
+	rflags|=(u64)(minuend<subtrahend)<<amd64_rflags_cf;
+	rflags|=(u64)nvc_emu_parity(result)<<amd64_rflags_pf;
+	rflags|=((minuend^subtrahend^result)>>4&1)<<amd64_rflags_af;
+	rflags|=(u64)(result==0)<<amd64_rflags_zf;
+	rflags|=(result>>sign&1)<<amd64_rflags_sf;
+	rflags|=(((minuend^subtrahend)&(minuend^result))>>sign&1)<<amd64_rflags_of;
+	return rflags;
+}
+
+bool static nvc_emu_read_operand(noir_cvm_virtual_cpu_p vcpu,u32 size,u64p value)
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	u64p gpr=(u64p)&vcpu->gpr;
+	switch(mem_ctxt->flags.operand_class)
+	{
+		case noir_cvm_operand_class_gpr:
 		{
-			u8 mode=(noir_bt(&vcpu->exit_context.cs.attrib,13)<<2)+(noir_bt(&vcpu->exit_context.cs.attrib,14)<<1);
-			char ins_byte_str[48];
-			for(u8 j=0;j<15;j++)
-				nv_snprintf(&ins_byte_str[j*3],sizeof(ins_byte_str)-(j*3),"%02X ",vcpu->exit_context.memory_access.instruction_bytes[j]);
-			if(mode==0)mode=1;
-			nvd_printf("[CVM MMIO] Failed to decode %u-bit instruction! Instruction Bytes: %s\n",mode<<4,ins_byte_str);
-			noir_int3();
+			*value=gpr[mem_ctxt->flags.operand_code]&nvc_emu_size_mask(size);
+			return true;
 		}
+		case noir_cvm_operand_class_gpr8hi:
+		{
+			*value=(u8)(gpr[mem_ctxt->flags.operand_code]>>8);
+			return true;
+		}
+		case noir_cvm_operand_class_immediate:
+		{
+			*value=mem_ctxt->operand.imm.u&nvc_emu_size_mask(size);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool static nvc_emu_write_operand(noir_cvm_virtual_cpu_p vcpu,u32 size,u64 value)
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	u64p gpr=(u64p)&vcpu->gpr;
+	switch(mem_ctxt->flags.operand_class)
+	{
+		case noir_cvm_operand_class_gpr:
+		{
+			u64p reg=&gpr[mem_ctxt->flags.operand_code];
+			// Writing to 32-bit GPR zero-extends to 64 bits. Writing to 8-bit or 16-bit GPR merges.
+			if(size==8)
+				*reg=value;
+			else if(size==4)
+				*reg=(u32)value;
+			else if(size==2 || size==1)
+				*reg=(*reg&~nvc_emu_size_mask(size))|(value&nvc_emu_size_mask(size));
+			else
+				return false;
+			return true;
+		}
+		case noir_cvm_operand_class_gpr8hi:
+		{
+			u64p reg=&gpr[mem_ctxt->flags.operand_code];
+			*reg=(*reg&~0xff00)|((value&0xff)<<8);
+			return true;
+		}
+	}
+	return false;
+}
+
+u64 static nvc_emu_update_address_register(u64 reg,u64 value,u64 addr_mask)
+{
+	// Writing to 32-bit registers zero-extends. Writing to 16-bit registers merges.
+	return addr_mask==0xffff?(reg&~addr_mask)|(value&addr_mask):value&addr_mask;
+}
+
+// Complete the string instruction by advancing rsi, rdi and rcx as if all elements are transferred.
+void static nvc_emu_complete_string(noir_cvm_virtual_cpu_p vcpu,noir_cvm_memory_access_result_p result)
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	const u64 addr_mask=nvc_emu_size_mask(2<<mem_ctxt->flags.address_size);
+	const u32 size=(u32)mem_ctxt->flags.operand_size;
+	u64 count=1,distance;
+	result->string=true;
+	result->stride=noir_bt(&vcpu->rflags,amd64_rflags_df)?-(i64)size:(i64)size;
+	if(mem_ctxt->flags.repeat)
+	{
+		count=vcpu->gpr.rcx&addr_mask;
+		vcpu->gpr.rcx=nvc_emu_update_address_register(vcpu->gpr.rcx,0,addr_mask);
+	}
+	result->repeat_count=count;
+	distance=(u64)result->stride*count;
+	// Address registers wrap around within the address size.
+	vcpu->gpr.rdi=nvc_emu_update_address_register(vcpu->gpr.rdi,vcpu->gpr.rdi+distance,addr_mask);
+	if(mem_ctxt->flags.instruction_code==noir_cvm_instruction_code_movs)
+	{
+		result->other_address=mem_ctxt->operand.mem;
+		vcpu->gpr.rsi=nvc_emu_update_address_register(vcpu->gpr.rsi,vcpu->gpr.rsi+distance,addr_mask);
+	}
+}
+
+// Complete the decoded MMIO instruction. The data is the value read from MMIO.
+// The destination register and rflags are computed, and the rip is advanced.
+noir_status nvc_emu_complete_memory_access(noir_cvm_virtual_cpu_p vcpu,u64 data,noir_cvm_memory_access_result_p result)
+{
+	noir_status st=noir_invalid_parameter;
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	// The rip is advanced once the access is completed. Do not complete it twice.
+	if(vcpu->exit_context.intercept_code==cv_memory_access && vcpu->rip==vcpu->exit_context.rip)
+	{
+		u32 size,reg_size;
+		u64 value=0;
+		bool completed=false;
+		if(!mem_ctxt->flags.decoded)nvc_emu_decode_memory_access(vcpu);
+		if(!mem_ctxt->flags.decoded)return noir_unsuccessful;
+		size=(u32)mem_ctxt->flags.operand_size;
+		reg_size=(u32)mem_ctxt->flags.register_size;
+		noir_stosb(result,0,sizeof(noir_cvm_memory_access_result));
+		data&=nvc_emu_size_mask(size);
+		switch(mem_ctxt->flags.instruction_code)
+		{
+			case noir_cvm_instruction_code_mov:
+			{
+				if(mem_ctxt->flags.mmio_destination)
+					result->write_required=completed=nvc_emu_read_operand(vcpu,size,&result->write_value);
+				else
+					completed=nvc_emu_write_operand(vcpu,size,data);
+				break;
+			}
+			case noir_cvm_instruction_code_movzx:
+			{
+				completed=nvc_emu_write_operand(vcpu,reg_size,data);
+				break;
+			}
+			case noir_cvm_instruction_code_movsx:
+			{
+				const u32 shift=64-(size<<3);
+				completed=nvc_emu_write_operand(vcpu,reg_size,(u64)((i64)(data<<shift)>>shift));
+				break;
+			}
+			case noir_cvm_instruction_code_and:
+			case noir_cvm_instruction_code_or:
+			case noir_cvm_instruction_code_xor:
+			case noir_cvm_instruction_code_test:
+			{
+				if(nvc_emu_read_operand(vcpu,size,&value))
+				{
+					const u32 code=(u32)mem_ctxt->flags.instruction_code;
+					if(code==noir_cvm_instruction_code_or)
+						value|=data;
+					else if(code==noir_cvm_instruction_code_xor)
+						value^=data;
+					else
+						value&=data;
+					vcpu->rflags=nvc_emu_logic_flags(vcpu->rflags,value,size);
+					completed=true;
+					if(code!=noir_cvm_instruction_code_test)
+					{
+						if(mem_ctxt->flags.mmio_destination)
+						{
+							result->write_value=value;
+							result->write_required=true;
+						}
+						else
+							completed=nvc_emu_write_operand(vcpu,size,value);
+					}
+				}
+				break;
+			}
+			case noir_cvm_instruction_code_cmp:
+			{
+				if(nvc_emu_read_operand(vcpu,size,&value))
+				{
+					if(mem_ctxt->flags.mmio_destination)
+						vcpu->rflags=nvc_emu_subtract_flags(vcpu->rflags,data,value,size);
+					else
+						vcpu->rflags=nvc_emu_subtract_flags(vcpu->rflags,value,data,size);
+					completed=true;
+				}
+				break;
+			}
+			case noir_cvm_instruction_code_xchg:
+			{
+				if(nvc_emu_read_operand(vcpu,size,&value))
+				{
+					result->write_value=value;
+					result->write_required=completed=nvc_emu_write_operand(vcpu,size,data);
+				}
+				break;
+			}
+			case noir_cvm_instruction_code_stos:
+			{
+				nvc_emu_read_operand(vcpu,size,&result->write_value);
+				result->write_required=true;
+				nvc_emu_complete_string(vcpu,result);
+				completed=true;
+				break;
+			}
+			case noir_cvm_instruction_code_movs:
+			{
+				// The User Hypervisor transfers the elements between the MMIO and the other address.
+				result->write_required=mem_ctxt->flags.mmio_destination;
+				nvc_emu_complete_string(vcpu,result);
+				completed=true;
+				break;
+			}
+		}
+		if(completed)
+		{
+			vcpu->rip=vcpu->exit_context.next_rip;
+			vcpu->state_cache.gprvalid=0;
+			st=noir_success;
+		}
+		else
+			st=noir_not_implemented;
 	}
 	return st;
 }
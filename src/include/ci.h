@@ -18,6 +18,18 @@
 #define ci_enforcement_delay 50000
 #endif
 
+// In event-driven mode, the worker polls dirty queues at a short interval
+// and sweeps all pages at a long interval as a backstop.
+#if !defined(ci_event_delay)
+#define ci_event_delay 100
+#endif
+
+#if !defined(ci_sweep_delay)
+#define ci_sweep_delay 600000
+#endif
+
+#define noir_ci_dirty_queue_size	64
+
 typedef struct _noir_ci_page
 {
 	void* virt;
@@ -35,6 +47,18 @@ typedef struct _noir_ci_page
 	}options;
 }noir_ci_page,*noir_ci_page_p;
 
+// Each processor owns one dirty queue. Only the owner processor
+// enqueues pages, and only the CI worker dequeues them.
+typedef struct _noir_ci_dirty_queue
+{
+	u32v head;
+	u32v tail;
+	// Set if a page could not be enqueued. The worker would sweep all pages.
+	u32v overflow;
+	u32 reserved[13];
+	u32 page_index[noir_ci_dirty_queue_size];
+}noir_ci_dirty_queue,*noir_ci_dirty_queue_p;
+
 typedef struct _noir_ci_context
 {
 #if !defined(_hv_type1)
@@ -49,23 +73,37 @@ typedef struct _noir_ci_context
 		{
 			u32 soft_ci:1;
 			u32 hard_ci:1;
-			u32 reserved:30;
+			u32 event_ci:1;
+			u32 reserved:29;
 		};
 		u32 value;
 	}options;
+	// Dirty queues are allocated outside the CI page. Otherwise, writes
+	// to them from the worker would be discarded by Hardware-Enforced CI.
+	noir_ci_dirty_queue_p dirty_queues;
+	u32v* page_queued;		// Set if the page is in a dirty queue.
+	u32 queue_count;
 	noir_ci_page page_ci[0];
 }noir_ci_context,*noir_ci_context_p;
 
 u8 nvc_confirm_cpu_manufacturer(char* vendor_string);
 bool nvc_is_vt_supported();
+u32 stdcall noir_crc32_page_std(void* page);
+u32 stdcall noir_crc32_page_slice8(void* page);
 u32 stdcall noir_crc32_page_sse(void* page);
+u32 stdcall noir_crc32_page_clmul(void* page);
+void stdcall noir_crc32_3pages_sse(void** pages,u32p crc);
 bool fastcall noir_check_sse42();
+bool fastcall noir_check_pclmulqdq();
 
 #if defined(_code_integrity)
 u32 noir_ci_selected_page=0;
 u32v noir_ci_stop_signal=0;
 noir_hvdata noir_ci_context_p noir_ci=null;
 noir_hvdata noir_crc32_page_func noir_crc32_page=null;
+noir_hvdata noir_crc32_pages_func noir_crc32_pages=null;
+// Slice-by-8 tables are generated from the byte-wise table at initialization.
+noir_hvdata u32 crc32c_slice_table[8][256];
 
 noir_hvdata const u32 crc32c_table[256]=
 {
@@ -136,5 +174,6 @@ noir_hvdata const u32 crc32c_table[256]=
 };
 #else
 bool fastcall noir_ci_is_ci_phys_page(u64 phys,void** virt);
+void fastcall noir_ci_log_write(u64 phys);
 extern noir_ci_context_p noir_ci;
 #endif
\ No newline at end of file
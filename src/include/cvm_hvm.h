@@ -55,6 +55,7 @@ typedef enum _noir_cvm_intercept_code
 	cv_task_switch=15,
 	cv_single_step=16,
 	cv_apic_msr=17,
+	cv_coalesced_mmio=18,
 	// The rest are scheduler-relevant.
 	cv_scheduler_exit=0x80000000,
 	cv_scheduler_pause=0x80000001,
@@ -162,6 +163,19 @@ typedef enum _noir_cvm_register_name
 	// FIXME: Implement more register names.
 }noir_cvm_register_name,*noir_cvm_register_name_p;
 
+// Register sets let the User Hypervisor exchange registers with the vCPU in the same call of running the vCPU.
+// Only registers with no more than 8 bytes can be used in register sets.
+#define noir_cvm_register_set_limit			8
+#define noir_cvm_register_set_code_limit	32
+
+typedef struct _noir_cvm_register_values
+{
+	u32 count;
+	u32 reserved;
+	noir_cvm_register_name names[noir_cvm_register_set_limit];
+	u64 values[noir_cvm_register_set_limit];
+}noir_cvm_register_values,*noir_cvm_register_values_p;
+
 typedef enum _noir_cvm_vcpu_option_type
 {
 	noir_cvm_guest_vcpu_options,
@@ -170,10 +184,13 @@ typedef enum _noir_cvm_vcpu_option_type
 	noir_cvm_msr_interception
 }noir_cvm_vcpu_option_type,*noir_cvm_vcpu_option_type_p;
 
-#define noir_cvm_cpuid_quickpath_limit_per_vm		64
-#define noir_cvm_cpuid_quickpath_limit_per_vcpu		16
+// CPUID models are stored in open-addressed hash tables with linear probing.
+// The table is kept at most half full so that probes are short.
+#define noir_cvm_cpuid_model_limit			1024
+#define noir_cvm_cpuid_override_limit		8
+#define noir_cvm_cpuid_override_slots		16
 
-typedef struct _noir_cvm_cpuid_quickpath_info
+typedef struct _noir_cvm_cpuid_entry
 {
 	u32 leaf;
 	u32 subleaf;
@@ -183,7 +200,7 @@ typedef struct _noir_cvm_cpuid_quickpath_info
 		{
 			u64 active:1;
 			u64 has_subleaf:1;
-			u64 vm_wide:1;
+			u64 builtin:1;
 			u64 reserved:61;
 		};
 		u64 value;
@@ -192,7 +209,14 @@ typedef struct _noir_cvm_cpuid_quickpath_info
 	u32 ebx;
 	u32 ecx;
 	u32 edx;
-}noir_cvm_cpuid_quickpath_info,*noir_cvm_cpuid_quickpath_info_p;
+}noir_cvm_cpuid_entry,*noir_cvm_cpuid_entry_p;
+
+typedef struct _noir_cvm_cpuid_table
+{
+	u32 mask;
+	u32 count;
+	noir_cvm_cpuid_entry entries[0];
+}noir_cvm_cpuid_table,*noir_cvm_cpuid_table_p;
 
 typedef union _noir_cvm_invalid_state_context
 {
@@ -291,6 +315,16 @@ typedef struct _noir_cvm_task_switch_context
 #define noir_cvm_operand_class_unknown		31
 
 #define noir_cvm_instruction_code_mov			0
+#define noir_cvm_instruction_code_movzx			1
+#define noir_cvm_instruction_code_movsx			2		// Including movsxd.
+#define noir_cvm_instruction_code_and			3
+#define noir_cvm_instruction_code_or			4
+#define noir_cvm_instruction_code_xor			5
+#define noir_cvm_instruction_code_test			6
+#define noir_cvm_instruction_code_cmp			7
+#define noir_cvm_instruction_code_xchg			8
+#define noir_cvm_instruction_code_movs			9		// The operand is the memory on the other side.
+#define noir_cvm_instruction_code_stos			10
 // NoirVisor's internal emulator cannot emulate this instruction...
 #define noir_cvm_instruction_code_unknown		0xffff
 
@@ -321,7 +355,15 @@ typedef struct _noir_cvm_memory_access_context
 			// The index of operand.
 			// (e.g.: rax is 0 because it's the first register among GPR)
 			u64 operand_code:7;
-			u64 reserved:19;
+			// The size of the register operand in bytes. (e.g.: movzx eax,byte ptr [rbx] has 4)
+			u64 register_size:4;
+			// The MMIO operand is the destination. (e.g.: and [rbx],eax)
+			u64 mmio_destination:1;
+			// The string instruction has the rep prefix.
+			u64 repeat:1;
+			// 0=16-bit, 1=32-bit, 2=64-bit address.
+			u64 address_size:2;
+			u64 reserved:11;
 			u64 decoded:1;
 		};
 		u64 value;
@@ -348,6 +390,26 @@ typedef struct _noir_cvm_memory_access_context
 	}operand;
 }noir_cvm_memory_access_context,*noir_cvm_memory_access_context_p;
 
+// The result of completing a decoded MMIO instruction with the data read from the device.
+// The destination register, rflags, rip and string registers of the vCPU are updated accordingly.
+typedef struct _noir_cvm_memory_access_result
+{
+	// The value to be written to the device.
+	u64 write_value;
+	// String instructions transfer this many elements.
+	u64 repeat_count;
+	// The guest-virtual address of the first element on the other side of movs.
+	u64 other_address;
+	// The distance between elements in bytes. This is negative if the direction flag is set.
+	i64 stride;
+	struct
+	{
+		u32 write_required:1;
+		u32 string:1;
+		u32 reserved:30;
+	};
+}noir_cvm_memory_access_result,*noir_cvm_memory_access_result_p;
+
 typedef struct _noir_cvm_interrupt_window_context
 {
 	struct
@@ -565,6 +627,26 @@ typedef union _noir_cvm_vcpu_state_cache
 	u32 value;
 }noir_cvm_vcpu_state_cache,*noir_cvm_vcpu_state_cache_p;
 
+// Bit positions of the state groups in the state cache.
+#define noir_cvm_state_cache_gpr		0
+#define noir_cvm_state_cache_cr			1
+#define noir_cvm_state_cache_cr2		2
+#define noir_cvm_state_cache_dr			3
+#define noir_cvm_state_cache_sr			4
+#define noir_cvm_state_cache_fg			5
+#define noir_cvm_state_cache_dt			6
+#define noir_cvm_state_cache_lt			7
+#define noir_cvm_state_cache_sc			8
+#define noir_cvm_state_cache_se			9
+#define noir_cvm_state_cache_tp			10
+#define noir_cvm_state_cache_ef			11
+#define noir_cvm_state_cache_pa			12
+#define noir_cvm_state_cache_lb			13
+#define noir_cvm_state_cache_ap			14
+#define noir_cvm_state_cache_ss			15
+#define noir_cvm_state_cache_ts			16
+#define noir_cvm_state_cache_groups		17
+
 typedef struct _noir_cvm_event_injection
 {
 	union
@@ -606,10 +688,97 @@ typedef struct _noir_cvm_vcpu_statistics
 		noir_cvm_interception_counter exception;
 		noir_cvm_interception_counter emulation;
 		noir_cvm_interception_counter rsm;
+		noir_cvm_interception_counter pio_device;	// I/O instructions completed by in-hypervisor device models.
 	}interceptions;
 	u64 runtime;
+	// Lookups of decoded MMIO instructions.
+	struct
+	{
+		u64 hits;
+		u64 misses;
+	}decode_cache;
+	// Lookups of guest-virtual address translations.
+	struct
+	{
+		u64 hits;
+		u64 misses;
+	}gva_tlb;
+	// Number of times each state group is reloaded into VMCB/VMCS after edits.
+	// Indexed by the bit positions of the state cache.
+	u64 state_reloads[noir_cvm_state_cache_groups];
 }noir_cvm_vcpu_statistics,*noir_cvm_vcpu_statistics_p;
 
+// Guest-virtual address translations are cached per vCPU, keyed by CR3, GVA page and access type.
+// Entries are tagged by generations of the vCPU and the VM. Incrementing either generation flushes them.
+#define noir_cvm_gva_tlb_entries		64
+
+typedef struct _noir_cvm_gva_tlb_entry
+{
+	u64 cr3;
+	u64 gva_page;
+	u64 gpa_page;
+	// Zero if the GPA is not yet translated into HPA.
+	u64 hpa_page;
+	// Access types granted by the guest paging structures. Zero if the entry is invalid.
+	u32 access;
+	u32 generation;
+	u32 vm_generation;
+	u32 reserved;
+}noir_cvm_gva_tlb_entry,*noir_cvm_gva_tlb_entry_p;
+
+// Decoded MMIO instructions are cached per VM, keyed by the instruction bytes and the CPU mode.
+// The cache is direct-mapped. Colliding instructions simply evict each other.
+#define noir_cvm_decode_cache_entries		256
+
+typedef struct _noir_cvm_decode_cache_entry
+{
+	// The sequence is odd while the entry is being written. Zero indicates an empty entry.
+	i32v sequence;
+	u32 length;
+	// 15 instruction bytes followed by the CPU mode.
+	union
+	{
+		u8 bytes[16];
+		u64 qwords[2];
+	}key;
+	u64 flags;
+	u64 operand[2];
+}noir_cvm_decode_cache_entry,*noir_cvm_decode_cache_entry_p;
+
+typedef struct _noir_cvm_decode_cache
+{
+	noir_cvm_decode_cache_entry entries[noir_cvm_decode_cache_entries];
+}noir_cvm_decode_cache,*noir_cvm_decode_cache_p;
+
+// Writes to coalesced MMIO zones are completed by NoirVisor and appended to the ring in VPCB.
+#define noir_cvm_coalesced_mmio_ring_entries	64
+#define noir_cvm_coalesced_mmio_zone_limit		16
+
+typedef struct _noir_cvm_coalesced_mmio_entry
+{
+	u64 gpa;
+	u64 data;
+	u32 size;
+	u32 reserved;
+}noir_cvm_coalesced_mmio_entry,*noir_cvm_coalesced_mmio_entry_p;
+
+// The User Hypervisor must drain the ring before handling any exit so that the order of writes is preserved.
+typedef struct _noir_cvm_coalesced_mmio_ring
+{
+	u32 head;		// Moved by the User Hypervisor.
+	u32 tail;		// Moved by NoirVisor.
+	// NoirVisor exits with cv_coalesced_mmio when the ring has this many entries. Zero means the ring is full.
+	u32 watermark;
+	u32 reserved;
+	noir_cvm_coalesced_mmio_entry entries[noir_cvm_coalesced_mmio_ring_entries];
+}noir_cvm_coalesced_mmio_ring,*noir_cvm_coalesced_mmio_ring_p;
+
+typedef struct _noir_cvm_coalesced_mmio_zone
+{
+	u64 gpa;
+	u64 size;
+}noir_cvm_coalesced_mmio_zone,*noir_cvm_coalesced_mmio_zone_p;
+
 // Virtual-Processor Control Block (VPCB) is one or more shared page(s) between the NoirVisor
 // and the User Hypervisors to accelerate VM-Exit handlings, especially I/O emulations.
 // When VPCB is active, Exit-Context is not used.
@@ -625,8 +794,12 @@ typedef struct _noir_cvm_vcpu_control_block
 		{
 			u64 req_intr_window:1;
 			u64 rescind_vcpu:1;
+			// Transfer string I/O through io_buff in batches. The count field of pio is the number of elements.
+			// For outs, the elements are gathered into io_buff. For ins, fill io_buff before the vCPU runs again.
+			// NoirVisor advances rcx, rsi, rdi and rip. Do not advance them in the User Hypervisor.
+			u64 batch_string_io:1;
 			// Reserved for future purposes.
-			u64 reserved:62;
+			u64 reserved:61;
 		};
 		u64 value;
 	}flags;
@@ -653,6 +826,13 @@ typedef struct _noir_cvm_vcpu_control_block
 	// Align the I/O buffer at 1024 bytes.
 	// Note that the biggest registers in x86 have 1024 bytes (AMX registers).
 	align_at(1024) u8 io_buff[1024];
+	// The ring is opt-in. It is used only if the size field covers it.
+	noir_cvm_coalesced_mmio_ring coalesced_mmio;
+	// Register sets are used only if the size field covers them.
+	// The import set is applied before the vCPU runs, then its count is reset to zero.
+	// The export set is filled after the vCPU exits.
+	noir_cvm_register_values import_set;
+	noir_cvm_register_values export_set;
 }noir_cvm_vcpu_control_block,*noir_cvm_vcpu_control_block_p;
 
 typedef struct _noir_cvm_virtual_cpu
@@ -672,6 +852,7 @@ typedef struct _noir_cvm_virtual_cpu
 	void* tunnel;
 	void* iobuff;
 	u64 swapped_pte;
+	struct _noir_cvm_virtual_machine *vm;
 	noir_pushlock vcpu_lock;
 	u32v ref_count;
 	noir_cvm_event_injection injected_event;
@@ -679,6 +860,8 @@ typedef struct _noir_cvm_virtual_cpu
 	noir_cvm_vcpu_options vcpu_options;
 	noir_cvm_vcpu_msr_interceptions msr_interceptions;
 	noir_cvm_vcpu_state_cache state_cache;
+	// State groups requested by the synchronization. Other groups are deferred.
+	u32 sync_groups;
 	noir_cvm_vcpu_statistics statistics;
 	struct
 	{
@@ -687,7 +870,22 @@ typedef struct _noir_cvm_virtual_cpu
 	}statistics_internal;
 	u32 exception_bitmap;
 	u32 scheduling_priority;
-	noir_cvm_cpuid_quickpath_info cpuid_quickpath[8];
+	// Per-vCPU CPUID entries (e.g.: APIC ID) take precedence over the CPUID model of the VM.
+	noir_cvm_cpuid_entry cpuid_overrides[noir_cvm_cpuid_override_slots];
+	// Registers to be exported on exit, indexed by intercept codes.
+	struct
+	{
+		u8 count[noir_cvm_register_set_code_limit];
+		noir_cvm_register_name names[noir_cvm_register_set_code_limit][noir_cvm_register_set_limit];
+	}export_set;
+	// Elements of a batched ins to be scattered from io_buff before the vCPU runs.
+	u32 pending_string_input;
+	// The guest may modify its paging structures without exiting. The generation is incremented whenever the vCPU runs.
+	struct
+	{
+		u32 generation;
+		noir_cvm_gva_tlb_entry entries[noir_cvm_gva_tlb_entries];
+	}gva_tlb;
 }noir_cvm_virtual_cpu,*noir_cvm_virtual_cpu_p;
 
 #define noir_cvm_memory_uc	0
@@ -719,23 +917,34 @@ typedef struct _noir_cvm_address_mapping
 }noir_cvm_address_mapping,*noir_cvm_address_mapping_p;
 
 // Each list takes a page.
+// Lists with free slots are chained through partial_next so that a slot is found without scanning the lists.
 typedef struct _noir_cvm_lockers_list
 {
 	struct _noir_cvm_lockers_list *next;
+	struct _noir_cvm_lockers_list *partial_next;
 #if defined(_amd64)
-	// For 64-bit, there are 503 lockers.
+	// For 64-bit, there are 502 lockers.
 	// The bitmap would be 64 bytes.
-#define noir_cvm_lockers_per_array	503
+#define noir_cvm_lockers_per_array	502
 	u8 bitmap[64];
 #else
-	// For 32-bit, there are 992 lockers.
+	// For 32-bit, there are 990 lockers.
 	// The bitmap would be 128 bytes.
-#define noir_cvm_lockers_per_array	992
+#define noir_cvm_lockers_per_array	990
 	u8 bitmap[128];
 #endif
-	void* lockers[noir_cvm_lockers_per_array];
+	struct _noir_cvm_locker_record* lockers[noir_cvm_lockers_per_array];
 }noir_cvm_lockers_list,*noir_cvm_lockers_list_p;
 
+// Mappings whose HVA range is already locked share the locker.
+typedef struct _noir_cvm_locker_record
+{
+	avl_node avl;		// AVL-Node must be at the top of the structure.
+	u64 hva;
+	u32 bytes;
+	void* locker;
+}noir_cvm_locker_record,*noir_cvm_locker_record_p;
+
 typedef union _noir_cvm_vm_properties
 {
 	struct
@@ -753,6 +962,19 @@ typedef union _noir_cvm_vm_properties
 	u32 value;
 }noir_cvm_vm_properties,*noir_cvm_vm_properties_p;
 
+// PIO Device Models that NoirVisor can emulate without the User Hypervisor.
+typedef enum _noir_cvm_pio_device_model
+{
+	// Writes are latched and reads return the latched value. (e.g.: Port 0x80 for POST codes and I/O delays)
+	noir_cvm_pio_device_sink=0,
+	// Writes are sent to the output buffer and reads return 0xE9. (e.g.: Port 0xE9 for Bochs/QEMU debug console)
+	noir_cvm_pio_device_debugcon=1,
+	// Eight ports of a 16550 UART whose transmitter is always ready. Interrupts are not generated.
+	// Only the polling console (e.g.: firmware and early kernel messages) can be served.
+	noir_cvm_pio_device_uart16550=2,
+	noir_cvm_pio_device_maximum
+}noir_cvm_pio_device_model,*noir_cvm_pio_device_model_p;
+
 typedef struct _noir_cvm_virtual_machine
 {
 	list_entry active_vm_list;
@@ -762,8 +984,30 @@ typedef struct _noir_cvm_virtual_machine
 	noir_cvm_vm_properties properties;
 	noir_cvm_lockers_list_p locker_head;
 	noir_cvm_lockers_list_p locker_tail;
-	noir_cvm_cpuid_quickpath_info cpuid_quickpath[64];
+	noir_cvm_lockers_list_p locker_partial;
+	noir_cvm_locker_record_p locker_root;
+	noir_pushlock locker_lock;
+	// The CPUID table is immutable once published. Replacing the table waits until no exit handlers are reading it.
+	struct
+	{
+		noir_cvm_cpuid_table_p table;
+		u32v readers;
+		bool user_loaded;
+	}cpuid_model;
 	noir_reslock vcpu_list_lock;
+	// In-Hypervisor PIO Device Models.
+	// Positive lock values count the exit handlers searching the tree. Registration sets it to -1.
+	struct _noir_io_avl_node *pio_device_root;
+	i32v pio_device_lock;
+	// Coalesced MMIO zones have their own lock so that memory-access exits do not contend on the vCPU list lock.
+	// Like the PIO device lock, -1 indicates a writer, and positive values count the readers.
+	i32v coalesced_mmio_lock;
+	u32 coalesced_mmio_zone_count;
+	noir_cvm_coalesced_mmio_zone coalesced_mmio_zones[noir_cvm_coalesced_mmio_zone_limit];
+	// Decoded MMIO instructions shared by all vCPUs. This is optional.
+	noir_cvm_decode_cache_p decode_cache;
+	// Incremented on mapping and NSV ownership changes in order to flush the GVA TLBs of all vCPUs.
+	u32v gva_tlb_generation;
 }noir_cvm_virtual_machine,*noir_cvm_virtual_machine_p;
 
 typedef struct _noir_cvm_gmem_op_context
@@ -781,6 +1025,28 @@ typedef struct _noir_cvm_gmem_op_context
 	noir_status status;
 }noir_cvm_gmem_op_context,*noir_cvm_gmem_op_context_p;
 
+// Vectored guest memory access services all descriptors in one call.
+// Translations are shared across descriptors. Each descriptor reports its own status.
+#define noir_cvm_guest_memory_vector_limit		256
+
+typedef struct _noir_cvm_guest_memory_descriptor
+{
+	u64 guest_address;
+	void* buffer;
+	struct
+	{
+		u64 size:32;
+		u64 write_op:1;
+		u64 use_va:1;
+		u64 np_fault:1;
+		u64 reserved:29;
+	};
+	noir_status status;
+	// This is the #PF error code for GVAs, or the #NPF error code for GPAs.
+	// If np_fault is set, the GVA is translated but its GPA is not mapped. This is the #NPF error code.
+	u32 error_code;
+}noir_cvm_guest_memory_descriptor,*noir_cvm_guest_memory_descriptor_p;
+
 typedef struct _noir_rmt_remap_context
 {
 	u64p hpa_list;
@@ -819,6 +1085,8 @@ noir_status nvc_svmc_set_mapping(noir_cvm_virtual_machine_p virtual_machine,noir
 noir_status nvc_svmc_set_unmapping(noir_cvm_virtual_machine_p virtual_machine,u64 gpa,u32 pages);
 noir_status nvc_svmc_query_gpa_accessing_bitmap(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size);
 noir_status nvc_svmc_clear_gpa_accessing_bits(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count);
+noir_status nvc_svmc_query_and_clear_gpa_accessing_bitmap(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size);
+u32 nvc_svmc_promote_page_mappings(noir_cvm_virtual_machine_p virtual_machine);
 u32 nvc_svmc_get_vm_asid(noir_cvm_virtual_machine_p vm);
 // CVM Functions from VT-Core
 noir_status nvc_vtc_create_vm(noir_cvm_virtual_machine_p *virtual_machine);
@@ -830,6 +1098,9 @@ noir_status nvc_vtc_rescind_vcpu(noir_cvm_virtual_cpu_p vcpu);
 noir_cvm_virtual_cpu_p nvc_vtc_reference_vcpu(noir_cvm_virtual_machine_p vm,u32 vcpu_id);
 noir_status nvc_vtc_set_mapping(noir_cvm_virtual_machine_p virtual_machine,noir_cvm_address_mapping_p mapping_info);
 u32 nvc_vtc_get_vm_asid(noir_cvm_virtual_machine_p vm);
+// Emulator Functions
+noir_status nvc_emu_decode_memory_access(noir_cvm_virtual_cpu_p vcpu);
+noir_status nvc_emu_complete_memory_access(noir_cvm_virtual_cpu_p vcpu,u64 data,noir_cvm_memory_access_result_p result);
 
 // Idle VM is to be considered as the List Head.
 noir_cvm_virtual_machine noir_idle_vm={0};
@@ -866,6 +1137,10 @@ noir_hvdata u32 noir_cvm_register_buffer_limit[noir_cvm_maximum_register_type]=
 #elif defined(_vt_core) || defined(_svm_core)
 // Emulator Functions
 noir_status nvc_emu_decode_memory_access(noir_cvm_virtual_cpu_p vcpu);
+// CPUID Model Functions
+bool fastcall nvc_query_cpuid_model(noir_cvm_virtual_cpu_p vcpu,u32 leaf,u32 subleaf,noir_cpuid_general_info_p info);
+// PIO Device Model Functions
+bool fastcall nvc_emulate_vm_pio_device(noir_cvm_virtual_machine_p vm,bool input,u16 port,u16 size,u64p rax);
 void nvc_release_lockers(noir_cvm_virtual_machine_p virtual_machine);
 extern noir_cvm_virtual_machine noir_idle_vm;
 extern noir_reslock noir_vm_list_lock;
@@ -27,6 +27,42 @@ typedef enum _noir_debug_mode
 	noir_debug_interactive
 }noir_debug_mode,*noir_debug_mode_p;
 
+// Trace Ring
+#define noir_trace_ring_records		1024	// Must be power of 2.
+#define noir_trace_max_arguments	6
+
+#if !defined(trace_drain_delay)
+#define trace_drain_delay			100
+#endif
+
+typedef struct _noir_trace_record
+{
+	u64 tsc;
+	const char* format;
+	const char* src_file;
+	u32 src_ln;
+	u32 argc;
+	u64 args[noir_trace_max_arguments];
+	// The record is published when the sequence is set to its slot number plus one.
+	u64v sequence;
+}noir_trace_record,*noir_trace_record_p;
+
+// Each processor owns one ring. A producer may be preempted or migrated after it picks the ring,
+// so slots are reserved atomically through the head and each record is published by its sequence.
+// The drainer is the only consumer, serialized by the debug port lock.
+typedef struct _noir_trace_ring
+{
+	// Producer-owned cache line.
+	u64v head;
+	u64v dropped;
+	u64 producer_pad[6];
+	// Consumer-owned cache line.
+	u64v tail;
+	u64 reported_dropped;
+	u64 consumer_pad[6];
+	noir_trace_record records[noir_trace_ring_records];
+}noir_trace_ring,*noir_trace_ring_p;
+
 typedef struct _noir_debugger
 {
 	noir_debug_media_type medium_type;
@@ -45,6 +81,13 @@ typedef struct _noir_debugger
 		}qemu_debugcon;
 	}debug_port;
 	u32v port_lock;
+	struct
+	{
+		noir_trace_ring_p rings;
+		u32 ring_count;
+		u32v stop_signal;
+		void* drain_thread;
+	}trace;
 }noir_debugger,*noir_debugger_p;
 
 // Serial Driver
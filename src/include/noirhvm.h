@@ -196,6 +196,37 @@ typedef struct _noir_io_avl_node
 	};
 }noir_io_avl_node,*noir_io_avl_node_p;
 
+#define noir_cvm_pio_device_output_size		0x800
+
+// In-Hypervisor PIO Device Model of CVM.
+typedef struct _noir_cvm_pio_device
+{
+	noir_io_avl_node node;		// AVL-Node must be at the top of the structure.
+	noir_cvm_pio_device_model model;
+	// Exit handlers of different vCPUs may access the same device.
+	u32v lock;
+	union
+	{
+		u32 latch;
+		struct
+		{
+			u8 ier;
+			u8 fcr;
+			u8 lcr;
+			u8 mcr;
+			u8 scr;
+			u8 dll;
+			u8 dlm;
+		}uart;
+	}regs;
+	// The output buffer is a ring. Exit handlers produce while holding the lock.
+	// The consumer only moves the head, so it does not take the lock.
+	u32v head;
+	u32v tail;
+	u32v drain_lock;
+	u8 output[noir_cvm_pio_device_output_size];
+}noir_cvm_pio_device,*noir_cvm_pio_device_p;
+
 // Hypervisor Structure
 typedef struct _noir_hypervisor
 {
@@ -328,6 +359,9 @@ typedef struct _noir_hypervisor
 	{
 		memory_descriptor directory;
 		u64 dir_count;
+		// Indexed by 1GiB-page number of HPA. Each slot holds the first directory entry ending above the page.
+		memory_descriptor index;
+		u64 index_count;
 		noir_pushlock lock;
 	}rmd;
 	u32 cpu_count;
@@ -387,6 +421,8 @@ noir_custom_vcpu_get_nested_paging_base noir_get_custom_vcpu_np_base=null;
 bool nvc_build_reverse_mapping_table();
 void nvc_configure_reverse_mapping(u64 hpa,u64 gpa,u32 asid,bool shared,u8 ownership);
 bool nvc_validate_rmt_reassignment(u64p hpa,u64p gpa,u32 pages,u32 asid,bool shared,u8 ownership);
+void nvc_configure_reverse_mapping_batch(u64p hpa,u64p gpa,u32 pages,u32 asid,bool shared,u8 ownership);
+bool nvc_build_rmt_index();
 noir_rmt_entry_p nvc_get_rmt_entry(u64 hpa);
 extern noir_hypervisor_p hvm_p;
 extern ulong_ptr system_cr3;
@@ -414,6 +450,15 @@ noir_status nvc_register_mmio_region(noir_mmio_region_p mr);
 void nvc_call_rw_pio_region(bool direction,u16 port,u16 size,u32p value);
 void nvc_call_rw_mmio_region(bool direction,u64 address,u64 size,u64p value);
 void nvc_cleanup_io_hooks(noir_io_avl_node_p root);
+noir_status nvc_register_vm_pio_region(noir_cvm_virtual_machine_p vm,noir_pio_region_p pr);
+noir_status nvc_create_vm_pio_device(noir_cvm_virtual_machine_p vm,noir_cvm_pio_device_model model,u16 port);
+noir_status nvc_read_vm_pio_device_output(noir_cvm_virtual_machine_p vm,u16 port,void* buffer,u32 buffer_size,u32p read_size);
+
+// Functions from CVM CPUID Model.
+noir_status nvc_load_cpuid_model(noir_cvm_virtual_machine_p vm,noir_cvm_cpuid_entry_p entries,u32 count);
+noir_status nvc_set_vcpu_cpuid_overrides(noir_cvm_virtual_cpu_p vcpu,noir_cvm_cpuid_entry_p entries,u32 count);
+noir_cvm_cpuid_table_p nvc_build_cpuid_table(noir_cvm_cpuid_entry_p entries,u32 count);
+void nvc_build_cpuid_overrides(noir_cvm_virtual_cpu_p vcpu,noir_cvm_cpuid_entry_p entries,u32 count);
 
 // Functions from NoirVisor internal debugger.
 noir_status noir_configure_serial_port_debugger(u8 port_number,u16 port_base,u32 baudrate);
@@ -427,6 +472,9 @@ u8 nvc_emu_try_vmexit_write_memory(noir_gpr_state_p gpr_state,noir_seg_state_p s
 bool nvc_translate_host_virtual_address_routine64(u64 pt,u64 va,u32 level,u64p pa,u32p error_code,bool r,bool w,bool x,bool u);
 size_t nvc_copy_host_virtual_memory64(u64 pt,u64 va,void* buffer,size_t length,bool write,bool la57,u32p error_code);
 size_t nvc_copy_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code);
+size_t nvc_copy_guest_virtual_memory_ex(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code,bool* np_fault);
+size_t nvc_probe_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,size_t length,bool write);
+noir_status nvc_access_guest_memory_vector(noir_cvm_virtual_cpu_p vcpu,noir_cvm_guest_memory_descriptor_p descriptors,u32 count);
 
 // Exception Handlers in Assembly
 void noir_divide_error_fault_handler_a(void);
@@ -18,6 +18,11 @@
 #include <intrin.h>
 #endif
 
+#ifdef _gcc
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
 #if defined(_msvc) || defined(_llvm)
 // bit-test instructions
 #define noir_bt		_bittest
@@ -41,6 +46,14 @@
 #define noir_bsr64	_BitScanReverse64
 #endif
 
+// Population-count and trailing-zero-count instructions
+// Note that tzcnt is executed as bsf on processors without BMI1, so the operand must not be zero.
+#define noir_popcnt		__popcnt
+#if defined(_amd64)
+#define noir_popcnt64	__popcnt64
+#define noir_tzcnt64	_tzcnt_u64
+#endif
+
 // Read Control Register instructions
 #define noir_readcr0	__readcr0
 #define noir_readcr2	__readcr2
@@ -146,6 +159,7 @@ void noir_outsd(u16 port,u32p buffer,size_t count,bool direction);
 #define noir_load_fence		_mm_lfence
 #define noir_store_fence	_mm_sfence
 #define noir_memory_fence	_mm_mfence
+#define noir_compiler_barrier	_ReadWriteBarrier
 
 // NOP instructions
 #define noir_nop		__nop
@@ -208,6 +222,230 @@ void noir_outsd(u16 port,u32p buffer,size_t count,bool direction);
 #define noir_rdvcpu64		__readfsqword
 #define noir_rdvcpuptr		__readfsqword
 #endif
+#elif defined(_gcc)
+// GCC does not offer the intrinsics that MSVC does.
+// Implement them with builtins and inline assembly.
+// Bit-test instructions operate on the bit string, so implement them in bytes.
+u8 inline noir_bt(const void* base,i32 bit)
+{
+	return (((const u8*)base)[bit>>3]>>(bit&7))&1;
+}
+
+u8 inline noir_bts(void* base,i32 bit)
+{
+	u8p p=(u8p)base+(bit>>3);
+	u8 r=(*p>>(bit&7))&1;
+	*p|=(u8)(1<<(bit&7));
+	return r;
+}
+
+u8 inline noir_btr(void* base,i32 bit)
+{
+	u8p p=(u8p)base+(bit>>3);
+	u8 r=(*p>>(bit&7))&1;
+	*p&=(u8)~(1<<(bit&7));
+	return r;
+}
+
+u8 inline noir_btc(void* base,i32 bit)
+{
+	u8p p=(u8p)base+(bit>>3);
+	u8 r=(*p>>(bit&7))&1;
+	*p^=(u8)(1<<(bit&7));
+	return r;
+}
+
+#define noir_bt64(b,i)		noir_bt(b,(i32)(i))
+#define noir_btc64(b,i)		noir_btc(b,(i32)(i))
+#define noir_btr64(b,i)		noir_btr(b,(i32)(i))
+#define noir_bts64(b,i)		noir_bts(b,(i32)(i))
+
+// bit-scan instructions
+u8 inline noir_bsf(u32p index,u32 mask)
+{
+	if(mask==0)return 0;
+	*index=(u32)__builtin_ctz(mask);
+	return 1;
+}
+
+u8 inline noir_bsr(u32p index,u32 mask)
+{
+	if(mask==0)return 0;
+	*index=31-(u32)__builtin_clz(mask);
+	return 1;
+}
+
+u8 inline noir_bsf64(u32p index,u64 mask)
+{
+	if(mask==0)return 0;
+	*index=(u32)__builtin_ctzll(mask);
+	return 1;
+}
+
+u8 inline noir_bsr64(u32p index,u64 mask)
+{
+	if(mask==0)return 0;
+	*index=63-(u32)__builtin_clzll(mask);
+	return 1;
+}
+
+// Population-count and trailing-zero-count instructions
+u32 inline noir_popcnt(u32 mask){return (u32)__builtin_popcount(mask);}
+u64 inline noir_popcnt64(u64 mask){return (u64)__builtin_popcountll(mask);}
+u64 inline noir_tzcnt64(u64 mask){return mask?(u64)__builtin_ctzll(mask):64;}
+
+// Control, Debug and Model-Specific Registers.
+// Note that these instructions are privileged.
+u64 inline noir_readcr0(void){u64 v;__asm__ __volatile__("mov %%cr0,%0":"=r"(v));return v;}
+u64 inline noir_readcr2(void){u64 v;__asm__ __volatile__("mov %%cr2,%0":"=r"(v));return v;}
+u64 inline noir_readcr3(void){u64 v;__asm__ __volatile__("mov %%cr3,%0":"=r"(v));return v;}
+u64 inline noir_readcr4(void){u64 v;__asm__ __volatile__("mov %%cr4,%0":"=r"(v));return v;}
+u64 inline noir_readcr8(void){u64 v;__asm__ __volatile__("mov %%cr8,%0":"=r"(v));return v;}
+void inline noir_writecr0(u64 v){__asm__ __volatile__("mov %0,%%cr0"::"r"(v):"memory");}
+void inline noir_writecr2(u64 v){__asm__ __volatile__("mov %0,%%cr2"::"r"(v):"memory");}
+void inline noir_writecr3(u64 v){__asm__ __volatile__("mov %0,%%cr3"::"r"(v):"memory");}
+void inline noir_writecr4(u64 v){__asm__ __volatile__("mov %0,%%cr4"::"r"(v):"memory");}
+void inline noir_writecr8(u64 v){__asm__ __volatile__("mov %0,%%cr8"::"r"(v):"memory");}
+
+#define noir_xsetbv		_xsetbv
+#define noir_xgetbv		_xgetbv
+
+#define noir_readdr(n)		({u64 v;__asm__ __volatile__("mov %%dr" #n ",%0":"=r"(v));v;})
+#define noir_writedr(n,x)	__asm__ __volatile__("mov %0,%%dr" #n::"r"((u64)(x)))
+#define noir_readdr0()		noir_readdr(0)
+#define noir_readdr1()		noir_readdr(1)
+#define noir_readdr2()		noir_readdr(2)
+#define noir_readdr3()		noir_readdr(3)
+#define noir_readdr6()		noir_readdr(6)
+#define noir_readdr7()		noir_readdr(7)
+#define noir_writedr0(x)	noir_writedr(0,x)
+#define noir_writedr1(x)	noir_writedr(1,x)
+#define noir_writedr2(x)	noir_writedr(2,x)
+#define noir_writedr3(x)	noir_writedr(3,x)
+#define noir_writedr6(x)	noir_writedr(6,x)
+#define noir_writedr7(x)	noir_writedr(7,x)
+
+u64 inline noir_rdmsr(u32 index)
+{
+	u32 a,d;
+	__asm__ __volatile__("rdmsr":"=a"(a),"=d"(d):"c"(index));
+	return ((u64)d<<32)|a;
+}
+
+void inline noir_wrmsr(u32 index,u64 value)
+{
+	__asm__ __volatile__("wrmsr"::"c"(index),"a"((u32)value),"d"((u32)(value>>32)));
+}
+
+// Read/Write Descriptor Tables
+#pragma pack(1)
+typedef struct _descriptor_register
+{
+	u16 limit;
+	ulong_ptr base;
+}descriptor_register,*descriptor_register_p;
+#pragma pack()
+
+#define noir_sidt(p)	__asm__ __volatile__("sidt %0":"=m"(*(descriptor_register_p)(p)))
+#define noir_lidt(p)	__asm__ __volatile__("lidt %0"::"m"(*(descriptor_register_p)(p)))
+void noir_sgdt(descriptor_register_p dest);
+void noir_lgdt(descriptor_register_p src);
+void noir_sldt(u16p dest);
+void noir_lldt(u16 src);
+void noir_str(u16p dest);
+void noir_ltr(u16 src);
+
+// Store-String instructions.
+void inline noir_stosb(void* d,u8 v,size_t n){__builtin_memset(d,v,n);}
+void inline noir_stosw(u16p d,u16 v,size_t n){for(size_t i=0;i<n;i++)d[i]=v;}
+void inline noir_stosd(u32p d,u32 v,size_t n){for(size_t i=0;i<n;i++)d[i]=v;}
+void inline noir_stosq(u64p d,u64 v,size_t n){for(size_t i=0;i<n;i++)d[i]=v;}
+#define noir_stosp		noir_stosq
+
+// Move-String instructions.
+void inline noir_movsb(void* d,const void* s,size_t n){__builtin_memcpy(d,s,n);}
+void inline noir_movsw(void* d,const void* s,size_t n){__builtin_memcpy(d,s,n<<1);}
+void inline noir_movsd(void* d,const void* s,size_t n){__builtin_memcpy(d,s,n<<2);}
+void inline noir_movsq(void* d,const void* s,size_t n){__builtin_memcpy(d,s,n<<3);}
+#define noir_movsp		noir_movsq
+
+// I/O instructions
+u8 inline noir_inb(u16 port){u8 v;__asm__ __volatile__("inb %1,%0":"=a"(v):"Nd"(port));return v;}
+u16 inline noir_inw(u16 port){u16 v;__asm__ __volatile__("inw %1,%0":"=a"(v):"Nd"(port));return v;}
+u32 inline noir_ind(u16 port){u32 v;__asm__ __volatile__("inl %1,%0":"=a"(v):"Nd"(port));return v;}
+void noir_insb(u16 port,u8p buffer,size_t count,bool direction);
+void noir_insw(u16 port,u16p buffer,size_t count,bool direction);
+void noir_insd(u16 port,u32p buffer,size_t count,bool direction);
+
+void inline noir_outb(u16 port,u8 v){__asm__ __volatile__("outb %0,%1"::"a"(v),"Nd"(port));}
+void inline noir_outw(u16 port,u16 v){__asm__ __volatile__("outw %0,%1"::"a"(v),"Nd"(port));}
+void inline noir_outd(u16 port,u32 v){__asm__ __volatile__("outl %0,%1"::"a"(v),"Nd"(port));}
+void noir_outsb(u16 port,u8p buffer,size_t count,bool direction);
+void noir_outsw(u16 port,u16p buffer,size_t count,bool direction);
+void noir_outsd(u16 port,u32p buffer,size_t count,bool direction);
+
+// Processor TSC instruction
+#define noir_rdtsc		__rdtsc
+#define noir_rdtscp		__rdtscp
+
+// Memory Barrier instructions.
+#define noir_load_fence		_mm_lfence
+#define noir_store_fence	_mm_sfence
+#define noir_memory_fence	_mm_mfence
+#define noir_compiler_barrier()	__asm__ __volatile__("":::"memory")
+
+// NOP instructions
+#define noir_nop()		__asm__ __volatile__("nop")
+#define noir_pause		_mm_pause
+
+// Invalidate TLBs
+#define noir_invlpg(p)	__asm__ __volatile__("invlpg (%0)"::"r"(p):"memory")
+
+// Clear/Set RFlags.IF
+#define noir_cli()		__asm__ __volatile__("cli")
+#define noir_sti()		__asm__ __volatile__("sti")
+
+// Debug-Break & Assertion
+#define noir_int3()		__asm__ __volatile__("int3")
+#define noir_assert(s)	if(!s)__asm__ __volatile__("int $0x2c")
+
+// Generate #UD exception
+#define noir_ud2		__builtin_trap
+
+// Invalidate Processor Cache
+#define noir_wbinvd()	__asm__ __volatile__("wbinvd":::"memory")
+
+// Atomic Operations
+// Keep the return-value semantics of MSVC's Interlocked intrinsics.
+#define noir_locked_add(a,b)			__atomic_add_fetch(a,b,__ATOMIC_SEQ_CST)
+#define noir_locked_inc(a)				__atomic_add_fetch(a,1,__ATOMIC_SEQ_CST)
+#define noir_locked_dec(a)				__atomic_sub_fetch(a,1,__ATOMIC_SEQ_CST)
+#define noir_locked_and(a,b)			__atomic_fetch_and(a,b,__ATOMIC_SEQ_CST)
+#define noir_locked_or(a,b)				__atomic_fetch_or(a,b,__ATOMIC_SEQ_CST)
+#define noir_locked_xor(a,b)			__atomic_fetch_xor(a,b,__ATOMIC_SEQ_CST)
+#define noir_locked_xchg(a,b)			__atomic_exchange_n(a,b,__ATOMIC_SEQ_CST)
+#define noir_locked_cmpxchg(a,e,c)		__sync_val_compare_and_swap(a,c,e)
+#define noir_locked_bts(a,b)			((__atomic_fetch_or((u8vp)(a)+((b)>>3),(u8)(1<<((b)&7)),__ATOMIC_SEQ_CST)>>((b)&7))&1)
+#define noir_locked_btr(a,b)			((__atomic_fetch_and((u8vp)(a)+((b)>>3),(u8)~(1<<((b)&7)),__ATOMIC_SEQ_CST)>>((b)&7))&1)
+
+// 64-Bit Atomic Operations
+#define noir_locked_add64		noir_locked_add
+#define noir_locked_inc64		noir_locked_inc
+#define noir_locked_dec64		noir_locked_dec
+#define noir_locked_and64		noir_locked_and
+#define noir_locked_or64		noir_locked_or
+#define noir_locked_xor64		noir_locked_xor
+#define noir_locked_xchg64		noir_locked_xchg
+#define noir_locked_cmpxchg64	noir_locked_cmpxchg
+#define noir_locked_bts64		noir_locked_bts
+#define noir_locked_btr64		noir_locked_btr
+
+// FS & GS Operations
+u8 inline noir_rdvcpu8(u64 offset){u8 v;__asm__ __volatile__("movb %%gs:(%1),%0":"=q"(v):"r"(offset));return v;}
+u16 inline noir_rdvcpu16(u64 offset){u16 v;__asm__ __volatile__("movw %%gs:(%1),%0":"=r"(v):"r"(offset));return v;}
+u32 inline noir_rdvcpu32(u64 offset){u32 v;__asm__ __volatile__("movl %%gs:(%1),%0":"=r"(v):"r"(offset));return v;}
+u64 inline noir_rdvcpu64(u64 offset){u64 v;__asm__ __volatile__("movq %%gs:(%1),%0":"=r"(v):"r"(offset));return v;}
+#define noir_rdvcpuptr		noir_rdvcpu64
 #endif
 
 // Optimization Intrinsics for Branch-Prediction
@@ -220,7 +458,7 @@ void noir_outsd(u16 port,u32p buffer,size_t count,bool direction);
 #define unlikely(x)		(x)
 #endif
 
-#if defined(_llvm)
+#if defined(_llvm) || defined(_gcc)
 #define strchr	__builtin_strchr
 #define strcmp	__builtin_strcmp
 #define strlen	__builtin_strlen
@@ -239,6 +477,8 @@ void inline noir_cpuid(u32 ia,u32 ic,u32* a,u32* b,u32* c,u32* d)
 	u32 info[4];
 #if defined(_msvc) || defined(_llvm)
 	__cpuidex((int*)info,ia,ic);
+#elif defined(_gcc)
+	__cpuid_count(ia,ic,info[0],info[1],info[2],info[3]);
 #endif
 	if(a)*a=info[0];
 	if(b)*b=info[1];
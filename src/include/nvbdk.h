@@ -143,6 +143,47 @@ typedef struct _avl_node
 	i64 height;
 }avl_node,*avl_node_p;
 
+// Bitmap with two-level summary. The summaries are indexed by qwords of the bitmap.
+typedef struct _noir_summary_bitmap
+{
+	u64p bitmap;
+	u64p full;			// The bit is set if the qword is all ones.
+	u64p nonempty;		// The bit is set if the qword is not zero.
+	u32 limit;
+	u32 words;
+}noir_summary_bitmap,*noir_summary_bitmap_p;
+
+// Pages are carved from chunks of physically-contiguous memory.
+#define noir_arena_chunk_pages		16
+// Arenas used in VM-exit context are topped up to this number of pages in passive context.
+#define noir_arena_reserve_pages	32
+
+typedef struct _noir_arena_chunk
+{
+	struct _noir_arena_chunk* next;
+	void* virt;
+	u64 phys;
+	u32 pages;
+}noir_arena_chunk,*noir_arena_chunk_p;
+
+// A free page keeps its link in the first bytes. The rest of the page is kept zeroed.
+typedef struct _noir_arena_page
+{
+	struct _noir_arena_page* next;
+	u64 phys;
+}noir_arena_page,*noir_arena_page_p;
+
+typedef struct _noir_page_arena
+{
+	noir_arena_chunk_p chunks;
+	noir_arena_page_p free_pages;
+	void** free_objects;
+	u32 object_size;
+	u32 free_page_count;
+	u32 pages_in_use;
+	u32 objects_in_use;
+}noir_page_arena,*noir_page_arena_p;
+
 // Processor Facility
 typedef struct _segment_register
 {
@@ -626,6 +667,18 @@ avl_node_p noir_search_avl_node(avl_node_p root,const void* item,noir_bst_search
 // Bitmap Facility
 u32 noir_find_clear_bit(void* bitmap,u32 limit);
 u32 noir_find_set_bit(void* bitmap,u32 limit);
+u32 noir_find_last_set_bit(void* bitmap,u32 limit);
+void noir_set_bitmap_range(void* bitmap,u32 start,u32 count);
+void noir_reset_bitmap_range(void* bitmap,u32 start,u32 count);
+u32 noir_count_set_bits(void* bitmap,u32 limit);
+bool noir_initialize_summary_bitmap(noir_summary_bitmap_p sb,u32 limit);
+void noir_finalize_summary_bitmap(noir_summary_bitmap_p sb);
+void noir_set_summary_bitmap(noir_summary_bitmap_p sb,u32 bit_position);
+void noir_reset_summary_bitmap(noir_summary_bitmap_p sb,u32 bit_position);
+void noir_set_summary_bitmap_range(noir_summary_bitmap_p sb,u32 start,u32 count);
+void noir_reset_summary_bitmap_range(noir_summary_bitmap_p sb,u32 start,u32 count);
+u32 noir_find_clear_summary_bit(noir_summary_bitmap_p sb);
+u32 noir_find_set_summary_bit(noir_summary_bitmap_p sb);
 
 // Memory-Mapped I/O Facility
 u8 noir_mmio_read8(u64 ptr);
@@ -674,6 +727,7 @@ u64 noir_get_current_process_cr3();
 void* noir_lock_pages(void* virt,size_t bytes,u64p phys);
 void noir_unlock_pages(void* locker);
 void noir_get_locked_range(void* locker,void** virt,u32p bytes);
+void noir_get_locked_pages(void* locker,u32 page_index,u32 pages,u64p phys);
 void* noir_map_physical_memory(u64 physical_address,size_t length);
 void* noir_map_uncached_memory(u64 physical_address,size_t length);
 void noir_unmap_physical_memory(void* virtual_address,size_t length);
@@ -682,6 +736,18 @@ bool noir_query_page_attributes(void* virtual_address,bool *valid,bool *locked,b
 void noir_copy_memory(void* dest,void* src,u32 cch);
 void noir_enum_physical_memory_ranges(noir_physical_range_callback callback_routine,void* context);
 
+// Page Arena Facility
+void noir_initialize_page_arena(noir_page_arena_p arena,u32 object_size);
+bool noir_reserve_page_arena(noir_page_arena_p arena,u32 pages);
+void* noir_arena_alloc_page(noir_page_arena_p arena,u64p phys);
+void* noir_arena_alloc_reserved_page(noir_page_arena_p arena,u64p phys);
+void noir_arena_free_page(noir_page_arena_p arena,void* virt,u64 phys);
+void* noir_arena_alloc_object(noir_page_arena_p arena);
+void* noir_arena_alloc_reserved_object(noir_page_arena_p arena);
+void noir_arena_free_object(noir_page_arena_p arena,void* object);
+void noir_finalize_page_arena(noir_page_arena_p arena);
+void noir_report_arena_counters();
+
 // String Facility
 i32 cdecl nv_snprintf(char* buffer,size_t limit,const char* format,...);
 
@@ -699,6 +765,20 @@ void cdecl nvd_printf_raw(const char* format,...);
 
 #define nvd_printf(fmt,...)		nvd_printf_fn(__FILE__,__LINE__,fmt,##__VA_ARGS__)
 
+// Trace Ring Facility
+// Records are formatted when they are drained. Up to 6 arguments are recorded as 64-bit raw values.
+// Do not pass pointers to transient strings, since they are dereferenced by the drainer.
+void cdecl nvd_tracef_fn(const char* src_file,const u32 src_ln,const char* format,const u32 argc,...);
+bool nvd_initialize_trace_rings();
+void nvd_finalize_trace_rings();
+u32 nvd_drain_trace_rings();
+u64 nvd_query_dropped_trace_records();
+
+#define nvd_trace_argc_expand(x)	x
+#define nvd_trace_argc_select(f,a1,a2,a3,a4,a5,a6,n,...)	n
+#define nvd_trace_argc(...)		nvd_trace_argc_expand(nvd_trace_argc_select(__VA_ARGS__,6,5,4,3,2,1,0))
+#define nvd_tracef(fmt,...)		nvd_tracef_fn(__FILE__,__LINE__,fmt,nvd_trace_argc(fmt,##__VA_ARGS__),##__VA_ARGS__)
+
 void cdecl nvd_panicf(const char* format,...);
 
 void noir_hbreak(void);
@@ -727,8 +807,10 @@ void noir_release_pushlock_exclusive(noir_pushlock *lock);
 
 // Crypto Facility
 typedef u32 (stdcall *noir_crc32_page_func)(void* page);
+typedef void (stdcall *noir_crc32_pages_func)(void** pages,u32p crc,u32 count);
 
 extern noir_crc32_page_func noir_crc32_page;
+extern noir_crc32_pages_func noir_crc32_pages;
 
 void noir_aes128_expand_key(u8p key,bool expand_encrypt,u8p expanded_keys);
 void noir_aes128_encrypt_pages(void* page_base,u8p expanded_keys,u64 pages,u8p key);
@@ -24,6 +24,20 @@ typedef signed __int8		i8;
 typedef signed __int16		i16;
 typedef signed __int32		i32;
 typedef signed __int64		i64;
+#elif defined(_gcc)
+#pragma once
+
+#include <stddef.h>
+
+typedef unsigned char		u8;
+typedef unsigned short		u16;
+typedef unsigned int		u32;
+typedef unsigned long long	u64;
+
+typedef signed char			i8;
+typedef signed short		i16;
+typedef signed int			i32;
+typedef signed long long	i64;
 #endif
 
 typedef u8*		u8p;
@@ -110,6 +124,29 @@ typedef enum
 #define noir_subhvt		__declspec(code_seg("subhvt"))
 #define noir_hvcode		__declspec(code_seg("hvtext"))
 #define noir_hvdata		__declspec(allocate("hvdata"))
+#elif defined(_gcc)
+typedef enum
+{
+	false=0,
+	true=1
+}bool;
+
+// Calling conventions are meaningless in System V AMD64 ABI.
+#define cdecl
+#define stdcall
+#define fastcall
+
+// Functions in headers are defined with inline keyword.
+// Make them static so that each translation unit owns a copy.
+#define inline			static __inline__
+#define always_inline	static __inline__ __attribute__((always_inline))
+
+#define align_at(n)		__attribute__((aligned(n)))
+
+// User-mode builds do not have to isolate hypervisor sections.
+#define noir_subhvt
+#define noir_hvcode
+#define noir_hvdata
 #endif
 
 #define null	(void*)0
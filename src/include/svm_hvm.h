@@ -40,8 +40,8 @@
 // Definition of vCPU APIC Global Status Bit Fields
 #define noir_svm_sipi_sent					0
 
-// Number of nested VMCBs to be cached.
-#define noir_svm_cached_nested_vmcb			16
+// Default number of nested VMCBs to be cached per vCPU.
+#define noir_svm_cached_nested_vmcb			64
 
 // Definitions of CVM CPUID maskings
 #define noir_svm_cpuid_cvmask0_ecx_fn0000_0001	0xE2D83209
@@ -53,6 +53,7 @@
 #define noir_svm_cpuid_cvmask0_edx_fn8000_0001	0xEFDFBB7F
 
 struct _noir_npt_manager;
+struct _noir_svm_shadow_npt_manager;
 
 typedef enum _noir_svm_consistency_check_failure_id
 {
@@ -78,6 +79,7 @@ typedef struct _noir_svm_hvm
 	memory_descriptor iopm;
 	memory_descriptor blank_page;
 	struct _noir_npt_manager* primary_nptm;
+	struct _noir_svm_snpt_registry* snpt_registry;
 #if !defined(_hv_type1)
 	struct _noir_npt_manager* secondary_nptm;
 #else
@@ -120,13 +122,52 @@ typedef struct _noir_svm_nested_vcpu_node
 		};
 		u64 value;
 	}flags;
+	// State groups that the nested guest may modify without VM-Exit.
+	// Other groups are not copied back to the nested hypervisor on VM-Exit.
+	union
+	{
+		struct
+		{
+			u32 crx:1;		// Includes cr0,cr3,cr4.
+			u32 dr7:1;
+			u32 dt:1;		// Includes gdtr,idtr.
+			u32 cr2:1;
+			u32 lbr:1;
+			u32 cet:1;		// Includes s_cet,ssp,isst.
+			u32 tr_ldtr:1;
+			u32 reserved:25;
+		};
+		u32 value;
+	}dirty;
+	// Cache List structure. The head is the most recently referenced node.
+	struct _noir_svm_nested_vcpu_node *cl_next;
+	struct _noir_svm_nested_vcpu_node *cl_prev;
+	// Hash chain of the bucket indexed by the nested VMCB GPA.
+	struct _noir_svm_nested_vcpu_node *hash_next;
+	struct _noir_svm_nested_vcpu_node **hash_pprev;
 }noir_svm_nested_vcpu_node,*noir_svm_nested_vcpu_node_p;
 
+typedef struct _noir_svm_nested_vcpu_cache_statistics
+{
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+}noir_svm_nested_vcpu_cache_statistics,*noir_svm_nested_vcpu_cache_statistics_p;
+
 typedef struct _noir_svm_nested_vcpu
 {
 	u64 hsave_gpa;
 	void* hsave_hva;
-	noir_svm_nested_vcpu_node node_pool[noir_svm_cached_nested_vmcb];
+	// Nested VMCBs are cached in a Cache List with a hash index.
+	noir_svm_nested_vcpu_node_p node_pool;
+	noir_svm_nested_vcpu_node_p *buckets;
+	noir_svm_nested_vcpu_node_p head;
+	noir_svm_nested_vcpu_node_p tail;
+	u32 capacity;
+	u32 bucket_shift;
+	noir_svm_nested_vcpu_cache_statistics statistics;
+	// Shadow NPT for nested guests whose hypervisor enables NPT.
+	struct _noir_svm_shadow_npt_manager* snpt;
 	struct
 	{
 		u64 svme:1;
@@ -179,6 +220,13 @@ typedef struct _noir_svm_vcpu
 	noir_svm_virtual_msr virtual_msr;
 	noir_svm_nested_vcpu nested_hvm;
 	noir_cvm_virtual_cpu cvm_state;
+	// ASIDs for CVM vCPUs are assigned per processor.
+	// When the ASIDs run out, a new generation starts with a TLB flush.
+	struct
+	{
+		u64 generation;
+		u32 next;
+	}cvm_asid;
 	union
 	{
 		struct
@@ -222,6 +270,7 @@ typedef struct _noir_svm_custom_npt_manager
 	{
 		struct _noir_npt_pdpte_descriptor *head;
 		struct _noir_npt_pdpte_descriptor *tail;
+		struct _noir_npt_pdpte_descriptor **index;	// Indexed by PML4E offset.
 	}pdpte;
 	struct
 	{
@@ -233,6 +282,8 @@ typedef struct _noir_svm_custom_npt_manager
 		struct _noir_npt_pte_descriptor *head;
 		struct _noir_npt_pte_descriptor *tail;
 	}pte;
+	// Paging structures, indices and descriptors are allocated from the arena.
+	noir_page_arena arena;
 }noir_svm_custom_npt_manager,*noir_svm_custom_npt_manager_p;
 
 // Some bits are host-owned. Therefore, Guest's bit must be saved accordingly.
@@ -274,6 +325,8 @@ typedef struct _noir_svm_custom_vcpu
 		u64 value;
 	}special_state;
 	u64 lasted_tsc;
+	u64 asid_generation;	// The ASID is valid only if the generation matches the processor's
+	u32 asid;
 	u32 proc_id;	// The physical processor id this vCPU was scheduled to
 	u32 vcpu_id;	// The virtual processor id of this vCPU
 }noir_svm_custom_vcpu,*noir_svm_custom_vcpu_p;
@@ -283,7 +336,7 @@ typedef struct _noir_svm_custom_vm
 	noir_cvm_virtual_machine header;
 	noir_svm_custom_vcpu_p* vcpu;
 	u32 vcpu_count;
-	u32 asid;
+	u32 asid;		// Identifies the NSV-Guest. TLB is tagged by vCPU's ASID.
 	memory_descriptor iopm;
 	memory_descriptor msrpm;
 	memory_descriptor msrpm_full;
@@ -356,12 +409,28 @@ bool nvc_svm_nsv_save_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu
 bool nvc_svm_nsv_load_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu);
 void nvc_svm_load_basic_exit_context(noir_svm_custom_vcpu_p vcpu);
 void nvc_svm_emulate_init_signal(noir_gpr_state_p gpr_state,void* vmcb,u32 cpuid_fms);
+noir_status nvc_svm_initialize_nested_vcpu_cache(noir_svm_nested_vcpu_p nvcpu,u32 capacity);
+void nvc_svm_finalize_nested_vcpu_cache(noir_svm_nested_vcpu_p nvcpu);
+noir_status nvc_svm_initialize_shadow_npt(noir_svm_vcpu_p vcpu);
+void nvc_svm_finalize_shadow_npt(noir_svm_vcpu_p vcpu);
+noir_status nvc_svm_initialize_snpt_registry(noir_svm_hvm_p relative_hvm,u32 cpu_count);
+void nvc_svm_finalize_snpt_registry(noir_svm_hvm_p relative_hvm);
+bool noir_hvcode nvc_svm_snpt_handle_l0_write(noir_svm_vcpu_p vcpu,u64 gpa);
+void noir_hvcode nvc_svm_snpt_acknowledge_flush(noir_svm_vcpu_p vcpu);
 noir_svm_nested_vcpu_node_p nvc_svm_get_nested_vcpu_node(noir_svm_nested_vcpu_p nvcpu,u64 vmcb);
 void noir_hvcode nvc_svm_switch_to_nested_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu_node);
 void noir_hvcode nvc_svm_switch_from_nested_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu);
 void noir_hvcode nvc_svm_clear_nested_gif(noir_svm_vcpu_p vcpu);
 void noir_hvcode nvc_svm_set_nested_gif(noir_svm_vcpu_p vcpu);
 bool nvc_svmc_get_physical_mapping(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64p hpa,bool r,bool w,bool x);
+u32 nvc_svmc_get_page_map_size(noir_svm_custom_npt_manager_p npt_manager,u64 gpa);
+noir_status nvc_svmc_set_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib);
+noir_status nvc_svmc_harvest_gpa_accessing_bits(noir_svm_custom_npt_manager_p nptm,u64 gpa_start,u32 page_count,void* bitmap,bool clear);
+void nvc_svmc_release_detached_tables(noir_svm_custom_npt_manager_p nptm);
+noir_status nvc_svmc_reserve_npt_tables(noir_svm_custom_npt_manager_p nptm,u32 pages);
+u32 nvc_svmc_promote_page_maps(noir_svm_custom_npt_manager_p nptm);
+noir_status nvc_svmc_initialize_npt_manager(noir_svm_custom_npt_manager_p nptm);
+void nvc_svmc_finalize_npt_manager(noir_svm_custom_npt_manager_p nptm);
 void nvc_npt_reassign_page_ownership_hvrt(noir_svm_vcpu_p vcpu,noir_rmt_remap_context_p context);
 bool nvc_npt_reassign_page_ownership(u64p hpa,u64p gpa,u32 pages,u32 asid,bool shared,u8 ownership);
 bool nvc_npt_reassign_cvm_all_pages_ownership(noir_svm_custom_vm_p vm,u32 asid,bool shared,u8 ownership);
@@ -186,6 +186,8 @@ typedef struct _noir_vt_custom_ept_manager
 		struct _noir_ept_pte_descriptor *head;
 		struct _noir_ept_pte_descriptor *tail;
 	}pte;
+	// Paging structures and descriptors are allocated from the arena.
+	noir_page_arena arena;
 }noir_vt_custom_ept_manager,*noir_vt_custom_ept_manager_p;
 
 // Virtual Processor defined for Customizable VM.
@@ -92,15 +92,52 @@ void noir_hvcode nvc_svm_switch_to_host_vcpu(noir_gpr_state_p gpr_state,noir_svm
 	// The context will go to the host when vmrun is executed.
 }
 
+/*
+  ASID Generations:
+
+  Like KVM, ASIDs for CVM vCPUs are assigned per processor on demand, so that
+  the number of CVMs is not limited by the number of ASIDs. Within a generation,
+  an ASID is assigned to one vCPU at most. Therefore, a vCPU keeps its TLB entries
+  as long as it stays on the same processor during the same generation.
+  When the processor runs out of ASIDs, a new generation starts and the entire
+  TLB is flushed once, so that all ASIDs could be assigned again.
+*/
+void static noir_hvcode nvc_svm_assign_cvcpu_asid(noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
+{
+	u8 tlb_ctrl=nvc_svm_tlb_control_do_nothing;
+	if(vcpu->cvm_asid.next<hvm_p->tlb_tagging.start || vcpu->cvm_asid.next>=hvm_p->tlb_tagging.start+hvm_p->tlb_tagging.limit)
+	{
+		vcpu->cvm_asid.generation++;
+		vcpu->cvm_asid.next=hvm_p->tlb_tagging.start;
+		tlb_ctrl=nvc_svm_tlb_control_flush_entire;
+	}
+	cvcpu->asid=vcpu->cvm_asid.next++;
+	cvcpu->asid_generation=vcpu->cvm_asid.generation;
+	noir_svm_vmwrite32(cvcpu->vmcb.virt,guest_asid,cvcpu->asid);
+	// The new ASID does not have stale TLB entries. Any pending flushes are unnecessary.
+	noir_svm_vmwrite8(cvcpu->vmcb.virt,tlb_control,tlb_ctrl);
+	noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_asid);
+}
+
+// If Flush-by-ASID is unsupported, assigning a new ASID avoids flushing the entire TLB.
+void static noir_hvcode nvc_svm_flush_cvcpu_tlb(noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
+{
+	if(vcpu->enabled_feature & noir_svm_flush_by_asid)
+		noir_svm_vmwrite8(cvcpu->vmcb.virt,tlb_control,nvc_svm_tlb_control_flush_guest);
+	else
+		cvcpu->asid_generation=0;
+}
+
 void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
 {
 	noir_svm_initial_stack_p loader_stack=noir_svm_get_loader_stack(vcpu->hv_stack);
-	bool asid_updated=false;
 	// IMPORTANT: If vCPU is scheduled to a different processor, resetting the VMCB cache state is required.
 	if(cvcpu->proc_id!=loader_stack->proc_id)
 	{
 		cvcpu->proc_id=loader_stack->proc_id;
 		noir_svm_vmwrite32(cvcpu->vmcb.virt,vmcb_clean_bits,0);
+		// The ASID assigned by the previous processor is invalid on this processor.
+		cvcpu->asid_generation=0;
 	}
 	// Step 1: Save State of the Subverted Host.
 	// Please note that it is unnecessary to save states which are already saved in VMCB.
@@ -133,6 +170,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_rip,cvcpu->header.rip);
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_rflags,cvcpu->header.rflags);
 			cvcpu->header.state_cache.gprvalid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_gpr]++;
 		}
 		// Load x87 FPU and SSE State...
 		noir_xrestore(cvcpu->header.xsave_area,maxu64);
@@ -149,6 +187,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_dr7,cvcpu->header.drs.dr7);
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_debug_reg);
 			cvcpu->header.state_cache.dr_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_dr]++;
 		}
 		// Load Control Registers...
 		if(!cvcpu->header.state_cache.cr_valid)
@@ -158,20 +197,23 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_cr4,cvcpu->header.crs.cr4);
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_control_reg);
 			cvcpu->header.state_cache.cr_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_cr]++;
 			// Changes made to control registers can cause TLBs to be invalid.
-			noir_svm_vmwrite8(cvcpu->vmcb.virt,tlb_control,nvc_svm_tlb_control_flush_guest);
+			nvc_svm_flush_cvcpu_tlb(vcpu,cvcpu);
 		}
 		if(!cvcpu->header.state_cache.cr2valid)
 		{
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_cr2,cvcpu->header.crs.cr2);
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_cr2);
 			cvcpu->header.state_cache.cr2valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_cr2]++;
 		}
 		if(!cvcpu->header.state_cache.tp_valid)
 		{
 			noir_svm_vmwrite8(cvcpu->vmcb.virt,avic_control,(u8)cvcpu->header.crs.cr8&0xf);
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_tpr);
 			cvcpu->header.state_cache.tp_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_tp]++;
 		}
 		// Load Segment Registers...
 		if(!cvcpu->header.state_cache.sr_valid)
@@ -199,6 +241,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			// Mark the VMCB cache invalid.
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_segment_reg);
 			cvcpu->header.state_cache.sr_valid=true;	// Cache is refreshed. Mark it valid.
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_sr]++;
 		}
 		if(!cvcpu->header.state_cache.fg_valid)
 		{
@@ -218,6 +261,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_kernel_gs_base,cvcpu->header.msrs.gsswap);
 			// No need to invalidate VMCB. The vmload instruction will load them.
 			cvcpu->header.state_cache.fg_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_fg]++;
 		}
 		// Load Descriptor Tables...
 		if(!cvcpu->header.state_cache.lt_valid)
@@ -236,6 +280,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_ldtr_base,cvcpu->header.seg.ldtr.base);
 			// No need to invalidate VMCB. The vmload instruction will load them.
 			cvcpu->header.state_cache.lt_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_lt]++;
 		}
 		if(!cvcpu->header.state_cache.dt_valid)
 		{
@@ -248,6 +293,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			// Mark the VMCB cache invalid.
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_idt_gdt);
 			cvcpu->header.state_cache.dt_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_dt]++;
 		}
 		// Load EFER MSR
 		if(!cvcpu->header.state_cache.ef_valid)
@@ -257,12 +303,13 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			cvcpu->shadowed_bits.svme=noir_bt((u32*)&cvcpu->header.msrs.efer,amd64_efer_svme);
 			// Changes made to EFER can cause TLBs to be invalid.
 			if((noir_svm_vmread64(cvcpu->vmcb.virt,guest_efer)&efer_tlb_mask)!=(cvcpu->header.msrs.efer&efer_tlb_mask))
-				noir_svm_vmwrite8(cvcpu->vmcb.virt,tlb_control,nvc_svm_tlb_control_flush_guest);
+				nvc_svm_flush_cvcpu_tlb(vcpu,cvcpu);
 			// Always enable EFER.SVME.
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_efer,cvcpu->header.msrs.efer|amd64_efer_svme_bit);
 			// Writing to EFER causes cached copy of control registers in VMCB to be invalid.
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_control_reg);
 			cvcpu->header.state_cache.ef_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_ef]++;
 		}
 		// Load PAT MSR
 		if(!cvcpu->header.state_cache.pa_valid)
@@ -271,6 +318,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			// Mark the VMCB cache invalid.
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_npt);
 			cvcpu->header.state_cache.pa_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_pa]++;
 		}
 		// Load MSRs for System Call (sysenter/sysexit)
 		if(!cvcpu->header.state_cache.se_valid)
@@ -280,6 +328,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_sysenter_eip,cvcpu->header.msrs.sysenter_eip);
 			// No need to invalidate VMCB. The vmload instruction will load them.
 			cvcpu->header.state_cache.se_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_se]++;
 		}
 		// Load MSRs for System Call (syscall/sysret)
 		if(!cvcpu->header.state_cache.sc_valid)
@@ -290,6 +339,20 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_sfmask,cvcpu->header.msrs.sfmask);
 			// No need to invalidate VMCB. The vmload instruction will load them.
 			cvcpu->header.state_cache.sc_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_sc]++;
+		}
+		// Load MSRs for Last Branch Record
+		if(!cvcpu->header.state_cache.lb_valid)
+		{
+			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_debug_ctrl,cvcpu->header.msrs.debug_ctrl);
+			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_last_branch_from,cvcpu->header.msrs.last_branch_from_ip);
+			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_last_branch_to,cvcpu->header.msrs.last_branch_to_ip);
+			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_last_exception_from,cvcpu->header.msrs.last_exception_from_ip);
+			noir_svm_vmwrite64(cvcpu->vmcb.virt,guest_last_exception_to,cvcpu->header.msrs.last_exception_to_ip);
+			// Mark the VMCB cache invalid.
+			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_lbr);
+			cvcpu->header.state_cache.lb_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_lb]++;
 		}
 		// Load the TSC offset.
 		if(!cvcpu->header.state_cache.ts_valid)
@@ -298,6 +361,7 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 			// Writing to TSC Offset causes the interception controls in VMCB to be invalid.
 			noir_svm_vmcb_btr32(cvcpu->vmcb.virt,vmcb_clean_bits,noir_svm_clean_interception);
 			cvcpu->header.state_cache.ts_valid=true;
+			cvcpu->header.statistics.state_reloads[noir_cvm_state_cache_ts]++;
 		}
 		cvcpu->special_state.switch_success=true;
 	}
@@ -335,9 +399,11 @@ void noir_hvcode nvc_svm_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_sv
 	// Flush TLB if the NPT is updated.
 	if(!cvcpu->header.state_cache.tl_valid)
 	{
-		noir_svm_vmwrite8(cvcpu->vmcb.virt,tlb_control,nvc_svm_tlb_control_flush_guest);
+		nvc_svm_flush_cvcpu_tlb(vcpu,cvcpu);
 		cvcpu->header.state_cache.tl_valid=true;
 	}
+	// Assign a new ASID if the vCPU has migrated or the generation has changed.
+	if(cvcpu->asid_generation!=vcpu->cvm_asid.generation)nvc_svm_assign_cvcpu_asid(vcpu,cvcpu);
 	// If AVIC is supported, set the Physical APIC ID Entry to be running.
 	if(noir_bt(&hvm_p->relative_hvm->virt_cap.capabilities,amd64_cpuid_avic))
 	{
@@ -415,31 +481,33 @@ void noir_hvcode nvc_svm_dump_guest_vcpu_state(noir_svm_custom_vcpu_p vcpu)
 	void* vmcb=vcpu->vmcb.virt;
 	// If the state is marked invalid, do not dump from VMCB in that
 	// the state is changed by layered hypervisor.
-	if(vcpu->header.state_cache.cr_valid)
+	// Groups not requested by the layered hypervisor are deferred.
+	const u32 groups=vcpu->header.state_cache.value&vcpu->header.sync_groups;
+	if(noir_bt(&groups,noir_cvm_state_cache_cr))
 	{
 		vcpu->header.crs.cr0=noir_svm_vmread64(vmcb,guest_cr0);
 		vcpu->header.crs.cr3=noir_svm_vmread64(vmcb,guest_cr3);
 		vcpu->header.crs.cr4=noir_svm_vmread64(vmcb,guest_cr4);
 	}
-	if(vcpu->header.state_cache.cr2valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_cr2))
 		vcpu->header.crs.cr2=noir_svm_vmread64(vmcb,guest_cr2);
-	if(vcpu->header.state_cache.dr_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_dr))
 	{
 		vcpu->header.drs.dr6=noir_svm_vmread64(vmcb,guest_dr6);
 		vcpu->header.drs.dr7=noir_svm_vmread64(vmcb,guest_dr7);
 	}
-	if(vcpu->header.state_cache.sr_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_sr))
 		nvc_svm_dump_guest_segments(&vcpu->header,vmcb);
-	if(vcpu->header.state_cache.fg_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_fg))
 		nvc_svm_dump_guest_fs_gs(&vcpu->header,vmcb);
-	if(vcpu->header.state_cache.dt_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_dt))
 	{
 		vcpu->header.seg.gdtr.limit=noir_svm_vmread32(vmcb,guest_gdtr_limit);
 		vcpu->header.seg.idtr.limit=noir_svm_vmread32(vmcb,guest_idtr_limit);
 		vcpu->header.seg.gdtr.base=noir_svm_vmread64(vmcb,guest_gdtr_base);
 		vcpu->header.seg.idtr.base=noir_svm_vmread64(vmcb,guest_idtr_base);
 	}
-	if(vcpu->header.state_cache.lt_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_lt))
 	{
 		vcpu->header.seg.ldtr.selector=noir_svm_vmread16(vmcb,guest_ldtr_selector);
 		vcpu->header.seg.ldtr.attrib=svm_attrib_inverse(noir_svm_vmread16(vmcb,guest_ldtr_attrib));
@@ -450,31 +518,31 @@ void noir_hvcode nvc_svm_dump_guest_vcpu_state(noir_svm_custom_vcpu_p vcpu)
 		vcpu->header.seg.tr.limit=noir_svm_vmread32(vmcb,guest_tr_limit);
 		vcpu->header.seg.tr.base=noir_svm_vmread64(vmcb,guest_tr_base);
 	}
-	if(vcpu->header.state_cache.sc_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_sc))
 	{
 		vcpu->header.msrs.star=noir_svm_vmread64(vmcb,guest_star);
 		vcpu->header.msrs.lstar=noir_svm_vmread64(vmcb,guest_lstar);
 		vcpu->header.msrs.cstar=noir_svm_vmread64(vmcb,guest_cstar);
 		vcpu->header.msrs.sfmask=noir_svm_vmread64(vmcb,guest_sfmask);
 	}
-	if(vcpu->header.state_cache.se_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_se))
 	{
 		vcpu->header.msrs.sysenter_cs=noir_svm_vmread64(vmcb,guest_sysenter_cs);
 		vcpu->header.msrs.sysenter_esp=noir_svm_vmread64(vmcb,guest_sysenter_esp);
 		vcpu->header.msrs.sysenter_eip=noir_svm_vmread64(vmcb,guest_sysenter_eip);
 	}
-	if(vcpu->header.state_cache.tp_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_tp))
 		vcpu->header.crs.cr8=noir_svm_vmread8(vmcb,avic_control)&0xf;
-	if(vcpu->header.state_cache.ef_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_ef))
 	{
 		vcpu->header.msrs.efer=noir_svm_vmread64(vmcb,guest_efer);
 		// Shadow the SVME bit.
 		if(!vcpu->shadowed_bits.svme)noir_btr((u32*)&vcpu->header.msrs.efer,amd64_efer_svme);
 	}
-	if(vcpu->header.state_cache.pa_valid)
+	if(noir_bt(&groups,noir_cvm_state_cache_pa))
 		vcpu->header.msrs.pat=noir_svm_vmread64(vmcb,guest_pat);
 	// Tell the layered hypervisor that the vCPU state is already synchronized.
-	vcpu->header.state_cache.synchronized=1;
+	if(vcpu->header.sync_groups==0xffffffff)vcpu->header.state_cache.synchronized=1;
 }
 
 void noir_hvcode nvc_svm_initialize_cvm_vmcb(noir_svm_custom_vcpu_p vcpu)
@@ -528,10 +596,9 @@ void noir_hvcode nvc_svm_initialize_cvm_vmcb(noir_svm_custom_vcpu_p vcpu)
 	vector2.intercept_clgi=1;
 	vector2.intercept_skinit=1;
 	noir_svm_vmwrite16(vmcb,intercept_instruction2,vector2.value);
-	// Initialize TLB: Flushing TLB & Setting ASID.
-	// Flush all TLBs associated with this ASID before running it.
-	noir_svm_vmwrite32(vmcb,guest_asid,vcpu->vm->asid);
-	noir_svm_vmwrite8(vmcb,tlb_control,nvc_svm_tlb_control_flush_guest);
+	// Initialize TLB: ASID is assigned when the vCPU is scheduled to a processor.
+	// There is no need to flush TLB here because the assigned ASID is always fresh.
+	vcpu->asid_generation=0;
 	// Initialize Interrupt Control.
 	avic_ctrl.value=0;
 	// Virtual interrupt masking must be enabled. Otherwise, the vCPU might block the host forever.
@@ -665,6 +732,8 @@ noir_status nvc_svmc_run_vcpu(noir_svm_custom_vcpu_p vcpu)
 							// VMCB pages must be reassigned in order to (un)protect their state.
 							nvc_npt_reassign_page_ownership(pa_list,pa_list,vcpu->vm->vcpu_count,0,false,vcpu->vm->header.properties.nsv_guest?noir_nsv_rmt_secure_guest:noir_nsv_rmt_insecure_guest);
 							noir_free_nonpg_memory(pa_list);
+							// Flush the software TLBs of all vCPUs.
+							noir_locked_inc(&vcpu->vm->header.gva_tlb_generation);
 						}
 						nvc_svmc_free_exclusion(vcpu);
 					}
@@ -695,6 +764,7 @@ noir_status nvc_svmc_run_vcpu(noir_svm_custom_vcpu_p vcpu)
 							}
 							// Perform reassignment.
 							nvc_npt_reassign_page_ownership(hpa_list,gpa_list,pages,vcpu->vm->asid,vcpu->header.exit_context.claim_pages.claim==false,ownership);
+							noir_locked_inc(&vcpu->vm->header.gva_tlb_generation);
 							nvc_svmc_free_exclusion(vcpu);
 							nv_dprintf("NSV-VM 0x%p has claimed security of GPA range 0x%llX-0x%llX!\n",vcpu->vm,vcpu->header.nsvs.claim_gpa_start,vcpu->header.nsvs.claim_gpa_end);
 						}
@@ -731,141 +801,98 @@ u64 nvc_svmc_get_vcpu_npt_base(noir_cvm_virtual_cpu_p vcpu)
 	return cvcpu->vm->nptm.ncr3.phys;
 }
 
-void nvc_svm_init_vcpu_cpuid_quickpath(noir_svm_custom_vcpu_p vcpu)
+void nvc_svm_init_vcpu_cpuid_overrides(noir_svm_custom_vcpu_p vcpu)
 {
+	noir_cvm_cpuid_entry entries[noir_cvm_cpuid_override_limit]={0};
 	u32 a,b,c,d;
 	u32 i=0;
 	// Standard Leaf 1 - Processor and Processor Feature Identifiers.
 	noir_cpuid(amd64_cpuid_std_proc_feature,0,&a,&b,&c,&d);
-	vcpu->header.cpuid_quickpath[i].leaf=amd64_cpuid_std_proc_feature;
-	vcpu->header.cpuid_quickpath[i].subleaf=0;
-	vcpu->header.cpuid_quickpath[i].options.value=0;
-	vcpu->header.cpuid_quickpath[i].options.active=true;
+	entries[i].leaf=amd64_cpuid_std_proc_feature;
 	// Family, Model, Stepping.
-	vcpu->header.cpuid_quickpath[i].eax=a;
+	entries[i].eax=a;
 	// Local APIC ID
-	vcpu->header.cpuid_quickpath[i].ebx=b&0xFFFF;		// Retain clflush and Brand ID info.
-	vcpu->header.cpuid_quickpath[i].ebx|=(vcpu->vcpu_id<<24)&0xff;
-	vcpu->header.cpuid_quickpath[i].ebx|=(vcpu->vm->vcpu_count<<16)&0xff;
+	entries[i].ebx=b&0xFFFF;		// Retain clflush and Brand ID info.
+	entries[i].ebx|=(vcpu->vcpu_id&0xff)<<24;
+	entries[i].ebx|=(vcpu->vm->vcpu_count&0xff)<<16;
 	// Feature Identifier
-	vcpu->header.cpuid_quickpath[i].ecx=c&noir_svm_cpuid_cvmask0_ecx_fn0000_0001|noir_svm_cpuid_cvmask1_ecx_fn0000_0001;
-	vcpu->header.cpuid_quickpath[i++].edx=d&noir_svm_cpuid_cvmask0_ecx_fn0000_0001;
+	entries[i].ecx=(c&noir_svm_cpuid_cvmask0_ecx_fn0000_0001)|noir_svm_cpuid_cvmask1_ecx_fn0000_0001;
+	entries[i++].edx=d&noir_svm_cpuid_cvmask0_edx_fn0000_0001;
 	// Standard Leaf D - Processor Extended State Enumeration (Subleaf 0)
-	noir_cpuid(amd64_cpuid_std_pestate_enum,0,&a,&b,&c,&d);
-	vcpu->header.cpuid_quickpath[i].leaf=amd64_cpuid_std_pestate_enum;
-	vcpu->header.cpuid_quickpath[i].subleaf=0;
-	vcpu->header.cpuid_quickpath[i].options.value=0;
-	vcpu->header.cpuid_quickpath[i].options.active=true;
-	vcpu->header.cpuid_quickpath[i].options.has_subleaf=true;
-	vcpu->header.cpuid_quickpath[i].eax=3;		// Allow FPU and SSE.
-	vcpu->header.cpuid_quickpath[i].ebx=vcpu->header.cpuid_quickpath[i].ecx=sizeof(noir_fx_state);
-	vcpu->header.cpuid_quickpath[i].edx=0;		// No higher bits in mask.
+	entries[i].leaf=amd64_cpuid_std_pestate_enum;
+	entries[i].subleaf=0;
+	entries[i].options.has_subleaf=true;
+	entries[i].eax=3;		// Allow FPU and SSE.
+	entries[i].ebx=entries[i].ecx=sizeof(noir_fx_state);
+	entries[i++].edx=0;		// No higher bits in mask.
 	// Extended Leaf 8000_0002-8000_0004 Extended Processor Name String
 	// Note that this is changeable by MSRs (0xC001_0030-0xC0010035), so keep it per-vCPU.
-	vcpu->header.cpuid_quickpath[++i].leaf=amd64_cpuid_ext_brand_str_p1;
-	vcpu->header.cpuid_quickpath[i].subleaf=0;
-	vcpu->header.cpuid_quickpath[i].options.value=0;
-	vcpu->header.cpuid_quickpath[i].options.active=true;
-	noir_cpuid(amd64_cpuid_ext_brand_str_p1,0,&vcpu->header.cpuid_quickpath[i].eax,&vcpu->header.cpuid_quickpath[i].ebx,&vcpu->header.cpuid_quickpath[i].ecx,&vcpu->header.cpuid_quickpath[i].edx);
-	vcpu->header.cpuid_quickpath[++i].leaf=amd64_cpuid_ext_brand_str_p2;
-	vcpu->header.cpuid_quickpath[i].subleaf=0;
-	vcpu->header.cpuid_quickpath[i].options.value=0;
-	vcpu->header.cpuid_quickpath[i].options.active=true;
-	noir_cpuid(amd64_cpuid_ext_brand_str_p2,0,&vcpu->header.cpuid_quickpath[i].eax,&vcpu->header.cpuid_quickpath[i].ebx,&vcpu->header.cpuid_quickpath[i].ecx,&vcpu->header.cpuid_quickpath[i].edx);
-	vcpu->header.cpuid_quickpath[++i].leaf=amd64_cpuid_ext_brand_str_p3;
-	vcpu->header.cpuid_quickpath[i].subleaf=0;
-	vcpu->header.cpuid_quickpath[i].options.value=0;
-	vcpu->header.cpuid_quickpath[i].options.active=true;
-	noir_cpuid(amd64_cpuid_ext_brand_str_p3,0,&vcpu->header.cpuid_quickpath[i].eax,&vcpu->header.cpuid_quickpath[i].ebx,&vcpu->header.cpuid_quickpath[i].ecx,&vcpu->header.cpuid_quickpath[i].edx);
-	i++;
+	for(u32 j=amd64_cpuid_ext_brand_str_p1;j<=amd64_cpuid_ext_brand_str_p3;j++)
+	{
+		entries[i].leaf=j;
+		noir_cpuid(j,0,&entries[i].eax,&entries[i].ebx,&entries[i].ecx,&entries[i].edx);
+		i++;
+	}
+	for(u32 j=0;j<i;j++)entries[j].options.builtin=true;
+	nvc_build_cpuid_overrides(&vcpu->header,entries,i);
 }
 
-void nvc_svm_init_vm_cpuid_quickpath(noir_svm_custom_vm_p vm)
+bool nvc_svm_init_vm_cpuid_model(noir_svm_custom_vm_p vm)
 {
+	noir_cvm_cpuid_entry entries[8]={0};
 	u32 a,b,c,d;
 	u32 i=0;
 	// Standard Leaf 0 - Maximum Standard Leaf Number and Vendor String.
 	noir_cpuid(amd64_cpuid_std_max_num_vstr,0,null,&b,&c,&d);
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_std_max_num_vstr;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=0xD;	// Maximum leaf is 0xD - Processor Extended State Enumeration.
-	vm->header.cpuid_quickpath[i].ebx=b;
-	vm->header.cpuid_quickpath[i].ecx=c;
-	vm->header.cpuid_quickpath[i++].edx=d;
+	entries[i].leaf=amd64_cpuid_std_max_num_vstr;
+	entries[i].eax=0xD;	// Maximum leaf is 0xD - Processor Extended State Enumeration.
+	entries[i].ebx=b;
+	entries[i].ecx=c;
+	entries[i++].edx=d;
 	// Standard Leaf 7 - Structured Extended Feature Identifiers
-	noir_cpuid(amd64_cpuid_std_struct_extid,0,&a,&b,&c,&d);
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_std_struct_extid;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.has_subleaf=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=0;	// No supported subfunctions from NoirVisor.
-	vm->header.cpuid_quickpath[i].ebx=b&noir_svm_cpuid_cvmask0_ebx_fn0000_0007;
-	vm->header.cpuid_quickpath[i].ecx=c&noir_svm_cpuid_cvmask0_ecx_fn0000_0007;
-	vm->header.cpuid_quickpath[i++].edx=0;	// Reserved by AMD.
-	// Standard Leaf 7 - Structured Extended Feature Identifiers (Subleaf 1)
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_std_pestate_enum;
-	vm->header.cpuid_quickpath[i].subleaf=1;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.has_subleaf=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=0;		// No support to xsaves, xgetbv, xsavec, xsaveopt...
-	vm->header.cpuid_quickpath[i].ebx=0x240;	// Fix to 0x240. No AVX support yet.
-	vm->header.cpuid_quickpath[i].ecx=0;		// No CET support yet...
-	vm->header.cpuid_quickpath[i++].edx=0;		// Reserved by AMD...
-	// Extended Leaf 8000_0000 - Maximum Extended Leaf Number and Vendor String.
+	noir_cpuid(amd64_cpuid_std_struct_extid,0,null,&b,&c,null);
+	entries[i].leaf=amd64_cpuid_std_struct_extid;
+	entries[i].subleaf=0;
+	entries[i].options.has_subleaf=true;
+	entries[i].eax=0;	// No supported subfunctions from NoirVisor.
+	entries[i].ebx=b&noir_svm_cpuid_cvmask0_ebx_fn0000_0007;
+	entries[i].ecx=c&noir_svm_cpuid_cvmask0_ecx_fn0000_0007;
+	entries[i++].edx=0;	// Reserved by AMD.
+	// Standard Leaf D - Processor Extended State Enumeration (Subleaf 1)
+	entries[i].leaf=amd64_cpuid_std_pestate_enum;
+	entries[i].subleaf=1;
+	entries[i].options.has_subleaf=true;
+	entries[i].eax=0;		// No support to xsaves, xgetbv, xsavec, xsaveopt...
+	entries[i].ebx=0x240;	// Fix to 0x240. No AVX support yet.
+	entries[i].ecx=0;		// No CET support yet...
+	entries[i++].edx=0;		// Reserved by AMD...
+	// Extended Leaf 8000_0000 - Maximum Extended Leaf Number and Vendor String
 	noir_cpuid(amd64_cpuid_ext_max_num_vstr,0,null,&b,&c,&d);
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_ext_max_num_vstr;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=amd64_cpuid_ext_pcap_prm_eid;	// Maximum leaf is 0x8000_0008
-	vm->header.cpuid_quickpath[i].ebx=b;
-	vm->header.cpuid_quickpath[i].ecx=c;
-	vm->header.cpuid_quickpath[i++].edx=d;
+	entries[i].leaf=amd64_cpuid_ext_max_num_vstr;
+	entries[i].eax=amd64_cpuid_ext_pcap_prm_eid;	// Maximum leaf is 0x8000_0008
+	entries[i].ebx=b;
+	entries[i].ecx=c;
+	entries[i++].edx=d;
 	// Extended Leaf 8000_0001 - Extended Processor and Processor Feature Identifiers
 	noir_cpuid(amd64_cpuid_ext_proc_feature,0,&a,&b,&c,&d);
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_ext_proc_feature;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=a;
-	vm->header.cpuid_quickpath[i].ebx=b;
-	vm->header.cpuid_quickpath[i].ecx=c&noir_svm_cpuid_cvmask0_ecx_fn8000_0001;
-	vm->header.cpuid_quickpath[i++].edx=d&noir_svm_cpuid_cvmask0_edx_fn8000_0001;
+	entries[i].leaf=amd64_cpuid_ext_proc_feature;
+	entries[i].eax=a;
+	entries[i].ebx=b;
+	entries[i].ecx=c&noir_svm_cpuid_cvmask0_ecx_fn8000_0001;
+	entries[i++].edx=d&noir_svm_cpuid_cvmask0_edx_fn8000_0001;
 	// Extended Leaf 8000_0008 - Processor Capacity Parameters and Extended Feature Identification
-	vm->header.cpuid_quickpath[i].leaf=amd64_cpuid_ext_pcap_prm_eid;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=0x3030;	// 48-bit physical/linear addresses.
-	vm->header.cpuid_quickpath[i].ebx=0;
-	vm->header.cpuid_quickpath[i].ecx=0;
-	vm->header.cpuid_quickpath[i++].edx=0;
+	entries[i].leaf=amd64_cpuid_ext_pcap_prm_eid;
+	entries[i++].eax=0x3030;	// 48-bit physical/linear addresses.
 	// Hypervisor Leaf 4000_0000 - Hypervisor Leaf Number and Vendor String
-	vm->header.cpuid_quickpath[i].leaf=ncvm_cpuid_leaf_range_and_vendor_string;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	vm->header.cpuid_quickpath[i].eax=ncvm_cpuid_leaf_limit;
-	noir_movsb(&vm->header.cpuid_quickpath[i].ebx,"NoirVisor ZT",12);
+	entries[i].leaf=ncvm_cpuid_leaf_range_and_vendor_string;
+	entries[i].eax=ncvm_cpuid_leaf_limit;
+	noir_movsb(&entries[i++].ebx,"NoirVisor ZT",12);
 	// Hypervisor Leaf 4000_0001 - Hypervisor Vendor-Neutral Interface ID
-	vm->header.cpuid_quickpath[i].leaf=ncvm_cpuid_vendor_neutral_interface_id;
-	vm->header.cpuid_quickpath[i].subleaf=0;
-	vm->header.cpuid_quickpath[i].options.value=0;
-	vm->header.cpuid_quickpath[i].options.active=true;
-	vm->header.cpuid_quickpath[i].options.vm_wide=true;
-	noir_movsb(&vm->header.cpuid_quickpath[i].eax,"Nv#1",4);
-	noir_stosd(&vm->header.cpuid_quickpath[i].ebx,0,3);
+	entries[i].leaf=ncvm_cpuid_vendor_neutral_interface_id;
+	noir_movsb(&entries[i++].eax,"Nv#1",4);
+	// The built-in model does not override interceptions requested by the User Hypervisor.
+	vm->header.cpuid_model.table=nvc_build_cpuid_table(entries,i);
+	return vm->header.cpuid_model.table!=null;
 }
 
 noir_svm_custom_vcpu_p nvc_svmc_reference_vcpu(noir_svm_custom_vm_p vm,u32 vcpu_id)
@@ -983,8 +1010,8 @@ noir_status nvc_svmc_create_vcpu(noir_svm_custom_vcpu_p* virtual_cpu,noir_svm_cu
 			if(!vcpu_id)noir_bts64(&vcpu->header.msrs.apic.value,amd64_apic_bsc);
 			// Mark the owner VM of vCPU.
 			vcpu->vm=virtual_machine;
-			// Initialize vCPU CPUID-QuickPath
-			nvc_svm_init_vcpu_cpuid_quickpath(vcpu);
+			// Initialize vCPU CPUID Overrides.
+			nvc_svm_init_vcpu_cpuid_overrides(vcpu);
 			// Initialize the VMCB via hypercall. It is supposed that only hypervisor can operate VMCB.
 			noir_svm_vmmcall(noir_svm_init_custom_vmcb,(ulong_ptr)vcpu);
 			// Increment the counter.
@@ -1023,324 +1050,11 @@ u32 nvc_svmc_alloc_asid()
 	return asid;
 }
 
-void static nvc_svmc_set_pte_entry(amd64_npt_pte_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
-	entry->value=0;
-	// Protection attributes...
-	entry->present=map_attrib.present;
-	entry->write=map_attrib.write;
-	entry->user=map_attrib.user;
-	entry->no_execute=!map_attrib.execute;
-	// Caching attributes...
-	entry->pwt=noir_bt(&pat_index,0);
-	entry->pcd=noir_bt(&pat_index,1);
-	entry->pat=noir_bt(&pat_index,2);
-	// Address translation...
-	entry->page_base=page_4kb_count(hpa);
-}
-
-void static nvc_svmc_set_pde_entry(amd64_npt_pde_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	entry->value=0;
-	if(map_attrib.psize!=1)
-	{
-		entry->present=entry->write=entry->user=1;
-		entry->pte_base=page_4kb_count(hpa);
-	}
-	else
-	{
-		u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
-		amd64_npt_large_pde_p large_pde=(amd64_npt_large_pde_p)entry;
-		// Protection attributes...
-		large_pde->present=map_attrib.present;
-		large_pde->write=map_attrib.write;
-		large_pde->user=map_attrib.user;
-		large_pde->no_execute=!map_attrib.execute;
-		// Caching attributes...
-		large_pde->pwt=noir_bt(&pat_index,0);
-		large_pde->pcd=noir_bt(&pat_index,1);
-		large_pde->pat=noir_bt(&pat_index,2);
-		// Address translation...
-		large_pde->page_base=page_2mb_count(hpa);
-		large_pde->large_pde=1;
-	}
-}
-
-void static nvc_svmc_set_pdpte_entry(amd64_npt_pdpte_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	entry->value=0;
-	if(map_attrib.psize!=2)
-	{
-		entry->present=entry->write=entry->user=1;
-		entry->pde_base=page_4kb_count(hpa);
-	}
-	else
-	{
-		u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
-		amd64_npt_huge_pdpte_p huge_pdpte=(amd64_npt_huge_pdpte_p)entry;
-		// Protection attributes...
-		huge_pdpte->present=map_attrib.present;
-		huge_pdpte->write=map_attrib.write;
-		huge_pdpte->user=map_attrib.user;
-		huge_pdpte->no_execute=!map_attrib.execute;
-		// Caching attributes...
-		huge_pdpte->pwt=noir_bt(&pat_index,0);
-		huge_pdpte->pcd=noir_bt(&pat_index,1);
-		huge_pdpte->pat=noir_bt(&pat_index,2);
-		// Address translation...
-		huge_pdpte->page_base=page_1gb_count(hpa);
-		huge_pdpte->huge_pdpte=1;
-	}
-}
-
-void static nvc_svmc_set_pml4e_entry(amd64_npt_pml4e_p entry,u64 hpa)
-{
-	entry->value=0;
-	entry->present=entry->write=entry->user=1;
-	entry->pdpte_base=page_4kb_count(hpa);
-}
-
-noir_status static nvc_svmc_create_1gb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	noir_status st=noir_insufficient_resources;
-	noir_npt_pdpte_descriptor_p pdpte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pdpte_descriptor));
-	if(pdpte_p)
-	{
-		pdpte_p->virt=noir_alloc_contd_memory(page_size);
-		if(pdpte_p->virt==null)
-			noir_free_nonpg_memory(pdpte_p);
-		else
-		{
-			amd64_addr_translator gpa_t;
-			gpa_t.value=gpa;
-			// Setup PDPTE descriptor.
-			pdpte_p->phys=noir_get_physical_address(pdpte_p->virt);
-			pdpte_p->gpa_start=page_512gb_base(gpa);
-			// Do mapping - this level.
-			nvc_svmc_set_pdpte_entry(&pdpte_p->virt[gpa_t.pdpte_offset],hpa,map_attrib);
-			// Do mapping - prior level.
-			// Note that PML4E is already described.
-			nvc_svmc_set_pml4e_entry(&npt_manager->ncr3.virt[gpa_t.pml4e_offset],pdpte_p->phys);
-			// Add to the linked list.
-			if(npt_manager->pdpte.head)
-				npt_manager->pdpte.tail->next=pdpte_p;
-			else
-				npt_manager->pdpte.head=pdpte_p;
-			npt_manager->pdpte.tail=pdpte_p;
-			st=noir_success;
-		}
-	}
-	return st;
-}
-
-noir_status static nvc_svmc_create_2mb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	noir_status st=noir_insufficient_resources;
-	noir_npt_pde_descriptor_p pde_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pde_descriptor));
-	if(pde_p)
-	{
-		pde_p->virt=noir_alloc_contd_memory(page_size);
-		if(pde_p->virt==null)
-			noir_free_nonpg_memory(pde_p);
-		else
-		{
-			noir_npt_pdpte_descriptor_p cur=npt_manager->pdpte.head;
-			amd64_addr_translator gpa_t;
-			gpa_t.value=gpa;
-			// Setup PDE descriptor
-			pde_p->phys=noir_get_physical_address(pde_p->virt);
-			pde_p->gpa_start=page_1gb_base(gpa);
-			// Do mapping
-			nvc_svmc_set_pde_entry(&pde_p->virt[gpa_t.pde_offset],hpa,map_attrib);
-			// Add to the linked list.
-			if(npt_manager->pde.head)
-				npt_manager->pde.tail->next=pde_p;
-			else
-				npt_manager->pde.head=pde_p;
-			npt_manager->pde.tail=pde_p;
-			// Search for existing PDPTEs and set up upper-level mapping.
-			while(cur)
-			{
-				if(gpa>=cur->gpa_start && gpa<cur->gpa_start+page_512gb_size)break;
-				cur=cur->next;
-			}
-			if(!cur)
-			{
-				noir_cvm_mapping_attributes null_map={0};
-				// This 512GiB page is not yet described.
-				st=nvc_svmc_create_1gb_page_map(npt_manager,gpa,0,null_map);
-				if(st==noir_success)cur=npt_manager->pdpte.tail;
-			}
-			if(cur)
-			{
-				nvc_svmc_set_pdpte_entry(&cur->virt[gpa_t.pdpte_offset],pde_p->phys,map_attrib);
-				st=noir_success;
-			}
-		}
-	}
-	return st;
-}
-
-noir_status static nvc_svmc_create_4kb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	noir_status st=noir_insufficient_resources;
-	noir_npt_pte_descriptor_p pte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pte_descriptor));
-	if(pte_p)
-	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
-		if(pte_p->virt==null)
-			noir_free_nonpg_memory(pte_p);
-		else
-		{
-			noir_npt_pde_descriptor_p cur=npt_manager->pde.head;
-			amd64_addr_translator gpa_t;
-			gpa_t.value=gpa;
-			// Setup PTE descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
-			pte_p->gpa_start=page_2mb_base(gpa);
-			// Do mapping
-			nvc_svmc_set_pte_entry(&pte_p->virt[gpa_t.pte_offset],0,map_attrib);
-			// Add to the linked list
-			if(npt_manager->pte.head)
-				npt_manager->pte.tail->next=pte_p;
-			else
-				npt_manager->pte.head=pte_p;
-			npt_manager->pte.tail=pte_p;
-			// Search for existing PDEs and set up upper-level mapping.
-			while(cur)
-			{
-				if(gpa>=cur->gpa_start && gpa<cur->gpa_start+page_1gb_size)break;
-				cur=cur->next;
-			}
-			if(!cur)
-			{
-				noir_cvm_mapping_attributes null_map={0};
-				// This 1GiB page is not yet described.
-				st=nvc_svmc_create_2mb_page_map(npt_manager,gpa,0,null_map);
-				if(st==noir_success)cur=npt_manager->pde.tail;
-			}
-			if(cur)
-			{
-				nvc_svmc_set_pde_entry(&cur->virt[gpa_t.pde_offset],pte_p->phys,map_attrib);
-				st=noir_success;
-			}
-		}
-	}
-	return st;
-}
-
-noir_status static nvc_svmc_set_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
-{
-	noir_status st=noir_unsuccessful;
-	amd64_addr_translator gpa_t;
-	gpa_t.value=gpa;
-	switch(map_attrib.psize)
-	{
-		case 0:
-		{
-			// Search for existing PTEs.
-			noir_npt_pte_descriptor_p cur=npt_manager->pte.head;
-			while(cur)
-			{
-				if(gpa>=cur->gpa_start && gpa<cur->gpa_start+page_2mb_size)break;
-				cur=cur->next;
-			}
-			if(!cur)
-			{
-				noir_cvm_mapping_attributes null_map={0};
-				// This 2MiB page is not described yet.
-				st=nvc_svmc_create_4kb_page_map(npt_manager,gpa,0,null_map);
-				if(st==noir_success)cur=npt_manager->pte.tail;
-			}
-			if(cur)
-			{
-				nvc_svmc_set_pte_entry(&cur->virt[gpa_t.pte_offset],hpa,map_attrib);
-				st=noir_success;
-			}
-			break;
-		}
-		default:
-		{
-			st=noir_not_implemented;
-			break;
-		}
-	}
-	return st;
-}
-
-bool nvc_svmc_get_physical_mapping(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64p hpa,bool r,bool w,bool x)
-{
-	bool result=false;
-	amd64_npt_pml4e_p pml4e;
-	amd64_addr_translator trans;
-	trans.value=gpa;
-	pml4e=&npt_manager->ncr3.virt[trans.pml4e_offset];
-	*hpa=0;
-	if(pml4e->present>=r && pml4e->write>=w && pml4e->no_execute<=x)
-	{
-		const u64 pdpte_phys=page_mult(pml4e->pdpte_base);
-		for(noir_npt_pdpte_descriptor_p pdpte_p=npt_manager->pdpte.head;pdpte_p;pdpte_p=pdpte_p->next)
-		{
-			if(pdpte_p->phys==pdpte_phys)
-			{
-				amd64_npt_huge_pdpte_p pdpte=(amd64_npt_huge_pdpte_p)&pdpte_p->virt[trans.pdpte_offset];
-				if(pdpte->present>=r && pdpte->write>=w && pdpte->no_execute<=x)
-				{
-					if(pdpte->huge_pdpte)
-					{
-						result=true;
-						*hpa=page_1gb_mult(pdpte->page_base)|page_1gb_offset(gpa);
-					}
-					else
-					{
-						const u64 pde_phys=page_mult(pdpte_p->virt[trans.pdpte_offset].pde_base);
-						for(noir_npt_pde_descriptor_p pde_p=npt_manager->pde.head;pde_p;pde_p=pde_p->next)
-						{
-							if(pde_p->phys==pde_phys)
-							{
-								amd64_npt_large_pde_p pde=(amd64_npt_large_pde_p)&pde_p->virt[trans.pde_offset];
-								if(pde->present>=r && pde->write>=w && pde->no_execute<=x)
-								{
-									if(pde->large_pde)
-									{
-										result=true;
-										*hpa=page_2mb_mult(pde->page_base)|page_2mb_offset(gpa);
-									}
-									else
-									{
-										const u64 pte_phys=page_mult(pde_p->virt[trans.pde_offset].pte_base);
-										for(noir_npt_pte_descriptor_p pte_p=npt_manager->pte.head;pte_p;pte_p=pte_p->next)
-										{
-											if(pte_p->phys==pte_phys)
-											{
-												amd64_npt_pte_p pte=&pte_p->virt[trans.pte_offset];
-												if(pte->present>=r && pte->write>=w && pte->no_execute<=x)
-												{
-													result=true;
-													*hpa=page_4kb_mult(pte->page_base)|trans.page_offset;
-												}
-												break;
-											}
-										}
-									}
-								}
-								break;
-							}
-						}
-					}
-				}
-				break;
-			}
-		}
-	}
-	return result;
-}
-
 noir_status nvc_svmc_set_unmapping(noir_svm_custom_vm_p virtual_machine,u64 gpa,u32 pages)
 {
 	noir_status st=noir_insufficient_resources;
-	u64p hpa_list=noir_alloc_nonpg_memory(pages<<3);
+	// Unmapping a part of a large page splits it. Reserve the tables beforehand.
+	u64p hpa_list=nvc_svmc_reserve_npt_tables(&virtual_machine->nptm,pages)==noir_success?noir_alloc_nonpg_memory(pages<<3):null;
 	if(hpa_list)
 	{
 		bool nsv_ret=true;
@@ -1354,11 +1068,18 @@ noir_status nvc_svmc_set_unmapping(noir_svm_custom_vm_p virtual_machine,u64 gpa,
 		// FIXME: Encrypt the pages if these pages are secure.
 		if(nsv_ret)
 		{
+			const u32 strides[3]={1,0x200,0x40000};
 			noir_cvm_mapping_attributes map_attrib={0};
-			for(u32 i=0;i<pages;i++)
+			for(u32 i=0;i<pages;)
 			{
-				st=nvc_svmc_set_page_map(&virtual_machine->nptm,gpa,0,map_attrib);
-				if(st!=noir_success)return st;
+				const u64 cur_gpa=gpa+page_4kb_mult((u64)i);
+				// Unmap an aligned run of a large page at its mapped size, so that the large page is not split.
+				u32 psize=nvc_svmc_get_page_map_size(&virtual_machine->nptm,cur_gpa);
+				while(psize && (strides[psize]>pages-i || (cur_gpa&(page_4kb_mult((u64)strides[psize])-1))))psize--;
+				map_attrib.psize=psize;
+				st=nvc_svmc_set_page_map(&virtual_machine->nptm,cur_gpa,0,map_attrib);
+				if(st!=noir_success)break;
+				i+=strides[psize];
 			}
 		}
 		noir_free_nonpg_memory(hpa_list);
@@ -1366,10 +1087,29 @@ noir_status nvc_svmc_set_unmapping(noir_svm_custom_vm_p virtual_machine,u64 gpa,
 	return st;
 }
 
+// Return the number of 4KiB pages that the largest page at this position can map.
+// A large page is used only if both GPA and HPA are aligned and the HPAs are contiguous.
+u32 static nvc_svmc_get_mapping_stride(u64p phys_array,u32 index,u32 pages,u64 gpa)
+{
+	const u32 strides[2]={0x40000,0x200};
+	for(u32 i=0;i<2;i++)
+	{
+		const u32 n=strides[i];
+		if(n<=pages-index && ((gpa|phys_array[index])&(page_4kb_mult((u64)n)-1))==0)
+		{
+			u32 j=1;
+			while(j<n && phys_array[index+j]==phys_array[index]+page_4kb_mult((u64)j))j++;
+			if(j==n)return n;
+		}
+	}
+	return 1;
+}
+
 noir_status nvc_svmc_set_mapping(noir_svm_custom_vm_p virtual_machine,noir_cvm_address_mapping_p mapping_info,u64p phys_array)
 {
 	noir_status st=noir_insufficient_resources;
-	u64p gpa_list=noir_alloc_nonpg_memory(mapping_info->pages<<3);
+	// Reserve the tables before gaining exclusion of the VM, so that mapping does not refill the arena.
+	u64p gpa_list=nvc_svmc_reserve_npt_tables(&virtual_machine->nptm,mapping_info->pages)==noir_success?noir_alloc_nonpg_memory(mapping_info->pages<<3):null;
 	if(gpa_list)
 	{
 		u8 ownership=mapping_info->attributes.nsv_secure?noir_nsv_rmt_secure_guest:noir_nsv_rmt_insecure_guest;
@@ -1396,13 +1136,19 @@ noir_status nvc_svmc_set_mapping(noir_svm_custom_vm_p virtual_machine,noir_cvm_a
 			for(u32 i=0;i<255;i++)
 				if(virtual_machine->vcpu[i])
 					noir_acquire_pushlock_exclusive(&virtual_machine->vcpu[i]->header.vcpu_lock);
-			for(u32 i=0;i<mapping_info->pages;i++)
+			for(u32 i=0;i<mapping_info->pages;)
 			{
+				noir_cvm_mapping_attributes map_attrib=mapping_info->attributes;
 				u64 gpa=mapping_info->gpa+page_4kb_mult(i);
 				u64 hpa=phys_array[i];
-				st=nvc_svmc_set_page_map(&virtual_machine->nptm,gpa,hpa,mapping_info->attributes);
+				u32 stride=nvc_svmc_get_mapping_stride(phys_array,i,mapping_info->pages,gpa);
+				map_attrib.psize=stride==0x40000?2:stride==0x200;
+				st=nvc_svmc_set_page_map(&virtual_machine->nptm,gpa,hpa,map_attrib);
 				if(st!=noir_success)break;
+				i+=stride;
 			}
+			// Large pages may have replaced existing tables.
+			nvc_svmc_release_detached_tables(&virtual_machine->nptm);
 			// Broadcast to all vCPUs that the TLBs are invalid now.
 			for(u32 i=0;i<255;i++)
 				if(virtual_machine->vcpu[i])
@@ -1424,152 +1170,44 @@ noir_status nvc_svmc_set_mapping(noir_svm_custom_vm_p virtual_machine,noir_cvm_a
 	return st;
 }
 
-bool static nvc_svmc_clear_gpa_accessing_bit(noir_svm_custom_npt_manager_p nptm,u64 gpa)
+u32 nvc_svmc_promote_page_mappings(noir_svm_custom_vm_p virtual_machine)
 {
-	// Start from PML4E.
-	amd64_addr_translator trans;
-	trans.value=gpa;
-	if(nptm->ncr3.virt[trans.pml4e_offset].present)
-	{
-		// Traverse the linked list to check the nested paging.
-		noir_npt_pdpte_descriptor_p pdpte_p=nptm->pdpte.head;
-		while(pdpte_p)
-		{
-			if(gpa>=pdpte_p->gpa_start && gpa<pdpte_p->gpa_start+page_512gb_size && pdpte_p->virt[trans.pdpte_offset].present)
-			{
-				amd64_npt_huge_pdpte_p pdpte_t=(amd64_npt_huge_pdpte_p)&pdpte_p->virt[trans.pdpte_offset];
-				if(pdpte_t->huge_pdpte)
-				{
-					pdpte_t->accessed=pdpte_t->dirty=false;
-					return true;
-				}
-				else
-				{
-					noir_npt_pde_descriptor_p pde_p=nptm->pde.head;
-					while(pde_p)
-					{
-						if(gpa>=pde_p->gpa_start && gpa<pde_p->gpa_start+page_1gb_size && pde_p->virt[trans.pde_offset].present)
-						{
-							amd64_npt_large_pde_p pde_t=(amd64_npt_large_pde_p)&pde_p->virt[trans.pde_offset];
-							if(pde_t->large_pde)
-							{
-								pde_t->accessed=pde_t->dirty=false;
-								return true;
-							}
-							else
-							{
-								noir_npt_pte_descriptor_p pte_p=nptm->pte.head;
-								while(pte_p)
-								{
-									if(gpa>=pte_p->gpa_start && gpa<pte_p->gpa_start+page_2mb_size && pte_p->virt[trans.pte_offset].present)
-									{
-										pte_p->virt[trans.pte_offset].accessed=pte_p->virt[trans.pte_offset].dirty=false;
-										return true;
-									}
-									pte_p=pte_p->next;
-								}
-							}
-						}
-						pde_p=pde_p->next;
-					}
-				}
-			}
-			pdpte_p=pdpte_p->next;
-		}
-	}
-	return false;
+	u32 promoted;
+	// Gain Exclusion of VM.
+	for(u32 i=0;i<255;i++)
+		if(virtual_machine->vcpu[i])
+			noir_acquire_pushlock_exclusive(&virtual_machine->vcpu[i]->header.vcpu_lock);
+	promoted=nvc_svmc_promote_page_maps(&virtual_machine->nptm);
+	// Broadcast to all vCPUs that the TLBs are invalid now.
+	if(promoted)
+		for(u32 i=0;i<255;i++)
+			if(virtual_machine->vcpu[i])
+				virtual_machine->vcpu[i]->header.state_cache.tl_valid=false;
+	// Release Exclusion of VM.
+	for(u32 i=0;i<255;i++)
+		if(virtual_machine->vcpu[i])
+			noir_release_pushlock_exclusive(&virtual_machine->vcpu[i]->header.vcpu_lock);
+	return promoted;
 }
 
 noir_status nvc_svmc_clear_gpa_accessing_bits(noir_svm_custom_vm_p virtual_machine,u64 gpa_start,u32 page_count)
 {
-	noir_status st=noir_success;
-	for(u32 i=0;i<page_count;i++)
-	{
-		bool r=nvc_svmc_clear_gpa_accessing_bit(&virtual_machine->nptm,gpa_start+(i<<page_4kb_shift));
-		if(r==false)
-		{
-			st=noir_guest_page_absent;
-			break;
-		}
-	}
-	return st;
+	return nvc_svmc_harvest_gpa_accessing_bits(&virtual_machine->nptm,gpa_start,page_count,null,true);
 }
 
-u8 static nvc_svmc_query_gpa_accessing_bit(noir_svm_custom_npt_manager_p nptm,u64 gpa)
+noir_status nvc_svmc_query_gpa_accessing_bitmap(noir_svm_custom_vm_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size)
 {
-	// Start from PML4E.
-	amd64_addr_translator trans;
-	trans.value=gpa;
-	if(nptm->ncr3.virt[trans.pml4e_offset].present)
-	{
-		// Traverse the linked list to check the nested paging.
-		noir_npt_pdpte_descriptor_p pdpte_p=nptm->pdpte.head;
-		while(pdpte_p)
-		{
-			if(gpa>=pdpte_p->gpa_start && gpa<pdpte_p->gpa_start+page_512gb_size && pdpte_p->virt[trans.pdpte_offset].present)
-			{
-				amd64_npt_huge_pdpte_p pdpte_t=(amd64_npt_huge_pdpte_p)&pdpte_p->virt[trans.pdpte_offset];
-				if(pdpte_t->huge_pdpte)
-					return (u8)((pdpte_t->dirty<<1)+pdpte_t->accessed);
-				else
-				{
-					noir_npt_pde_descriptor_p pde_p=nptm->pde.head;
-					while(pde_p)
-					{
-						if(gpa>=pde_p->gpa_start && gpa<pde_p->gpa_start+page_1gb_size && pde_p->virt[trans.pde_offset].present)
-						{
-							amd64_npt_large_pde_p pde_t=(amd64_npt_large_pde_p)&pde_p->virt[trans.pde_offset];
-							if(pde_t->large_pde)
-								return (u8)((pde_t->dirty<<1)+pde_t->accessed);
-							else
-							{
-								noir_npt_pte_descriptor_p pte_p=nptm->pte.head;
-								while(pte_p)
-								{
-									if(gpa>=pte_p->gpa_start && gpa<pte_p->gpa_start+page_2mb_size && pte_p->virt[trans.pte_offset].present)
-										return (u8)((pte_p->virt[trans.pte_offset].dirty<<1)+pte_p->virt[trans.pte_offset].accessed);
-									pte_p=pte_p->next;
-								}
-							}
-						}
-					}
-					pde_p=pde_p->next;
-				}
-			}
-			pdpte_p=pdpte_p->next;
-		}
-	}
-	return 0xff;
+	noir_status st=noir_buffer_too_small;
+	if(page_count<=(bitmap_size<<2))
+		st=nvc_svmc_harvest_gpa_accessing_bits(&virtual_machine->nptm,gpa_start,page_count,bitmap,false);
+	return st;
 }
 
-noir_status nvc_svmc_query_gpa_accessing_bitmap(noir_svm_custom_vm_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size)
+noir_status nvc_svmc_query_and_clear_gpa_accessing_bitmap(noir_svm_custom_vm_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size)
 {
 	noir_status st=noir_buffer_too_small;
 	if(page_count<=(bitmap_size<<2))
-	{
-		// Acquire the vCPU list lock. No vCPUs should be running.
-		st=noir_success;
-		for(u32 i=0;i<page_count;i++)
-		{
-			u8 r=nvc_svmc_query_gpa_accessing_bit(&virtual_machine->nptm,gpa_start+(i<<page_4kb_shift));
-			if(r==0xff)
-			{
-				st=noir_guest_page_absent;
-				break;
-			}
-			else
-			{
-				if(noir_bt(&r,0))
-					noir_set_bitmap(bitmap,i<<1);
-				else
-					noir_reset_bitmap(bitmap,i<<1);
-				if(noir_bt(&r,1))
-					noir_set_bitmap(bitmap,(i<<1)+1);
-				else
-					noir_reset_bitmap(bitmap,(i<<1)+1);
-			}
-		}
-	}
+		st=nvc_svmc_harvest_gpa_accessing_bits(&virtual_machine->nptm,gpa_start,page_count,bitmap,true);
 	return st;
 }
 
@@ -1673,44 +1311,7 @@ void nvc_svmc_release_vm(noir_svm_custom_vm_p vm)
 		}
 		noir_release_reslock(vm->header.vcpu_list_lock);
 		// Release Nested Paging Structure.
-		if(vm->nptm.ncr3.virt)
-			noir_free_contd_memory(vm->nptm.ncr3.virt,page_size);
-		// Release PDPTE descriptors and paging structures...
-		if(vm->nptm.pdpte.head)
-		{
-			noir_npt_pdpte_descriptor_p cur=vm->nptm.pdpte.head;
-			while(cur)
-			{
-				noir_npt_pdpte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		// Release PDE descriptors and paging structures...
-		if(vm->nptm.pde.head)
-		{
-			noir_npt_pde_descriptor_p cur=vm->nptm.pde.head;
-			while(cur)
-			{
-				noir_npt_pde_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		// Release PTE descriptors and paging structures...
-		if(vm->nptm.pte.head)
-		{
-			noir_npt_pte_descriptor_p cur=vm->nptm.pte.head;
-			while(cur)
-			{
-				noir_npt_pte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
+		nvc_svmc_finalize_npt_manager(&vm->nptm);
 		if(hvm_p->options.enable_nsv)
 		{
 			// Encrypt all secure pages in the VM.
@@ -1750,14 +1351,16 @@ noir_status nvc_svmc_create_vm(noir_svm_custom_vm_p* virtual_machine)
 		*virtual_machine=vm;
 		if(vm)
 		{
+			vm->asid=0xffffffff;
 			// Create a generic Page Map Level 4 (PML4) Table.
-			vm->nptm.ncr3.virt=noir_alloc_contd_memory(page_size);
-			if(vm->nptm.ncr3.virt)
-				vm->nptm.ncr3.phys=noir_get_physical_address(vm->nptm.ncr3.virt);
-			else
-				goto alloc_failure;
-			// Allocate ASID for CVM.
-			vm->asid=nvc_svmc_alloc_asid();
+			if(nvc_svmc_initialize_npt_manager(&vm->nptm)!=noir_success)goto alloc_failure;
+			// Only NSV-Guests require an ASID to identify their pages.
+			// TLB is tagged by ASIDs assigned to vCPUs on each processor.
+			if(hvm_p->options.enable_nsv)
+			{
+				vm->asid=nvc_svmc_alloc_asid();
+				if(vm->asid==0xffffffff)goto alloc_failure;
+			}
 			// Allocate IOPM.
 			vm->iopm.virt=noir_alloc_contd_memory(page_size*3);
 			if(vm->iopm.virt)
@@ -1825,8 +1428,8 @@ noir_status nvc_svmc_create_vm(noir_svm_custom_vm_p* virtual_machine)
 			noir_stosb(vm->iopm.virt,0xff,noir_svm_iopm_size);
 			// Some MSRs are unnessary to be intercepted. Rule them out of interception.
 			nvc_svmc_setup_msr_interception_exception(vm->msrpm.virt);
-			// Initialize CPUID Quick-Path
-			nvc_svm_init_vm_cpuid_quickpath(vm);
+			// Initialize CPUID Model.
+			if(!nvc_svm_init_vm_cpuid_model(vm))goto alloc_failure;
 			st=noir_success;
 		}
 	}
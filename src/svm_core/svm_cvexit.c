@@ -364,8 +364,14 @@ void static noir_hvcode fastcall nvc_svm_virtint_cvexit_handler(noir_gpr_state_p
 void static noir_hvcode fastcall nvc_svm_cpuid_cvexit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_custom_vcpu_p cvcpu)
 {
 	noir_nsv_virtual_cpu_p nsvcpu=(noir_nsv_virtual_cpu_p)cvcpu->header.vmsa.virt;
+	u32 leaf=(u32)gpr_state->rax,subleaf=(u32)gpr_state->rcx;
+	noir_cpuid_general_info info={0};
+	bool hit=false;
+	// Search the CPUID model. The built-in model does not answer the CPUID if the User Hypervisor intercepts it.
+	if(!cvcpu->header.vcpu_options.intercept_cpuid || cvcpu->vm->header.cpuid_model.user_loaded)
+		hit=nvc_query_cpuid_model(&cvcpu->header,leaf,subleaf,&info);
 	// Determine whether CPUID-Interception is subject to be delivered to subverted host.
-	if(cvcpu->header.vcpu_options.intercept_cpuid)
+	if(cvcpu->header.vcpu_options.intercept_cpuid && !hit)
 	{
 		if(cvcpu->vm->header.properties.nsv_guest)
 		{
@@ -389,51 +395,12 @@ void static noir_hvcode fastcall nvc_svm_cpuid_cvexit_handler(noir_gpr_state_p g
 	else
 	{
 		// NoirVisor will be handling CVM's CPUID Interception.
-		u32 leaf=(u32)gpr_state->rax,subleaf=(u32)gpr_state->rcx;
-		noir_cpuid_general_info info={0};
-		bool qp_hit=false;
-		// Use QuickPath to handle CPUID interception.
-		// Search per-vCPU QuickPath list.
-		for(u32 i=0;i<noir_cvm_cpuid_quickpath_limit_per_vcpu;i++)
-		{
-			noir_cvm_cpuid_quickpath_info_p qp=&cvcpu->header.cpuid_quickpath[i];
-			if(qp->leaf==leaf)
-			{
-				if(qp->options.has_subleaf==false || qp->subleaf==subleaf)
-				{
-					info.eax=qp->eax;
-					info.ebx=qp->ebx;
-					info.ecx=qp->ecx;
-					info.edx=qp->edx;
-					qp_hit=true;
-					break;
-				}
-			}
-		}
-		if(!qp_hit)
-		{
-			// Search per-VM QuickPath list.
-			for(u32 i=0;i<noir_cvm_cpuid_quickpath_limit_per_vm;i++)
-			{
-				noir_cvm_cpuid_quickpath_info_p qp=&cvcpu->vm->header.cpuid_quickpath[i];
-				if(qp->leaf==leaf)
-				{
-					if(qp->options.has_subleaf==false || qp->subleaf==subleaf)
-					{
-						info.eax=qp->eax;
-						info.ebx=qp->ebx;
-						info.ecx=qp->ecx;
-						info.edx=qp->edx;
-						qp_hit=true;
-						break;
-					}
-				}
-			}
-		}
-		*(u32*)&gpr_state->rax=info.eax;
-		*(u32*)&gpr_state->rbx=info.ebx;
-		*(u32*)&gpr_state->rcx=info.ecx;
-		*(u32*)&gpr_state->rdx=info.edx;
+		// Leaves not in the CPUID model are answered with zeros.
+		// The cpuid instruction zero-extends the results into 64-bit registers.
+		gpr_state->rax=info.eax;
+		gpr_state->rbx=info.ebx;
+		gpr_state->rcx=info.ecx;
+		gpr_state->rdx=info.edx;
 		noir_svm_advance_rip(cvcpu->vmcb.virt);
 		// Profiler: Classify the interception.
 		cvcpu->header.statistics_internal.selector=&cvcpu->header.statistics.interceptions.emulation;
@@ -528,6 +495,13 @@ void static noir_hvcode fastcall nvc_svm_io_cvexit_handler(noir_gpr_state_p gpr_
 		nsvcpu->nsvs.vc_info1=(u64)cvcpu->header.exit_context.io.access.value;
 		nsvcpu->nsvs.vc_info2=(u64)cvcpu->header.exit_context.io.port;
 	}
+	else if(!info.string && nvc_emulate_vm_pio_device(&cvcpu->vm->header,info.type,(u16)info.port,(u16)info.op_size,&gpr_state->rax))
+	{
+		// The port is emulated by a device model in NoirVisor. Return to the guest directly.
+		noir_svm_advance_rip(cvcpu->vmcb.virt);
+		// Profiler: Classify the interception.
+		cvcpu->header.statistics_internal.selector=&cvcpu->header.statistics.interceptions.pio_device;
+	}
 	else
 	{
 		// Deliver the I/O interception to subverted host.
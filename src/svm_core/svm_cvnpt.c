@@ -0,0 +1,721 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the Nested Paging manager of Customizable VM for AMD-V.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /svm_core/svm_cvnpt.c
+*/
+
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <amd64.h>
+#include "svm_npt.h"
+
+/*
+  Descriptors are indexed in the same radix layout as the paging structures:
+  The manager indexes PDPTE descriptors by PML4E offset.
+  Each PDPTE descriptor indexes PDE descriptors by PDPTE offset.
+  Each PDE descriptor indexes PTE descriptors by PDE offset.
+  Therefore, locating the descriptor of any GPA takes constant time.
+*/
+noir_npt_pdpte_descriptor_p static nvc_svmc_find_pdpte_descriptor(noir_svm_custom_npt_manager_p npt_manager,u64 gpa)
+{
+	amd64_addr_translator gpa_t;
+	gpa_t.value=gpa;
+	return npt_manager->pdpte.index[gpa_t.pml4e_offset];
+}
+
+noir_npt_pde_descriptor_p static nvc_svmc_find_pde_descriptor(noir_svm_custom_npt_manager_p npt_manager,u64 gpa)
+{
+	noir_npt_pdpte_descriptor_p pdpte_p=nvc_svmc_find_pdpte_descriptor(npt_manager,gpa);
+	amd64_addr_translator gpa_t;
+	gpa_t.value=gpa;
+	return pdpte_p?pdpte_p->pde_index[gpa_t.pdpte_offset]:null;
+}
+
+noir_npt_pte_descriptor_p static nvc_svmc_find_pte_descriptor(noir_svm_custom_npt_manager_p npt_manager,u64 gpa)
+{
+	noir_npt_pde_descriptor_p pde_p=nvc_svmc_find_pde_descriptor(npt_manager,gpa);
+	amd64_addr_translator gpa_t;
+	gpa_t.value=gpa;
+	return pde_p?pde_p->pte_index[gpa_t.pde_offset]:null;
+}
+
+void static nvc_svmc_set_pte_entry(amd64_npt_pte_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
+	entry->value=0;
+	// Protection attributes...
+	entry->present=map_attrib.present;
+	entry->write=map_attrib.write;
+	entry->user=map_attrib.user;
+	entry->no_execute=!map_attrib.execute;
+	// Caching attributes...
+	entry->pwt=noir_bt(&pat_index,0);
+	entry->pcd=noir_bt(&pat_index,1);
+	entry->pat=noir_bt(&pat_index,2);
+	// Address translation...
+	entry->page_base=page_4kb_count(hpa);
+}
+
+void static nvc_svmc_set_pde_entry(amd64_npt_pde_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	entry->value=0;
+	if(map_attrib.psize!=1)
+	{
+		entry->present=entry->write=entry->user=1;
+		entry->pte_base=page_4kb_count(hpa);
+	}
+	else
+	{
+		u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
+		amd64_npt_large_pde_p large_pde=(amd64_npt_large_pde_p)entry;
+		// Protection attributes...
+		large_pde->present=map_attrib.present;
+		large_pde->write=map_attrib.write;
+		large_pde->user=map_attrib.user;
+		large_pde->no_execute=!map_attrib.execute;
+		// Caching attributes...
+		large_pde->pwt=noir_bt(&pat_index,0);
+		large_pde->pcd=noir_bt(&pat_index,1);
+		large_pde->pat=noir_bt(&pat_index,2);
+		// Address translation...
+		large_pde->page_base=page_2mb_count(hpa);
+		large_pde->large_pde=1;
+	}
+}
+
+void static nvc_svmc_set_pdpte_entry(amd64_npt_pdpte_p entry,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	entry->value=0;
+	if(map_attrib.psize!=2)
+	{
+		entry->present=entry->write=entry->user=1;
+		entry->pde_base=page_4kb_count(hpa);
+	}
+	else
+	{
+		u64 pat_index=(u64)nvc_npt_get_host_pat_index(map_attrib.caching);
+		amd64_npt_huge_pdpte_p huge_pdpte=(amd64_npt_huge_pdpte_p)entry;
+		// Protection attributes...
+		huge_pdpte->present=map_attrib.present;
+		huge_pdpte->write=map_attrib.write;
+		huge_pdpte->user=map_attrib.user;
+		huge_pdpte->no_execute=!map_attrib.execute;
+		// Caching attributes...
+		huge_pdpte->pwt=noir_bt(&pat_index,0);
+		huge_pdpte->pcd=noir_bt(&pat_index,1);
+		huge_pdpte->pat=noir_bt(&pat_index,2);
+		// Address translation...
+		huge_pdpte->page_base=page_1gb_count(hpa);
+		huge_pdpte->huge_pdpte=1;
+	}
+}
+
+void static nvc_svmc_set_pml4e_entry(amd64_npt_pml4e_p entry,u64 hpa)
+{
+	entry->value=0;
+	entry->present=entry->write=entry->user=1;
+	entry->pdpte_base=page_4kb_count(hpa);
+}
+
+// Split a 1GiB page into 512 2MiB pages so that a part of it can be remapped.
+void static nvc_svmc_split_huge_pdpte(amd64_npt_large_pde_p pde,amd64_npt_huge_pdpte_p huge_pdpte)
+{
+	for(u32 i=0;i<512;i++)
+	{
+		pde[i].value=huge_pdpte->value&~noir_npt_large_base_bits;
+		pde[i].page_base=(huge_pdpte->page_base<<9)+i;
+	}
+}
+
+// Split a 2MiB page into 512 4KiB pages so that a part of it can be remapped.
+// Note that the PAT bit is at different positions.
+void static nvc_svmc_split_large_pde(amd64_npt_pte_p pte,amd64_npt_large_pde_p large_pde)
+{
+	for(u32 i=0;i<512;i++)
+	{
+		pte[i].value=large_pde->value&~(noir_npt_large_base_bits|0x1080);
+		pte[i].pat=large_pde->pat;
+		pte[i].page_base=(large_pde->page_base<<9)+i;
+	}
+}
+
+noir_status static nvc_svmc_create_1gb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	noir_status st=noir_insufficient_resources;
+	noir_npt_pdpte_descriptor_p pdpte_p=noir_arena_alloc_reserved_object(&npt_manager->arena);
+	if(pdpte_p)
+	{
+		pdpte_p->virt=noir_arena_alloc_reserved_page(&npt_manager->arena,&pdpte_p->phys);
+		pdpte_p->pde_index=noir_arena_alloc_reserved_page(&npt_manager->arena,&pdpte_p->pde_index_phys);
+		if(pdpte_p->virt==null || pdpte_p->pde_index==null)
+		{
+			if(pdpte_p->virt)noir_arena_free_page(&npt_manager->arena,pdpte_p->virt,pdpte_p->phys);
+			if(pdpte_p->pde_index)noir_arena_free_page(&npt_manager->arena,pdpte_p->pde_index,pdpte_p->pde_index_phys);
+			noir_arena_free_object(&npt_manager->arena,pdpte_p);
+		}
+		else
+		{
+			amd64_addr_translator gpa_t;
+			gpa_t.value=gpa;
+			// Setup PDPTE descriptor.
+			pdpte_p->gpa_start=page_512gb_base(gpa);
+			// Do mapping - this level.
+			nvc_svmc_set_pdpte_entry(&pdpte_p->virt[gpa_t.pdpte_offset],hpa,map_attrib);
+			// Do mapping - prior level.
+			// Note that PML4E is already described.
+			nvc_svmc_set_pml4e_entry(&npt_manager->ncr3.virt[gpa_t.pml4e_offset],pdpte_p->phys);
+			// Add to the linked list and the index.
+			if(npt_manager->pdpte.head)
+				npt_manager->pdpte.tail->next=pdpte_p;
+			else
+				npt_manager->pdpte.head=pdpte_p;
+			npt_manager->pdpte.tail=pdpte_p;
+			npt_manager->pdpte.index[gpa_t.pml4e_offset]=pdpte_p;
+			st=noir_success;
+		}
+	}
+	return st;
+}
+
+noir_status static nvc_svmc_create_2mb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	noir_status st=noir_insufficient_resources;
+	noir_npt_pde_descriptor_p pde_p=noir_arena_alloc_reserved_object(&npt_manager->arena);
+	if(pde_p)
+	{
+		pde_p->virt=noir_arena_alloc_reserved_page(&npt_manager->arena,&pde_p->phys);
+		pde_p->pte_index=noir_arena_alloc_reserved_page(&npt_manager->arena,&pde_p->pte_index_phys);
+		if(pde_p->virt==null || pde_p->pte_index==null)
+		{
+			if(pde_p->virt)noir_arena_free_page(&npt_manager->arena,pde_p->virt,pde_p->phys);
+			if(pde_p->pte_index)noir_arena_free_page(&npt_manager->arena,pde_p->pte_index,pde_p->pte_index_phys);
+			noir_arena_free_object(&npt_manager->arena,pde_p);
+		}
+		else
+		{
+			noir_npt_pdpte_descriptor_p cur=nvc_svmc_find_pdpte_descriptor(npt_manager,gpa);
+			amd64_addr_translator gpa_t;
+			bool split;
+			gpa_t.value=gpa;
+			split=cur && cur->huge[gpa_t.pdpte_offset].huge_pdpte;
+			// Setup PDE descriptor
+			pde_p->gpa_start=page_1gb_base(gpa);
+			// Preserve the rest of the 1GiB page if it is to be split.
+			if(split)nvc_svmc_split_huge_pdpte(pde_p->large,&cur->huge[gpa_t.pdpte_offset]);
+			// Do mapping. If a 4KiB page is to be mapped in a split page, the caller splits the 2MiB page.
+			if(!split || map_attrib.psize==1)nvc_svmc_set_pde_entry(&pde_p->virt[gpa_t.pde_offset],hpa,map_attrib);
+			// Add to the linked list.
+			if(npt_manager->pde.head)
+				npt_manager->pde.tail->next=pde_p;
+			else
+				npt_manager->pde.head=pde_p;
+			npt_manager->pde.tail=pde_p;
+			if(!cur)
+			{
+				noir_cvm_mapping_attributes null_map={0};
+				// This 512GiB page is not yet described.
+				st=nvc_svmc_create_1gb_page_map(npt_manager,gpa,0,null_map);
+				if(st==noir_success)cur=npt_manager->pdpte.tail;
+			}
+			if(cur)
+			{
+				nvc_svmc_set_pdpte_entry(&cur->virt[gpa_t.pdpte_offset],pde_p->phys,map_attrib);
+				cur->pde_index[gpa_t.pdpte_offset]=pde_p;
+				st=noir_success;
+			}
+		}
+	}
+	return st;
+}
+
+noir_status static nvc_svmc_create_4kb_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	noir_status st=noir_insufficient_resources;
+	noir_npt_pte_descriptor_p pte_p=noir_arena_alloc_reserved_object(&npt_manager->arena);
+	if(pte_p)
+	{
+		pte_p->virt=noir_arena_alloc_reserved_page(&npt_manager->arena,&pte_p->phys);
+		if(pte_p->virt==null)
+			noir_arena_free_object(&npt_manager->arena,pte_p);
+		else
+		{
+			noir_npt_pde_descriptor_p cur=nvc_svmc_find_pde_descriptor(npt_manager,gpa);
+			amd64_addr_translator gpa_t;
+			gpa_t.value=gpa;
+			// Setup PTE descriptor
+			pte_p->gpa_start=page_2mb_base(gpa);
+			// Do mapping
+			nvc_svmc_set_pte_entry(&pte_p->virt[gpa_t.pte_offset],0,map_attrib);
+			// Add to the linked list
+			if(npt_manager->pte.head)
+				npt_manager->pte.tail->next=pte_p;
+			else
+				npt_manager->pte.head=pte_p;
+			npt_manager->pte.tail=pte_p;
+			if(!cur)
+			{
+				noir_cvm_mapping_attributes null_map={0};
+				// This 1GiB page is not yet described.
+				st=nvc_svmc_create_2mb_page_map(npt_manager,gpa,0,null_map);
+				if(st==noir_success)cur=npt_manager->pde.tail;
+			}
+			if(cur)
+			{
+				// Preserve the rest of the 2MiB page if it is to be split.
+				if(cur->large[gpa_t.pde_offset].large_pde)nvc_svmc_split_large_pde(pte_p->virt,&cur->large[gpa_t.pde_offset]);
+				nvc_svmc_set_pde_entry(&cur->virt[gpa_t.pde_offset],pte_p->phys,map_attrib);
+				cur->pte_index[gpa_t.pde_offset]=pte_p;
+				st=noir_success;
+			}
+		}
+	}
+	return st;
+}
+
+noir_status nvc_svmc_set_page_map(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
+{
+	noir_status st=noir_unsuccessful;
+	amd64_addr_translator gpa_t;
+	gpa_t.value=gpa;
+	switch(map_attrib.psize)
+	{
+		case 0:
+		{
+			// Search for existing PTEs.
+			noir_npt_pte_descriptor_p cur=nvc_svmc_find_pte_descriptor(npt_manager,gpa);
+			if(!cur)
+			{
+				noir_cvm_mapping_attributes null_map={0};
+				// This 2MiB page is not described yet.
+				st=nvc_svmc_create_4kb_page_map(npt_manager,gpa,0,null_map);
+				if(st==noir_success)cur=npt_manager->pte.tail;
+			}
+			if(cur)
+			{
+				nvc_svmc_set_pte_entry(&cur->virt[gpa_t.pte_offset],hpa,map_attrib);
+				st=noir_success;
+			}
+			break;
+		}
+		case 1:
+		{
+			// Search for existing PDEs.
+			noir_npt_pde_descriptor_p cur=nvc_svmc_find_pde_descriptor(npt_manager,gpa);
+			if(!cur)
+				st=nvc_svmc_create_2mb_page_map(npt_manager,gpa,hpa,map_attrib);
+			else
+			{
+				// The PTE table, if any, is detached. It is released by nvc_svmc_release_detached_tables.
+				nvc_svmc_set_pde_entry(&cur->virt[gpa_t.pde_offset],hpa,map_attrib);
+				cur->pte_index[gpa_t.pde_offset]=null;
+				st=noir_success;
+			}
+			break;
+		}
+		case 2:
+		{
+			// Search for existing PDPTEs.
+			noir_npt_pdpte_descriptor_p cur=nvc_svmc_find_pdpte_descriptor(npt_manager,gpa);
+			if(!cur)
+				st=nvc_svmc_create_1gb_page_map(npt_manager,gpa,hpa,map_attrib);
+			else
+			{
+				// The PDE table, if any, is detached. It is released by nvc_svmc_release_detached_tables.
+				nvc_svmc_set_pdpte_entry(&cur->virt[gpa_t.pdpte_offset],hpa,map_attrib);
+				cur->pde_index[gpa_t.pdpte_offset]=null;
+				st=noir_success;
+			}
+			break;
+		}
+		default:
+		{
+			st=noir_not_implemented;
+			break;
+		}
+	}
+	return st;
+}
+
+/*
+  Tables replaced by large pages are no longer indexed, but they are still linked.
+  Release them in one pass over the lists. The caller must ensure no vCPUs are running.
+  Descriptors of detached PTE tables are checked through the index before their PDE tables are released.
+*/
+void nvc_svmc_release_detached_tables(noir_svm_custom_npt_manager_p nptm)
+{
+	noir_npt_pte_descriptor_p *pte_link=&nptm->pte.head;
+	noir_npt_pde_descriptor_p *pde_link=&nptm->pde.head;
+	nptm->pte.tail=null;
+	while(*pte_link)
+	{
+		noir_npt_pte_descriptor_p pte_p=*pte_link;
+		if(nvc_svmc_find_pte_descriptor(nptm,pte_p->gpa_start)==pte_p)
+		{
+			nptm->pte.tail=pte_p;
+			pte_link=&pte_p->next;
+		}
+		else
+		{
+			*pte_link=pte_p->next;
+			noir_arena_free_page(&nptm->arena,pte_p->virt,pte_p->phys);
+			noir_arena_free_object(&nptm->arena,pte_p);
+		}
+	}
+	nptm->pde.tail=null;
+	while(*pde_link)
+	{
+		noir_npt_pde_descriptor_p pde_p=*pde_link;
+		if(nvc_svmc_find_pde_descriptor(nptm,pde_p->gpa_start)==pde_p)
+		{
+			nptm->pde.tail=pde_p;
+			pde_link=&pde_p->next;
+		}
+		else
+		{
+			*pde_link=pde_p->next;
+			noir_arena_free_page(&nptm->arena,pde_p->virt,pde_p->phys);
+			noir_arena_free_page(&nptm->arena,pde_p->pte_index,pde_p->pte_index_phys);
+			noir_arena_free_object(&nptm->arena,pde_p);
+		}
+	}
+}
+
+// Accessing bits of the merged entries are accumulated into the large entry.
+bool static nvc_svmc_promote_pte_table(noir_npt_pde_descriptor_p pde_p,noir_npt_pte_descriptor_p pte_p,u32 index)
+{
+	const u64 attributes=pte_p->virt[0].value&~(noir_npt_pte_base_bits|noir_npt_accessing_bits);
+	const u64 base=pte_p->virt[0].page_base;
+	u64 accessing=0;
+	amd64_npt_large_pde large_pde;
+	if(!pte_p->virt[0].present || (base&511))return false;
+	for(u32 i=0;i<512;i++)
+	{
+		if((pte_p->virt[i].value&~(noir_npt_pte_base_bits|noir_npt_accessing_bits))!=attributes)return false;
+		if(pte_p->virt[i].page_base!=base+i)return false;
+		accessing|=pte_p->virt[i].value&noir_npt_accessing_bits;
+	}
+	// Note that the PAT bit is at different positions.
+	large_pde.value=(attributes&~0x80)|accessing;
+	large_pde.pat=pte_p->virt[0].pat;
+	large_pde.large_pde=1;
+	large_pde.page_base=base>>9;
+	pde_p->large[index].value=large_pde.value;
+	pde_p->pte_index[index]=null;
+	return true;
+}
+
+bool static nvc_svmc_promote_pde_table(noir_npt_pdpte_descriptor_p pdpte_p,noir_npt_pde_descriptor_p pde_p,u32 index)
+{
+	const u64 attributes=pde_p->virt[0].value&~(noir_npt_large_base_bits|noir_npt_accessing_bits);
+	const u64 base=pde_p->large[0].page_base;
+	u64 accessing=0;
+	amd64_npt_huge_pdpte huge_pdpte;
+	if(!pde_p->large[0].present || !pde_p->large[0].large_pde || (base&511))return false;
+	for(u32 i=0;i<512;i++)
+	{
+		if((pde_p->virt[i].value&~(noir_npt_large_base_bits|noir_npt_accessing_bits))!=attributes)return false;
+		if(pde_p->large[i].page_base!=base+i)return false;
+		accessing|=pde_p->virt[i].value&noir_npt_accessing_bits;
+	}
+	huge_pdpte.value=attributes|accessing;
+	huge_pdpte.page_base=base>>9;
+	pdpte_p->huge[index].value=huge_pdpte.value;
+	pdpte_p->pde_index[index]=null;
+	return true;
+}
+
+/*
+  Promote fully-populated tables into large pages so that the walk is shorter and fewer TLB entries are needed.
+  A table is merged if all its entries are present, have identical attributes and map contiguous, aligned HPAs.
+  PTE tables are merged first, so that PDE tables consisting of merged 2MiB pages are merged in the same pass.
+  The caller must ensure no vCPUs are running. Return the number of tables merged.
+*/
+u32 nvc_svmc_promote_page_maps(noir_svm_custom_npt_manager_p nptm)
+{
+	u32 promoted=0;
+	for(noir_npt_pte_descriptor_p pte_p=nptm->pte.head;pte_p;pte_p=pte_p->next)
+	{
+		if(nvc_svmc_find_pte_descriptor(nptm,pte_p->gpa_start)==pte_p)
+		{
+			amd64_addr_translator gpa_t;
+			gpa_t.value=pte_p->gpa_start;
+			promoted+=nvc_svmc_promote_pte_table(nvc_svmc_find_pde_descriptor(nptm,pte_p->gpa_start),pte_p,(u32)gpa_t.pde_offset);
+		}
+	}
+	for(noir_npt_pde_descriptor_p pde_p=nptm->pde.head;pde_p;pde_p=pde_p->next)
+	{
+		if(nvc_svmc_find_pde_descriptor(nptm,pde_p->gpa_start)==pde_p)
+		{
+			amd64_addr_translator gpa_t;
+			gpa_t.value=pde_p->gpa_start;
+			promoted+=nvc_svmc_promote_pde_table(nvc_svmc_find_pdpte_descriptor(nptm,pde_p->gpa_start),pde_p,(u32)gpa_t.pdpte_offset);
+		}
+	}
+	if(promoted)nvc_svmc_release_detached_tables(nptm);
+	return promoted;
+}
+
+// Return the size of the leaf entry that maps this GPA, in the encoding of noir_cvm_mapping_attributes.psize.
+u32 nvc_svmc_get_page_map_size(noir_svm_custom_npt_manager_p npt_manager,u64 gpa)
+{
+	amd64_addr_translator trans;
+	noir_npt_pdpte_descriptor_p pdpte_p;
+	trans.value=gpa;
+	pdpte_p=npt_manager->pdpte.index[trans.pml4e_offset];
+	if(pdpte_p)
+	{
+		noir_npt_pde_descriptor_p pde_p=pdpte_p->pde_index[trans.pdpte_offset];
+		if(pdpte_p->huge[trans.pdpte_offset].huge_pdpte)return 2;
+		if(pde_p && pde_p->large[trans.pde_offset].large_pde)return 1;
+	}
+	return 0;
+}
+
+bool nvc_svmc_get_physical_mapping(noir_svm_custom_npt_manager_p npt_manager,u64 gpa,u64p hpa,bool r,bool w,bool x)
+{
+	amd64_npt_pml4e_p pml4e;
+	amd64_addr_translator trans;
+	trans.value=gpa;
+	pml4e=&npt_manager->ncr3.virt[trans.pml4e_offset];
+	*hpa=0;
+	if(pml4e->present>=r && pml4e->write>=w && pml4e->no_execute<=x)
+	{
+		noir_npt_pdpte_descriptor_p pdpte_p=npt_manager->pdpte.index[trans.pml4e_offset];
+		if(pdpte_p)
+		{
+			amd64_npt_huge_pdpte_p pdpte=&pdpte_p->huge[trans.pdpte_offset];
+			if(pdpte->present>=r && pdpte->write>=w && pdpte->no_execute<=x)
+			{
+				noir_npt_pde_descriptor_p pde_p=pdpte_p->pde_index[trans.pdpte_offset];
+				if(pdpte->huge_pdpte)
+				{
+					*hpa=page_1gb_mult((u64)pdpte->page_base)|page_1gb_offset(gpa);
+					return true;
+				}
+				if(pde_p)
+				{
+					amd64_npt_large_pde_p pde=&pde_p->large[trans.pde_offset];
+					if(pde->present>=r && pde->write>=w && pde->no_execute<=x)
+					{
+						noir_npt_pte_descriptor_p pte_p=pde_p->pte_index[trans.pde_offset];
+						if(pde->large_pde)
+						{
+							*hpa=page_2mb_mult((u64)pde->page_base)|page_2mb_offset(gpa);
+							return true;
+						}
+						if(pte_p)
+						{
+							amd64_npt_pte_p pte=&pte_p->virt[trans.pte_offset];
+							if(pte->present>=r && pte->write>=w && pte->no_execute<=x)
+							{
+								*hpa=page_4kb_mult(pte->page_base)|trans.page_offset;
+								return true;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Spread the lower 32 bits into the even bits of a qword.
+u64 static nvc_svmc_spread_bits(u64 x)
+{
+	x=(x|(x<<16))&0x0000FFFF0000FFFF;
+	x=(x|(x<<8))&0x00FF00FF00FF00FF;
+	x=(x|(x<<4))&0x0F0F0F0F0F0F0F0F;
+	x=(x|(x<<2))&0x3333333333333333;
+	x=(x|(x<<1))&0x5555555555555555;
+	return x;
+}
+
+// Compact the accessing bits of 32 PTEs into a qword, two bits per entry.
+// Each bit of interest is shifted to the sign bit so that movmskpd gathers two entries at a time.
+u64 static nvc_svmc_compact_accessing_bits(amd64_npt_pte_p pte,u32p present)
+{
+	u64 a=0,d=0,p=0;
+	for(u32 i=0;i<32;i+=2)
+	{
+		__m128i x=_mm_loadu_si128((__m128i*)&pte[i]);
+		p|=(u64)_mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(x,63)))<<i;
+		a|=(u64)_mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(x,58)))<<i;
+		d|=(u64)_mm_movemask_pd(_mm_castsi128_pd(_mm_slli_epi64(x,57)))<<i;
+	}
+	*present=(u32)p;
+	return nvc_svmc_spread_bits(a)|(nvc_svmc_spread_bits(d)<<1);
+}
+
+// The bitmap is written byte-wise here so that it is never overrun.
+void static nvc_svmc_write_accessing_bits(void* bitmap,u32 index,u8 bits)
+{
+	u8p p=&((u8p)bitmap)[index>>2];
+	const u8 shift=(u8)((index&3)<<1);
+	*p=(u8)((*p&~(3<<shift))|(bits<<shift));
+}
+
+void static nvc_svmc_fill_accessing_bits(void* bitmap,u32 index,u32 count,u8 bits)
+{
+	const u64 pattern=0x5555555555555555*bits;
+	const u32 limit=index+count;
+	u32 i=index;
+	for(;i<limit && (i&31);i++)nvc_svmc_write_accessing_bits(bitmap,i,bits);
+	for(;i+32<=limit;i+=32)((u64p)bitmap)[i>>5]=pattern;
+	for(;i<limit;i++)nvc_svmc_write_accessing_bits(bitmap,i,bits);
+}
+
+// Atomically clear the accessing bits so that no updates from hardware would be lost.
+u64 static nvc_svmc_clear_accessing_bits(u64p entry)
+{
+	u64 value=*entry;
+	if(value&noir_npt_accessing_bits)value=(u64)noir_locked_and64((i64vp)entry,~(i64)noir_npt_accessing_bits);
+	return value;
+}
+
+// Harvest a run of PTEs in the same table, 32 entries at a time if possible.
+// Return the number of entries harvested before an absent entry is encountered.
+u32 static nvc_svmc_harvest_pte_run(amd64_npt_pte_p pte,u32 count,void* bitmap,u32 index,bool clear)
+{
+	u32 i=0;
+	while(i<count)
+	{
+		u32 present=0;
+		u64 bits=0;
+		if(((index+i)&31)==0 && i+32<=count)bits=nvc_svmc_compact_accessing_bits(&pte[i],&present);
+		if(present==0xffffffff)
+		{
+			if(clear && bits)
+			{
+				for(u32 j=0;j<32;j++)
+				{
+					const u64 value=nvc_svmc_clear_accessing_bits(&pte[i+j].value);
+					// Catch the bits set by hardware since the compaction.
+					bits|=((value&noir_npt_accessing_bits)>>5)<<(j<<1);
+				}
+			}
+			if(bitmap)((u64p)bitmap)[(index+i)>>5]=bits;
+			i+=32;
+		}
+		else
+		{
+			// Fall back to single entries at boundaries or around absent entries.
+			const u32 limit=i+32-((index+i)&31)<count?i+32-((index+i)&31):count;
+			for(;i<limit;i++)
+			{
+				u64 value=pte[i].value;
+				if(!pte[i].present)return i;
+				if(clear)value=nvc_svmc_clear_accessing_bits(&pte[i].value);
+				if(bitmap)nvc_svmc_write_accessing_bits(bitmap,index+i,(u8)((value&noir_npt_accessing_bits)>>5));
+			}
+		}
+	}
+	return i;
+}
+
+/*
+  Harvest the accessing bits of a range of GPAs in one pass.
+  The bitmap receives two bits per page: accessed bit in even bit and dirty bit in odd bit.
+  Bitmap is optional. If clear is specified, the accessing bits are atomically reset.
+  Each table is walked only once per range it describes.
+*/
+noir_status nvc_svmc_harvest_gpa_accessing_bits(noir_svm_custom_npt_manager_p nptm,u64 gpa_start,u32 page_count,void* bitmap,bool clear)
+{
+	u32 i=0;
+	while(i<page_count)
+	{
+		const u64 gpa=gpa_start+page_4kb_mult((u64)i);
+		noir_npt_pdpte_descriptor_p pdpte_p;
+		amd64_npt_general_entry_p leaf;
+		amd64_addr_translator trans;
+		u32 span;
+		trans.value=gpa;
+		pdpte_p=nptm->pdpte.index[trans.pml4e_offset];
+		if(!nptm->ncr3.virt[trans.pml4e_offset].present || !pdpte_p || !pdpte_p->virt[trans.pdpte_offset].present)break;
+		if(pdpte_p->huge[trans.pdpte_offset].huge_pdpte)
+		{
+			// All pages until the next 1GiB boundary share the same entry.
+			leaf=(amd64_npt_general_entry_p)&pdpte_p->virt[trans.pdpte_offset];
+			span=(u32)page_4kb_count(page_1gb_size-page_1gb_offset(gpa));
+		}
+		else
+		{
+			noir_npt_pde_descriptor_p pde_p=pdpte_p->pde_index[trans.pdpte_offset];
+			if(!pde_p || !pde_p->virt[trans.pde_offset].present)break;
+			if(pde_p->large[trans.pde_offset].large_pde)
+			{
+				// All pages until the next 2MiB boundary share the same entry.
+				leaf=(amd64_npt_general_entry_p)&pde_p->virt[trans.pde_offset];
+				span=(u32)page_4kb_count(page_2mb_size-page_2mb_offset(gpa));
+			}
+			else
+			{
+				noir_npt_pte_descriptor_p pte_p=pde_p->pte_index[trans.pde_offset];
+				const u32 count=512-(u32)trans.pte_offset<page_count-i?512-(u32)trans.pte_offset:page_count-i;
+				u32 harvested;
+				if(!pte_p)break;
+				harvested=nvc_svmc_harvest_pte_run(&pte_p->virt[trans.pte_offset],count,bitmap,i,clear);
+				i+=harvested;
+				if(harvested<count)break;
+				continue;
+			}
+		}
+		if(span>page_count-i)span=page_count-i;
+		{
+			const u64 value=clear?nvc_svmc_clear_accessing_bits(&leaf->value):leaf->value;
+			if(bitmap)nvc_svmc_fill_accessing_bits(bitmap,i,span,(u8)((value&noir_npt_accessing_bits)>>5));
+		}
+		i+=span;
+	}
+	return i<page_count?noir_guest_page_absent:noir_success;
+}
+
+void nvc_svmc_finalize_npt_manager(noir_svm_custom_npt_manager_p nptm)
+{
+	// Release all descriptors and paging structures in bulk.
+	noir_finalize_page_arena(&nptm->arena);
+	// Release the index and the Nested Paging Structure.
+	if(nptm->pdpte.index)noir_free_nonpg_memory(nptm->pdpte.index);
+	if(nptm->ncr3.virt)noir_free_contd_memory(nptm->ncr3.virt,page_size);
+	noir_stosb(nptm,0,sizeof(noir_svm_custom_npt_manager));
+}
+
+// Reserve the paging structures for mapping a range of pages. This function must be called in passive context.
+noir_status nvc_svmc_reserve_npt_tables(noir_svm_custom_npt_manager_p nptm,u32 pages)
+{
+	// Each 2MiB requires a PTE table. Each 1GiB and 512GiB requires a table and an index. Both ends could be split.
+	const u32 descriptors=(pages>>9)+(pages>>18)+(pages>>27)+6;
+	const u32 tables=descriptors+(pages>>18)+(pages>>27)+4;
+	// Descriptors are carved from the pages of the arena as well.
+	const u32 slot_pages=descriptors/(page_size/nptm->arena.object_size)+1;
+	if(noir_reserve_page_arena(&nptm->arena,tables+slot_pages+noir_arena_reserve_pages))return noir_success;
+	return noir_insufficient_resources;
+}
+
+noir_status nvc_svmc_initialize_npt_manager(noir_svm_custom_npt_manager_p nptm)
+{
+	// The PDPTE descriptor is the largest one, so the slots can hold any descriptors.
+	noir_initialize_page_arena(&nptm->arena,sizeof(noir_npt_pdpte_descriptor));
+	// Create a generic Page Map Level 4 (PML4) Table.
+	nptm->ncr3.virt=noir_alloc_contd_memory(page_size);
+	nptm->pdpte.index=noir_alloc_nonpg_memory(page_size);
+	// Paging structures are taken from the reserved pages only.
+	if(nptm->ncr3.virt && nptm->pdpte.index && noir_reserve_page_arena(&nptm->arena,noir_arena_reserve_pages))
+	{
+		nptm->ncr3.phys=noir_get_physical_address(nptm->ncr3.virt);
+		return noir_success;
+	}
+	nvc_svmc_finalize_npt_manager(nptm);
+	return noir_insufficient_resources;
+}
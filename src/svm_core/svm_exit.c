@@ -749,6 +749,8 @@ void static noir_hvcode fastcall nvc_svm_invlpga_handler(noir_gpr_state_p gpr_st
 		// Beyond the range are the ASIDs reserved for Customizable VM.
 		if(asid>0 && asid<hvm_p->tlb_tagging.start-2)
 			noir_svm_invlpga(addr,asid+1);
+		// The nested hypervisor may have changed its NPT. Synchronize the shadow NPT.
+		if(vcpu->nested_hvm.snpt)nvc_svm_snpt_synchronize(vcpu->nested_hvm.snpt);
 		noir_svm_advance_rip(vmcb);
 	}
 	else
@@ -1068,19 +1070,11 @@ void static noir_hvcode fastcall nvc_svm_vmrun_handler(noir_gpr_state_p gpr_stat
 			noir_svm_inject_event(vmcb,amd64_general_protection,amd64_fault_trap_exception,true,true,0);
 		else
 		{
-			void* nested_vmcb_va=(void*)nested_vmcb_pa;
-			// Get a node.
+			// Get a node. The least recently used node is recycled for new VMCB.
 			noir_svm_nested_vcpu_node_p nvcpu=nvc_svm_get_nested_vcpu_node(&vcpu->nested_hvm,nested_vmcb_pa);
 			nvd_printf("Intercepted Nested VM-Entry! Guest VMCB: 0x%p, Shadowed VMCB: 0x%p\n",nested_vmcb_pa,nvcpu->vmcb_t.phys);
-			if(nvcpu->vmcb_c.phys!=nested_vmcb_pa)
-			{
-				nvd_printf("New/Collided VMCB! Assigning shadowed VMCB: 0x%p for 0x%p!\n",nvcpu->vmcb_t.phys,nested_vmcb_pa);
-				// Collision occured!
-				nvcpu->vmcb_c.phys=nested_vmcb_pa;
-				nvcpu->vmcb_c.virt=nested_vmcb_va;
-				// Invalidate the cached state of VMCB.
-				nvcpu->flags.clean=false;
-			}
+			// A recycled node missed previous vmload broadcasts. Load the state from Current VMCB.
+			if(!nvcpu->flags.clean)nvc_svm_vmsl_helper(nvcpu->vmcb_t.virt,vmcb);
 			nvc_svm_switch_to_nested_vcpu(gpr_state,vcpu,nvcpu);
 			noir_svm_advance_rip(vmcb);
 		}
@@ -1248,8 +1242,7 @@ void static noir_hvcode fastcall nvc_svm_vmmcall_handler(noir_gpr_state_p gpr_st
 #endif
 				reassignment->result=nvc_validate_rmt_reassignment(reassignment->hpa_list,reassignment->gpa_list,reassignment->pages,reassignment->asid,reassignment->shared,reassignment->ownership);
 				if(reassignment->result)	// If validation fails, do not reconfigure the reverse mapping.
-					for(u32 i=0;i<reassignment->pages;i++)
-						nvc_configure_reverse_mapping(reassignment->hpa_list[i],reassignment->gpa_list[i],reassignment->asid,reassignment->shared,reassignment->ownership);
+					nvc_configure_reverse_mapping_batch(reassignment->hpa_list,reassignment->gpa_list,reassignment->pages,reassignment->asid,reassignment->shared,reassignment->ownership);
 			}
 			break;
 		}
@@ -1350,9 +1343,10 @@ void static noir_hvcode fastcall nvc_svm_vmload_handler(noir_gpr_state_p gpr_sta
 			nvd_printf("Intercepted vmload! Source VMCB: 0x%p\n",nested_vmcb_pa);
 			// Load to Current VMCB.
 			nvc_svm_vmsl_helper(vmcb,nested_vmcb);
-			// Broadcast to all nodes in nested VMCB.
-			for(u32 i=0;i<noir_svm_cached_nested_vmcb;i++)
-				nvc_svm_vmsl_helper(vcpu->nested_hvm.node_pool[i].vmcb_t.virt,nested_vmcb);
+			// Broadcast to cached nodes in nested VMCB. Cached nodes precede unused nodes in the Cache List.
+			// Unused nodes will be loaded from Current VMCB on Nested VM-Entry.
+			for(noir_svm_nested_vcpu_node_p node=vcpu->nested_hvm.head;node && node->hash_pprev;node=node->cl_next)
+				nvc_svm_vmsl_helper(node->vmcb_t.virt,nested_vmcb);
 			// Everything are loaded to Current VMCB. Return to guest.
 			noir_svm_advance_rip(vmcb);
 		}
@@ -1510,6 +1504,10 @@ void static noir_hvcode fastcall nvc_svm_nested_pf_handler(noir_gpr_state_p gpr_
 	amd64_npt_fault_code fault;
 	fault.value=noir_svm_vmread64(vcpu->vmcb.virt,exit_info1);
 	noir_rmt_entry_p rm_table=nvc_get_rmt_entry(gpa);
+	// The nested hypervisor writes to its NPT being shadowed. Let the write go through.
+	if(fault.write && vcpu->relative_hvm->snpt_registry && noir_svm_vmread64(vcpu->vmcb.virt,npt_cr3)==vcpu->relative_hvm->primary_nptm->ncr3.phys)
+		if(nvc_svm_snpt_handle_l0_write(vcpu,gpa))
+			return;
 	// MMIO ranges are not reverse-mapped!
 	if(rm_table)
 	{
@@ -1561,7 +1559,12 @@ void static noir_hvcode fastcall nvc_svm_nested_pf_handler(noir_gpr_state_p gpr_
 				// In this regard, we assume this instruction is writing protected page.
 				void* gva;
 				if(noir_ci_is_ci_phys_page(gpa,&gva))
-					nvd_printf("CI-event is intercepted! #NPF Code: 0x%x, GPA=0x%p, GVA=0x%p, rip=0x%p\n",fault.value,gpa,gva,gip);
+				{
+					// Do not print synchronously. The guest may keep writing the page.
+					nvd_tracef("CI-event is intercepted! #NPF Code: 0x%x, GPA=0x%p, GVA=0x%p, rip=0x%p\n",fault.value,gpa,gva,gip);
+					// Let the CI worker re-hash this page.
+					noir_ci_log_write(gpa);
+				}
 				else
 				{
 					// Might be Linux KVM's bug. Not confirmed.
@@ -1842,6 +1845,8 @@ void noir_hvcode fastcall nvc_svm_exit_handler(noir_gpr_state_p gpr_state,noir_s
 		nvd_printf("vCPU pointer: 0x%p, GPR Base: 0x%p\n",vcpu,gpr_state);
 		noir_int3();
 	}
+	// Pages protected by other processors require the TLB to be flushed.
+	nvc_svm_snpt_acknowledge_flush(vcpu);
 	// The rax in GPR state should be the physical address of VMCB
 	// in order to execute the vmrun instruction properly.
 	// Reading/Writing the rax is like the vmptrst/vmptrld instruction in Intel VT-x.
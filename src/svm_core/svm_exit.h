@@ -165,6 +165,7 @@ void static fastcall nvc_svm_stgi_handler(noir_gpr_state_p gpr_state,noir_svm_vc
 void static fastcall nvc_svm_clgi_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu);
 void static fastcall nvc_svm_skinit_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu);
 void static fastcall nvc_svm_nested_pf_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu);
+void static fastcall nvc_svm_vmsl_helper(void* dest_vmcb,void* src_vmcb);
 
 noir_hvdata noir_svm_exit_handler_routine svm_exit_handler_group1[noir_svm_maximum_code1]=
 {
@@ -451,6 +452,7 @@ void nvc_svm_nsv_load_nae_synthetic_msr_state(noir_svm_custom_vcpu_p cvcpu);
 void static fastcall nvc_svm_nvexit_default_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu);
 void static fastcall nvc_svm_nvexit_cpuid_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu);
 void static fastcall nvc_svm_nvexit_shutdown_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu);
+void static fastcall nvc_svm_nvexit_npf_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu);
 
 noir_hvdata noir_svm_nvexit_handler_routine svm_nvexit_handler_group1[noir_svm_maximum_code1]=
 {
@@ -546,7 +548,7 @@ noir_hvdata noir_svm_nvexit_handler_routine svm_nvexit_handler_group1[noir_svm_m
 
 noir_hvdata noir_svm_nvexit_handler_routine svm_nvexit_handler_group2[noir_svm_maximum_code2]=
 {
-	nvc_svm_nvexit_default_handler,					// Nested Page Fault
+	nvc_svm_nvexit_npf_handler,						// Nested Page Fault
 	nvc_svm_nvexit_default_handler,					// AVIC Incomplete Virtual IPI Delivery
 	nvc_svm_nvexit_default_handler,					// Virtual APIC Access Unhandled by AVIC Hardware
 	nvc_svm_nvexit_default_handler					// vmgexit Instruction
@@ -227,6 +227,9 @@ void static nvc_svm_setup_control_area(noir_svm_vcpu_p vcpu)
 		vcpu->enabled_feature|=noir_svm_nested_paging;
 	if(d & amd64_cpuid_flush_asid_bit)
 		vcpu->enabled_feature|=noir_svm_flush_by_asid;
+	// The first ASID assignment for CVM will start a new generation.
+	vcpu->cvm_asid.generation=1;
+	vcpu->cvm_asid.next=0;
 	if(d & amd64_cpuid_vgif_bit)
 		vcpu->enabled_feature|=noir_svm_virtual_gif;
 	if(d & amd64_cpuid_vmlsvirt_bit)
@@ -554,12 +557,12 @@ void nvc_svm_cleanup(noir_hypervisor_p hvm_p)
 				noir_free_nonpg_memory(vcpu->hv_stack);
 			if(vcpu->cvm_state.xsave_area)
 				noir_free_contd_memory(vcpu->cvm_state.xsave_area,page_size);
-			for(u32 j=0;j<noir_svm_cached_nested_vmcb;j++)
-				if(vcpu->nested_hvm.node_pool[j].vmcb_t.virt)
-					noir_free_contd_memory(vcpu->nested_hvm.node_pool[j].vmcb_t.virt,page_size);
+			nvc_svm_finalize_nested_vcpu_cache(&vcpu->nested_hvm);
+			nvc_svm_finalize_shadow_npt(vcpu);
 		}
 		noir_free_nonpg_memory(hvm_p->virtual_cpu);
 	}
+	nvc_svm_finalize_snpt_registry(hvm_p->relative_hvm);
 	if(hvm_p->relative_hvm->primary_nptm)
 		nvc_npt_cleanup(hvm_p->relative_hvm->primary_nptm);
 #if !defined(_hv_type1)
@@ -592,6 +595,8 @@ void nvc_svm_cleanup(noir_hypervisor_p hvm_p)
 		}
 		noir_free_contd_memory(hvm_p->rmd.directory.virt,page_size);
 	}
+	if(hvm_p->rmd.index.virt)
+		noir_free_contd_memory(hvm_p->rmd.index.virt,hvm_p->rmd.index_count<<2);
 }
 
 noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
@@ -640,14 +645,8 @@ noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 			vcpu->relative_hvm=(noir_svm_hvm_p)hvm_p->reserved;
 			if(hvm_p->options.nested_virtualization)		// Setup Nested Hypervisor
 			{
-				for(u32 j=0;j<noir_svm_cached_nested_vmcb;j++)
-				{
-					vcpu->nested_hvm.node_pool[j].vmcb_t.virt=noir_alloc_contd_memory(page_size);
-					if(vcpu->nested_hvm.node_pool[j].vmcb_t.virt)
-						vcpu->nested_hvm.node_pool[j].vmcb_t.phys=noir_get_physical_address(vcpu->nested_hvm.node_pool[j].vmcb_t.virt);
-					else
-						goto alloc_failure;
-				}
+				if(nvc_svm_initialize_nested_vcpu_cache(&vcpu->nested_hvm,noir_svm_cached_nested_vmcb)!=noir_success)goto alloc_failure;
+				if(nvc_svm_initialize_shadow_npt(vcpu)!=noir_success)goto alloc_failure;
 			}
 #if !defined(_hv_type1)
 			if(hvm_p->options.stealth_msr_hook)vcpu->enabled_feature|=noir_svm_syscall_hook;
@@ -667,6 +666,9 @@ noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 	}
 	hvm_p->relative_hvm->primary_nptm=nvc_npt_build_identity_map();
 	if(hvm_p->relative_hvm->primary_nptm==null)goto alloc_failure;
+	// Shadow NPTs on all processors share the write-protection in primary NPT.
+	if(hvm_p->options.nested_virtualization)
+		if(nvc_svm_initialize_snpt_registry(hvm_p->relative_hvm,hvm_p->cpu_count)!=noir_success)goto alloc_failure;
 #if !defined(_hv_type1)
 	// Only Type-II Hypervisor would hook into guest.
 	hvm_p->relative_hvm->secondary_nptm=nvc_npt_build_identity_map();
@@ -701,8 +703,8 @@ noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 		u32 bitmap_size;
 		hvm_p->tlb_tagging.start=hvm_p->relative_hvm->virt_cap.asid_limit>>1;
 		hvm_p->tlb_tagging.limit=hvm_p->relative_hvm->virt_cap.asid_limit-hvm_p->tlb_tagging.start;
-		bitmap_size=hvm_p->tlb_tagging.limit>>3;
-		if(hvm_p->tlb_tagging.limit & 7)bitmap_size++;
+		// Bitmaps are scanned in qwords.
+		bitmap_size=((hvm_p->tlb_tagging.limit+63)>>6)<<3;
 		hvm_p->tlb_tagging.asid_pool=noir_alloc_nonpg_memory(bitmap_size);
 	}
 	else
@@ -710,8 +712,8 @@ noir_status nvc_svm_subvert_system(noir_hypervisor_p hvm_p)
 		u32 bitmap_size;
 		hvm_p->tlb_tagging.start=2;
 		hvm_p->tlb_tagging.limit=hvm_p->relative_hvm->virt_cap.asid_limit-2;
-		bitmap_size=hvm_p->tlb_tagging.limit>>3;
-		if(hvm_p->tlb_tagging.limit & 7)bitmap_size++;
+		// Bitmaps are scanned in qwords.
+		bitmap_size=((hvm_p->tlb_tagging.limit+63)>>6)<<3;
 		hvm_p->tlb_tagging.asid_pool=noir_alloc_nonpg_memory(bitmap_size);
 	}
 	nv_dprintf("Number of ASIDs reserved for Customizable VMs: %u\n",hvm_p->tlb_tagging.limit);
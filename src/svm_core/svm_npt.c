@@ -32,28 +32,8 @@ void nvc_npt_cleanup(noir_npt_manager_p nptm)
 			noir_free_contd_memory(nptm->ncr3.virt,page_size);
 		if(nptm->pdpt.virt)
 			noir_free_2mb_page(nptm->pdpt.virt);
-		if(nptm->pde.head)
-		{
-			noir_npt_pde_descriptor_p cur=nptm->pde.head;
-			while(cur)
-			{
-				noir_npt_pde_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		if(nptm->pte.head)
-		{
-			noir_npt_pte_descriptor_p cur=nptm->pte.head;
-			while(cur)
-			{
-				noir_npt_pte_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
+		// Descriptors and tables of split pages are released in bulk.
+		noir_finalize_page_arena(&nptm->arena);
 		noir_free_nonpg_memory(nptm);
 	}
 }
@@ -90,16 +70,16 @@ noir_npt_pde_descriptor_p nvc_npt_split_pdpte(noir_npt_manager_p nptm,u64 gpa,bo
 	if(alloc==true && pde_p==null)
 	{
 		// The 1GB page has not been described yet.
-		pde_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pde_descriptor));
+		// This could be in VM-exit context. Only use the reserved pages.
+		pde_p=noir_arena_alloc_reserved_object(&nptm->arena);
 		if(pde_p)
 		{
-			pde_p->virt=noir_alloc_contd_memory(page_size);
+			pde_p->virt=noir_arena_alloc_reserved_page(&nptm->arena,&pde_p->phys);
 			if(pde_p->virt)
 			{
 				const u64 index=page_1gb_count(gpa);
 				amd64_npt_pdpte_p pdpte_p=(amd64_npt_pdpte_p)&nptm->pdpt.virt[index];
 				// PDE Descriptor
-				pde_p->phys=noir_get_physical_address(pde_p->virt);
 				pde_p->gpa_start=index<<page_shift_diff64;
 				for(u32 i=0;i<page_table_entries64;i++)
 				{
@@ -124,12 +104,12 @@ noir_npt_pde_descriptor_p nvc_npt_split_pdpte(noir_npt_manager_p nptm,u64 gpa,bo
 				}
 				goto update_pdpte;
 			}
-			noir_free_nonpg_memory(pde_p);
+			noir_arena_free_object(&nptm->arena,pde_p);
 		}
 	}
 update_pdpte:
 	// If in host mode, update PDPTE.
-	if(host)
+	if(host && pde_p)
 	{
 		const u64 index=page_1gb_count(gpa);
 		amd64_npt_pdpte_p pdpte_p=(amd64_npt_pdpte_p)&nptm->pdpt.virt[index];
@@ -152,10 +132,11 @@ noir_npt_pte_descriptor_p nvc_npt_split_pde(noir_npt_manager_p nptm,u64 gpa,bool
 	if(alloc==true && pte_p==null)
 	{
 		// The 2MB page has not been described yet.
-		pte_p=noir_alloc_nonpg_memory(sizeof(noir_npt_pte_descriptor));
+		// This could be in VM-exit context. Only use the reserved pages.
+		pte_p=noir_arena_alloc_reserved_object(&nptm->arena);
 		if(pte_p)
 		{
-			pte_p->virt=noir_alloc_contd_memory(page_size);
+			pte_p->virt=noir_arena_alloc_reserved_page(&nptm->arena,&pte_p->phys);
 			if(pte_p->virt)
 			{
 				// Split the PDPTE first.
@@ -165,7 +146,6 @@ noir_npt_pte_descriptor_p nvc_npt_split_pde(noir_npt_manager_p nptm,u64 gpa,bool
 					const u64 pfn_index=page_2mb_count(gpa);
 					const u64 pde_index=page_entry_index64(pfn_index);
 					// PTE Descriptor
-					pte_p->phys=noir_get_physical_address(pte_p->virt);
 					pte_p->gpa_start=pfn_index<<page_shift_diff64;
 					for(u32 i=0;i<page_table_entries64;i++)
 					{
@@ -189,13 +169,13 @@ noir_npt_pte_descriptor_p nvc_npt_split_pde(noir_npt_manager_p nptm,u64 gpa,bool
 					}
 					goto update_pde;
 				}
-				noir_free_contd_memory(pte_p->virt,page_size);
+				noir_arena_free_page(&nptm->arena,pte_p->virt,pte_p->phys);
 			}
-			noir_free_nonpg_memory(pte_p);
+			noir_arena_free_object(&nptm->arena,pte_p);
 		}
 	}
 update_pde:
-	if(host)
+	if(host && pte_p)
 	{
 		// If in host mode, update PDE.
 		noir_npt_pde_descriptor_p pde_p=nvc_npt_split_pdpte(nptm,gpa,host,alloc);
@@ -214,6 +194,8 @@ bool nvc_npt_update_pdpte(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,
 {
 	const u64 index=page_1gb_count(gpa);
 	amd64_npt_pdpte_p pdpte_p=(amd64_npt_pdpte_p)&nptm->pdpt.virt[index];
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&nptm->arena,noir_arena_reserve_pages)==false)return false;
 	if(h)
 	{
 		// Reset to huge PDPTE.
@@ -237,8 +219,11 @@ bool nvc_npt_update_pdpte(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,
 
 bool nvc_npt_update_pde(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,bool x,bool l,bool alloc)
 {
+	noir_npt_pde_descriptor_p pde_p;
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&nptm->arena,noir_arena_reserve_pages)==false)return false;
 	// Split the PDPTE.
-	noir_npt_pde_descriptor_p pde_p=nvc_npt_split_pdpte(nptm,gpa,true,alloc);
+	pde_p=nvc_npt_split_pdpte(nptm,gpa,true,alloc);
 	if(pde_p)
 	{
 		amd64_addr_translator gat;
@@ -268,8 +253,11 @@ bool nvc_npt_update_pde(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,bo
 
 bool nvc_npt_update_pte(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,bool x,bool alloc)
 {
+	noir_npt_pte_descriptor_p pte_p;
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&nptm->arena,noir_arena_reserve_pages)==false)return false;
 	// Split the PDE
-	noir_npt_pte_descriptor_p pte_p=nvc_npt_split_pde(nptm,gpa,true,alloc);
+	pte_p=nvc_npt_split_pde(nptm,gpa,true,alloc);
 	if(pte_p)
 	{
 		amd64_addr_translator gat;
@@ -326,6 +314,9 @@ bool nvc_npt_protect_critical_hypervisor(noir_hypervisor_p hvm)
 			result&=nvc_npt_update_pte(pri_nptm,cur->phys,hvm->relative_hvm->blank_page.phys,true,true,true,true);
 		// Protect Reverse-Mapping Directory...
 		result&=nvc_npt_update_pte(pri_nptm,hvm_p->rmd.directory.phys,hvm_p->rmd.directory.phys,true,false,true,true);
+		// Protect the index of Reverse-Mapping Directory...
+		for(u64 phys=hvm_p->rmd.index.phys;phys<hvm_p->rmd.index.phys+(hvm_p->rmd.index_count<<2);phys+=page_size)
+			result&=nvc_npt_update_pte(pri_nptm,phys,phys,true,false,true,true);
 		// Protect Reverse-Mapping Tables...
 		for(u64 i=0;i<hvm_p->rmd.dir_count;i++)
 		{
@@ -447,13 +438,15 @@ noir_npt_manager_p nvc_npt_build_identity_map()
 #endif
 	if(nptm)
 	{
+		noir_initialize_page_arena(&nptm->arena,sizeof(noir_npt_pde_descriptor));
 		nptm->ncr3.virt=noir_alloc_contd_memory(page_size);
 		if(nptm->ncr3.virt)
 		{
 			nptm->pdpt.virt=noir_alloc_2mb_page();
 			if(nptm->pdpt.virt)
 			{
-				alloc_success=true;
+				// Paging structures are split from the reserved pages only.
+				alloc_success=noir_reserve_page_arena(&nptm->arena,noir_arena_reserve_pages);
 				nptm->pdpt.phys=noir_get_physical_address(nptm->pdpt.virt);
 			}
 			nptm->ncr3.phys=noir_get_physical_address(nptm->ncr3.virt);
@@ -589,6 +582,8 @@ bool static nvc_npt_reassign_page_ownership_unsafe(u64p hpa,u64p gpa,u32 pages,u
 	// Stage I: Split the PDPTEs and PDEs, if haven't done already.
 	for(u32 i=0;i<pages;i++)
 	{
+		// Top up the arena in passive context so that splitting never refills it.
+		if(noir_reserve_page_arena(&pri_nptm->arena,noir_arena_reserve_pages)==false)goto alloc_failure;
 		// Get splitted PDPTE and PDE.
 		noir_npt_pde_descriptor_p pde_p=nvc_npt_split_pdpte(pri_nptm,hpa[i],false,false);
 		noir_npt_pte_descriptor_p pte_p=nvc_npt_split_pde(pri_nptm,hpa[i],false,false);
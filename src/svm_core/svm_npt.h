@@ -156,6 +156,12 @@ typedef union _amd64_npt_general_entry
 	u64 value;
 }amd64_npt_general_entry,*amd64_npt_general_entry_p;
 
+// Accessed and dirty bits are at the same position in all levels of leaf entries.
+#define noir_npt_accessing_bits		0x60
+// Page bases of leaf entries.
+#define noir_npt_pte_base_bits		0x000FFFFFFFFFF000
+#define noir_npt_large_base_bits	0x000FFFFFFFE00000
+
 // Notice that NPT PDPTE Descriptor is describing
 // 512 1GiB-Pages in a 512GiB Page.
 typedef struct _noir_npt_pdpte_descriptor
@@ -168,6 +174,8 @@ typedef struct _noir_npt_pdpte_descriptor
 	};
 	u64 phys;
 	u64 gpa_start;
+	struct _noir_npt_pde_descriptor** pde_index;	// Only CVM NPT Manager uses the index.
+	u64 pde_index_phys;								// Required to return the index page to the arena.
 }noir_npt_pdpte_descriptor,*noir_npt_pdpte_descriptor_p;
 
 // Notice that NPT PDE Descriptor is describing
@@ -182,6 +190,8 @@ typedef struct _noir_npt_pde_descriptor
 	};
 	u64 phys;
 	u64 gpa_start;
+	struct _noir_npt_pte_descriptor** pte_index;	// Only CVM NPT Manager uses the index.
+	u64 pte_index_phys;								// Required to return the index page to the arena.
 }noir_npt_pde_descriptor,*noir_npt_pde_descriptor_p;
 
 // Notice that NPT PTE Descriptor is describing
@@ -216,6 +226,7 @@ typedef struct _noir_npt_manager
 		noir_npt_pte_descriptor_p head;
 		noir_npt_pte_descriptor_p tail;
 	}pte;
+	noir_page_arena arena;
 #if !defined(_hv_type1)
 	noir_pushlock nptm_lock;
 	noir_hook_page hook_pages[1];
@@ -246,10 +257,152 @@ typedef union _amd64_npt_fault_code
 	u64 value;
 }amd64_npt_fault_code,*amd64_npt_fault_code_p;
 
+// Shadow NPT for nested guests whose hypervisor enables NPT.
+// Default number of shadow tables per vCPU. The pool is physically contiguous.
+#define noir_svm_shadow_npt_pages		512
+#define noir_svm_shadow_npt_min_pages	8
+// Number of L1 tables written on other processors that can be posted before synchronization.
+#define noir_svm_shadow_npt_remote_writes	16
+
+// Translate GPA of the nested hypervisor (L1) with NoirVisor's NPT (L0).
+// The base of the entry is the HPA frame of the GPA. The size_shift indicates
+// the size of the L0 mapping, in which the HPA is contiguous.
+typedef bool (*noir_svm_snpt_translate_routine)
+(
+ void* context,
+ u64 gpa,
+ amd64_npt_general_entry_p entry,
+ u32p size_shift
+);
+
+// Get the host virtual address of a 4KiB page in L1 GPA space.
+typedef void* (*noir_svm_snpt_map_routine)
+(
+ void* context,
+ u64 gpa
+);
+
+// Write-protect or unprotect a page in L1 GPA space. Returns true if the protection is in effect.
+typedef bool (*noir_svm_snpt_protect_routine)
+(
+ void* context,
+ u64 gpa,
+ bool protect
+);
+
+typedef struct _noir_svm_shadow_npt_page
+{
+	// Cache List of leaf tables. Free pages are linked by cl_next.
+	struct _noir_svm_shadow_npt_page *cl_next;
+	struct _noir_svm_shadow_npt_page *cl_prev;
+	// Hash chain of the bucket indexed by the GPA of the shadowed L1 table.
+	struct _noir_svm_shadow_npt_page *hash_next;
+	struct _noir_svm_shadow_npt_page **hash_pprev;
+	// List of tables whose L1 tables are not write-protected.
+	struct _noir_svm_shadow_npt_page *unsync_next;
+	struct _noir_svm_shadow_npt_page **unsync_pprev;
+	struct _noir_svm_shadow_npt_page *parent;
+	amd64_npt_general_entry_p virt;
+	u64 phys;
+	u64 guest_table;		// Fragments of L1 large pages do not shadow L1 tables.
+	u32 parent_index;
+	u8 level;				// 1=PT, 2=PD, 3=PDPT, 4=PML4
+	u8 in_use:1;
+	u8 hashed:1;
+	u8 unsync:1;
+	u8 reserved:5;
+}noir_svm_shadow_npt_page,*noir_svm_shadow_npt_page_p;
+
+typedef struct _noir_svm_shadow_npt_statistics
+{
+	u64 fills;			// Nested page faults resolved by filling the shadow.
+	u64 reflects;		// Nested page faults reflected to L1.
+	u64 host_faults;	// Nested page faults violating L0 NPT.
+	u64 evictions;		// Leaf tables recycled from the Cache List.
+	u64 resyncs;		// Tables zapped because L1 wrote them.
+	u64 resets;			// The pool is drained and everything is zapped.
+}noir_svm_shadow_npt_statistics,*noir_svm_shadow_npt_statistics_p;
+
+typedef struct _noir_svm_shadow_npt_manager
+{
+	noir_svm_shadow_npt_page_p pool;
+	noir_svm_shadow_npt_page_p free;
+	noir_svm_shadow_npt_page_p head;		// The most recently filled leaf table.
+	noir_svm_shadow_npt_page_p tail;
+	noir_svm_shadow_npt_page_p unsync;
+	noir_svm_shadow_npt_page_p root;
+	noir_svm_shadow_npt_page_p *buckets;
+	memory_descriptor tables;
+	u32 capacity;
+	u32 bucket_shift;
+	// The shadow has dropped translations. TLB of the nested guest must be flushed.
+	bool flush_pending;
+	// L1 GPA of the last nested page fault violating L0 NPT.
+	u64 host_fault_gpa;
+	// L1 tables written on other processors. Their shadows are marked out-of-sync on synchronization.
+	struct
+	{
+		u64 list[noir_svm_shadow_npt_remote_writes];
+		u32 count;
+		bool overflow;		// Too many tables are written. Mark all shadows out-of-sync.
+		i32v lock;
+	}remote_writes;
+	noir_svm_snpt_translate_routine translate;
+	noir_svm_snpt_map_routine map;
+	noir_svm_snpt_protect_routine protect;
+	void* context;
+	noir_svm_shadow_npt_statistics statistics;
+}noir_svm_shadow_npt_manager,*noir_svm_shadow_npt_manager_p;
+
+// L1 tables are write-protected in the primary NPT, which is shared by all processors.
+// The registry keeps track of the processors whose shadows rely on the protection.
+#define noir_svm_snpt_registry_entries	1024
+
+typedef struct _noir_svm_snpt_protection
+{
+	struct _noir_svm_snpt_protection *next;
+	u64 gpa;
+	// The protection is in effect after all processors have flushed their TLBs of this generation.
+	u64 generation;
+	u64p holders;		// Bitmap indexed by processor.
+}noir_svm_snpt_protection,*noir_svm_snpt_protection_p;
+
+typedef struct _noir_svm_snpt_registry
+{
+	noir_svm_snpt_protection_p pool;
+	noir_svm_snpt_protection_p free;
+	noir_svm_snpt_protection_p *buckets;
+	u64p bitmaps;
+	// Generation of the TLB flush each processor has performed.
+	u64v *flushed;
+	u64v generation;
+	u32 bucket_shift;
+	u32 bitmap_words;
+	u32 cpu_count;
+	i32v lock;
+}noir_svm_snpt_registry,*noir_svm_snpt_registry_p;
+
+typedef enum _noir_svm_snpt_fault_result
+{
+	noir_svm_snpt_fault_resolved,
+	noir_svm_snpt_fault_reflect,		// Violation in L1 NPT. Reflect the #NPF to L1.
+	noir_svm_snpt_fault_host			// Violation in L0 NPT.
+}noir_svm_snpt_fault_result,*noir_svm_snpt_fault_result_p;
+
+noir_status nvc_svm_snpt_initialize(noir_svm_shadow_npt_manager_p snpt,u32 capacity);
+void nvc_svm_snpt_finalize(noir_svm_shadow_npt_manager_p snpt);
+void nvc_svm_snpt_reset(noir_svm_shadow_npt_manager_p snpt);
+u64 nvc_svm_snpt_switch_root(noir_svm_shadow_npt_manager_p snpt,u64 ncr3);
+noir_svm_snpt_fault_result nvc_svm_snpt_handle_fault(noir_svm_shadow_npt_manager_p snpt,u64 ngpa,amd64_npt_fault_code_p fault);
+bool nvc_svm_snpt_handle_table_write(noir_svm_shadow_npt_manager_p snpt,u64 gpa);
+void nvc_svm_snpt_post_table_write(noir_svm_shadow_npt_manager_p snpt,u64 gpa);
+void nvc_svm_snpt_synchronize(noir_svm_shadow_npt_manager_p snpt);
 bool nvc_npt_protect_critical_hypervisor(noir_hypervisor_p hvm);
 bool nvc_npt_initialize_ci(noir_npt_manager_p nptm);
 noir_npt_manager_p nvc_npt_build_identity_map();
 void nvc_npt_build_reverse_map();
+noir_npt_pde_descriptor_p nvc_npt_split_pdpte(noir_npt_manager_p nptm,u64 gpa,bool host,bool alloc);
+noir_npt_pte_descriptor_p nvc_npt_split_pde(noir_npt_manager_p nptm,u64 gpa,bool host,bool alloc);
 bool nvc_npt_update_pde(noir_npt_manager_p nptm,u64 gpa,u64 hpa,bool r,bool w,bool x,bool l,bool alloc);
 bool nvc_npt_update_pte(noir_npt_manager_p nptm,u64 hpa,u64 gpa,bool r,bool w,bool x,bool alloc);
 #if defined(_hv_type1)
@@ -69,8 +69,7 @@ void noir_hvcode nvc_svm_switch_from_nested_vcpu(noir_gpr_state_p gpr_state,noir
 	noir_svm_vmcopy8(vmcb_c,vmcb_t,number_of_bytes_fetched);
 	for(u32 i=0;i<15;i++)noir_svm_vmcopy8(vmcb_c,vmcb_t,guest_instruction_bytes+i);
 	// Copy Nested vCPU State.
-	// Unfortunately, there's no cached-state mechanism we can utilize here.
-	// We have to be dumb and just synchronize everything.
+	// States that the nested guest can modify without VM-Exit are always copied.
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,avic_control);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_interrupt);
 	// Copy ES Segment.
@@ -93,32 +92,42 @@ void noir_hvcode nvc_svm_switch_from_nested_vcpu(noir_gpr_state_p gpr_state,noir
 	noir_svm_vmcopy16(vmcb_c,vmcb_t,guest_ds_attrib);
 	noir_svm_vmcopy32(vmcb_c,vmcb_t,guest_ds_limit);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_ds_base);
-	// Copy GDT Register.
-	noir_svm_vmcopy16(vmcb_c,vmcb_t,guest_gdtr_limit);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_gdtr_base);
-	// Copy IDT Register.
-	noir_svm_vmcopy16(vmcb_c,vmcb_t,guest_idtr_limit);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_gdtr_base);
 	// Copy whatever else.
 	noir_svm_vmcopy8(vmcb_c,vmcb_t,guest_cpl);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_efer);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr4);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr3);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr0);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_dr7);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_dr6);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_rflags);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_rip);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_rsp);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_s_cet);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_ssp);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_isst);
 	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_rax);
-	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr2);
-	// We may optionally copy some states due to the switches.
-	if(noir_svm_vmcb_bt32(vmcb_t,npt_control,nvc_svm_npt_control_npt))
-		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_pat);
-	if(noir_svm_vmcb_bt32(vmcb_t,lbr_virtualization_control,nvc_svm_lbr_virt_control_lbr))
+	noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_pat);
+	// Other states are copied only if the nested guest could have modified them.
+	if(nvcpu->dirty.crx)
+	{
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr4);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr3);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr0);
+	}
+	if(nvcpu->dirty.dr7)
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_dr7);
+	if(nvcpu->dirty.dt)
+	{
+		// Copy GDT Register.
+		noir_svm_vmcopy16(vmcb_c,vmcb_t,guest_gdtr_limit);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_gdtr_base);
+		// Copy IDT Register.
+		noir_svm_vmcopy16(vmcb_c,vmcb_t,guest_idtr_limit);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_idtr_base);
+	}
+	if(nvcpu->dirty.cr2)
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_cr2);
+	if(nvcpu->dirty.cet)
+	{
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_s_cet);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_ssp);
+		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_isst);
+	}
+	if(nvcpu->dirty.lbr)
 	{
 		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_debug_ctrl);
 		noir_svm_vmcopy64(vmcb_c,vmcb_t,guest_last_branch_from);
@@ -137,16 +146,19 @@ void noir_hvcode nvc_svm_switch_from_nested_vcpu(noir_gpr_state_p gpr_state,noir
 	noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_gs_attrib);
 	noir_svm_vmcopy32(vmcb_l1,vmcb_t,guest_gs_limit);
 	noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_gs_base);
-	// Copy Task Register
-	noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_tr_selector);
-	noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_tr_attrib);
-	noir_svm_vmcopy32(vmcb_l1,vmcb_t,guest_tr_limit);
-	noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_tr_base);
-	// Copy Local Descriptor Table Register
-	noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_ldtr_selector);
-	noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_ldtr_attrib);
-	noir_svm_vmcopy32(vmcb_l1,vmcb_t,guest_ldtr_limit);
-	noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_ldtr_base);
+	if(nvcpu->dirty.tr_ldtr)
+	{
+		// Copy Task Register
+		noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_tr_selector);
+		noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_tr_attrib);
+		noir_svm_vmcopy32(vmcb_l1,vmcb_t,guest_tr_limit);
+		noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_tr_base);
+		// Copy Local Descriptor Table Register
+		noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_ldtr_selector);
+		noir_svm_vmcopy16(vmcb_l1,vmcb_t,guest_ldtr_attrib);
+		noir_svm_vmcopy32(vmcb_l1,vmcb_t,guest_ldtr_limit);
+		noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_ldtr_base);
+	}
 	// Copy Model-Specific Registers
 	noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_sysenter_cs);
 	noir_svm_vmcopy64(vmcb_l1,vmcb_t,guest_sysenter_esp);
@@ -165,6 +177,49 @@ void noir_hvcode nvc_svm_switch_from_nested_vcpu(noir_gpr_state_p gpr_state,noir
 	loader_stack->guest_vmcb_pa=vcpu->vmcb.phys;
 }
 
+/*
+  Dirty Tracking of Nested vCPU State:
+
+  Upon VM-Exit from the nested guest (L2), its state must be copied back to the VMCB
+  of the nested hypervisor (L1). Some states can be modified by L2 only with certain
+  instructions or events. If all of them are intercepted, the state in the VMCB used
+  by NoirVisor is still identical to L1's VMCB, so copying the state can be skipped.
+  Task switches could load CR0.TS, CR3, DR7, TR and LDTR, but not in long mode.
+*/
+// The MSR Permission Map of nested hypervisor is identity-mapped, like the nested VMCB.
+bool static noir_hvcode nvc_svm_is_nested_msr_write_intercepted(void* vmcb_t,u32 index)
+{
+	const u32 vector1=noir_svm_vmread32(vmcb_t,intercept_instruction1);
+	const u8p msrpm=(u8p)noir_svm_vmread(vmcb_t,msrpm_physical_address);
+	if(!noir_bt(&vector1,nvc_svm_intercept_vector1_msr))return false;
+	// MSRs 0-0x1FFF are described by the first 2KiB. Each MSR takes two bits. The upper one intercepts writes.
+	return (msrpm[index>>2]>>(((index&3)<<1)+1))&1;
+}
+
+void static noir_hvcode nvc_svm_set_nested_dirty_groups(noir_svm_nested_vcpu_node_p nvcpu_node)
+{
+	void* vmcb_t=nvcpu_node->vmcb_t.virt;
+	const u32 cr_intercept=noir_svm_vmread32(vmcb_t,intercept_access_cr);
+	const u32 dr_intercept=noir_svm_vmread32(vmcb_t,intercept_access_dr);
+	const u32 ex_intercept=noir_svm_vmread32(vmcb_t,intercept_exceptions);
+	const u32 vector1=noir_svm_vmread32(vmcb_t,intercept_instruction1);
+	// Task switches are impossible in long mode, but the guest can leave long mode unless CR0 writes are intercepted.
+	const bool cr0_intercept=noir_bt(&cr_intercept,16) || noir_bt(&vector1,nvc_svm_intercept_vector1_cr0_tsmp);
+	const bool ts_intercept=noir_bt(&vector1,nvc_svm_intercept_vector1_ts) || (cr0_intercept && noir_svm_vmcb_bt32(vmcb_t,guest_efer,amd64_efer_lma));
+	// Writes to CR0, including clts and lmsw instructions, are intercepted by Bit 16.
+	nvcpu_node->dirty.crx=!(ts_intercept && noir_bt(&cr_intercept,16) && noir_bt(&cr_intercept,19) && noir_bt(&cr_intercept,20));
+	// Delivering a #DB clears DR7.GD.
+	nvcpu_node->dirty.dr7=!(ts_intercept && noir_bt(&dr_intercept,23) && !noir_svm_vmcb_bt32(vmcb_t,guest_dr7,13));
+	nvcpu_node->dirty.dt=!(noir_bt(&vector1,nvc_svm_intercept_vector1_lgdt) && noir_bt(&vector1,nvc_svm_intercept_vector1_lidt));
+	// Delivering a #PF writes CR2.
+	nvcpu_node->dirty.cr2=!(noir_bt(&ex_intercept,amd64_page_fault) && noir_bt(&cr_intercept,18));
+	nvcpu_node->dirty.lbr=noir_svm_vmcb_bt32(vmcb_t,lbr_virtualization_control,nvc_svm_lbr_virt_control_lbr);
+	// SSP can be modified only if CR4.CET is set. S_CET and ISST_ADDR can be modified by wrmsr regardless of CR4.CET.
+	nvcpu_node->dirty.cet=nvcpu_node->dirty.crx || noir_svm_vmcb_bt32(vmcb_t,guest_cr4,amd64_cr4_cet);
+	if(!nvc_svm_is_nested_msr_write_intercepted(vmcb_t,amd64_s_cet) || !nvc_svm_is_nested_msr_write_intercepted(vmcb_t,amd64_isst_addr))nvcpu_node->dirty.cet=true;
+	nvcpu_node->dirty.tr_ldtr=!(ts_intercept && noir_bt(&vector1,nvc_svm_intercept_vector1_ltr) && noir_bt(&vector1,nvc_svm_intercept_vector1_lldt));
+}
+
 void noir_hvcode nvc_svm_switch_to_nested_vcpu(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu_node)
 {
 	noir_svm_initial_stack_p loader_stack=noir_svm_get_loader_stack(vcpu->hv_stack);
@@ -191,6 +246,15 @@ void noir_hvcode nvc_svm_switch_to_nested_vcpu(noir_gpr_state_p gpr_state,noir_s
 	noir_svm_vmcopy64(vmcb_t,vmcb_c,guest_rip);
 	noir_svm_vmcopy64(vmcb_t,vmcb_c,guest_rsp);
 	noir_svm_vmcopy64(vmcb_t,vmcb_c,guest_rax);
+	// Shadow the NPT of nested hypervisor.
+	if(vcpu->nested_hvm.snpt && noir_svm_vmcb_bt32(vmcb_c,npt_control,nvc_svm_npt_control_npt))
+	{
+		// Flushing the TLB indicates the nested hypervisor may have changed its NPT.
+		if(noir_svm_vmread8(vmcb_c,tlb_control)!=nvc_svm_tlb_control_do_nothing)nvc_svm_snpt_synchronize(vcpu->nested_hvm.snpt);
+		nvc_svm_load_shadow_npt(vcpu,vmcb_t,noir_svm_vmread64(vmcb_c,npt_cr3));
+	}
+	// Determine the states to be copied back on VM-Exit.
+	nvc_svm_set_nested_dirty_groups(nvcpu_node);
 	// Mark cache of this nested vCPU is clean.
 	nvcpu_node->flags.clean=true;
 	// No need to emulate set GIF because this is a new VMCB.
@@ -254,8 +318,8 @@ void static noir_hvcode fastcall nvc_svm_clean_vmcb_np(void* vmcb_c,void* vmcb_t
 	// Cached States for Nested Paging are invalidated.
 	if(noir_svm_vmcb_bt32(vmcb_c,npt_control,nvc_svm_npt_control_npt))
 	{
-		// FIXME: Shadow Nested Paging.
-		// Current implementation forwards the NPT, meaning that the nested hypervisor
+		// The NPT is replaced by the shadow NPT on nested VM-Entry.
+		// If shadow NPT is unavailable, the NPT is forwarded, meaning that the nested hypervisor
 		// in the guest can disable NoirVisor's security featured implemented via NPT.
 		noir_svm_vmcopy64(vmcb_t,vmcb_c,npt_control);
 		noir_svm_vmcopy64(vmcb_t,vmcb_c,npt_cr3);
@@ -369,18 +433,417 @@ void static noir_hvcode fastcall nvc_svm_clean_vmcb_cet(void* vmcb_c,void* vmcb_
 	noir_svm_vmcb_btr32(vmcb_t,vmcb_clean_bits,noir_svm_clean_cet);
 }
 
+/*
+  Nested VMCB Cache:
+
+  Translated VMCBs are kept in a Cache List (see /doc/cache_list.md).
+  The Cache List sorts the nodes by time of reference so that the least
+  recently used node is recycled when a new nested VMCB is encountered.
+  The search operation is implemented with hash buckets indexed by the
+  nested VMCB GPA. Chains are doubly-linked via pointer-to-pointer so
+  that a recycled node can be unhashed in constant time.
+  There are at least twice as many buckets as the capacity, so that
+  every operation takes constant time on average.
+*/
+u32 static noir_hvcode nvc_svm_hash_nested_vmcb(noir_svm_nested_vcpu_p nvcpu,u64 vmcb)
+{
+	// Fibonacci hashing on the page frame number.
+	return (u32)((page_4kb_count(vmcb)*0x9E3779B97F4A7C15)>>nvcpu->bucket_shift);
+}
+
+// Place the node at the head of the Cache List.
+void static noir_hvcode nvc_svm_reference_nested_vcpu_node(noir_svm_nested_vcpu_p nvcpu,noir_svm_nested_vcpu_node_p node)
+{
+	if(nvcpu->head!=node)
+	{
+		// Remove the node from the middle.
+		node->cl_prev->cl_next=node->cl_next;
+		if(node->cl_next)
+			node->cl_next->cl_prev=node->cl_prev;
+		else
+			nvcpu->tail=node->cl_prev;
+		// Place the node at the head.
+		node->cl_prev=null;
+		node->cl_next=nvcpu->head;
+		nvcpu->head->cl_prev=node;
+		nvcpu->head=node;
+	}
+}
+
 noir_svm_nested_vcpu_node_p noir_hvcode nvc_svm_get_nested_vcpu_node(noir_svm_nested_vcpu_p nvcpu,u64 vmcb)
 {
-	// Hash the VMCB GPA into 4 bits.
-	u8 hash=0xC;
-	for(u32 i=12;i<64;i+=4)
+	noir_svm_nested_vcpu_node_p *bucket=&nvcpu->buckets[nvc_svm_hash_nested_vmcb(nvcpu,vmcb)];
+	noir_svm_nested_vcpu_node_p node;
+	for(node=*bucket;node;node=node->hash_next)
 	{
-		u8 cur_value=(u8)((vmcb>>i)&0xF);
-		hash^=cur_value;
+		if(node->vmcb_c.phys==vmcb)
+		{
+			nvcpu->statistics.hits++;
+			nvc_svm_reference_nested_vcpu_node(nvcpu,node);
+			return node;
+		}
+	}
+	// Cache miss. Recycle the least recently used node.
+	nvcpu->statistics.misses++;
+	node=nvcpu->tail;
+	if(node->hash_pprev)
+	{
+		// Remove the node from its bucket.
+		*node->hash_pprev=node->hash_next;
+		if(node->hash_next)node->hash_next->hash_pprev=node->hash_pprev;
+		nvcpu->statistics.evictions++;
+	}
+	node->vmcb_c.phys=vmcb;
+	node->vmcb_c.virt=(void*)vmcb;
+	// Invalidate the cached state of VMCB.
+	node->flags.clean=false;
+	// Insert the node into the bucket.
+	node->hash_pprev=bucket;
+	node->hash_next=*bucket;
+	if(*bucket)(*bucket)->hash_pprev=&node->hash_next;
+	*bucket=node;
+	nvc_svm_reference_nested_vcpu_node(nvcpu,node);
+	return node;
+}
+
+void nvc_svm_finalize_nested_vcpu_cache(noir_svm_nested_vcpu_p nvcpu)
+{
+	if(nvcpu->node_pool)
+	{
+		for(u32 i=0;i<nvcpu->capacity;i++)
+			if(nvcpu->node_pool[i].vmcb_t.virt)
+				noir_free_contd_memory(nvcpu->node_pool[i].vmcb_t.virt,page_size);
+		noir_free_nonpg_memory(nvcpu->node_pool);
+		nvcpu->node_pool=null;
+	}
+	if(nvcpu->buckets)
+	{
+		noir_free_nonpg_memory(nvcpu->buckets);
+		nvcpu->buckets=null;
+	}
+}
+
+noir_status nvc_svm_initialize_nested_vcpu_cache(noir_svm_nested_vcpu_p nvcpu,u32 capacity)
+{
+	u32 bucket_bits=1;
+	// It is meaningless if there are too few nodes in the list.
+	if(capacity<2)return noir_invalid_parameter;
+	while((1<<bucket_bits)<(capacity<<1))bucket_bits++;
+	nvcpu->capacity=capacity;
+	nvcpu->bucket_shift=64-bucket_bits;
+	nvcpu->node_pool=noir_alloc_nonpg_memory(sizeof(noir_svm_nested_vcpu_node)*capacity);
+	nvcpu->buckets=noir_alloc_nonpg_memory(sizeof(noir_svm_nested_vcpu_node_p)<<bucket_bits);
+	if(nvcpu->node_pool && nvcpu->buckets)
+	{
+		for(u32 i=0;i<capacity;i++)
+		{
+			noir_svm_nested_vcpu_node_p node=&nvcpu->node_pool[i];
+			node->vmcb_t.virt=noir_alloc_contd_memory(page_size);
+			if(node->vmcb_t.virt==null)goto alloc_failure;
+			node->vmcb_t.phys=noir_get_physical_address(node->vmcb_t.virt);
+			// Link the nodes into the Cache List. Unused nodes are not hashed.
+			node->cl_prev=i?&nvcpu->node_pool[i-1]:null;
+			node->cl_next=i<capacity-1?&nvcpu->node_pool[i+1]:null;
+		}
+		nvcpu->head=&nvcpu->node_pool[0];
+		nvcpu->tail=&nvcpu->node_pool[capacity-1];
+		return noir_success;
+	}
+alloc_failure:
+	nvc_svm_finalize_nested_vcpu_cache(nvcpu);
+	return noir_insufficient_resources;
+}
+
+/*
+  Shadow NPT Callbacks:
+
+  The shadow NPT engine is driven by NoirVisor's primary NPT, which is
+  shared by all processors. Memory cannot be allocated in host context,
+  so only the pages in PDEs which are already split can be protected.
+  Other L1 tables are synchronized on every flush of the TLB.
+
+  Write-protection is shared by all processors. The registry records the
+  processors whose shadows rely on the protection of an L1 table, so that
+  the protection is withdrawn only if no processor relies on it.
+  There is no inter-processor interrupt in host context. Protecting a page
+  advances the generation of TLB flush instead. Every processor flushes
+  its TLB before entering the guest if it has not reached the generation.
+  The protection is in effect after all other processors have flushed.
+  Until then, the L1 table is synchronized on every flush of the TLB.
+  If the L1 table is written on any processor, the protection is removed
+  and the write is posted to the shadows of the processors relying on it.
+*/
+u32 static noir_hvcode nvc_svm_snpt_protection_hash(noir_svm_snpt_registry_p registry,u64 gpa)
+{
+	// Fibonacci hashing on the page frame number.
+	return (u32)((page_4kb_count(gpa)*0x9E3779B97F4A7C15)>>registry->bucket_shift);
+}
+
+// Locate the link to the protection of the page. The link points to null if the page is not protected.
+noir_svm_snpt_protection_p static* noir_hvcode nvc_svm_snpt_find_protection(noir_svm_snpt_registry_p registry,u64 gpa)
+{
+	noir_svm_snpt_protection_p *link=&registry->buckets[nvc_svm_snpt_protection_hash(registry,gpa)];
+	while(*link && (*link)->gpa!=gpa)link=&(*link)->next;
+	return link;
+}
+
+void static noir_hvcode nvc_svm_snpt_remove_protection(noir_svm_snpt_registry_p registry,noir_svm_snpt_protection_p *link)
+{
+	noir_svm_snpt_protection_p entry=*link;
+	*link=entry->next;
+	for(u32 i=0;i<registry->bitmap_words;i++)entry->holders[i]=0;
+	entry->gpa=0;
+	entry->next=registry->free;
+	registry->free=entry;
+}
+
+bool static noir_hvcode nvc_svm_snpt_l0_translate(void* context,u64 gpa,amd64_npt_general_entry_p entry,u32p size_shift)
+{
+	noir_npt_manager_p nptm=hvm_p->relative_hvm->primary_nptm;
+	noir_npt_pde_descriptor_p pde_p;
+	u64 hpa;
+	if(page_256tb_count(gpa))return false;
+	pde_p=nvc_npt_split_pdpte(nptm,gpa,false,false);
+	if(pde_p==null)
+	{
+		entry->value=nptm->pdpt.virt[page_1gb_count(gpa)].value;
+		*size_shift=page_1gb_shift;
+	}
+	else
+	{
+		amd64_addr_translator gat;
+		gat.value=gpa;
+		if(pde_p->large[gat.pde_offset].large_pde)
+		{
+			entry->value=pde_p->virt[gat.pde_offset].value;
+			*size_shift=page_2mb_shift;
+		}
+		else
+		{
+			noir_npt_pte_descriptor_p pte_p=nvc_npt_split_pde(nptm,gpa,false,false);
+			if(pte_p==null)return false;
+			entry->value=pte_p->virt[gat.pte_offset].value;
+			*size_shift=page_4kb_shift;
+		}
+	}
+	// Locate the HPA of the 4KiB page in the L0 mapping.
+	hpa=(entry->value&noir_npt_pte_base_bits&~(((u64)1<<*size_shift)-1))|(gpa&(((u64)1<<*size_shift)-1));
+	entry->base=page_4kb_count(hpa);
+	return entry->present;
+}
+
+void static* noir_hvcode nvc_svm_snpt_l1_map(void* context,u64 gpa)
+{
+	amd64_npt_general_entry entry;
+	u32 size_shift;
+	if(nvc_svm_snpt_l0_translate(context,gpa,&entry,&size_shift))
+		return noir_find_virt_by_phys(page_4kb_mult((u64)entry.base));
+	return null;
+}
+
+bool static noir_hvcode nvc_svm_snpt_l0_protect(void* context,u64 gpa,bool protect)
+{
+	noir_svm_vcpu_p vcpu=(noir_svm_vcpu_p)context;
+	noir_svm_snpt_registry_p registry=hvm_p->relative_hvm->snpt_registry;
+	noir_npt_pte_descriptor_p pte_p=nvc_npt_split_pde(hvm_p->relative_hvm->primary_nptm,gpa,false,false);
+	noir_svm_snpt_protection_p *link,entry;
+	const u32 word=vcpu->proc_id>>6;
+	const u64 bit=(u64)1<<(vcpu->proc_id&63);
+	bool in_effect=true;
+	amd64_addr_translator gat;
+	gat.value=gpa;
+	if(pte_p==null)return false;
+	while(noir_locked_cmpxchg(&registry->lock,-1,0)!=0)noir_pause();
+	link=nvc_svm_snpt_find_protection(registry,gpa);
+	entry=*link;
+	if(protect)
+	{
+		if(entry==null)
+		{
+			// Pages that are read-only in L0 NPT (e.g.: protected by CI) are left alone.
+			if(pte_p->virt[gat.pte_offset].write && registry->free)
+			{
+				entry=registry->free;
+				registry->free=entry->next;
+				entry->next=null;
+				entry->gpa=gpa;
+				*link=entry;
+				noir_locked_and64((i64vp)&pte_p->virt[gat.pte_offset].value,~(i64)2);
+				// Request all processors to flush their TLBs so that writes are intercepted.
+				entry->generation=++registry->generation;
+			}
+			else
+				in_effect=false;
+		}
+		if(entry)
+		{
+			// This processor flushes its TLB before entering the guest.
+			for(u32 i=0;i<registry->cpu_count;i++)
+				if(i!=vcpu->proc_id && registry->flushed[i]<entry->generation)
+					in_effect=false;
+			if(in_effect)entry->holders[word]|=bit;
+		}
+	}
+	else if(entry)
+	{
+		bool held=false;
+		entry->holders[word]&=~bit;
+		for(u32 i=0;i<registry->bitmap_words;i++)held|=entry->holders[i]!=0;
+		// Unprotect the page when no processor relies on the protection.
+		if(!held)
+		{
+			noir_locked_or64((i64vp)&pte_p->virt[gat.pte_offset].value,2);
+			nvc_svm_snpt_remove_protection(registry,link);
+		}
+	}
+	noir_locked_xchg(&registry->lock,0);
+	return in_effect;
+}
+
+// Handle the write to the page protected for shadow NPT. Return true if the write should be re-executed.
+bool noir_hvcode nvc_svm_snpt_handle_l0_write(noir_svm_vcpu_p vcpu,u64 gpa)
+{
+	noir_svm_snpt_registry_p registry=hvm_p->relative_hvm->snpt_registry;
+	const u64 table=gpa&noir_npt_pte_base_bits;
+	noir_npt_pte_descriptor_p pte_p=nvc_npt_split_pde(hvm_p->relative_hvm->primary_nptm,table,false,false);
+	noir_svm_snpt_protection_p *link;
+	bool handled;
+	amd64_addr_translator gat;
+	gat.value=table;
+	if(registry==null || pte_p==null)return false;
+	while(noir_locked_cmpxchg(&registry->lock,-1,0)!=0)noir_pause();
+	link=nvc_svm_snpt_find_protection(registry,table);
+	if(*link)
+	{
+		// Post the write to the shadows of other processors relying on the protection.
+		for(u32 i=0;i<registry->cpu_count;i++)
+			if(i!=vcpu->proc_id && (((*link)->holders[i>>6]>>(i&63))&1))
+				nvc_svm_snpt_post_table_write(hvm_p->virtual_cpu[i].nested_hvm.snpt,table);
+		// Let L1 keep writing the table until it flushes the TLB.
+		noir_locked_or64((i64vp)&pte_p->virt[gat.pte_offset].value,2);
+		nvc_svm_snpt_remove_protection(registry,link);
+		handled=true;
+	}
+	else
+	{
+		// The protection is removed by another processor, but the TLB is stale.
+		handled=pte_p->virt[gat.pte_offset].write;
+	}
+	noir_locked_xchg(&registry->lock,0);
+	if(handled && vcpu->nested_hvm.snpt)nvc_svm_snpt_handle_table_write(vcpu->nested_hvm.snpt,table);
+	return handled;
+}
+
+// Flush the TLB before entering the guest if other processors have protected pages since last flush.
+void noir_hvcode nvc_svm_snpt_acknowledge_flush(noir_svm_vcpu_p vcpu)
+{
+	noir_svm_snpt_registry_p registry=hvm_p->relative_hvm->snpt_registry;
+	if(registry)
+	{
+		const u64 generation=registry->generation;
+		if(registry->flushed[vcpu->proc_id]!=generation)
+		{
+			noir_svm_initial_stack_p loader_stack=noir_svm_get_loader_stack(vcpu->hv_stack);
+			void* vmcb;
+			if(loader_stack->guest_vmcb_pa==vcpu->vmcb.phys)
+				vmcb=vcpu->vmcb.virt;
+			else if(loader_stack->nested_vcpu && loader_stack->guest_vmcb_pa==loader_stack->nested_vcpu->vmcb_t.phys)
+				vmcb=loader_stack->nested_vcpu->vmcb_t.virt;
+			else
+				vmcb=loader_stack->custom_vcpu->vmcb.virt;
+			noir_svm_vmwrite8(vmcb,tlb_control,nvc_svm_tlb_control_flush_entire);
+			registry->flushed[vcpu->proc_id]=generation;
+		}
+	}
+}
+
+noir_status nvc_svm_initialize_snpt_registry(noir_svm_hvm_p relative_hvm,u32 cpu_count)
+{
+	noir_svm_snpt_registry_p registry=noir_alloc_nonpg_memory(sizeof(noir_svm_snpt_registry));
+	u32 bucket_bits=1;
+	if(registry==null)return noir_insufficient_resources;
+	while((1<<bucket_bits)<(noir_svm_snpt_registry_entries<<1))bucket_bits++;
+	relative_hvm->snpt_registry=registry;
+	registry->cpu_count=cpu_count;
+	registry->bitmap_words=(cpu_count+63)>>6;
+	registry->bucket_shift=64-bucket_bits;
+	registry->pool=noir_alloc_nonpg_memory(sizeof(noir_svm_snpt_protection)*noir_svm_snpt_registry_entries);
+	registry->buckets=noir_alloc_nonpg_memory(sizeof(noir_svm_snpt_protection_p)<<bucket_bits);
+	registry->bitmaps=noir_alloc_nonpg_memory(sizeof(u64)*registry->bitmap_words*noir_svm_snpt_registry_entries);
+	registry->flushed=noir_alloc_nonpg_memory(sizeof(u64)*cpu_count);
+	if(registry->pool && registry->buckets && registry->bitmaps && registry->flushed)
+	{
+		for(u32 i=0;i<noir_svm_snpt_registry_entries;i++)
+		{
+			registry->pool[i].holders=&registry->bitmaps[i*registry->bitmap_words];
+			registry->pool[i].next=i<noir_svm_snpt_registry_entries-1?&registry->pool[i+1]:null;
+		}
+		registry->free=&registry->pool[0];
+		return noir_success;
+	}
+	nvc_svm_finalize_snpt_registry(relative_hvm);
+	return noir_insufficient_resources;
+}
+
+void nvc_svm_finalize_snpt_registry(noir_svm_hvm_p relative_hvm)
+{
+	noir_svm_snpt_registry_p registry=relative_hvm->snpt_registry;
+	if(registry)
+	{
+		if(registry->pool)noir_free_nonpg_memory(registry->pool);
+		if(registry->buckets)noir_free_nonpg_memory(registry->buckets);
+		if(registry->bitmaps)noir_free_nonpg_memory(registry->bitmaps);
+		if(registry->flushed)noir_free_nonpg_memory((void*)registry->flushed);
+		noir_free_nonpg_memory(registry);
+		relative_hvm->snpt_registry=null;
+	}
+}
+
+noir_status nvc_svm_initialize_shadow_npt(noir_svm_vcpu_p vcpu)
+{
+	noir_svm_shadow_npt_manager_p snpt=noir_alloc_nonpg_memory(sizeof(noir_svm_shadow_npt_manager));
+	noir_status st=noir_insufficient_resources;
+	if(snpt)
+	{
+		snpt->translate=nvc_svm_snpt_l0_translate;
+		snpt->map=nvc_svm_snpt_l1_map;
+		snpt->protect=nvc_svm_snpt_l0_protect;
+		snpt->context=vcpu;
+		st=nvc_svm_snpt_initialize(snpt,noir_svm_shadow_npt_pages);
+		if(st==noir_success)
+			vcpu->nested_hvm.snpt=snpt;
+		else
+			noir_free_nonpg_memory(snpt);
+	}
+	return st;
+}
+
+void nvc_svm_finalize_shadow_npt(noir_svm_vcpu_p vcpu)
+{
+	if(vcpu->nested_hvm.snpt)
+	{
+		nvc_svm_snpt_finalize(vcpu->nested_hvm.snpt);
+		noir_free_nonpg_memory(vcpu->nested_hvm.snpt);
+		vcpu->nested_hvm.snpt=null;
+	}
+}
+
+// Feed the shadow NPT to the VMCB of nested guest.
+void static noir_hvcode nvc_svm_load_shadow_npt(noir_svm_vcpu_p vcpu,void* vmcb_t,u64 ncr3)
+{
+	noir_svm_shadow_npt_manager_p snpt=vcpu->nested_hvm.snpt;
+	const u64 root=nvc_svm_snpt_switch_root(snpt,ncr3);
+	if(noir_svm_vmread64(vmcb_t,npt_cr3)!=root)
+	{
+		noir_svm_vmwrite64(vmcb_t,npt_cr3,root);
+		noir_svm_vmcb_btr32(vmcb_t,vmcb_clean_bits,noir_svm_clean_npt);
+	}
+	if(snpt->flush_pending)
+	{
+		// Translations are dropped from the shadow NPT.
+		noir_svm_vmwrite8(vmcb_t,tlb_control,vcpu->enabled_feature & noir_svm_flush_by_asid?nvc_svm_tlb_control_flush_guest:nvc_svm_tlb_control_flush_entire);
+		snpt->flush_pending=false;
 	}
-	// Use the hash as index to locate the node.
-	return &nvcpu->node_pool[hash];
-	// It is caller's responsibility to check hash collision!
 }
 
 /*
@@ -418,6 +881,60 @@ void static noir_hvcode fastcall nvc_svm_nvexit_cpuid_handler(noir_gpr_state_p g
 	}
 }
 
+// Expected Intercept Code: 0x400
+void static noir_hvcode fastcall nvc_svm_nvexit_npf_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu)
+{
+	void* vmcb_t=nvcpu->vmcb_t.virt;
+	if(vcpu->nested_hvm.snpt && noir_svm_vmcb_bt32(nvcpu->vmcb_c.virt,npt_control,nvc_svm_npt_control_npt))
+	{
+		const u64 ngpa=noir_svm_vmread64(vmcb_t,exit_info2);
+		amd64_npt_fault_code fault;
+		fault.value=noir_svm_vmread64(vmcb_t,exit_info1);
+		// Do not repeat the TLB flush requested by the nested hypervisor.
+		noir_svm_vmwrite8(vmcb_t,tlb_control,nvc_svm_tlb_control_do_nothing);
+		switch(nvc_svm_snpt_handle_fault(vcpu->nested_hvm.snpt,ngpa,&fault))
+		{
+			case noir_svm_snpt_fault_resolved:
+			{
+				// The shadow is filled. Resume the nested guest.
+				vcpu->nested_hvm.forward=false;
+				break;
+			}
+			case noir_svm_snpt_fault_reflect:
+			{
+				// The fault is caused by L1 NPT. Forward the #NPF to the nested hypervisor.
+				noir_svm_vmwrite64(vmcb_t,exit_info1,fault.value);
+				break;
+			}
+			case noir_svm_snpt_fault_host:
+			{
+				void* instruction;
+				bool long_mode;
+				ulong_ptr gip;
+				// The nested guest writes to an L1 table being shadowed. Let the write go through.
+				if(fault.write && nvc_svm_snpt_handle_l0_write(vcpu,vcpu->nested_hvm.snpt->host_fault_gpa))
+				{
+					vcpu->nested_hvm.forward=false;
+					break;
+				}
+				// The access violates NoirVisor's NPT. Ignore the instruction.
+				instruction=(void*)((ulong_ptr)vmcb_t+guest_instruction_bytes);
+				// Determine the Long-Mode through CS.L bit.
+				long_mode=noir_svm_vmcb_bt32(vmcb_t,guest_cs_attrib,9);
+				gip=noir_svm_vmread(vmcb_t,guest_rip)+noir_get_instruction_length(instruction,long_mode);
+				// If guest is not in long mode, cut the higher 32 bits in rip register.
+				if(!long_mode)gip&=maxu32;
+				noir_svm_vmwrite(vmcb_t,guest_rip,gip);
+				nvd_printf("Nested guest violates NoirVisor's NPT! #NPF Code: 0x%x, NGPA=0x%p\n",fault.value,ngpa);
+				vcpu->nested_hvm.forward=false;
+				break;
+			}
+		}
+		// The shadow NPT may be reset.
+		nvc_svm_load_shadow_npt(vcpu,vmcb_t,noir_svm_vmread64(nvcpu->vmcb_c.virt,npt_cr3));
+	}
+}
+
 // Expected Intercept Code: 0x7F
 void static noir_hvcode fastcall nvc_svm_nvexit_shutdown_handler(noir_gpr_state_p gpr_state,noir_svm_vcpu_p vcpu,noir_svm_nested_vcpu_node_p nvcpu)
 {
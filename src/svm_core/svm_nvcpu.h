@@ -35,6 +35,7 @@ void static fastcall nvc_svm_clean_vmcb_cr2(void* vmcb_c,void* vmcb_t);
 void static fastcall nvc_svm_clean_vmcb_lbr(void* vmcb_c,void* vmcb_t);
 void static fastcall nvc_svm_clean_vmcb_avic(void* vmcb_c,void* vmcb_t);
 void static fastcall nvc_svm_clean_vmcb_cet(void* vmcb_c,void* vmcb_t);
+void static nvc_svm_load_shadow_npt(noir_svm_vcpu_p vcpu,void* vmcb_t,u64 ncr3);
 
 extern noir_svm_cpuid_exit_handler nvcp_svm_cpuid_handler;
 
@@ -0,0 +1,512 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the Shadow NPT engine for nested virtualization of AMD-V.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /svm_core/svm_snpt.c
+*/
+
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+#include <noirhvm.h>
+#include <nv_intrin.h>
+#include <amd64.h>
+#include "svm_npt.h"
+
+/*
+  Shadow NPT:
+
+  When the nested hypervisor (L1) enables NPT for its guest (L2), the
+  hardware can only walk one level of nested paging. The shadow NPT
+  composes the L1 NPT (NGPA->GPA) with NoirVisor's NPT (GPA->HPA) into
+  NGPA->HPA tables that are fed to the VMCB of the nested guest.
+  See /doc/spt.md for the principles.
+
+  Shadows are built lazily on nested page faults. The engine does not
+  touch NoirVisor's NPT directly. The L0 translation, the access to L1
+  memory and the write-protection are provided by callbacks, so that the
+  composition can be verified in user mode against synthetic tables.
+
+  Shadow tables are drawn from a bounded pool of physically contiguous
+  pages, so that the descriptor of a shadow table can be located from
+  the base address in an entry. Leaf tables are sorted by time of fill
+  in a Cache List (see /doc/cache_list.md). If the pool is drained, the
+  least recently filled leaf table is recycled. Tables above the leaf
+  level are rare and are only released by zapping or resetting.
+
+  The L1 tables being shadowed are write-protected in L0 NPT. Writing to
+  them unprotects the L1 table and marks its shadows out-of-sync. The
+  out-of-sync shadows are zapped when L1 flushes the TLB of its guest,
+  either by TLB Control field of VMCB or by invlpga instruction. Tables
+  written since last flush are the only ones to be zapped. If an L1 table
+  cannot be write-protected, its shadows are zapped on every flush.
+
+  The L0 NPT is shared by all processors. If an L1 table is written on
+  another processor, the write is posted to this engine. Posted tables
+  are marked out-of-sync at the next synchronization, right before the
+  zapping. The engine itself is not thread-safe otherwise.
+*/
+
+#define nvc_svm_snpt_index(l,x)		(((x)>>(page_4kb_shift+((l)-1)*9))&0x1FF)
+#define nvc_svm_snpt_level_size(l)	((u64)1<<(page_4kb_shift+((l)-1)*9))
+
+u32 static noir_hvcode nvc_svm_snpt_hash(noir_svm_shadow_npt_manager_p snpt,u64 gpa)
+{
+	// Fibonacci hashing on the page frame number.
+	return (u32)((page_4kb_count(gpa)*0x9E3779B97F4A7C15)>>snpt->bucket_shift);
+}
+
+noir_svm_shadow_npt_page_p static noir_hvcode nvc_svm_snpt_page_of(noir_svm_shadow_npt_manager_p snpt,u64 phys)
+{
+	return &snpt->pool[page_4kb_count(phys-snpt->tables.phys)];
+}
+
+// Search for a shadow of the L1 table. Level zero matches shadows of any levels.
+noir_svm_shadow_npt_page_p static noir_hvcode nvc_svm_snpt_find_page(noir_svm_shadow_npt_manager_p snpt,u64 gpa,u8 level)
+{
+	for(noir_svm_shadow_npt_page_p page=snpt->buckets[nvc_svm_snpt_hash(snpt,gpa)];page;page=page->hash_next)
+		if(page->guest_table==gpa && (level==0 || page->level==level))
+			return page;
+	return null;
+}
+
+void static noir_hvcode nvc_svm_snpt_link_unsync(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	page->unsync=true;
+	page->unsync_pprev=&snpt->unsync;
+	page->unsync_next=snpt->unsync;
+	if(snpt->unsync)snpt->unsync->unsync_pprev=&page->unsync_next;
+	snpt->unsync=page;
+}
+
+void static noir_hvcode nvc_svm_snpt_unlink_unsync(noir_svm_shadow_npt_page_p page)
+{
+	if(page->unsync)
+	{
+		*page->unsync_pprev=page->unsync_next;
+		if(page->unsync_next)page->unsync_next->unsync_pprev=page->unsync_pprev;
+		page->unsync_next=null;
+		page->unsync_pprev=null;
+		page->unsync=false;
+	}
+}
+
+void static noir_hvcode nvc_svm_snpt_hash_page(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page,u64 gpa)
+{
+	noir_svm_shadow_npt_page_p *bucket=&snpt->buckets[nvc_svm_snpt_hash(snpt,gpa)];
+	noir_svm_shadow_npt_page_p sibling=nvc_svm_snpt_find_page(snpt,gpa,0);
+	page->guest_table=gpa;
+	page->hashed=true;
+	page->hash_pprev=bucket;
+	page->hash_next=*bucket;
+	if(*bucket)(*bucket)->hash_pprev=&page->hash_next;
+	*bucket=page;
+	if(sibling)
+	{
+		// The L1 table is already shadowed. Follow its state of protection.
+		if(sibling->unsync)nvc_svm_snpt_link_unsync(snpt,page);
+	}
+	else if(!snpt->protect(snpt->context,gpa,true))
+		nvc_svm_snpt_link_unsync(snpt,page);
+}
+
+void static noir_hvcode nvc_svm_snpt_unhash_page(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	*page->hash_pprev=page->hash_next;
+	if(page->hash_next)page->hash_next->hash_pprev=page->hash_pprev;
+	page->hash_next=null;
+	page->hash_pprev=null;
+	page->hashed=false;
+	// Unprotect the L1 table when its last shadow is gone.
+	if(!page->unsync && nvc_svm_snpt_find_page(snpt,page->guest_table,0)==null)
+		snpt->protect(snpt->context,page->guest_table,false);
+}
+
+void static noir_hvcode nvc_svm_snpt_remove_leaf(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	if(page->cl_prev)
+		page->cl_prev->cl_next=page->cl_next;
+	else
+		snpt->head=page->cl_next;
+	if(page->cl_next)
+		page->cl_next->cl_prev=page->cl_prev;
+	else
+		snpt->tail=page->cl_prev;
+	page->cl_next=null;
+	page->cl_prev=null;
+}
+
+void static noir_hvcode nvc_svm_snpt_insert_leaf(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	page->cl_prev=null;
+	page->cl_next=snpt->head;
+	if(snpt->head)
+		snpt->head->cl_prev=page;
+	else
+		snpt->tail=page;
+	snpt->head=page;
+}
+
+void static noir_hvcode nvc_svm_snpt_free_page(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page);
+
+// Drop all translations in the shadow table. Lower-level shadow tables are released.
+void static noir_hvcode nvc_svm_snpt_zap_page(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	for(u32 i=0;i<page_table_entries64;i++)
+	{
+		if(page->virt[i].present)
+		{
+			if(page->level>1 && !page->virt[i].psize)
+				nvc_svm_snpt_free_page(snpt,nvc_svm_snpt_page_of(snpt,page_4kb_mult((u64)page->virt[i].base)));
+			else
+				page->virt[i].value=0;
+			snpt->flush_pending=true;
+		}
+	}
+}
+
+void static noir_hvcode nvc_svm_snpt_free_page(noir_svm_shadow_npt_manager_p snpt,noir_svm_shadow_npt_page_p page)
+{
+	nvc_svm_snpt_zap_page(snpt,page);
+	if(page->parent)
+	{
+		page->parent->virt[page->parent_index].value=0;
+		snpt->flush_pending=true;
+	}
+	if(page->hashed)nvc_svm_snpt_unhash_page(snpt,page);
+	nvc_svm_snpt_unlink_unsync(page);
+	if(page->level==1)nvc_svm_snpt_remove_leaf(snpt,page);
+	if(snpt->root==page)snpt->root=null;
+	page->parent=null;
+	page->guest_table=0;
+	page->in_use=false;
+	// Return to the free list.
+	page->cl_next=snpt->free;
+	snpt->free=page;
+}
+
+noir_svm_shadow_npt_page_p static noir_hvcode nvc_svm_snpt_alloc_page(noir_svm_shadow_npt_manager_p snpt,u8 level)
+{
+	noir_svm_shadow_npt_page_p page=snpt->free;
+	if(page==null)
+	{
+		// The pool is drained. Recycle the least recently filled leaf table.
+		if(snpt->tail==null)return null;
+		nvc_svm_snpt_free_page(snpt,snpt->tail);
+		snpt->statistics.evictions++;
+		page=snpt->free;
+	}
+	snpt->free=page->cl_next;
+	page->cl_next=null;
+	page->level=level;
+	page->in_use=true;
+	if(level==1)nvc_svm_snpt_insert_leaf(snpt,page);
+	return page;
+}
+
+void nvc_svm_snpt_reset(noir_svm_shadow_npt_manager_p snpt)
+{
+	// Releasing the roots releases everything.
+	for(u32 i=0;i<snpt->capacity;i++)
+		if(snpt->pool[i].in_use && snpt->pool[i].parent==null)
+			nvc_svm_snpt_free_page(snpt,&snpt->pool[i]);
+	snpt->statistics.resets++;
+}
+
+u64 nvc_svm_snpt_switch_root(noir_svm_shadow_npt_manager_p snpt,u64 ncr3)
+{
+	const u64 gpa=ncr3&noir_npt_pte_base_bits;
+	noir_svm_shadow_npt_page_p root=nvc_svm_snpt_find_page(snpt,gpa,4);
+	if(root==null)
+	{
+		root=nvc_svm_snpt_alloc_page(snpt,4);
+		if(root==null)
+		{
+			// Tables above leaf level exhausted the pool.
+			nvc_svm_snpt_reset(snpt);
+			root=nvc_svm_snpt_alloc_page(snpt,4);
+		}
+		nvc_svm_snpt_hash_page(snpt,root,gpa);
+	}
+	snpt->root=root;
+	return root->phys;
+}
+
+noir_svm_snpt_fault_result nvc_svm_snpt_handle_fault(noir_svm_shadow_npt_manager_p snpt,u64 ngpa,amd64_npt_fault_code_p fault)
+{
+	amd64_npt_general_entry_p l1_entries[5];
+	u64 l1_tables[5];
+	amd64_npt_general_entry l0,leaf,shadow;
+	noir_svm_shadow_npt_page_p table=snpt->root;
+	const u64 ncr3=table->guest_table;
+	u64 gpa,table_gpa=ncr3;
+	u32 l0_shift,index;
+	u8 level,leaf_level,target;
+	bool write=true,user=true,nx=false;
+	snpt->host_fault_gpa=maxu64;
+	// Walk the L1 NPT.
+	for(level=4;level;level--)
+	{
+		amd64_npt_general_entry_p l1_table=snpt->map(snpt->context,table_gpa);
+		// L1 tables must be backed by memory.
+		if(l1_table==null)
+		{
+			snpt->host_fault_gpa=table_gpa;
+			goto host_fault;
+		}
+		l1_tables[level]=table_gpa;
+		l1_entries[level]=&l1_table[nvc_svm_snpt_index(level,ngpa)];
+		leaf=*l1_entries[level];
+		if(!leaf.present)
+		{
+			fault->present=false;
+			goto reflect;
+		}
+		write&=leaf.write;
+		user&=leaf.user;
+		nx|=leaf.no_execute;
+		// Set the accessed bit as the processor would do.
+		if(!leaf.accessed)noir_locked_or64((i64vp)l1_entries[level],0x20);
+		if(level==1 || (level<4 && leaf.psize))break;
+		table_gpa=page_4kb_mult((u64)leaf.base);
+	}
+	leaf_level=level;
+	// Nested paging treats all accesses as user accesses.
+	if(!user || (fault->write && !write) || (fault->execute && nx))
+	{
+		fault->present=true;
+		goto reflect;
+	}
+	// Set the dirty bit as the processor would do.
+	if(fault->write && !leaf.dirty)
+	{
+		noir_locked_or64((i64vp)l1_entries[leaf_level],0x40);
+		leaf.dirty=true;
+	}
+	gpa=(leaf.value&noir_npt_pte_base_bits&~(nvc_svm_snpt_level_size(leaf_level)-1))|(ngpa&(nvc_svm_snpt_level_size(leaf_level)-1));
+	// Translate with L0 NPT.
+	snpt->host_fault_gpa=gpa;
+	if(!snpt->translate(snpt->context,gpa,&l0,&l0_shift))goto host_fault;
+	if((fault->write && !l0.write) || (fault->execute && l0.no_execute))goto host_fault;
+	// Compose the translations. Use 2MiB page if both L1 and L0 map the range with large pages.
+	target=leaf_level>1 && l0_shift>=page_2mb_shift?2:1;
+	shadow.value=0;
+	shadow.present=true;
+	shadow.user=true;
+	// Clean pages are write-protected so that the dirty bit in L1 NPT can be set.
+	shadow.write=write && l0.write && leaf.dirty;
+	shadow.no_execute=nx || l0.no_execute;
+	// Memory type follows L1 NPT.
+	shadow.pwt=leaf.pwt;
+	shadow.pcd=leaf.pcd;
+	if(target==2)
+	{
+		shadow.psize=true;
+		// The PAT bit of large pages is bit 12.
+		shadow.value|=(page_4kb_mult((u64)l0.base)&noir_npt_large_base_bits)|(leaf.value&0x1000);
+	}
+	else
+	{
+		shadow.psize=leaf_level>1?(leaf.value>>12)&1:leaf.psize;
+		shadow.base=l0.base;
+	}
+	// Build the shadow tables down to the target level.
+	for(level=4;level>target;level--)
+	{
+		amd64_npt_general_entry_p entry;
+		noir_svm_shadow_npt_page_p child=null;
+		// The lower-level table shadows an L1 table, unless it is a fragment of L1 large page.
+		const bool shadowing=level>leaf_level;
+		index=(u32)nvc_svm_snpt_index(level,ngpa);
+		entry=&table->virt[index];
+		if(entry->present)
+		{
+			if(entry->psize)
+			{
+				// Replace the large page with a table.
+				entry->value=0;
+				snpt->flush_pending=true;
+			}
+			else
+			{
+				child=nvc_svm_snpt_page_of(snpt,page_4kb_mult((u64)entry->base));
+				// L1 may have changed the entry to reference another table without flushing the TLB.
+				if(child->hashed!=shadowing || (shadowing && child->guest_table!=l1_tables[level-1]))
+				{
+					nvc_svm_snpt_free_page(snpt,child);
+					child=null;
+				}
+			}
+		}
+		if(child==null)
+		{
+			child=nvc_svm_snpt_alloc_page(snpt,level-1);
+			if(child==null)
+			{
+				// Tables above leaf level exhausted the pool. Start over and let the fault recur.
+				nvc_svm_snpt_reset(snpt);
+				nvc_svm_snpt_switch_root(snpt,ncr3);
+				return noir_svm_snpt_fault_resolved;
+			}
+			child->parent=table;
+			child->parent_index=index;
+			if(shadowing)nvc_svm_snpt_hash_page(snpt,child,l1_tables[level-1]);
+			// Permissions are enforced by the leaf entries.
+			entry->present=true;
+			entry->write=true;
+			entry->user=true;
+			entry->base=page_4kb_count(child->phys);
+		}
+		table=child;
+	}
+	// Fill the leaf entry.
+	index=(u32)nvc_svm_snpt_index(target,ngpa);
+	if(table->virt[index].present)
+	{
+		if(target>1 && !table->virt[index].psize)
+			nvc_svm_snpt_free_page(snpt,nvc_svm_snpt_page_of(snpt,page_4kb_mult((u64)table->virt[index].base)));
+		else if(table->virt[index].value!=shadow.value)
+			snpt->flush_pending=true;
+	}
+	table->virt[index].value=shadow.value;
+	if(target==1 && snpt->head!=table)
+	{
+		nvc_svm_snpt_remove_leaf(snpt,table);
+		nvc_svm_snpt_insert_leaf(snpt,table);
+	}
+	snpt->statistics.fills++;
+	return noir_svm_snpt_fault_resolved;
+reflect:
+	snpt->statistics.reflects++;
+	return noir_svm_snpt_fault_reflect;
+host_fault:
+	snpt->statistics.host_faults++;
+	return noir_svm_snpt_fault_host;
+}
+
+bool nvc_svm_snpt_handle_table_write(noir_svm_shadow_npt_manager_p snpt,u64 gpa)
+{
+	const u64 table=gpa&noir_npt_pte_base_bits;
+	bool unprotect=false;
+	for(noir_svm_shadow_npt_page_p page=snpt->buckets[nvc_svm_snpt_hash(snpt,table)];page;page=page->hash_next)
+	{
+		if(page->guest_table==table && !page->unsync)
+		{
+			nvc_svm_snpt_link_unsync(snpt,page);
+			unprotect=true;
+		}
+	}
+	// Let L1 keep writing the table until it flushes the TLB.
+	if(unprotect)snpt->protect(snpt->context,table,false);
+	return unprotect;
+}
+
+// This function can be called from any processor.
+void nvc_svm_snpt_post_table_write(noir_svm_shadow_npt_manager_p snpt,u64 gpa)
+{
+	while(noir_locked_cmpxchg(&snpt->remote_writes.lock,-1,0)!=0)noir_pause();
+	if(snpt->remote_writes.count<noir_svm_shadow_npt_remote_writes)
+		snpt->remote_writes.list[snpt->remote_writes.count++]=gpa&noir_npt_pte_base_bits;
+	else
+		snpt->remote_writes.overflow=true;
+	noir_locked_xchg(&snpt->remote_writes.lock,0);
+}
+
+void static noir_hvcode nvc_svm_snpt_drain_remote_writes(noir_svm_shadow_npt_manager_p snpt)
+{
+	u64 list[noir_svm_shadow_npt_remote_writes];
+	u32 count;
+	bool overflow;
+	while(noir_locked_cmpxchg(&snpt->remote_writes.lock,-1,0)!=0)noir_pause();
+	count=snpt->remote_writes.count;
+	overflow=snpt->remote_writes.overflow;
+	for(u32 i=0;i<count;i++)list[i]=snpt->remote_writes.list[i];
+	snpt->remote_writes.count=0;
+	snpt->remote_writes.overflow=false;
+	noir_locked_xchg(&snpt->remote_writes.lock,0);
+	if(overflow)
+	{
+		// Posted tables are lost. Assume every L1 table is written.
+		for(u32 i=0;i<snpt->capacity;i++)
+			if(snpt->pool[i].hashed && !snpt->pool[i].unsync)
+				nvc_svm_snpt_handle_table_write(snpt,snpt->pool[i].guest_table);
+	}
+	else
+	{
+		for(u32 i=0;i<count;i++)
+			nvc_svm_snpt_handle_table_write(snpt,list[i]);
+	}
+}
+
+void nvc_svm_snpt_synchronize(noir_svm_shadow_npt_manager_p snpt)
+{
+	noir_svm_shadow_npt_page_p list;
+	// Tables written on other processors are out-of-sync as well.
+	if(snpt->remote_writes.count || snpt->remote_writes.overflow)nvc_svm_snpt_drain_remote_writes(snpt);
+	// Detach the list. Tables failing to be protected again are kept for the next synchronization.
+	list=snpt->unsync;
+	if(list)list->unsync_pprev=&list;
+	snpt->unsync=null;
+	while(list)
+	{
+		noir_svm_shadow_npt_page_p page=list;
+		nvc_svm_snpt_unlink_unsync(page);
+		// Lower-level shadow tables in the detached list are unlinked when released.
+		nvc_svm_snpt_zap_page(snpt,page);
+		snpt->statistics.resyncs++;
+		if(!snpt->protect(snpt->context,page->guest_table,true))
+			nvc_svm_snpt_link_unsync(snpt,page);
+	}
+}
+
+void nvc_svm_snpt_finalize(noir_svm_shadow_npt_manager_p snpt)
+{
+	if(snpt->tables.virt)
+	{
+		noir_free_contd_memory(snpt->tables.virt,page_4kb_mult(snpt->capacity));
+		snpt->tables.virt=null;
+	}
+	if(snpt->pool)
+	{
+		noir_free_nonpg_memory(snpt->pool);
+		snpt->pool=null;
+	}
+	if(snpt->buckets)
+	{
+		noir_free_nonpg_memory(snpt->buckets);
+		snpt->buckets=null;
+	}
+}
+
+noir_status nvc_svm_snpt_initialize(noir_svm_shadow_npt_manager_p snpt,u32 capacity)
+{
+	u32 bucket_bits=1;
+	if(capacity<noir_svm_shadow_npt_min_pages)return noir_invalid_parameter;
+	while((1<<bucket_bits)<(capacity<<1))bucket_bits++;
+	snpt->capacity=capacity;
+	snpt->bucket_shift=64-bucket_bits;
+	snpt->pool=noir_alloc_nonpg_memory(sizeof(noir_svm_shadow_npt_page)*capacity);
+	snpt->buckets=noir_alloc_nonpg_memory(sizeof(noir_svm_shadow_npt_page_p)<<bucket_bits);
+	snpt->tables.virt=noir_alloc_contd_memory(page_4kb_mult(capacity));
+	if(snpt->pool && snpt->buckets && snpt->tables.virt)
+	{
+		snpt->tables.phys=noir_get_physical_address(snpt->tables.virt);
+		for(u32 i=0;i<capacity;i++)
+		{
+			snpt->pool[i].virt=(amd64_npt_general_entry_p)((ulong_ptr)snpt->tables.virt+page_4kb_mult(i));
+			snpt->pool[i].phys=snpt->tables.phys+page_4kb_mult(i);
+			snpt->pool[i].cl_next=i<capacity-1?&snpt->pool[i+1]:null;
+		}
+		snpt->free=&snpt->pool[0];
+		return noir_success;
+	}
+	nvc_svm_snpt_finalize(snpt);
+	return noir_insufficient_resources;
+}
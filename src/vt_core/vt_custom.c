@@ -78,6 +78,8 @@ void noir_hvcode nvc_vt_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_vt_
 		noir_vt_vmclear(&cvcpu->vmcs.phys);
 		// Mark that the vmlaunch instruction is supposed to be executed.
 		loader_stack->flags.initial_vmcs=true;
+		// This processor may have stale EPT TLBs of this VM.
+		cvcpu->header.state_cache.tl_valid=false;
 	}
 	// Step 1: Save State of the Subverted Host.
 	// Please note that it is unnecessary to save states which are already saved in VMCS.
@@ -230,6 +232,15 @@ void noir_hvcode nvc_vt_switch_to_guest_vcpu(noir_gpr_state_p gpr_state,noir_vt_
 		// Cache is refreshed. Mark it valid.
 		cvcpu->header.state_cache.ef_valid=true;
 	}
+	// Flush TLB if the EPT is updated.
+	if(!cvcpu->header.state_cache.tl_valid)
+	{
+		invept_descriptor ied;
+		ied.eptp=cvcpu->vm->eptm.eptp.phys;
+		ied.reserved=0;
+		noir_vt_invept(ept_single_invd,&ied);
+		cvcpu->header.state_cache.tl_valid=true;
+	}
 	// Load PAT MSR
 	if(!cvcpu->header.state_cache.pa_valid)
 	{
@@ -730,21 +741,61 @@ void static nvc_vtc_set_pml4e_entry(ia32_ept_pml4e_p entry,u64 hpa)
 	entry->pdpte_offset=page_4kb_count(hpa);
 }
 
+// Split a 2MiB page into 512 4KiB pages so that a part of it can be remapped.
+void static nvc_vtc_split_large_pde(ia32_ept_pte_p pte,ia32_ept_large_pde_p large_pde)
+{
+	for(u32 i=0;i<512;i++)
+	{
+		pte[i].value=large_pde->value&~0x000FFFFFFFE00080;
+		pte[i].page_offset=(large_pde->page_offset<<9)+i;
+	}
+}
+
+noir_ept_pde_descriptor_p static nvc_vtc_find_pde_descriptor(noir_vt_custom_ept_manager_p ept_manager,u64 gpa)
+{
+	noir_ept_pde_descriptor_p cur=ept_manager->pde.head;
+	while(cur)
+	{
+		if(gpa>=cur->gpa_start && gpa<cur->gpa_start+page_1gb_size)break;
+		cur=cur->next;
+	}
+	return cur;
+}
+
+// Remove the PTE table replaced by a 2MiB page. The caller must ensure no vCPUs are running.
+void static nvc_vtc_release_pte_table(noir_vt_custom_ept_manager_p ept_manager,u64 gpa)
+{
+	noir_ept_pte_descriptor_p *link=&ept_manager->pte.head,prev=null;
+	while(*link)
+	{
+		noir_ept_pte_descriptor_p cur=*link;
+		if(gpa>=cur->gpa_start && gpa<cur->gpa_start+page_2mb_size)
+		{
+			*link=cur->next;
+			if(ept_manager->pte.tail==cur)ept_manager->pte.tail=prev;
+			noir_arena_free_page(&ept_manager->arena,cur->virt,cur->phys);
+			noir_arena_free_object(&ept_manager->arena,cur);
+			break;
+		}
+		prev=cur;
+		link=&cur->next;
+	}
+}
+
 noir_status static nvc_vtc_create_1gb_page_map(noir_vt_custom_ept_manager_p ept_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
 {
 	noir_status st=noir_insufficient_resources;
-	noir_ept_pdpte_descriptor_p pdpte_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pdpte_descriptor));
+	noir_ept_pdpte_descriptor_p pdpte_p=noir_arena_alloc_reserved_object(&ept_manager->arena);
 	if(pdpte_p)
 	{
-		pdpte_p->virt=noir_alloc_contd_memory(page_size);
+		pdpte_p->virt=noir_arena_alloc_reserved_page(&ept_manager->arena,&pdpte_p->phys);
 		if(pdpte_p->virt==null)
-			noir_free_nonpg_memory(pdpte_p);
+			noir_arena_free_object(&ept_manager->arena,pdpte_p);
 		else
 		{
 			ia32_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PDPTE descriptor.
-			pdpte_p->phys=noir_get_physical_address(pdpte_p->virt);
 			pdpte_p->gpa_start=page_512gb_base(gpa);
 			// Do mapping - this level.
 			nvc_vtc_set_pdpte_entry(&pdpte_p->virt[gpa_t.pdpte_offset],hpa,map_attrib);
@@ -766,22 +817,21 @@ noir_status static nvc_vtc_create_1gb_page_map(noir_vt_custom_ept_manager_p ept_
 noir_status static nvc_vtc_create_2mb_page_map(noir_vt_custom_ept_manager_p ept_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
 {
 	noir_status st=noir_insufficient_resources;
-	noir_ept_pde_descriptor_p pde_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pde_descriptor));
+	noir_ept_pde_descriptor_p pde_p=noir_arena_alloc_reserved_object(&ept_manager->arena);
 	if(pde_p)
 	{
-		pde_p->virt=noir_alloc_contd_memory(page_size);
+		pde_p->virt=noir_arena_alloc_reserved_page(&ept_manager->arena,&pde_p->phys);
 		if(pde_p->virt==null)
-			noir_free_nonpg_memory(pde_p);
+			noir_arena_free_object(&ept_manager->arena,pde_p);
 		else
 		{
 			noir_ept_pdpte_descriptor_p cur=ept_manager->pdpte.head;
 			ia32_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PDE descriptor
-			pde_p->phys=noir_get_physical_address(pde_p->virt);
 			pde_p->gpa_start=page_1gb_base(gpa);
 			// Do mapping
-			nvc_vtc_set_pde_entry(&pde_p->virt[gpa_t.pte_offset],hpa,map_attrib);
+			nvc_vtc_set_pde_entry(&pde_p->virt[gpa_t.pde_offset],hpa,map_attrib);
 			// Add to the linked list.
 			if(ept_manager->pde.head)
 				ept_manager->pde.tail->next=pde_p;
@@ -814,19 +864,18 @@ noir_status static nvc_vtc_create_2mb_page_map(noir_vt_custom_ept_manager_p ept_
 noir_status static nvc_vtc_create_4kb_page_map(noir_vt_custom_ept_manager_p ept_manager,u64 gpa,u64 hpa,noir_cvm_mapping_attributes map_attrib)
 {
 	noir_status st=noir_insufficient_resources;
-	noir_ept_pte_descriptor_p pte_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
+	noir_ept_pte_descriptor_p pte_p=noir_arena_alloc_reserved_object(&ept_manager->arena);
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_arena_alloc_reserved_page(&ept_manager->arena,&pte_p->phys);
 		if(pte_p->virt==null)
-			noir_free_nonpg_memory(pte_p);
+			noir_arena_free_object(&ept_manager->arena,pte_p);
 		else
 		{
 			noir_ept_pde_descriptor_p cur=ept_manager->pde.head;
 			ia32_addr_translator gpa_t;
 			gpa_t.value=gpa;
 			// Setup PTE descriptor
-			pte_p->phys=noir_get_physical_address(pte_p->virt);
 			pte_p->gpa_start=page_2mb_base(gpa);
 			// Do mapping
 			nvc_vtc_set_pte_entry(&pte_p->virt[gpa_t.pte_offset],0,map_attrib);
@@ -851,6 +900,8 @@ noir_status static nvc_vtc_create_4kb_page_map(noir_vt_custom_ept_manager_p ept_
 			}
 			if(cur)
 			{
+				// Preserve the rest of the 2MiB page if it is to be split.
+				if(cur->large[gpa_t.pde_offset].large_pde)nvc_vtc_split_large_pde(pte_p->virt,&cur->large[gpa_t.pde_offset]);
 				nvc_vtc_set_pde_entry(&cur->virt[gpa_t.pde_offset],pte_p->phys,map_attrib);
 				st=noir_success;
 			}
@@ -889,9 +940,24 @@ noir_status static nvc_vtc_set_page_map(noir_vt_custom_ept_manager_p npt_manager
 			}
 			break;
 		}
+		case 1:
+		{
+			// Search for existing PDEs.
+			noir_ept_pde_descriptor_p cur=nvc_vtc_find_pde_descriptor(npt_manager,gpa);
+			if(!cur)
+				st=nvc_vtc_create_2mb_page_map(npt_manager,gpa,hpa,map_attrib);
+			else
+			{
+				const bool table=!cur->large[gpa_t.pde_offset].large_pde && cur->virt[gpa_t.pde_offset].read;
+				nvc_vtc_set_pde_entry(&cur->virt[gpa_t.pde_offset],hpa,map_attrib);
+				if(table)nvc_vtc_release_pte_table(npt_manager,gpa);
+				st=noir_success;
+			}
+			break;
+		}
 		default:
 		{
-			// By default, large-page mapping is not implemented.
+			// By default, 1GiB-page mapping is not implemented.
 			st=noir_not_implemented;
 			break;
 		}
@@ -899,12 +965,42 @@ noir_status static nvc_vtc_set_page_map(noir_vt_custom_ept_manager_p npt_manager
 	return st;
 }
 
+// Return true if the 2MiB page starting at this HVA is locked and physically contiguous.
+bool static nvc_vtc_is_contiguous_2mb_page(u64 hva,u64 hpa)
+{
+	for(u32 i=1;i<512;i++)
+	{
+		bool valid,locked,large_page;
+		void* va=(void*)(hva+page_4kb_mult((u64)i));
+		if(!noir_query_page_attributes(va,&valid,&locked,&large_page))return false;
+		if(!valid || !locked)return false;
+		if(noir_get_user_physical_address(va)!=hpa+page_4kb_mult((u64)i))return false;
+	}
+	return true;
+}
+
+// Reserve the paging structures for mapping a range of pages. The count of pages in any size is an upper bound.
+bool static nvc_vtc_reserve_ept_tables(noir_vt_custom_ept_manager_p ept_manager,u32 pages)
+{
+	// Each 2MiB, 1GiB and 512GiB requires a table. Both ends could be split.
+	const u32 tables=(pages>>9)+(pages>>18)+(pages>>27)+6;
+	// Descriptors are carved from the pages of the arena as well.
+	const u32 slot_pages=tables/(page_size/ept_manager->arena.object_size)+1;
+	return noir_reserve_page_arena(&ept_manager->arena,tables+slot_pages+noir_arena_reserve_pages);
+}
+
 noir_status nvc_vtc_set_mapping(noir_vt_custom_vm_p virtual_machine,noir_cvm_address_mapping_p mapping_info)
 {
 	noir_status st=noir_unsuccessful;
 	ia32_addr_translator gpa;
 	u32 increment[4]={page_4kb_shift,page_2mb_shift,page_1gb_shift,page_512gb_shift};
 	gpa.value=mapping_info->gpa;
+	// Reserve the tables before gaining exclusion of the VM, so that mapping does not refill the arena.
+	if(nvc_vtc_reserve_ept_tables(&virtual_machine->eptm,mapping_info->pages)==false)return noir_insufficient_resources;
+	// Gain Exclusion of VM. Promotions may release PTE tables.
+	for(u32 i=0;i<255;i++)
+		if(virtual_machine->vcpu[i])
+			noir_acquire_pushlock_exclusive(&virtual_machine->vcpu[i]->header.vcpu_lock);
 	for(u32 i=0;i<mapping_info->pages;i++)
 	{
 		u64 hva=mapping_info->hva+(i<<increment[mapping_info->attributes.psize]);
@@ -914,13 +1010,28 @@ noir_status nvc_vtc_set_mapping(noir_vt_custom_vm_p virtual_machine,noir_cvm_add
 			st=noir_user_page_violation;
 			if(valid && locked || !mapping_info->attributes.present)
 			{
+				noir_cvm_mapping_attributes map_attrib=mapping_info->attributes;
 				u64 gpa=mapping_info->gpa+(i<<increment[mapping_info->attributes.psize]);
 				u64 hpa=noir_get_user_physical_address((void*)hva);
-				st=nvc_vtc_set_page_map(&virtual_machine->eptm,gpa,hpa,mapping_info->attributes);
+				bool promoted=false;
+				// Use a 2MiB page for an aligned, physically contiguous run of mapped pages.
+				if(map_attrib.psize==0 && map_attrib.present && i+512<=mapping_info->pages && page_2mb_offset(gpa|hpa)==0)
+					promoted=nvc_vtc_is_contiguous_2mb_page(hva,hpa);
+				if(promoted)map_attrib.psize=1;
+				st=nvc_vtc_set_page_map(&virtual_machine->eptm,gpa,hpa,map_attrib);
+				if(promoted)i+=511;
 			}
 		}
 		if(st!=noir_success)break;
 	}
+	// Broadcast to all vCPUs that the TLBs are invalid now.
+	for(u32 i=0;i<255;i++)
+		if(virtual_machine->vcpu[i])
+			virtual_machine->vcpu[i]->header.state_cache.tl_valid=false;
+	// Release Exclusion of VM.
+	for(u32 i=0;i<255;i++)
+		if(virtual_machine->vcpu[i])
+			noir_release_pushlock_exclusive(&virtual_machine->vcpu[i]->header.vcpu_lock);
 	return st;
 }
 
@@ -1007,39 +1118,7 @@ void nvc_vtc_release_vm(noir_vt_custom_vm_p virtual_machine)
 		// Release Extended Paging Structure...
 		if(virtual_machine->eptm.eptp.virt)
 			noir_free_contd_memory(virtual_machine->eptm.eptp.virt,page_size);
-		if(virtual_machine->eptm.pdpte.head)
-		{
-			noir_ept_pdpte_descriptor_p cur=virtual_machine->eptm.pdpte.head;
-			while(cur)
-			{
-				noir_ept_pdpte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		if(virtual_machine->eptm.pde.head)
-		{
-			noir_ept_pde_descriptor_p cur=virtual_machine->eptm.pde.head;
-			while(cur)
-			{
-				noir_ept_pde_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		if(virtual_machine->eptm.pte.head)
-		{
-			noir_ept_pte_descriptor_p cur=virtual_machine->eptm.pte.head;
-			while(cur)
-			{
-				noir_ept_pte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
+		noir_finalize_page_arena(&virtual_machine->eptm.arena);
 		// Free VPID.
 		noir_acquire_reslock_exclusive(hvm_p->tlb_tagging.vpid_pool_lock);
 		noir_reset_bitmap(hvm_p->tlb_tagging.vpid_pool,virtual_machine->vpid-hvm_p->tlb_tagging.start);
@@ -1067,6 +1146,7 @@ noir_status nvc_vtc_create_vm(noir_vt_custom_vm_p *virtual_machine)
 			vm->vcpu=noir_alloc_nonpg_memory(page_size);
 			if(vm->vcpu==null)goto alloc_failure;
 			// Initialize EPT Manager (with Top-Level Paging Structure)
+			noir_initialize_page_arena(&vm->eptm.arena,sizeof(noir_ept_pdpte_descriptor));
 			vm->eptm.eptp.virt=noir_alloc_contd_memory(page_size);
 			if(vm->eptm.eptp.virt)
 			{
@@ -1079,6 +1159,8 @@ noir_status nvc_vtc_create_vm(noir_vt_custom_vm_p *virtual_machine)
 			}
 			else
 				goto alloc_failure;
+			// Paging structures are taken from the reserved pages only.
+			if(noir_reserve_page_arena(&vm->eptm.arena,noir_arena_reserve_pages)==false)goto alloc_failure;
 			// Allocate VPID
 			vm->vpid=nvc_vtc_alloc_vpid();
 			if(vm->vpid==0xffffffff)goto alloc_failure;
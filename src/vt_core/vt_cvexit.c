@@ -209,7 +209,13 @@ void static noir_hvcode fastcall nvc_vt_task_switch_cvexit_handler(noir_gpr_stat
 
 void static noir_hvcode fastcall nvc_vt_cpuid_cvexit_handler(noir_gpr_state_p gpr_state,noir_vt_vcpu_p vcpu,noir_vt_custom_vcpu_p cvcpu)
 {
-	if(cvcpu->header.vcpu_options.intercept_cpuid)
+	u32 leaf=(u32)gpr_state->rax,subleaf=(u32)gpr_state->rcx;
+	noir_cpuid_general_info info;
+	bool hit=false;
+	// Search the CPUID model. The model answers the CPUID even if it is intercepted, as long as it is loaded by the User Hypervisor.
+	if(!cvcpu->header.vcpu_options.intercept_cpuid || cvcpu->vm->header.cpuid_model.user_loaded)
+		hit=nvc_query_cpuid_model(&cvcpu->header,leaf,subleaf,&info);
+	if(cvcpu->header.vcpu_options.intercept_cpuid && !hit)
 	{
 		// Switch to subverted host in order to handle the cpuid instruction.
 		nvc_vt_save_generic_cvexit_context(cvcpu);
@@ -221,10 +227,9 @@ void static noir_hvcode fastcall nvc_vt_cpuid_cvexit_handler(noir_gpr_state_p gp
 	else
 	{
 		// NoirVisor will be handling CVM's CPUID Interception.
-		u32 leaf=(u32)gpr_state->rax,subleaf=(u32)gpr_state->rcx;
 		u32 leaf_class=noir_cpuid_class(leaf);
-		noir_cpuid_general_info info;
-		if(leaf_class==hvm_leaf_index)
+		// Leaves not in the CPUID model are passed through.
+		if(!hit && leaf_class==hvm_leaf_index)
 		{
 			// The first two fields will be compliant with Microsoft Hypervisor Top-Level Functionality Specification
 			// even though NoirVisor CVM is running with different set of Hypervisor functionalities.
@@ -249,7 +254,7 @@ void static noir_hvcode fastcall nvc_vt_cpuid_cvexit_handler(noir_gpr_state_p gp
 				}
 			}
 		}
-		else
+		else if(!hit)
 		{
 			noir_cpuid(leaf,subleaf,&info.eax,&info.ebx,&info.ecx,&info.edx);
 			switch(leaf)
@@ -264,6 +269,11 @@ void static noir_hvcode fastcall nvc_vt_cpuid_cvexit_handler(noir_gpr_state_p gp
 				}
 			}
 		}
+		// The cpuid instruction zero-extends the results into 64-bit registers.
+		gpr_state->rax=info.eax;
+		gpr_state->rbx=info.ebx;
+		gpr_state->rcx=info.ecx;
+		gpr_state->rdx=info.edx;
 		noir_vt_advance_rip();
 	}
 }
@@ -610,6 +620,14 @@ void static noir_hvcode fastcall nvc_vt_io_cvexit_handler(noir_gpr_state_p gpr_s
 	u32 seg_ar;
 	noir_vt_vmread(vmexit_qualification,&info.value);
 	noir_vt_vmread(vmexit_instruction_information,&exit_info.value);
+	// Access sizes of 1, 2 and 4 bytes are encoded as 0, 1 and 3.
+	if(!info.string && nvc_emulate_vm_pio_device(&cvcpu->vm->header,info.direction,(u16)info.port,(u16)info.access_size+1,&gpr_state->rax))
+	{
+		// The port is emulated by a device model in NoirVisor. Return to the guest directly.
+		noir_vt_advance_rip();
+		cvcpu->header.statistics.interceptions.pio_device.count++;
+		return;
+	}
 	// Deliver the I/O interception to subverted host.
 	nvc_vt_save_generic_cvexit_context(cvcpu);
 	// Before the VMCS is switched, read essential data from VMCS.
@@ -32,28 +32,8 @@ void nvc_ept_cleanup(noir_ept_manager_p eptm)
 			noir_free_contd_memory(eptm->eptp.virt,page_size);
 		if(eptm->pdpt.virt)
 			noir_free_2mb_page(eptm->pdpt.virt);
-		if(eptm->pde.head)
-		{
-			noir_ept_pde_descriptor_p cur=eptm->pde.head;
-			do
-			{
-				noir_ept_pde_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}while(cur);
-		}
-		if(eptm->pte.head)
-		{
-			noir_ept_pte_descriptor_p cur=eptm->pte.head;
-			do
-			{
-				noir_ept_pte_descriptor_p next=cur->next;
-				noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}while(cur);
-		}
+		// Descriptors and tables of split pages are released in bulk.
+		noir_finalize_page_arena(&eptm->arena);
 		if(eptm->blank_page.virt)
 			noir_free_contd_memory(eptm->blank_page.virt,page_size);
 		noir_free_nonpg_memory(eptm);
@@ -75,15 +55,15 @@ noir_ept_pde_descriptor_p nvc_ept_split_pdpte(noir_ept_manager_p eptm,u64 gpa,bo
 	{
 		// This 1GiB page has not been described yet.
 		nvd_printf("Splitting PDPTE for GPA 0x%016llX...\n",gpa);
-		pde_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pde_descriptor));
+		// This could be in VM-exit context. Only use the reserved pages.
+		pde_p=noir_arena_alloc_reserved_object(&eptm->arena);
 		if(pde_p)
 		{
-			pde_p->virt=noir_alloc_contd_memory(page_size);
+			pde_p->virt=noir_arena_alloc_reserved_page(&eptm->arena,&pde_p->phys);
 			if(pde_p->virt)
 			{
 				const u64 index=page_1gb_count(gpa);
 				// PDE Descriptor
-				pde_p->phys=noir_get_physical_address(pde_p->virt);
 				pde_p->gpa_start=index<<page_shift_diff64;
 				for(u32 i=0;i<page_table_entries64;i++)
 				{
@@ -109,12 +89,12 @@ noir_ept_pde_descriptor_p nvc_ept_split_pdpte(noir_ept_manager_p eptm,u64 gpa,bo
 				}
 				goto update_pdpte;
 			}
-			noir_free_nonpg_memory(pde_p);
+			noir_arena_free_object(&eptm->arena,pde_p);
 		}
 	}
 update_pdpte:
 	// If in host mode, update PDPTE.
-	if(host)
+	if(host && pde_p)
 	{
 		const u64 index=page_1gb_count(gpa);
 		ia32_ept_pdpte_p pdpte_p=(ia32_ept_pdpte_p)&eptm->pdpt.virt[index];
@@ -138,10 +118,11 @@ noir_ept_pte_descriptor_p nvc_ept_split_pde(noir_ept_manager_p eptm,u64 gpa,bool
 	{
 		// The 2MiB page has not been described yet.
 		nvd_printf("Splitting PDE for GPA 0x%016llX...\n",gpa);
-		pte_p=noir_alloc_nonpg_memory(sizeof(noir_ept_pte_descriptor));
+		// This could be in VM-exit context. Only use the reserved pages.
+		pte_p=noir_arena_alloc_reserved_object(&eptm->arena);
 		if(pte_p)
 		{
-			pte_p->virt=noir_alloc_contd_memory(page_size);
+			pte_p->virt=noir_arena_alloc_reserved_page(&eptm->arena,&pte_p->phys);
 			if(pte_p->virt)
 			{
 				// Split the PDPTE first.
@@ -151,7 +132,6 @@ noir_ept_pte_descriptor_p nvc_ept_split_pde(noir_ept_manager_p eptm,u64 gpa,bool
 					const u64 pfn_index=page_2mb_count(gpa);
 					const u64 pde_index=page_entry_index64(pfn_index);
 					// PTE Descriptor
-					pte_p->phys=noir_get_physical_address(pte_p->virt);
 					pte_p->gpa_start=pfn_index<<page_shift_diff64;
 					for(u32 i=0;i<page_table_entries64;i++)
 					{
@@ -176,13 +156,13 @@ noir_ept_pte_descriptor_p nvc_ept_split_pde(noir_ept_manager_p eptm,u64 gpa,bool
 					}
 					goto update_pde;
 				}
-				noir_free_contd_memory(pte_p->virt,page_size);
+				noir_arena_free_page(&eptm->arena,pte_p->virt,pte_p->phys);
 			}
-			noir_free_nonpg_memory(pte_p);
+			noir_arena_free_object(&eptm->arena,pte_p);
 		}
 	}
 update_pde:
-	if(host)
+	if(host && pte_p)
 	{
 		// If in host mode, update PDE.
 		noir_ept_pde_descriptor_p pde_p=nvc_ept_split_pdpte(eptm,gpa,host,alloc);
@@ -247,6 +227,7 @@ bool nvc_ept_update_pde_memory_type(noir_ept_manager_p eptm,u64 gpa,u8 memory_ty
 				bool result=nvc_ept_update_pte_memory_type(eptm,gpa+page_4kb_mult(i),memory_type,force);
 				if(!result)return false;
 			}
+			return true;
 		}
 	}
 	return false;
@@ -279,6 +260,8 @@ bool nvc_ept_update_pdpte(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,
 {
 	const u64 index=page_1gb_count(gpa);
 	ia32_ept_pdpte_p pdpte_p=(ia32_ept_pdpte_p)&eptm->pdpt.virt[index];
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&eptm->arena,noir_arena_reserve_pages)==false)return false;
 	if(h)
 	{
 		// Reset to huge PDPTE.
@@ -304,8 +287,11 @@ bool nvc_ept_update_pdpte(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,
 
 bool nvc_ept_update_pde(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,bool x,bool l,bool ignore_mt,u8 memory_type,bool alloc)
 {
+	noir_ept_pde_descriptor_p pde_p;
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&eptm->arena,noir_arena_reserve_pages)==false)return false;
 	// Split the PDPTE.
-	noir_ept_pde_descriptor_p pde_p=nvc_ept_split_pdpte(eptm,gpa,true,alloc);
+	pde_p=nvc_ept_split_pdpte(eptm,gpa,true,alloc);
 	if(pde_p)
 	{
 		ia32_addr_translator gat;
@@ -337,8 +323,11 @@ bool nvc_ept_update_pde(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,bo
 
 noir_ept_pte_descriptor_p nvc_ept_update_pte(noir_ept_manager_p eptm,u64 hpa,u64 gpa,bool r,bool w,bool x,bool ignore_mt,u8 memory_type,bool alloc)
 {
+	noir_ept_pte_descriptor_p pte_p;
+	// Top up the arena in passive context so that splitting never refills it.
+	if(alloc && noir_reserve_page_arena(&eptm->arena,noir_arena_reserve_pages)==false)return null;
 	// Split the PDE
-	noir_ept_pte_descriptor_p pte_p=nvc_ept_split_pde(eptm,gpa,true,alloc);
+	pte_p=nvc_ept_split_pde(eptm,gpa,true,alloc);
 	if(pte_p)
 	{
 		ia32_addr_translator gat;
@@ -380,8 +369,9 @@ bool nvc_ept_insert_pte(noir_ept_manager_p eptm,noir_hook_page_p nhp)
 	The final value of the memory type will be the one that have smallest value.
 */
 
-void static nvc_ept_update_per_var_mtrr(noir_ept_manager_p eptm,u32 mtrr_msr_index)
+bool static nvc_ept_update_per_var_mtrr(noir_ept_manager_p eptm,u32 mtrr_msr_index)
 {
+	bool result=true;
 	ia32_mtrr_phys_mask_msr phys_mask;
 	phys_mask.value=noir_rdmsr(mtrr_msr_index+1);
 	if(phys_mask.valid)
@@ -423,17 +413,17 @@ void static nvc_ept_update_per_var_mtrr(noir_ept_manager_p eptm,u32 mtrr_msr_ind
 				{
 					case page_1gb_size:
 					{
-						nvc_ept_update_pdpte_memory_type(eptm,addr,(u8)phys_base.type,false);
+						result&=nvc_ept_update_pdpte_memory_type(eptm,addr,(u8)phys_base.type,false);
 						break;
 					}
 					case page_2mb_size:
 					{
-						nvc_ept_update_pde_memory_type(eptm,addr,(u8)phys_base.type,false);
+						result&=nvc_ept_update_pde_memory_type(eptm,addr,(u8)phys_base.type,false);
 						break;
 					}
 					case page_4kb_size:
 					{
-						nvc_ept_update_pte_memory_type(eptm,addr,(u8)phys_base.type,false);
+						result&=nvc_ept_update_pte_memory_type(eptm,addr,(u8)phys_base.type,false);
 						break;
 					}
 					default:
@@ -445,10 +435,14 @@ void static nvc_ept_update_per_var_mtrr(noir_ept_manager_p eptm,u32 mtrr_msr_ind
 			}
 		}
 	}
+	return result;
 }
 
-void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
+// If the reserved pages are drained in splitting, the MTRRs are partially emulated and false is returned.
+// Emulating the MTRRs again is harmless and only splits the pages that are not split yet.
+bool nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 {
+	bool result=true;
 	if(eptm->def_type.enabled)
 	{
 		ia32_mtrr_cap_msr mtrr_cap;
@@ -456,10 +450,10 @@ void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 		mtrr_cap.value=noir_rdmsr(ia32_mtrr_cap);
 		// Traverse variable-range MTRRs.
 		for(u32 i=0;i<mtrr_cap.variable_count;i++)
-			nvc_ept_update_per_var_mtrr(eptm,ia32_mtrr_phys_base0+(i<<1));
+			result&=nvc_ept_update_per_var_mtrr(eptm,ia32_mtrr_phys_base0+(i<<1));
 		// By the way, set the SMRR.
 		if(mtrr_cap.support_smrr)
-			nvc_ept_update_per_var_mtrr(eptm,ia32_smrr_phys_base);
+			result&=nvc_ept_update_per_var_mtrr(eptm,ia32_smrr_phys_base);
 	}
 	// Traverse fixed-range MTRRs.
 	if(eptm->def_type.enabled && eptm->def_type.fix_enabled)
@@ -480,64 +474,69 @@ void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 		u64 fix4k_f8000=noir_rdmsr(ia32_mtrr_fix4k_f8000);
 		// Locate the PTE descriptor for first 2MiB.
 		noir_ept_pte_descriptor_p pte_p=nvc_ept_split_pde(eptm,0,true,true);
-		// MTRR Fixed64K 00000
-		// This register specifies eight 64KiB ranges, 512KiB in total.
-		type=(u8*)&fix64k_00000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<16;j++)	// 64KiB is actually 16 pages.
-				pte_p->virt[(i<<4)+j].memory_type=type[i];
-		// MTRR Fixed16K_80000
-		// This register specifies eight 16KiB ranges, 128KiB in total.
-		type=(u8*)&fix16k_80000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
-				pte_p->virt[0x80+(i<<2)+j].memory_type=type[i];
-		// MTRR Fixed16K_a0000
-		// This register specifies eight 16KiB ranges, 128KiB in total.
-		type=(u8*)&fix16k_a0000;
-		for(u32 i=0;i<8;i++)
-			for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
-				pte_p->virt[0xa0+(i<<2)+j].memory_type=type[i];
-		// MTRR Fixed4K_c0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_c0000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xc0+i].memory_type=type[i];
-		// MTRR Fixed4K_c8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_c8000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xc8+i].memory_type=type[i];
-		// MTRR Fixed4K_d0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_d0000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xd0+i].memory_type=type[i];
-		// MTRR Fixed4K_d8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_d8000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xd8+i].memory_type=type[i];
-		// MTRR Fixed4K_e0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_e0000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xe0+i].memory_type=type[i];
-		// MTRR Fixed4K_e8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_e8000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xe8+i].memory_type=type[i];
-		// MTRR Fixed4K_f0000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_f0000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xf0+i].memory_type=type[i];
-		// MTRR Fixed4K_f8000
-		// This register specifies eight 4KiB ranges, 32KiB in total
-		type=(u8*)&fix4k_f8000;
-		for(u32 i=0;i<8;i++)
-			pte_p->virt[0xf8+i].memory_type=type[i];
+		if(pte_p==null)
+			result=false;
+		else
+		{
+			// MTRR Fixed64K 00000
+			// This register specifies eight 64KiB ranges, 512KiB in total.
+			type=(u8*)&fix64k_00000;
+			for(u32 i=0;i<8;i++)
+				for(u32 j=0;j<16;j++)	// 64KiB is actually 16 pages.
+					pte_p->virt[(i<<4)+j].memory_type=type[i];
+			// MTRR Fixed16K_80000
+			// This register specifies eight 16KiB ranges, 128KiB in total.
+			type=(u8*)&fix16k_80000;
+			for(u32 i=0;i<8;i++)
+				for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
+					pte_p->virt[0x80+(i<<2)+j].memory_type=type[i];
+			// MTRR Fixed16K_a0000
+			// This register specifies eight 16KiB ranges, 128KiB in total.
+			type=(u8*)&fix16k_a0000;
+			for(u32 i=0;i<8;i++)
+				for(u32 j=0;j<4;j++)	// 16KiB is actually 4 pages.
+					pte_p->virt[0xa0+(i<<2)+j].memory_type=type[i];
+			// MTRR Fixed4K_c0000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_c0000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xc0+i].memory_type=type[i];
+			// MTRR Fixed4K_c8000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_c8000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xc8+i].memory_type=type[i];
+			// MTRR Fixed4K_d0000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_d0000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xd0+i].memory_type=type[i];
+			// MTRR Fixed4K_d8000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_d8000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xd8+i].memory_type=type[i];
+			// MTRR Fixed4K_e0000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_e0000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xe0+i].memory_type=type[i];
+			// MTRR Fixed4K_e8000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_e8000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xe8+i].memory_type=type[i];
+			// MTRR Fixed4K_f0000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_f0000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xf0+i].memory_type=type[i];
+			// MTRR Fixed4K_f8000
+			// This register specifies eight 4KiB ranges, 32KiB in total
+			type=(u8*)&fix4k_f8000;
+			for(u32 i=0;i<8;i++)
+				pte_p->virt[0xf8+i].memory_type=type[i];
+		}
 	}
 	// Clear all MTRR-related bits.
 	for(u32 i=0;i<512*512;i++)
@@ -548,6 +547,7 @@ void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm)
 	for(noir_ept_pte_descriptor_p pte_p=eptm->pte.head;pte_p;pte_p=pte_p->next)
 		for(u32 i=0;i<512;i++)
 			pte_p->virt[i].var_mtrr_covered=false;
+	return result;
 }
 
 bool nvc_ept_install_mmio_hook(noir_ept_manager_p eptm,noir_io_avl_node_p node)
@@ -671,6 +671,7 @@ noir_ept_manager_p nvc_ept_build_identity_map()
 #endif
 	if(eptm)
 	{
+		noir_initialize_page_arena(&eptm->arena,sizeof(noir_ept_pde_descriptor));
 		eptm->eptp.virt=noir_alloc_contd_memory(page_size);
 		if(eptm->eptp.virt)
 		{
@@ -715,8 +716,14 @@ noir_ept_manager_p nvc_ept_build_identity_map()
 			eptm->eptp.virt[i].write=1;
 			eptm->eptp.virt[i].execute=1;
 		}
-		// Update MTRR.
-		nvc_ept_update_by_mtrr(eptm);
+		// Paging structures are split from the reserved pages only.
+		if(noir_reserve_page_arena(&eptm->arena,noir_arena_reserve_pages)==false)goto alloc_failure;
+		// Update MTRR. Reserve more pages until all pages required by MTRRs are split.
+		while(nvc_ept_update_by_mtrr(eptm)==false)
+			if(noir_reserve_page_arena(&eptm->arena,eptm->arena.free_page_count+noir_arena_chunk_pages)==false)
+				goto alloc_failure;
+		// Top up the arena again for splits in VM-exit context.
+		if(noir_reserve_page_arena(&eptm->arena,noir_arena_reserve_pages)==false)goto alloc_failure;
 #if !defined(_hv_type1)
 		// Make Hooked Pages.
 		noir_copy_memory(eptm->hook_pages,noir_hook_pages,sizeof(noir_hook_page)*noir_hook_pages_count);
@@ -235,6 +235,7 @@ typedef struct _noir_ept_manager
 		noir_ept_pte_descriptor_p head;
 		noir_ept_pte_descriptor_p tail;
 	}pte;
+	noir_page_arena arena;
 	memory_descriptor blank_page;
 	ia32_mtrr_def_type_msr def_type;
 	u8 phys_addr_size;
@@ -279,4 +280,4 @@ bool nvc_ept_protect_hypervisor(noir_hypervisor_p hvm,noir_ept_manager_p eptm);
 bool nvc_ept_setup_mmio_hooks(noir_ept_manager_p eptm);
 noir_ept_manager_p nvc_ept_build_identity_map();
 void nvc_ept_cleanup(noir_ept_manager_p eptm);
-void nvc_ept_update_by_mtrr(noir_ept_manager_p eptm);
\ No newline at end of file
+bool nvc_ept_update_by_mtrr(noir_ept_manager_p eptm);
\ No newline at end of file
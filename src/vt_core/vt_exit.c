@@ -757,14 +757,15 @@ void static noir_hvcode fastcall nvc_vt_cr_access_handler(noir_gpr_state_p gpr_s
 						if(noir_bt((u32*)&data,ia32_cr0_cd)==0 && vcpu->mtrr_dirty)
 						{
 							invept_descriptor ied;
-							// Reset EPT entries.
-							nvc_ept_update_by_mtrr(vcpu->ept_manager);
+							// Reset EPT entries. If the reserved pages are drained, keep the MTRR dirty and retry later.
+							if(nvc_ept_update_by_mtrr(vcpu->ept_manager))
+								vcpu->mtrr_dirty=0;		// Mark this vCPU's MTRR is clean
+							else
+								nvd_printf("Reserved pages for EPT are drained! MTRRs are partially emulated!\n");
 							// Flush EPT TLB due to the update.
 							ied.eptp=vcpu->ept_manager->eptp.phys.value;
 							ied.reserved=0;
 							noir_vt_invept(ept_single_invd,&ied);
-							// Mark this vCPU's MTRR is clean
-							vcpu->mtrr_dirty=0;
 						}
 					}
 					// If the guest tries to change the paging mode, we have to emulate this behavior in Guest EFER and VM-Entry Controls.
@@ -1038,8 +1039,12 @@ void static noir_hvcode fastcall nvc_vt_wrmsr_handler(noir_gpr_state_p gpr_state
 					else
 					{
 						invept_descriptor ied;
-						// Reset EPT entries.
-						nvc_ept_update_by_mtrr(vcpu->ept_manager);
+						// Reset EPT entries. If the reserved pages are drained, retry when CR0.CD is cleared again.
+						if(nvc_ept_update_by_mtrr(vcpu->ept_manager)==false)
+						{
+							nvd_printf("Reserved pages for EPT are drained! MTRRs are partially emulated!\n");
+							vcpu->mtrr_dirty=1;
+						}
 						// Flush EPT TLB due to the update.
 						ied.eptp=vcpu->ept_manager->eptp.phys.value;
 						ied.reserved=0;
@@ -1357,6 +1362,29 @@ void static noir_hvcode fastcall nvc_vt_ept_violation_handler(noir_gpr_state_p g
 	if(!is_stealth_hook && !info.execute)
 #endif
 	{
+		void* gva;
+		// Writes to CI pages are discarded by Hardware-Enforced CI.
+		if(info.write && noir_ci && noir_ci_is_ci_phys_page(gpa,&gva))
+		{
+			vmx_segment_access_right cs_attrib;
+			ulong_ptr gcsb,gcr3,gcr4;
+			u8 instruction[15]={0};
+			u32 err;
+			nvd_tracef("CI-event is intercepted! GPA=0x%llX, GVA=0x%p, rip=0x%llX\n",gpa,gva,gip);
+			// Let the CI worker re-hash this page.
+			noir_ci_log_write(gpa);
+			// VM-Exit instruction length is undefined for EPT Violations. Decode the instruction.
+			noir_vt_vmread(guest_cs_access_rights,&cs_attrib.value);
+			noir_vt_vmread(guest_cs_base,&gcsb);
+			noir_vt_vmread(guest_cr3,&gcr3);
+			noir_vt_vmread(guest_cr4,&gcr4);
+			nvc_copy_host_virtual_memory64(gcr3,gcsb+gip,instruction,sizeof(instruction),false,noir_bt(&gcr4,ia32_cr4_la57),&err);
+			gip+=noir_get_instruction_length(instruction,cs_attrib.long_mode);
+			// If guest is not in long mode, cut the higher 32 bits in rip register.
+			if(!cs_attrib.long_mode)gip&=maxu32;
+			noir_vt_vmwrite(guest_rip,gip);
+			return;
+		}
 		// This could be MMIO Hook.
 		u32 err;
 		u8 val[8];
@@ -239,8 +239,6 @@ void nvc_vt_iommu_cleanup()
 	noir_dmar_manager_p dmarm=hvm_p->relative_hvm->dmar_manager;
 	if(dmarm)
 	{
-		noir_dmar_pde_descriptor_p pde_p=dmarm->pde.head;
-		noir_dmar_pte_descriptor_p pte_p=dmarm->pte.head;
 		for(u64 i=0;i<dmarm->iommu_count;i++)
 		{
 			// Unmap IOMMU Register Base.
@@ -266,53 +264,14 @@ void nvc_vt_iommu_cleanup()
 				noir_free_contd_memory(dmarm->pml5.virt,page_size);
 		// Level 4 (PML4E) can be either top-level or sub-level.
 		if(dmarm->minimum_features.using_agaw<=intel_iommu_context_agaw_48_bit)
-		{
 			if(dmarm->pml4.virt)
 				noir_free_contd_memory(dmarm->pml4.virt,page_size);
-		}
-		else
-		{
-			// This is a linked-list.
-			noir_dmar_pml4e_descriptor_p cur=dmarm->pml4.head;
-			while(cur)
-			{
-				noir_dmar_pml4e_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
 		// Level 3 (PDPTE) can be either top-level or sub-level.
 		if(dmarm->minimum_features.using_agaw<=intel_iommu_context_agaw_39_bit)
-			noir_free_contd_memory(dmarm->pdpte.virt,page_size);
-		else
-		{
-			// This is a linked-list.
-			noir_dmar_pdpte_descriptor_p cur=dmarm->pdpte.head;
-			while(cur)
-			{
-				noir_dmar_pdpte_descriptor_p next=cur->next;
-				if(cur->virt)noir_free_contd_memory(cur->virt,page_size);
-				noir_free_nonpg_memory(cur);
-				cur=next;
-			}
-		}
-		// Level 2 (PDE) is always sub-level.
-		while(pde_p)
-		{
-			noir_dmar_pde_descriptor_p next=pde_p->next;
-			if(pde_p->virt)noir_free_contd_memory(pde_p->virt,page_size);
-			noir_free_nonpg_memory(pde_p);
-			pde_p=next;
-		}
-		// Level 1 (PTE) is always sub-level.
-		while(pte_p)
-		{
-			noir_dmar_pte_descriptor_p next=pte_p->next;
-			if(pte_p->virt)noir_free_contd_memory(pte_p->virt,page_size);
-			noir_free_nonpg_memory(pte_p);
-			pte_p=next;
-		}
+			if(dmarm->pdpte.virt)
+				noir_free_contd_memory(dmarm->pdpte.virt,page_size);
+		// Sub-level structures and their descriptors are released in bulk.
+		noir_finalize_page_arena(&dmarm->arena);
 		// Free the entire DMAR Manager.
 		noir_free_nonpg_memory(dmarm);
 	}
@@ -373,16 +332,15 @@ noir_status nvc_vt_iommu_create_512gb_page_map(noir_dmar_manager_p dmar_manager,
 			*descriptor=pml4e_p;
 			return noir_success;
 		}
-		pml4e_p=noir_alloc_nonpg_memory(sizeof(noir_dmar_pml4e_descriptor));
+		pml4e_p=noir_arena_alloc_object(&dmar_manager->arena);
 		if(pml4e_p)
 		{
-			pml4e_p->virt=noir_alloc_contd_memory(sizeof(page_size));
+			pml4e_p->virt=noir_arena_alloc_page(&dmar_manager->arena,&pml4e_p->phys);
 			if(pml4e_p->virt==null)
-				noir_free_nonpg_memory(pml4e_p);
+				noir_arena_free_object(&dmar_manager->arena,pml4e_p);
 			else
 			{
 				// Setup PML4E descriptor.
-				pml4e_p->phys=noir_get_physical_address(pml4e_p->virt);
 				pml4e_p->gpa_start=page_256tb_base(gpa);
 				// Append to linked-list.
 				if(dmar_manager->pml4.head)
@@ -444,12 +402,12 @@ noir_status nvc_vt_iommu_create_1gb_page_map(noir_dmar_manager_p dmar_manager,u6
 			*descriptor=pdpte_p;
 			return noir_success;
 		}
-		pdpte_p=noir_alloc_nonpg_memory(sizeof(noir_dmar_pdpte_descriptor));
+		pdpte_p=noir_arena_alloc_object(&dmar_manager->arena);
 		if(pdpte_p)
 		{
-			pdpte_p->virt=noir_alloc_contd_memory(page_size);
+			pdpte_p->virt=noir_arena_alloc_page(&dmar_manager->arena,&pdpte_p->phys);
 			if(pdpte_p->virt==null)
-				noir_free_nonpg_memory(pdpte_p);
+				noir_arena_free_object(&dmar_manager->arena,pdpte_p);
 			else
 			{
 				// Locate the PML4E descriptor to update PDPTE.
@@ -458,7 +416,6 @@ noir_status nvc_vt_iommu_create_1gb_page_map(noir_dmar_manager_p dmar_manager,u6
 				if(st==noir_success)
 				{
 					// Setup PDPTE descriptor.
-					pdpte_p->phys=noir_get_physical_address(pdpte_p->virt);
 					pdpte_p->gpa_start=page_512gb_base(gpa);
 					// Append to linked-list.
 					if(dmar_manager->pdpte.head)
@@ -499,8 +456,8 @@ noir_status nvc_vt_iommu_create_1gb_page_map(noir_dmar_manager_p dmar_manager,u6
 				}
 				else
 				{
-					noir_free_contd_memory(pdpte_p->virt,page_size);
-					noir_free_nonpg_memory(pdpte_p);
+					noir_arena_free_page(&dmar_manager->arena,pdpte_p->virt,pdpte_p->phys);
+					noir_arena_free_object(&dmar_manager->arena,pdpte_p);
 				}
 			}
 		}
@@ -519,12 +476,12 @@ noir_status nvc_vt_iommu_create_2mb_page_map(noir_dmar_manager_p dmar_manager,u6
 		*descriptor=pde_p;
 		return noir_success;
 	}
-	pde_p=noir_alloc_nonpg_memory(sizeof(noir_dmar_pde_descriptor));
+	pde_p=noir_arena_alloc_object(&dmar_manager->arena);
 	if(pde_p)
 	{
-		pde_p->virt=noir_alloc_contd_memory(page_size);
+		pde_p->virt=noir_arena_alloc_page(&dmar_manager->arena,&pde_p->phys);
 		if(pde_p->virt==null)
-			noir_free_nonpg_memory(pde_p);
+			noir_arena_free_object(&dmar_manager->arena,pde_p);
 		else
 		{
 			// Locate the PDPTE descriptor to update PDPTE.
@@ -533,7 +490,6 @@ noir_status nvc_vt_iommu_create_2mb_page_map(noir_dmar_manager_p dmar_manager,u6
 			if(st==noir_success)
 			{
 				// Setup PDE descriptor.
-				pde_p->phys=noir_get_physical_address(pde_p->virt);
 				pde_p->gpa_start=page_1gb_base(gpa);
 				// Append to linked-list.
 				if(dmar_manager->pde.head)
@@ -577,8 +533,8 @@ noir_status nvc_vt_iommu_create_2mb_page_map(noir_dmar_manager_p dmar_manager,u6
 			}
 			else
 			{
-				noir_free_contd_memory(pde_p->virt,page_size);
-				noir_free_nonpg_memory(pde_p);
+				noir_arena_free_page(&dmar_manager->arena,pde_p->virt,pde_p->phys);
+				noir_arena_free_object(&dmar_manager->arena,pde_p);
 			}
 		}
 	}
@@ -596,12 +552,12 @@ noir_status nvc_vt_iommu_create_4kb_page_map(noir_dmar_manager_p dmar_manager,u6
 		*descriptor=pte_p;
 		return noir_success;
 	}
-	pte_p=noir_alloc_nonpg_memory(sizeof(noir_dmar_pte_descriptor));
+	pte_p=noir_arena_alloc_object(&dmar_manager->arena);
 	if(pte_p)
 	{
-		pte_p->virt=noir_alloc_contd_memory(page_size);
+		pte_p->virt=noir_arena_alloc_page(&dmar_manager->arena,&pte_p->phys);
 		if(pte_p->virt==null)
-			noir_free_nonpg_memory(pte_p);
+			noir_arena_free_object(&dmar_manager->arena,pte_p);
 		else
 		{
 			// Locate the PDE descriptor to update PDE.
@@ -610,7 +566,6 @@ noir_status nvc_vt_iommu_create_4kb_page_map(noir_dmar_manager_p dmar_manager,u6
 			if(st==noir_success)
 			{
 				// Setup PTE descriptor.
-				pte_p->phys=noir_get_physical_address(pte_p->virt);
 				pte_p->gpa_start=page_2mb_base(gpa);
 				// Append to linked-list.
 				if(dmar_manager->pte.head)
@@ -634,8 +589,8 @@ noir_status nvc_vt_iommu_create_4kb_page_map(noir_dmar_manager_p dmar_manager,u6
 			}
 			else
 			{
-				noir_free_contd_memory(pte_p->virt,page_size);
-				noir_free_nonpg_memory(pte_p);
+				noir_arena_free_page(&dmar_manager->arena,pte_p->virt,pte_p->phys);
+				noir_arena_free_object(&dmar_manager->arena,pte_p);
 			}
 		}
 	}
@@ -797,6 +752,7 @@ noir_status nvc_vt_iommu_initialize()
 	{
 		noir_dmar_manager_p dmarm=noir_alloc_nonpg_memory(sizeof(noir_dmar_manager)+iommu_bar_count*sizeof(noir_dmar_iommu_bar_descriptor));
 		if(dmarm==null)goto alloc_failure;
+		noir_initialize_page_arena(&dmarm->arena,sizeof(noir_dmar_pdpte_descriptor));
 		dmarm->iommu_count=iommu_bar_count;
 		nv_dprintf("This system %s 2MiB Large-Page and %s 1GiB Huge-Page\n",large_page?"supports":"doesn't support",huge_page?"supports":"doesn't support");
 		hvm_p->relative_hvm->dmar_manager=dmarm;
@@ -149,6 +149,8 @@ typedef struct _noir_dmar_manager
 		noir_dmar_pte_descriptor_p head;
 		noir_dmar_pte_descriptor_p tail;
 	}pte;
+	// Sub-level paging structures and descriptors are allocated from the arena.
+	noir_page_arena arena;
 	// Lower bits list the features supported by all IOMMU Hardwares.
 	// Higher bits list the what NoirVisor has enabled.
 	union
@@ -22,7 +22,7 @@
 #include <ci.h>
 
 // Use CRC32 Castagnoli Algorithm.
-u32 static stdcall noir_crc32_page_std(void* page)
+u32 stdcall noir_crc32_page_std(void* page)
 {
 	u8* buf=(u8*)page;
 	u32 crc=0xffffffff;
@@ -34,6 +34,51 @@ u32 static stdcall noir_crc32_page_std(void* page)
     return crc;
 }
 
+// Slice-by-8 consumes 8 bytes per iteration with eight independent table lookups.
+u32 stdcall noir_crc32_page_slice8(void* page)
+{
+	u64p buf=(u64p)page;
+	u32 crc=0xffffffff;
+	for(u32 i=0;i<page_size>>3;i++)
+	{
+		const u64 v=buf[i]^crc;
+		crc=crc32c_slice_table[7][v&0xff]^crc32c_slice_table[6][(v>>8)&0xff];
+		crc^=crc32c_slice_table[5][(v>>16)&0xff]^crc32c_slice_table[4][(v>>24)&0xff];
+		crc^=crc32c_slice_table[3][(v>>32)&0xff]^crc32c_slice_table[2][(v>>40)&0xff];
+		crc^=crc32c_slice_table[1][(v>>48)&0xff]^crc32c_slice_table[0][v>>56];
+	}
+	return crc;
+}
+
+void static noir_crc32_generate_slice_table()
+{
+	for(u32 i=0;i<256;i++)
+	{
+		u32 crc=crc32c_table[i];
+		crc32c_slice_table[0][i]=crc;
+		for(u32 j=1;j<8;j++)
+		{
+			crc=crc32c_table[crc&0xff]^(crc>>8);
+			crc32c_slice_table[j][i]=crc;
+		}
+	}
+}
+
+void static stdcall noir_crc32_pages_std(void** pages,u32p crc,u32 count)
+{
+	for(u32 i=0;i<count;i++)crc[i]=noir_crc32_page(pages[i]);
+}
+
+#if defined(_amd64)
+void static stdcall noir_crc32_pages_sse(void** pages,u32p crc,u32 count)
+{
+	u32 i=0;
+	// Three pages are hashed at once to hide the latency of crc32 instruction.
+	for(;i+3<=count;i+=3)noir_crc32_3pages_sse(&pages[i],&crc[i]);
+	for(;i<count;i++)crc[i]=noir_crc32_page(pages[i]);
+}
+#endif
+
 // This function checks the basic SLAT capability.
 // It is specific for the CI component.
 // Returning true, this function does not imply
@@ -88,33 +133,145 @@ svm_check:
 	return false;
 }
 
-bool noir_hvcode fastcall noir_ci_is_ci_phys_page(u64 phys,void** virt)
+i32 static noir_hvcode noir_ci_find_phys_page(u64 phys)
 {
-	u32 lo=0,hi=noir_ci->pages;
+	i32 lo=0,hi=(i32)noir_ci->pages-1;
 	while(lo<=hi)
 	{
-		u32 mid=(lo+hi)>>1;
+		i32 mid=(lo+hi)>>1;
 		if(phys<noir_ci->page_ci[mid].phys)
 			hi=mid-1;
 		else if(phys>=noir_ci->page_ci[mid].phys+page_size)
 			lo=mid+1;
 		else
+			return mid;
+	}
+	return -1;
+}
+
+bool noir_hvcode fastcall noir_ci_is_ci_phys_page(u64 phys,void** virt)
+{
+	i32 i=noir_ci_find_phys_page(phys);
+	if(i<0)return false;
+	if(virt)*virt=(void*)((ulong_ptr)noir_ci->page_ci[i].virt+page_offset(phys));
+	return true;
+}
+
+// This function is called in VM-Exit context when a write to CI page is intercepted.
+// In event-driven mode, the page is queued so that the worker would re-hash it.
+void noir_hvcode fastcall noir_ci_log_write(u64 phys)
+{
+	if(noir_ci->options.event_ci)
+	{
+		i32 i=noir_ci_find_phys_page(phys);
+		// Skip if the page is already queued.
+		if(i>=0 && noir_locked_cmpxchg(&noir_ci->page_queued[i],1,0)==0)
 		{
-			if(virt)*virt=(void*)((ulong_ptr)noir_ci->page_ci[mid].virt+page_offset(phys));
-			return true;
+			noir_ci_dirty_queue_p queue=&noir_ci->dirty_queues[noir_get_current_processor()%noir_ci->queue_count];
+			const u32 head=queue->head;
+			if(head-queue->tail>=noir_ci_dirty_queue_size)
+			{
+				// Queue is full. Let the worker sweep all pages.
+				noir_ci->page_queued[i]=0;
+				queue->overflow=1;
+			}
+			else
+			{
+				queue->page_index[head&(noir_ci_dirty_queue_size-1)]=(u32)i;
+				// Publish the entry only after it is written.
+				noir_compiler_barrier();
+				queue->head=head+1;
+			}
 		}
 	}
-	return false;
 }
 
 #if !defined(_hv_type1)
+// Verify a list of pages with the batch interface.
+void static noir_ci_verify_pages(noir_ci_context_p ncie,u32p index,u32 count)
+{
+	void* pages[16];
+	u32 crc[16];
+	for(u32 i=0;i<count;i+=16)
+	{
+		const u32 n=count-i>16?16:count-i;
+		for(u32 j=0;j<n;j++)pages[j]=ncie->page_ci[index[i+j]].virt;
+		noir_crc32_pages(pages,crc,n);
+		for(u32 j=0;j<n;j++)
+		{
+			if(crc[j]!=ncie->page_ci[index[i+j]].crc)
+				nvci_panicf("CI detected corruption in Page 0x%p!\n",pages[j]);
+			else
+				nvci_tracef("Page 0x%p scanned. CRC32C=0x%08X - No Anomaly.\n",pages[j],crc[j]);
+		}
+	}
+}
+
+void static noir_ci_sweep_pages(noir_ci_context_p ncie)
+{
+	u32 index[16],count=0;
+	for(u32 i=0;i<ncie->pages;i++)
+	{
+		// Skip pages that software CI was disabled.
+		if(!ncie->page_ci[i].options.soft_ci)continue;
+		index[count++]=i;
+		if(count==16)
+		{
+			noir_ci_verify_pages(ncie,index,count);
+			count=0;
+		}
+	}
+	noir_ci_verify_pages(ncie,index,count);
+}
+
+// Returns true if any queue has overflowed.
+bool static noir_ci_drain_dirty_queues(noir_ci_context_p ncie)
+{
+	bool overflow=false;
+	for(u32 i=0;i<ncie->queue_count;i++)
+	{
+		noir_ci_dirty_queue_p queue=&ncie->dirty_queues[i];
+		const u32 head=queue->head;
+		u32 index[noir_ci_dirty_queue_size],count=0;
+		// Do not read entries before the head is observed.
+		noir_compiler_barrier();
+		for(u32 tail=queue->tail;tail!=head;tail++)
+		{
+			const u32 j=queue->page_index[tail&(noir_ci_dirty_queue_size-1)];
+			// Clear the flag before hashing so that a later write is queued again.
+			noir_locked_xchg(&ncie->page_queued[j],0);
+			if(ncie->page_ci[j].options.soft_ci)index[count++]=j;
+		}
+		noir_compiler_barrier();
+		queue->tail=head;
+		noir_ci_verify_pages(ncie,index,count);
+		if(noir_locked_xchg(&queue->overflow,0))overflow=true;
+	}
+	return overflow;
+}
+
 u32 static noir_hvcode stdcall noir_ci_enforcement_worker(void* context)
 {
 	// Retrieve Thread Context
 	noir_ci_context_p ncie=(noir_ci_context_p)context;
+	u32 sweep_ticks=0;
 	// Check exit signal.
 	while(noir_locked_cmpxchg(&noir_ci_stop_signal,1,1)==0)
 	{
+		if(ncie->options.event_ci)
+		{
+			// Only re-hash pages whose write-protection is violated.
+			bool overflow=noir_ci_drain_dirty_queues(ncie);
+			// Periodic full sweep is the backstop.
+			if(overflow || ++sweep_ticks>=ci_sweep_delay/ci_event_delay)
+			{
+				noir_ci_sweep_pages(ncie);
+				sweep_ticks=0;
+			}
+			// Clock.
+			noir_sleep(ci_event_delay);
+			continue;
+		}
 		// Select a page to enforce CI.
 		u32 i=noir_ci_selected_page++;
 		// Skip pages that software CI was disabled.
@@ -157,12 +314,21 @@ bool noir_add_section_to_ci(void* base,u32 size,bool enable_scan)
 	for(u32 i=noir_ci->pages;i<noir_ci->pages+page_num;i++)
 	{
 		noir_ci->page_ci[i].virt=(void*)((ulong_ptr)base+page_mult(i-noir_ci->pages));
-		noir_ci->page_ci[i].crc=noir_crc32_page(noir_ci->page_ci[i].virt);
 		noir_ci->page_ci[i].phys=noir_get_physical_address(noir_ci->page_ci[i].virt);
 		noir_ci->page_ci[i].options.value=0;
 		noir_ci->page_ci[i].options.soft_ci=enable_scan?noir_ci->options.soft_ci:false;
 		noir_ci->page_ci[i].options.hard_ci=noir_ci->options.hard_ci;
 	}
+	// Hash the section in batches.
+	for(u32 i=0;i<page_num;i+=16)
+	{
+		void* pages[16];
+		u32 crc[16];
+		const u32 count=page_num-i>16?16:page_num-i;
+		for(u32 j=0;j<count;j++)pages[j]=noir_ci->page_ci[noir_ci->pages+i+j].virt;
+		noir_crc32_pages(pages,crc,count);
+		for(u32 j=0;j<count;j++)noir_ci->page_ci[noir_ci->pages+i+j].crc=crc[j];
+	}
 	noir_ci->pages+=page_num;
 	return true;
 }
@@ -177,12 +343,27 @@ bool noir_activate_ci()
 		nvci_tracef("Number of pages protected by CI: %u\n",noir_ci->pages);
 		for(u32 i=0;i<noir_ci->pages;i++)
 			nvci_tracef("Physical: 0x%llX\t CRC32C: 0x%08X\t Virtual: 0x%p\n",noir_ci->page_ci[i].phys,noir_ci->page_ci[i].crc,noir_ci->page_ci[i].virt);
+		// Allocate dirty queues for event-driven mode.
+		if(noir_ci->options.event_ci)
+		{
+			const u32 count=noir_get_processor_count();
+			const size_t size=sizeof(noir_ci_dirty_queue)*count+sizeof(u32)*noir_ci->pages;
+			noir_ci->dirty_queues=noir_alloc_nonpg_memory(size);
+			if(noir_ci->dirty_queues)
+			{
+				noir_ci->page_queued=(u32v*)&noir_ci->dirty_queues[count];
+				noir_ci->queue_count=count;
+			}
+			else
+				noir_ci->options.event_ci=false;
+		}
 		// Create Worker Thread.
 		if(noir_ci->options.soft_ci)noir_ci->ci_thread=noir_create_thread(noir_ci_enforcement_worker,noir_ci);
 		if(noir_ci->ci_thread || noir_ci->options.soft_ci==false)
 			goto activation;
 		else
 		{
+			if(noir_ci->dirty_queues)noir_free_nonpg_memory(noir_ci->dirty_queues);
 			noir_free_contd_memory(noir_ci,page_size);
 			return false;
 		}
@@ -198,22 +379,38 @@ activation:
 bool noir_initialize_ci(bool soft_ci,bool hard_ci)
 {
 	// Check Intel EPT/AMD NPT supportability.
-	bool use_hard=hard_ci&noir_check_slat_paging();
+	bool use_hard=hard_ci && noir_check_slat_paging();
 	// Either Hardware-Level or Software-Level CI-Enforcement should be enabled.
 	// If both are disabled, fail the Code Integrity initialization.
 	if(use_hard || soft_ci)
 	{
-		// Check supportability of SSE4.2.
+		noir_crc32_generate_slice_table();
+		// Check supportability of SSE4.2 and PCLMULQDQ.
 		if(noir_check_sse42())
+		{
+#if defined(_amd64)
+			noir_crc32_page=noir_check_pclmulqdq()?noir_crc32_page_clmul:noir_crc32_page_sse;
+			noir_crc32_pages=noir_crc32_pages_sse;
+#else
 			noir_crc32_page=noir_crc32_page_sse;
+			noir_crc32_pages=noir_crc32_pages_std;
+#endif
+		}
 		else
-			noir_crc32_page=noir_crc32_page_std;
+		{
+			noir_crc32_page=noir_crc32_page_slice8;
+			noir_crc32_pages=noir_crc32_pages_std;
+		}
 		noir_ci=noir_alloc_contd_memory(page_size);
 		if(noir_ci)
 		{
 			noir_ci->limit=(page_size-sizeof(noir_ci_context))/sizeof(noir_ci_page);
 			noir_ci->options.soft_ci=soft_ci;
 			noir_ci->options.hard_ci=hard_ci;
+#if !defined(_hv_type1)
+			// If writes to CI pages are intercepted, the worker only has to re-hash pages being written.
+			noir_ci->options.event_ci=soft_ci && use_hard;
+#endif
 			// Add CI page to protection. Do not enable scanner. Otherwise CI will always report corruption.
 			if(noir_add_section_to_ci(noir_ci,page_size,false))
 				return true;
@@ -235,6 +432,7 @@ void noir_finalize_ci()
 		noir_alert_thread(noir_ci->ci_thread);
 		// Wait for exit.
 		noir_join_thread(noir_ci->ci_thread);
+		if(noir_ci->dirty_queues)noir_free_nonpg_memory(noir_ci->dirty_queues);
 #endif
 		// Finalization.
 		noir_free_contd_memory(noir_ci,page_size);
@@ -75,6 +75,7 @@ avl_node_p static noir_rotl_avl_node(avl_node_p x)
 	avl_node_p y=x->right,t2=y->left;
 	y->left=x;
 	x->right=t2;
+	// The lower node must be updated first.
 	noir_reset_avl_height(x);
 	noir_reset_avl_height(y);
 	return y;
@@ -85,8 +86,9 @@ avl_node_p static noir_rotr_avl_node(avl_node_p y)
 	avl_node_p x=y->left,t2=x->right;
 	x->right=y;
 	y->left=t2;
-	noir_reset_avl_height(x);
+	// The lower node must be updated first.
 	noir_reset_avl_height(y);
+	noir_reset_avl_height(x);
 	return x;
 }
 
@@ -95,7 +97,11 @@ avl_node_p noir_insert_avl_node(avl_node_p parent,avl_node_p node,noir_sorting_c
 {
 	// Insert to as-is place.
 	if(parent==null)
+	{
+		node->left=node->right=null;
+		node->height=1;
 		return node;
+	}
 	// Insert according to the comparison result.
 	const i32 compare_result=compare_fn(node,parent);
 	if(compare_result<0)
@@ -104,20 +110,27 @@ avl_node_p noir_insert_avl_node(avl_node_p parent,avl_node_p node,noir_sorting_c
 		parent->right=noir_insert_avl_node(parent->right,node,compare_fn);
 	noir_reset_avl_height(parent);
 	// Retrieve balance factor to determine how to rotate.
+	// Note that the balance factor is right-height minus left-height.
 	i64 bf=noir_get_avl_balance_factor(parent);
-	if(bf>1 && compare_result<0)			// Left-Left Case.
-		return noir_rotl_avl_node(parent);
-	else if(bf<-1 && compare_result>0)		// Right-Right Case.
-		return noir_rotr_avl_node(parent);
-	else if(bf>1 && compare_result>0)		// Left-Right Case.
+	if(bf<-1)
 	{
-		parent->left=noir_rotl_avl_node(parent->left);
-		return noir_rotr_avl_node(parent);
+		if(compare_fn(node,parent->left)<0)		// Left-Left Case.
+			return noir_rotr_avl_node(parent);
+		else									// Left-Right Case.
+		{
+			parent->left=noir_rotl_avl_node(parent->left);
+			return noir_rotr_avl_node(parent);
+		}
 	}
-	else if(bf<-1 && compare_result<0)		// Right-Left Case.
+	else if(bf>1)
 	{
-		parent->right=noir_rotr_avl_node(parent->right);
-		return noir_rotl_avl_node(parent);
+		if(compare_fn(node,parent->right)>=0)	// Right-Right Case.
+			return noir_rotl_avl_node(parent);
+		else									// Right-Left Case.
+		{
+			parent->right=noir_rotr_avl_node(parent->right);
+			return noir_rotl_avl_node(parent);
+		}
 	}
 	return parent;
 }
@@ -203,69 +216,223 @@ void noir_mmio_write64(u64 ptr,u64 val)
 	noir_memory_fence();
 }
 
-u32 noir_find_clear_bit(void* bitmap,u32 limit)
+/*
+  Bitmap Facility:
+
+  Bitmaps are accessed in qwords, so the size of a bitmap must be a multiple of 8 bytes.
+  Scanning checks four qwords at a time to skip the qwords without candidates, then locates
+  the bit with tzcnt. Vector instructions are not used, because the hypervisor must not
+  clobber the YMM registers of the guest.
+  Bits beyond the limit are never reported.
+*/
+u32 static noir_bitmap_tzcnt64(u64 mask)
 {
-	// Confirm the index border for bit scanning.
-	u32 result=0xffffffff;
 #if defined(_amd64)
-	u64 *bmp=(u64*)bitmap;
-	u32 limit_index=limit>>6;
-	if(limit & 0x3F)limit_index++;
+	return (u32)noir_tzcnt64(mask);
 #else
-	u32 *bmp=(u64*)bitmap;
-	u32 limit_index=limit>>5;
-	if(limit & 0x1F)limit_index++;
+	u32 index;
+	if(noir_bsf(&index,(u32)mask))return index;
+	noir_bsf(&index,(u32)(mask>>32));
+	return index+32;
 #endif
-	// Search the bitmap.
-	for(u32 i=0;i<limit_index;i++)
-	{
-		// Complement the mask before scanning in
-		// that we are looking for a cleared bit.
+}
+
+u32 static noir_bitmap_popcnt64(u64 mask)
+{
 #if defined(_amd64)
-		if(noir_bsf64(&result,~bmp[i]))
-		{
-			result+=(i<<6);
+	return (u32)noir_popcnt64(mask);
 #else
-		if(noir_bsf(&result,~bmp[i]))
-		{
-			result+=(i<<5);
+	return noir_popcnt((u32)mask)+noir_popcnt((u32)(mask>>32));
 #endif
+}
+
+// The complement is applied to each qword so that clear bits can be searched like set bits.
+u32 static noir_scan_bitmap(u64p bitmap,u32 limit,u64 complement)
+{
+	const u32 words=(limit+63)>>6;
+	u32 i=0;
+	for(;i+4<=words;i+=4)
+		if((bitmap[i]^complement)|(bitmap[i+1]^complement)|(bitmap[i+2]^complement)|(bitmap[i+3]^complement))
 			break;
+	for(;i<words;i++)
+	{
+		const u64 mask=bitmap[i]^complement;
+		if(mask)
+		{
+			const u32 result=(i<<6)+noir_bitmap_tzcnt64(mask);
+			return result<limit?result:0xffffffff;
 		}
 	}
-	return result;
+	return 0xffffffff;
+}
+
+u32 noir_find_clear_bit(void* bitmap,u32 limit)
+{
+	return noir_scan_bitmap((u64p)bitmap,limit,0xffffffffffffffff);
 }
 
 u32 noir_find_set_bit(void* bitmap,u32 limit)
 {
-	// Confirm the index border for bit scanning.
-	u32 result=0xffffffff;
+	return noir_scan_bitmap((u64p)bitmap,limit,0);
+}
+
+u32 noir_find_last_set_bit(void* bitmap,u32 limit)
+{
+	u64p bmp=(u64p)bitmap;
+	u32 i=(limit+63)>>6;
+	// Bits beyond the limit in the last qword are masked.
+	u64 mask=(limit&63)?((u64)1<<(limit&63))-1:0xffffffffffffffff;
+	while(i)
+	{
+		const u64 w=bmp[--i]&mask;
+		u32 index;
+		mask=0xffffffffffffffff;
 #if defined(_amd64)
-	u64 *bmp=(u64*)bitmap;
-	u32 limit_index=limit>>6;
-	if(limit & 0x3F)limit_index++;
+		if(noir_bsr64(&index,w))return (i<<6)+index;
 #else
-	u32 *bmp=(u64*)bitmap;
-	u32 limit_index=limit>>5;
-	if(limit & 0x1F)limit_index++;
+		if(noir_bsr(&index,(u32)(w>>32)))return (i<<6)+index+32;
+		if(noir_bsr(&index,(u32)w))return (i<<6)+index;
 #endif
-	// Search the bitmap.
-	for(u32 i=0;i<limit_index;i++)
+	}
+	return 0xffffffff;
+}
+
+void static noir_fill_bitmap_range(u64p bitmap,u32 start,u32 count,bool set)
+{
+	u32 i=start>>6;
+	const u32 last=(start+count-1)>>6;
+	if(count)
 	{
-		// Use bsf instruction to search.
-#if defined(_amd64)
-		if(noir_bsf64(&result,bmp[i]))
+		// Masks of the bits in range for the first and the last qwords.
+		const u64 head=0xffffffffffffffff<<(start&63);
+		const u64 tail=0xffffffffffffffff>>(63-((start+count-1)&63));
+		if(i==last)
 		{
-			result+=(i<<6);
-#else
-		if(noir_bsf(&result,bmp[i]))
-		{
-			result+=(i<<5);
-#endif
-			break;
+			if(set)bitmap[i]|=head&tail;
+			else bitmap[i]&=~(head&tail);
+			return;
 		}
+		if(set)bitmap[i]|=head;
+		else bitmap[i]&=~head;
+		for(i++;i<last;i++)bitmap[i]=set?0xffffffffffffffff:0;
+		if(set)bitmap[last]|=tail;
+		else bitmap[last]&=~tail;
+	}
+}
+
+void noir_set_bitmap_range(void* bitmap,u32 start,u32 count)
+{
+	noir_fill_bitmap_range((u64p)bitmap,start,count,true);
+}
+
+void noir_reset_bitmap_range(void* bitmap,u32 start,u32 count)
+{
+	noir_fill_bitmap_range((u64p)bitmap,start,count,false);
+}
+
+u32 noir_count_set_bits(void* bitmap,u32 limit)
+{
+	u64p bmp=(u64p)bitmap;
+	const u32 words=limit>>6;
+	u32 count=0;
+	for(u32 i=0;i<words;i++)count+=noir_bitmap_popcnt64(bmp[i]);
+	if(limit&63)count+=noir_bitmap_popcnt64(bmp[words]&(((u64)1<<(limit&63))-1));
+	return count;
+}
+
+/*
+  Summary Bitmap:
+
+  For large bitmaps, scanning the summaries locates the qword in 1/64 of the time.
+  The "full" summary is scanned for clear bits and the "nonempty" summary is scanned
+  for set bits. Every modification updates the summaries of the qwords it touches.
+  The summary bitmap is not synchronized. The owner must serialize the accesses.
+*/
+bool noir_initialize_summary_bitmap(noir_summary_bitmap_p sb,u32 limit)
+{
+	u32 summary_words;
+	sb->limit=limit;
+	sb->words=(limit+63)>>6;
+	summary_words=(sb->words+63)>>6;
+	sb->bitmap=noir_alloc_nonpg_memory(sb->words<<3);
+	sb->full=noir_alloc_nonpg_memory(summary_words<<3);
+	sb->nonempty=noir_alloc_nonpg_memory(summary_words<<3);
+	if(sb->bitmap && sb->full && sb->nonempty)return true;
+	noir_finalize_summary_bitmap(sb);
+	return false;
+}
+
+void noir_finalize_summary_bitmap(noir_summary_bitmap_p sb)
+{
+	if(sb->bitmap)noir_free_nonpg_memory(sb->bitmap);
+	if(sb->full)noir_free_nonpg_memory(sb->full);
+	if(sb->nonempty)noir_free_nonpg_memory(sb->nonempty);
+	sb->bitmap=sb->full=sb->nonempty=null;
+}
+
+void static noir_update_summary_words(noir_summary_bitmap_p sb,u32 first,u32 last)
+{
+	for(u32 i=first;i<=last;i++)
+	{
+		const u64 bit=(u64)1<<(i&63);
+		if(sb->bitmap[i]==0xffffffffffffffff)
+			sb->full[i>>6]|=bit;
+		else
+			sb->full[i>>6]&=~bit;
+		if(sb->bitmap[i])
+			sb->nonempty[i>>6]|=bit;
+		else
+			sb->nonempty[i>>6]&=~bit;
+	}
+}
+
+void noir_set_summary_bitmap(noir_summary_bitmap_p sb,u32 bit_position)
+{
+	sb->bitmap[bit_position>>6]|=(u64)1<<(bit_position&63);
+	noir_update_summary_words(sb,bit_position>>6,bit_position>>6);
+}
+
+void noir_reset_summary_bitmap(noir_summary_bitmap_p sb,u32 bit_position)
+{
+	sb->bitmap[bit_position>>6]&=~((u64)1<<(bit_position&63));
+	noir_update_summary_words(sb,bit_position>>6,bit_position>>6);
+}
+
+void noir_set_summary_bitmap_range(noir_summary_bitmap_p sb,u32 start,u32 count)
+{
+	if(count)
+	{
+		noir_fill_bitmap_range(sb->bitmap,start,count,true);
+		noir_update_summary_words(sb,start>>6,(start+count-1)>>6);
+	}
+}
+
+void noir_reset_summary_bitmap_range(noir_summary_bitmap_p sb,u32 start,u32 count)
+{
+	if(count)
+	{
+		noir_fill_bitmap_range(sb->bitmap,start,count,false);
+		noir_update_summary_words(sb,start>>6,(start+count-1)>>6);
 	}
-	return result;
+}
+
+// Only the last qword can be partially beyond the limit, so the first qword that is not full decides.
+u32 noir_find_clear_summary_bit(noir_summary_bitmap_p sb)
+{
+	const u32 word=noir_find_clear_bit(sb->full,sb->words);
+	if(word!=0xffffffff)
+	{
+		const u32 result=(word<<6)+noir_bitmap_tzcnt64(~sb->bitmap[word]);
+		if(result<sb->limit)return result;
+	}
+	return 0xffffffff;
+}
+
+u32 noir_find_set_summary_bit(noir_summary_bitmap_p sb)
+{
+	const u32 word=noir_find_set_bit(sb->nonempty,sb->words);
+	if(word!=0xffffffff)return (word<<6)+noir_bitmap_tzcnt64(sb->bitmap[word]);
+	return 0xffffffff;
 }
 
 u64 u64_max(const u64 n,...)
@@ -296,6 +463,177 @@ i64 i64_max(const u64 n,...)
 	return m;
 }
 
+/*
+  Page Arena Facility:
+
+  Paging structures are allocated and released frequently while guest memory is being remapped.
+  The arena hands out pre-zeroed pages from chunks of contiguous memory and carves its own pages
+  into fixed-size slots for the descriptors. Nothing is returned to the system until finalization,
+  where the chunks are released in bulk without walking through the paging structures.
+
+  The arena itself is not synchronized. The owner of the arena must serialize the accesses.
+  Refilling requires the allocator of the system. Reserve the pages in passive context beforehand.
+  In VM-exit context, use the reserved allocation, which fails instead of refilling the arena.
+*/
+u32v noir_arena_chunk_count=0;
+u32v noir_arena_refill_count=0;
+u32v noir_arena_pages_in_use=0;
+u32v noir_arena_objects_in_use=0;
+
+void noir_initialize_page_arena(noir_page_arena_p arena,u32 object_size)
+{
+	arena->chunks=null;
+	arena->free_pages=null;
+	arena->free_objects=null;
+	// Keep the slots aligned on pointer boundary.
+	arena->object_size=(object_size+sizeof(void*)-1)&~(u32)(sizeof(void*)-1);
+	arena->free_page_count=0;
+	arena->pages_in_use=0;
+	arena->objects_in_use=0;
+}
+
+bool noir_reserve_page_arena(noir_page_arena_p arena,u32 pages)
+{
+	while(arena->free_page_count<pages)
+	{
+		noir_arena_chunk_p chunk=noir_alloc_nonpg_memory(sizeof(noir_arena_chunk));
+		if(chunk==null)return false;
+		chunk->pages=noir_arena_chunk_pages;
+		chunk->virt=noir_alloc_contd_memory(page_4kb_mult(chunk->pages));
+		if(chunk->virt==null)
+		{
+			noir_free_nonpg_memory(chunk);
+			return false;
+		}
+		chunk->phys=noir_get_physical_address(chunk->virt);
+		noir_stosb(chunk->virt,0,page_4kb_mult(chunk->pages));
+		chunk->next=arena->chunks;
+		arena->chunks=chunk;
+		// Push the pages in reverse order so that they are handed out in ascending order.
+		for(u32 i=chunk->pages;i>0;i--)
+		{
+			noir_arena_page_p page=(noir_arena_page_p)((ulong_ptr)chunk->virt+page_4kb_mult(i-1));
+			page->next=arena->free_pages;
+			page->phys=chunk->phys+page_4kb_mult(i-1);
+			arena->free_pages=page;
+		}
+		arena->free_page_count+=chunk->pages;
+		noir_locked_inc(&noir_arena_chunk_count);
+		noir_locked_inc(&noir_arena_refill_count);
+	}
+	return true;
+}
+
+void* noir_arena_pop_page(noir_page_arena_p arena,u64p phys,bool refill)
+{
+	noir_arena_page_p page=arena->free_pages;
+	if(page==null)
+	{
+		// The arena is drained. Refill it if the allocator of the system is usable.
+		if(refill==false || noir_reserve_page_arena(arena,1)==false)return null;
+		page=arena->free_pages;
+	}
+	arena->free_pages=page->next;
+	arena->free_page_count--;
+	arena->pages_in_use++;
+	noir_locked_inc(&noir_arena_pages_in_use);
+	if(phys)*phys=page->phys;
+	// Erase the link so that the page is entirely zeroed.
+	page->next=null;
+	page->phys=0;
+	return page;
+}
+
+void* noir_arena_alloc_page(noir_page_arena_p arena,u64p phys)
+{
+	return noir_arena_pop_page(arena,phys,true);
+}
+
+// This function never refills the arena. It returns null if the reserved pages are drained.
+void* noir_arena_alloc_reserved_page(noir_page_arena_p arena,u64p phys)
+{
+	return noir_arena_pop_page(arena,phys,false);
+}
+
+// The phys must be the one returned on allocation. It is handed out again with the page.
+void noir_arena_free_page(noir_page_arena_p arena,void* virt,u64 phys)
+{
+	noir_arena_page_p page=(noir_arena_page_p)virt;
+	noir_stosb(virt,0,page_size);
+	page->next=arena->free_pages;
+	page->phys=phys;
+	arena->free_pages=page;
+	arena->free_page_count++;
+	arena->pages_in_use--;
+	noir_locked_dec(&noir_arena_pages_in_use);
+}
+
+void* noir_arena_pop_object(noir_page_arena_p arena,bool refill)
+{
+	void** object=arena->free_objects;
+	if(object==null)
+	{
+		// Carve a page into slots. Such pages are never returned until finalization.
+		u8p page=noir_arena_pop_page(arena,null,refill);
+		if(page==null)return null;
+		for(u32 i=page_size/arena->object_size;i>0;i--)
+		{
+			void** slot=(void**)&page[(i-1)*arena->object_size];
+			*slot=arena->free_objects;
+			arena->free_objects=slot;
+		}
+		object=arena->free_objects;
+	}
+	arena->free_objects=*object;
+	*object=null;
+	arena->objects_in_use++;
+	noir_locked_inc(&noir_arena_objects_in_use);
+	return object;
+}
+
+void* noir_arena_alloc_object(noir_page_arena_p arena)
+{
+	return noir_arena_pop_object(arena,true);
+}
+
+// This function never refills the arena. It returns null if the reserved pages are drained.
+void* noir_arena_alloc_reserved_object(noir_page_arena_p arena)
+{
+	return noir_arena_pop_object(arena,false);
+}
+
+void noir_arena_free_object(noir_page_arena_p arena,void* object)
+{
+	void** slot=(void**)object;
+	noir_stosb(object,0,arena->object_size);
+	*slot=arena->free_objects;
+	arena->free_objects=slot;
+	arena->objects_in_use--;
+	noir_locked_dec(&noir_arena_objects_in_use);
+}
+
+void noir_finalize_page_arena(noir_page_arena_p arena)
+{
+	noir_arena_chunk_p chunk=arena->chunks;
+	while(chunk)
+	{
+		noir_arena_chunk_p next=chunk->next;
+		noir_free_contd_memory(chunk->virt,page_4kb_mult(chunk->pages));
+		noir_free_nonpg_memory(chunk);
+		noir_locked_dec(&noir_arena_chunk_count);
+		chunk=next;
+	}
+	noir_locked_add(&noir_arena_pages_in_use,-(i32)arena->pages_in_use);
+	noir_locked_add(&noir_arena_objects_in_use,-(i32)arena->objects_in_use);
+	noir_initialize_page_arena(arena,arena->object_size);
+}
+
+void noir_report_arena_counters()
+{
+	nv_dprintf("Unreleased Arena Chunks: %u (%u KiB)\n",noir_arena_chunk_count,noir_arena_chunk_count*noir_arena_chunk_pages*4);
+	nv_dprintf("Arena Refills: %u, Pages in Use: %u, Objects in Use: %u\n",noir_arena_refill_count,noir_arena_pages_in_use,noir_arena_objects_in_use);
+}
+
 // Use the third-party static library for internal debugger.
 int rpl_vsnprintf(char *str,size_t size,const char *format,va_list args);
 
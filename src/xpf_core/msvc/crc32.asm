@@ -40,7 +40,7 @@ noir_crc32_page_sse proc
 	; Load relevant parameters.
 	xchg rsi,rcx	; rsi is volatile
 	mov rdx,rcx		; Save rsi to rdx
-	xor r8,r8		; Initialize CRC checksum.
+	or r8,-1		; Initialize CRC checksum.
 	mov ecx,512		; There are 512 8-byte blocks in a page.
 	cld				; Ensure correct direction.
 	; Use lods-loop combination for best performance.
@@ -54,6 +54,103 @@ loop_crc:
 
 noir_crc32_page_sse endp
 
+noir_check_pclmulqdq proc
+
+	xor eax,eax
+	inc eax
+	push rbx		; ebx is volatile
+	cpuid
+	bt ecx,1		; check flags
+	pop rbx			; restore ebx
+	setc al
+	movzx eax,al
+	ret
+
+noir_check_pclmulqdq endp
+
+; The crc32 instruction has 3-cycle latency but 1-cycle throughput.
+; Split the page into three 1360-byte streams so that three chains are in flight.
+; The stream checksums are combined by shifting them with carry-less multiplication.
+; A 32-bit checksum is shifted by N bytes if it is multiplied by x^(8N-33) mod P
+; and then reduced by a crc32 instruction with zero checksum.
+noir_crc32_page_clmul proc
+
+	; Input Registers:
+	; rcx: Page to be hashed.
+	; Save xmm registers
+	sub rsp,20h
+	movdqu xmmword ptr[rsp+00h],xmm0
+	movdqu xmmword ptr[rsp+10h],xmm1
+	mov r9,rcx
+	or eax,-1		; Initialize CRC checksum of the first stream.
+	xor edx,edx		; The other streams start with zero.
+	xor r8d,r8d
+	mov ecx,170		; There are 170 8-byte blocks in a stream.
+loop_crc3:
+	crc32 rax,qword ptr [r9]
+	crc32 rdx,qword ptr [r9+1360]
+	crc32 r8,qword ptr [r9+2720]
+	add r9,8
+	dec ecx
+	jnz loop_crc3
+	; Shift the first stream by 2720 bytes.
+	movd xmm0,eax
+	mov eax,5aa1f3cfh
+	movd xmm1,eax
+	pclmulqdq xmm0,xmm1,0
+	movq r10,xmm0
+	; Shift the second stream by 1360 bytes.
+	movd xmm0,edx
+	mov eax,3f70cc6fh
+	movd xmm1,eax
+	pclmulqdq xmm0,xmm1,0
+	movq rax,xmm0
+	; Reduce both products at once, then merge the third stream.
+	xor rax,r10
+	xor edx,edx
+	crc32 rdx,rax
+	xor edx,r8d
+	; Remaining two 8-byte blocks. r9 points to the end of the first stream.
+	crc32 rdx,qword ptr [r9+2720]
+	crc32 rdx,qword ptr [r9+2728]
+	mov eax,edx
+	; Restore xmm registers
+	movdqu xmm0,xmmword ptr[rsp+00h]
+	movdqu xmm1,xmmword ptr[rsp+10h]
+	add rsp,20h
+	ret
+
+noir_crc32_page_clmul endp
+
+; Hash three pages in parallel. No combination is required.
+noir_crc32_3pages_sse proc
+
+	; Input Registers:
+	; rcx: Array of three page pointers.
+	; rdx: Array of three checksums.
+	mov r8,qword ptr [rcx]
+	mov r9,qword ptr [rcx+8]
+	mov r10,qword ptr [rcx+16]
+	or eax,-1		; Initialize CRC checksums.
+	or r11d,-1
+	push rbx		; rbx is non-volatile
+	or ebx,-1
+	xor ecx,ecx
+loop_crc3p:
+	crc32 rax,qword ptr [r8+rcx]
+	crc32 r11,qword ptr [r9+rcx]
+	crc32 rbx,qword ptr [r10+rcx]
+	add ecx,8
+	cmp ecx,4096
+	jb loop_crc3p
+	mov dword ptr [rdx],eax
+	mov dword ptr [rdx+4],r11d
+	mov dword ptr [rdx+8],ebx
+	pop rbx
+	ret
+
+noir_crc32_3pages_sse endp
+
 else
 
 noir_check_sse42 proc
@@ -76,7 +173,7 @@ noir_crc32_page_sse proc uses esi p:dword
 
 	; Load relevant parameters.
 	mov esi,dword ptr [p]
-	xor edx,edx		; Initialize CRC checksum.
+	or edx,-1		; Initialize CRC checksum.
 	mov ecx,1024	; There are 1024 4-byte blocks in a page.
 	cld				; Ensure correct direction.
 	; Use lods-loop combination for best performance.
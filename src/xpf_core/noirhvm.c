@@ -181,14 +181,28 @@ noir_status nvc_set_guest_vcpu_options(noir_cvm_virtual_cpu_p vcpu,noir_cvm_vcpu
 	return st;
 }
 
-void nvc_synchronize_vcpu_state(noir_cvm_virtual_cpu_p vcpu)
+void static nvc_synchronize_vcpu_state_groups(noir_cvm_virtual_cpu_p vcpu,u32 groups)
 {
+	vcpu->sync_groups=groups;
 	if(hvm_p->selected_core==use_svm_core)
 		noir_svm_vmmcall(noir_cvm_dump_vcpu_vmcb,(ulong_ptr)vcpu);
 	else if(hvm_p->selected_core==use_vt_core)
 		noir_vt_vmcall(noir_cvm_dump_vcpu_vmcb,(ulong_ptr)vcpu);
 }
 
+void nvc_synchronize_vcpu_state(noir_cvm_virtual_cpu_p vcpu)
+{
+	nvc_synchronize_vcpu_state_groups(vcpu,0xffffffff);
+}
+
+// Editing a part of a state group requires the rest of the group to be up-to-date,
+// in that the whole group will be reloaded. Synchronization of other groups is deferred.
+void static nvc_synchronize_vcpu_group(noir_cvm_virtual_cpu_p vcpu,u32 group)
+{
+	if(!vcpu->state_cache.synchronized && noir_bt(&vcpu->state_cache.value,group))
+		nvc_synchronize_vcpu_state_groups(vcpu,1<<group);
+}
+
 noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_register_name_p register_names,u32 register_count,u32 register_size,void* buffer)
 {
 	noir_status st=noir_invalid_parameter;
@@ -222,29 +236,28 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 		{
 			u32 copy_size=register_size<16?register_size:16;
 			segment_register_p seg_array=&vcpu->seg.es;
-			noir_copy_memory(&seg_array[register_names[i]-noir_cvm_register_es],reg_buff,copy_size);
-			// Clean Cache depending on scenario.
+			u32 group=noir_cvm_state_cache_lt;
 			switch(register_names[i])
 			{
 				case noir_cvm_register_es:
 				case noir_cvm_register_cs:
 				case noir_cvm_register_ds:
 				case noir_cvm_register_ss:
-					vcpu->state_cache.sr_valid=0;
+					group=noir_cvm_state_cache_sr;
 					break;
 				case noir_cvm_register_fs:
 				case noir_cvm_register_gs:
-					vcpu->state_cache.fg_valid=0;
+					group=noir_cvm_state_cache_fg;
 					break;
 				case noir_cvm_register_gdtr:
 				case noir_cvm_register_idtr:
-					vcpu->state_cache.dt_valid=0;
-					break;
-				case noir_cvm_register_tr:
-				case noir_cvm_register_ldtr:
-					vcpu->state_cache.lt_valid=0;
+					group=noir_cvm_state_cache_dt;
 					break;
 			}
+			// Only the group being edited is synchronized and then invalidated.
+			nvc_synchronize_vcpu_group(vcpu,group);
+			noir_copy_memory(&seg_array[register_names[i]-noir_cvm_register_es],reg_buff,copy_size);
+			noir_btr(&vcpu->state_cache.value,group);
 		}
 		// Control Register.
 		else if(register_names[i]>=noir_cvm_register_cr0 && register_names[i]<=noir_cvm_register_cr8)
@@ -252,20 +265,26 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 			switch(register_names[i])
 			{
 				case noir_cvm_register_cr0:
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_cr);
 					vcpu->crs.cr0=*(u64p)reg_buff;
 					vcpu->state_cache.cr_valid=0;
+					vcpu->gva_tlb.generation++;
 					break;
 				case noir_cvm_register_cr2:
 					vcpu->crs.cr2=*(u64p)reg_buff;
 					vcpu->state_cache.cr2valid=0;
 					break;
 				case noir_cvm_register_cr3:
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_cr);
 					vcpu->crs.cr3=*(u64p)reg_buff;
 					vcpu->state_cache.cr_valid=0;
+					vcpu->gva_tlb.generation++;
 					break;
 				case noir_cvm_register_cr4:
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_cr);
 					vcpu->crs.cr4=*(u64p)reg_buff;
 					vcpu->state_cache.cr_valid=0;
+					vcpu->gva_tlb.generation++;
 					break;
 				case noir_cvm_register_cr8:
 					vcpu->crs.cr8=*(u64p)reg_buff;
@@ -287,6 +306,7 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 		else if(register_names[i]==noir_cvm_register_dr6 || register_names[i]==noir_cvm_register_dr7)
 		{
 			u64p dr_array=&vcpu->drs.dr6;
+			nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_dr);
 			dr_array[register_names[i]-noir_cvm_register_dr6]=*(u64p)reg_buff;
 			vcpu->state_cache.dr_valid=0;
 		}
@@ -307,8 +327,10 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 				case noir_cvm_register_efer:
 					vcpu->msrs.efer=*(u64p)reg_buff;
 					vcpu->state_cache.ef_valid=0;
+					vcpu->gva_tlb.generation++;
 					break;
 				case noir_cvm_register_kgs_base:
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_fg);
 					vcpu->msrs.gsswap=*(u64p)reg_buff;
 					vcpu->state_cache.fg_valid=0;
 					break;
@@ -321,6 +343,7 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 				case noir_cvm_register_sysenter_eip:
 				{
 					u64p msr_array=&vcpu->msrs.sysenter_cs;
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_se);
 					msr_array[register_names[i]-noir_cvm_register_sysenter_cs]=*(u64p)reg_buff;
 					vcpu->state_cache.se_valid=0;
 					break;
@@ -336,6 +359,7 @@ noir_status nvc_edit_vcpu_registers2(noir_cvm_virtual_cpu_p vcpu,noir_cvm_regist
 				case noir_cvm_register_ststar:
 				{
 					u64p msr_array=&vcpu->msrs.star;
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_sc);
 					msr_array[register_names[i]-noir_cvm_register_star]=*(u64p)reg_buff;
 					vcpu->state_cache.sc_valid=0;
 					break;
@@ -514,6 +538,7 @@ noir_status nvc_edit_vcpu_registers(noir_cvm_virtual_cpu_p vcpu,noir_cvm_registe
 				vcpu->crs.cr3=cr_list[1];
 				vcpu->crs.cr4=cr_list[2];
 				vcpu->state_cache.cr_valid=0;
+				vcpu->gva_tlb.generation++;
 				break;
 			}
 			case noir_cvm_cr2_register:
@@ -546,11 +571,13 @@ noir_status nvc_edit_vcpu_registers(noir_cvm_virtual_cpu_p vcpu,noir_cvm_registe
 			case noir_cvm_fgseg_register:
 			{
 				segment_register_p sr_list=(segment_register_p)buffer;
-				vcpu->seg.fs=sr_list[0];
-				vcpu->seg.gs=sr_list[1];
-				// Compatibility purpose for Kernel-GS-Base settings.
+				// Kernel-GS-Base is in the same group. Keep it up-to-date if it is not specified.
 				if(buffer_size-noir_cvm_register_buffer_limit[noir_cvm_fgseg_register]>=sizeof(u64))
 					vcpu->msrs.gsswap=*(u64p)((ulong_ptr)buffer+32);
+				else
+					nvc_synchronize_vcpu_group(vcpu,noir_cvm_state_cache_fg);
+				vcpu->seg.fs=sr_list[0];
+				vcpu->seg.gs=sr_list[1];
 				vcpu->state_cache.fg_valid=0;
 				break;
 			}
@@ -612,6 +639,7 @@ noir_status nvc_edit_vcpu_registers(noir_cvm_virtual_cpu_p vcpu,noir_cvm_registe
 			{
 				vcpu->msrs.efer=*(u64*)buffer;
 				vcpu->state_cache.ef_valid=0;
+				vcpu->gva_tlb.generation++;
 				break;
 			}
 			case noir_cvm_pat_register:
@@ -872,24 +900,317 @@ invalid_state:
 	return false;
 }
 
-noir_status nvc_run_vcpu(noir_cvm_virtual_cpu_p vcpu,void* exit_context)
+bool static nvc_is_coalesced_mmio_gpa(noir_cvm_virtual_machine_p vm,u64 gpa)
+{
+	bool result=false;
+	while(1)
+	{
+		const i32 lock=vm->coalesced_mmio_lock;
+		if(lock>=0 && noir_locked_cmpxchg(&vm->coalesced_mmio_lock,lock+1,lock)==lock)break;
+		noir_pause();
+	}
+	for(u32 i=0;i<vm->coalesced_mmio_zone_count;i++)
+	{
+		if(gpa>=vm->coalesced_mmio_zones[i].gpa && gpa-vm->coalesced_mmio_zones[i].gpa<vm->coalesced_mmio_zones[i].size)
+		{
+			result=true;
+			break;
+		}
+	}
+	noir_locked_dec(&vm->coalesced_mmio_lock);
+	return result;
+}
+
+// Complete the MMIO write by appending it to the coalesced MMIO ring.
+// Return true if the vCPU can be resumed without going back to the User Hypervisor.
+bool static nvc_coalesce_mmio_write(noir_cvm_virtual_cpu_p vcpu)
+{
+	noir_cvm_memory_access_context_p mem_ctxt=&vcpu->exit_context.memory_access;
+	noir_cvm_vcpu_control_block_p vpcb=vcpu->tunnel;
+	noir_cvm_coalesced_mmio_ring_p ring;
+	noir_cvm_coalesced_mmio_entry_p entry;
+	u64 data,size_mask;
+	u32 count,watermark;
+	if(!vcpu->vcpu_options.use_tunnel || vcpu->vcpu_options.tunnel_format!=noir_cvm_tunnel_format_nvc)return false;
+	if(vpcb->size<field_offset(noir_cvm_vcpu_control_block,import_set) || vcpu->exit_context.intercept_code!=cv_memory_access)return false;
+	if(!mem_ctxt->access.write || mem_ctxt->access.execute || !mem_ctxt->access.fetched_bytes)return false;
+	// Single-stepping guests must see every instruction.
+	if(noir_bt(&vcpu->rflags,8))return false;
+	if(!vcpu->vm->coalesced_mmio_zone_count || !nvc_is_coalesced_mmio_gpa(vcpu->vm,mem_ctxt->gpa))return false;
+	if(!mem_ctxt->flags.decoded)nvc_emu_decode_memory_access(vcpu);
+	if(!mem_ctxt->flags.decoded || mem_ctxt->flags.instruction_code!=noir_cvm_instruction_code_mov)return false;
+	// Only values in GPRs or immediate numbers can be collected.
+	switch(mem_ctxt->flags.operand_size)
+	{
+		case 1:
+		case 2:
+		case 4:
+		{
+			size_mask=((u64)1<<(mem_ctxt->flags.operand_size<<3))-1;
+			break;
+		}
+		case 8:
+		{
+			size_mask=maxu64;
+			break;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+	switch(mem_ctxt->flags.operand_class)
+	{
+		case noir_cvm_operand_class_gpr:
+		{
+			data=((u64p)&vcpu->gpr)[mem_ctxt->flags.operand_code];
+			break;
+		}
+		case noir_cvm_operand_class_gpr8hi:
+		{
+			data=((u64p)&vcpu->gpr)[mem_ctxt->flags.operand_code]>>8;
+			break;
+		}
+		case noir_cvm_operand_class_immediate:
+		{
+			data=mem_ctxt->operand.imm.u;
+			break;
+		}
+		default:
+		{
+			return false;
+		}
+	}
+	// If the ring is full, deliver the write as usual.
+	ring=&vpcb->coalesced_mmio;
+	count=ring->tail-ring->head;
+	if(count>=noir_cvm_coalesced_mmio_ring_entries)return false;
+	entry=&ring->entries[ring->tail%noir_cvm_coalesced_mmio_ring_entries];
+	entry->gpa=mem_ctxt->gpa;
+	entry->data=data&size_mask;
+	entry->size=(u32)mem_ctxt->flags.operand_size;
+	entry->reserved=0;
+	noir_compiler_barrier();
+	ring->tail++;
+	// The write is completed. Advance the rip.
+	vcpu->rip=vcpu->exit_context.next_rip;
+	vcpu->state_cache.gprvalid=0;
+	watermark=ring->watermark;
+	if(watermark==0 || watermark>noir_cvm_coalesced_mmio_ring_entries)watermark=noir_cvm_coalesced_mmio_ring_entries;
+	if(count+1<watermark)return true;
+	// Tell the User Hypervisor to drain the ring.
+	vcpu->exit_context.intercept_code=cv_coalesced_mmio;
+	return false;
+}
+
+// Get the number of string I/O elements that can be transferred through io_buff in one batch.
+// The batch does not wrap around the address size.
+u32 static nvc_get_string_io_batch(noir_cvm_virtual_cpu_p vcpu,u64 address,u64 addr_mask,u32 size)
+{
+	noir_cvm_io_context_p io=&vcpu->exit_context.io;
+	const u64 room=noir_bt(&vcpu->rflags,amd64_rflags_df)?address&addr_mask:addr_mask-(address&addr_mask);
+	u64 count=io->access.repeat?vcpu->gpr.rcx&addr_mask:1;
+	if(count>sizeof(((noir_cvm_vcpu_control_block_p)0)->io_buff)/size)count=sizeof(((noir_cvm_vcpu_control_block_p)0)->io_buff)/size;
+	if(count && room/size<count-1)count=room/size+1;
+	return (u32)count;
+}
+
+void static nvc_reverse_string_io_elements(u8p buffer,u32 count,u32 size)
+{
+	for(u32 i=0,j=count-1;i<j;i++,j--)
+	{
+		for(u32 k=0;k<size;k++)
+		{
+			const u8 t=buffer[i*size+k];
+			buffer[i*size+k]=buffer[j*size+k];
+			buffer[j*size+k]=t;
+		}
+	}
+}
+
+// Advance the address register, rcx and rip as if the elements are transferred by the processor.
+void static nvc_advance_string_io(noir_cvm_virtual_cpu_p vcpu,u64p address,u64 addr_mask,u32 count,u32 size)
+{
+	noir_cvm_io_context_p io=&vcpu->exit_context.io;
+	const i64 stride=noir_bt(&vcpu->rflags,amd64_rflags_df)?-(i64)size:(i64)size;
+	const u64 value=*address+(u64)stride*count;
+	// Writing to 32-bit registers zero-extends. Writing to 16-bit registers merges.
+	*address=addr_mask==0xffff?(*address&~addr_mask)|(value&addr_mask):value&addr_mask;
+	if(io->access.repeat)
+	{
+		const u64 rcx=vcpu->gpr.rcx-count;
+		vcpu->gpr.rcx=addr_mask==0xffff?(vcpu->gpr.rcx&~addr_mask)|(rcx&addr_mask):rcx&addr_mask;
+	}
+	// The rep instruction is executed again if there are remaining elements.
+	if(!io->access.repeat || (vcpu->gpr.rcx&addr_mask)==0)vcpu->rip=vcpu->exit_context.next_rip;
+	vcpu->state_cache.gprvalid=0;
+}
+
+// Scatter the elements of a batched ins from io_buff into the guest memory.
+void static nvc_scatter_string_input(noir_cvm_virtual_cpu_p vcpu)
+{
+	noir_cvm_vcpu_control_block_p vpcb=vcpu->tunnel;
+	noir_cvm_io_context_p io=&vcpu->exit_context.io;
+	const u64 addr_mask=io->access.address_width>=8?maxu64:((u64)1<<(io->access.address_width<<3))-1;
+	const u32 size=io->access.operand_size;
+	const bool df=noir_bt(&vcpu->rflags,amd64_rflags_df);
+	u32 count=vcpu->pending_string_input,error_code;
+	u64 first=vcpu->gpr.rdi&addr_mask;
+	size_t copied;
+	vcpu->pending_string_input=0;
+	if(!vcpu->state_cache.synchronized)nvc_synchronize_vcpu_state(vcpu);
+	// Elements are stored downwards if the direction flag is set.
+	if(df)
+	{
+		first-=(u64)(count-1)*size;
+		nvc_reverse_string_io_elements(vpcb->io_buff,count,size);
+	}
+	// The destination is validated when the batch is made. It fails only if the mapping is changed in the meantime.
+	copied=nvc_copy_guest_virtual_memory(vcpu,io->segment.base+first,vpcb->io_buff,count*size,true,&error_code);
+	// If only a part is copied, the guest will run into the failure again.
+	if(copied<count*size)count=df?0:(u32)(copied/size);
+	if(count)nvc_advance_string_io(vcpu,&vcpu->gpr.rdi,addr_mask,count,size);
+}
+
+// Batch the string I/O. For outs, gather the elements into io_buff and complete them.
+// For ins, tell the User Hypervisor how many elements to be filled into io_buff.
+void static nvc_batch_string_io(noir_cvm_virtual_cpu_p vcpu)
+{
+	noir_cvm_vcpu_control_block_p vpcb=vcpu->tunnel;
+	noir_cvm_io_context_p io=&vcpu->exit_context.io;
+	u64 addr_mask;
+	u32 size,count;
+	if(!vcpu->vcpu_options.use_tunnel || vcpu->vcpu_options.tunnel_format!=noir_cvm_tunnel_format_nvc)return;
+	if(vcpu->exit_context.intercept_code!=cv_io_instruction || !io->access.string)return;
+	if(vpcb->size<field_offset(noir_cvm_vcpu_control_block,coalesced_mmio) || !vpcb->flags.batch_string_io)return;
+	vpcb->io.pio.port=io->port;
+	vpcb->io.pio.size=(u8)io->access.operand_size;
+	vpcb->io.pio.direction=(u8)io->access.io_type;
+	vpcb->io.pio.count=0;
+	// Single-stepping guests must see every iteration.
+	if(noir_bt(&vcpu->rflags,amd64_rflags_tf))return;
+	size=io->access.operand_size;
+	if(size!=1 && size!=2 && size!=4)return;
+	addr_mask=io->access.address_width>=8?maxu64:((u64)1<<(io->access.address_width<<3))-1;
+	if(io->access.io_type)
+	{
+		// Input: io_buff will be scattered when the vCPU runs again.
+		const bool df=noir_bt(&vcpu->rflags,amd64_rflags_df);
+		u64 first=vcpu->gpr.rdi&addr_mask;
+		size_t probed;
+		count=nvc_get_string_io_batch(vcpu,vcpu->gpr.rdi,addr_mask,size);
+		if(count==0)return;
+		if(!vcpu->state_cache.synchronized)nvc_synchronize_vcpu_state(vcpu);
+		// Device data cannot be put back. Batch only the elements whose destination is writable.
+		if(df)first-=(u64)(count-1)*size;
+		probed=nvc_probe_guest_virtual_memory(vcpu,io->segment.base+first,count*size,true);
+		// Leave the failed elements to the User Hypervisor.
+		if(probed<count*size)count=df?0:(u32)(probed/size);
+		if(count==0)return;
+		vcpu->pending_string_input=count;
+	}
+	else
+	{
+		// Output: gather the elements from the guest memory.
+		const bool df=noir_bt(&vcpu->rflags,amd64_rflags_df);
+		u64 first=vcpu->gpr.rsi&addr_mask;
+		size_t copied;
+		u32 error_code;
+		count=nvc_get_string_io_batch(vcpu,vcpu->gpr.rsi,addr_mask,size);
+		if(count==0)return;
+		if(!vcpu->state_cache.synchronized)nvc_synchronize_vcpu_state(vcpu);
+		if(df)first-=(u64)(count-1)*size;
+		copied=nvc_copy_guest_virtual_memory(vcpu,io->segment.base+first,vpcb->io_buff,count*size,false,&error_code);
+		// Leave the failed elements to the User Hypervisor.
+		if(copied<count*size)count=df?0:(u32)(copied/size);
+		if(count==0)return;
+		if(df)nvc_reverse_string_io_elements(vpcb->io_buff,count,size);
+		nvc_advance_string_io(vcpu,&vcpu->gpr.rsi,addr_mask,count,size);
+	}
+	vpcb->io.pio.count=count;
+}
+
+bool static nvc_validate_register_set(noir_cvm_register_name_p names,u32 count)
+{
+	if(count>noir_cvm_register_set_limit)return false;
+	// Segment registers take 16 bytes.
+	for(u32 i=0;i<count;i++)
+		if(names[i]>=noir_cvm_register_es && names[i]<=noir_cvm_register_ldtr)
+			return false;
+	return true;
+}
+
+noir_status nvc_set_vcpu_export_set(noir_cvm_virtual_cpu_p vcpu,noir_cvm_intercept_code intercept_code,noir_cvm_register_name_p names,u32 count)
+{
+	noir_status st=noir_invalid_parameter;
+	if(intercept_code<noir_cvm_register_set_code_limit && nvc_validate_register_set(names,count))
+	{
+		noir_acquire_pushlock_exclusive(&vcpu->vcpu_lock);
+		for(u32 i=0;i<count;i++)vcpu->export_set.names[intercept_code][i]=names[i];
+		vcpu->export_set.count[intercept_code]=(u8)count;
+		noir_release_pushlock_exclusive(&vcpu->vcpu_lock);
+		st=noir_success;
+	}
+	return st;
+}
+
+void static nvc_export_vcpu_registers(noir_cvm_virtual_cpu_p vcpu,noir_cvm_register_values_p export_set)
+{
+	const noir_cvm_intercept_code code=vcpu->exit_context.intercept_code;
+	export_set->count=0;
+	if(code<noir_cvm_register_set_code_limit && vcpu->export_set.count[code])
+	{
+		const u32 count=vcpu->export_set.count[code];
+		for(u32 i=0;i<count;i++)export_set->names[i]=vcpu->export_set.names[code][i];
+		if(nvc_view_vcpu_registers2(vcpu,export_set->names,count,sizeof(u64),export_set->values)==noir_success)
+			export_set->count=count;
+	}
+}
+
+// The import set is applied and consumed before the vCPU runs. The export set is filled after the vCPU exits.
+// Either of them can be null.
+noir_status nvc_run_vcpu_ex(noir_cvm_virtual_cpu_p vcpu,void* exit_context,noir_cvm_register_values_p import_set,noir_cvm_register_values_p export_set)
 {
 	noir_status st=noir_hypervision_absent;
 	if(hvm_p)
 	{
+		bool valid_state;
+		if(import_set)
+		{
+			// The import set may be mapped to the User Hypervisor. Capture it once before validation.
+			noir_cvm_register_values import_values;
+			noir_movsb(&import_values,import_set,sizeof(import_values));
+			if(import_values.count)
+			{
+				if(!nvc_validate_register_set(import_values.names,import_values.count))return noir_invalid_parameter;
+				st=nvc_edit_vcpu_registers2(vcpu,import_values.names,import_values.count,sizeof(u64),import_values.values);
+				if(st!=noir_success)return st;
+				// The import set is consumed. Do not apply the stale values on the next run.
+				import_set->count=0;
+			}
+		}
+		// Complete the batched ins with the data provided by the User Hypervisor.
+		if(vcpu->pending_string_input)nvc_scatter_string_input(vcpu);
 		// Some processor state is not checked and loaded by Intel VT-x/AMD-V. (e.g: x87 FPU State)
 		// Check their consistency manually.
-		bool valid_state=nvc_validate_vcpu_state(vcpu);
+		valid_state=nvc_validate_vcpu_state(vcpu);
 		st=noir_success;
 		if(valid_state)
 		{
-			if(hvm_p->selected_core==use_svm_core)
-				st=nvc_svmc_run_vcpu(vcpu);
-			else if(hvm_p->selected_core==use_vt_core)
-				st=nvc_vtc_run_vcpu(vcpu);
-			else
-				st=noir_unknown_processor;
+			do
+			{
+				if(hvm_p->selected_core==use_svm_core)
+					st=nvc_svmc_run_vcpu(vcpu);
+				else if(hvm_p->selected_core==use_vt_core)
+					st=nvc_vtc_run_vcpu(vcpu);
+				else
+					st=noir_unknown_processor;
+			}while(st==noir_success && nvc_coalesce_mmio_write(vcpu));
+			// The guest may have modified its paging structures. Flush the software TLB.
+			vcpu->gva_tlb.generation++;
 		}
+		if(st==noir_success)nvc_batch_string_io(vcpu);
+		if(st==noir_success && export_set)nvc_export_vcpu_registers(vcpu,export_set);
 		if(st==noir_success)
 		{
 			if(!vcpu->vcpu_options.use_tunnel)
@@ -913,6 +1234,32 @@ noir_status nvc_run_vcpu(noir_cvm_virtual_cpu_p vcpu,void* exit_context)
 	return st;
 }
 
+noir_status nvc_run_vcpu(noir_cvm_virtual_cpu_p vcpu,void* exit_context)
+{
+	noir_cvm_register_values_p import_set=null,export_set=null;
+	if(vcpu->vcpu_options.use_tunnel && vcpu->vcpu_options.tunnel_format==noir_cvm_tunnel_format_nvc)
+	{
+		// Use the register sets in VPCB if they are covered.
+		noir_cvm_vcpu_control_block_p vpcb=vcpu->tunnel;
+		if(vpcb->size>=sizeof(noir_cvm_vcpu_control_block))
+		{
+			import_set=&vpcb->import_set;
+			export_set=&vpcb->export_set;
+		}
+	}
+	return nvc_run_vcpu_ex(vcpu,exit_context,import_set,export_set);
+}
+
+// Complete the MMIO instruction of the last memory-access exit with the data read from the device.
+noir_status nvc_complete_memory_access(noir_cvm_virtual_cpu_p vcpu,u64 data,noir_cvm_memory_access_result_p result)
+{
+	noir_status st;
+	noir_acquire_pushlock_exclusive(&vcpu->vcpu_lock);
+	st=nvc_emu_complete_memory_access(vcpu,data,result);
+	noir_release_pushlock_exclusive(&vcpu->vcpu_lock);
+	return st;
+}
+
 noir_status nvc_rescind_vcpu(noir_cvm_virtual_cpu_p vcpu)
 {
 	noir_status st=noir_hypervision_absent;
@@ -985,6 +1332,7 @@ noir_status nvc_create_vcpu(noir_cvm_virtual_machine_p vm,noir_cvm_virtual_cpu_p
 		if(st==noir_success)
 		{
 			(*vcpu)->ref_count=1;
+			(*vcpu)->vm=vm;
 			// Initialize some registers...
 			(*vcpu)->xcrs.xcr0=1;			// HAXM does not know XCR0.
 			(*vcpu)->msrs.mtrr.def_type=6;	// Let WB to be default.
@@ -1044,52 +1392,126 @@ void nvc_release_lockers(noir_cvm_virtual_machine_p virtual_machine)
 	{
 		noir_cvm_lockers_list_p next=cur->next;
 		for(u32 i=0;i<noir_cvm_lockers_per_array;i++)
+		{
 			if(cur->lockers[i])
-				noir_unlock_pages(cur->lockers[i]);
+			{
+				noir_unlock_pages(cur->lockers[i]->locker);
+				noir_free_nonpg_memory(cur->lockers[i]);
+			}
+		}
 		noir_free_nonpg_memory(cur);
 		cur=next;
 	}
 }
 
+noir_cvm_lockers_list_p static nvc_alloc_lockers_list()
+{
+	noir_cvm_lockers_list_p locker_list=noir_alloc_nonpg_memory(page_size);
+	if(locker_list)
+	{
+		// The bits beyond the slots are permanently set so that they are never allocated.
+		for(u32 i=noir_cvm_lockers_per_array;i<sizeof(locker_list->bitmap)<<3;i++)
+			noir_set_bitmap(locker_list->bitmap,i);
+	}
+	return locker_list;
+}
+
 // Warning: this function erases the slot!
 // Unlock the page before releasing the slot.
-void nvc_free_locker_slot(void** locker_slot)
+void nvc_free_locker_slot(noir_cvm_virtual_machine_p virtual_machine,noir_cvm_locker_record_p *locker_slot)
 {
 	noir_cvm_lockers_list_p locker_list=(noir_cvm_lockers_list_p)page_4kb_base((ulong_ptr)locker_slot);
-	if(locker_list)
+	const u32 index=(u32)(locker_slot-locker_list->lockers);
+	// A full list goes back to the partial stack once a slot is released.
+	if(noir_find_clear_bit(locker_list->bitmap,noir_cvm_lockers_per_array)==0xffffffff)
 	{
-#if defined(_amd64)
-		u32 index=(u32)page_4kb_offset((u64)locker_slot)>>3;
-#else
-		u32 index=(u32)page_4kb_offset((u32)locker_slot)>>2;
-#endif
-		noir_reset_bitmap(locker_list,index);
-		*locker_slot=null;
+		locker_list->partial_next=virtual_machine->locker_partial;
+		virtual_machine->locker_partial=locker_list;
 	}
+	noir_reset_bitmap(locker_list->bitmap,index);
+	*locker_slot=null;
 }
 
-void** nvc_alloc_locker_slot(noir_cvm_virtual_machine_p virtual_machine)
+/*
+  Slots are allocated from the list on top of the partial stack.
+  Only the top list is ever allocated from, so a list is popped as soon as it is full.
+  A list is pushed again when a slot of the full list is released.
+  Hence, every list with free slots is on the stack and searching the bitmap of one list suffices.
+*/
+noir_cvm_locker_record_p* nvc_alloc_locker_slot(noir_cvm_virtual_machine_p virtual_machine)
 {
-	for(noir_cvm_lockers_list_p cur=virtual_machine->locker_head;cur;cur=cur->next)
+	noir_cvm_lockers_list_p cur=virtual_machine->locker_partial;
+	u32 index;
+	if(cur==null)
 	{
-		u32 index=noir_find_clear_bit(cur->bitmap,noir_cvm_lockers_per_array);
-		if(index!=0xffffffff)
-		{
-			noir_set_bitmap(cur->bitmap,index);
-			return &cur->lockers[index];
-		}
+		// At this point, all lockers are allocated.
+		cur=nvc_alloc_lockers_list();
+		// Insufficient system resources.
+		if(cur==null)return null;
+		virtual_machine->locker_tail->next=cur;
+		virtual_machine->locker_tail=cur;
+		virtual_machine->locker_partial=cur;
 	}
-	// At this point, all lockers are allocated.
-	virtual_machine->locker_tail->next=noir_alloc_nonpg_memory(page_size);
-	if(virtual_machine->locker_tail->next)
+	index=noir_find_clear_bit(cur->bitmap,noir_cvm_lockers_per_array);
+	noir_set_bitmap(cur->bitmap,index);
+	if(noir_find_clear_bit(cur->bitmap,noir_cvm_lockers_per_array)==0xffffffff)
 	{
-		noir_cvm_lockers_list_p locker_list=virtual_machine->locker_tail->next;
-		// Return the first entry.
-		locker_list->bitmap[0]=1;
-		return locker_list->lockers;
+		virtual_machine->locker_partial=cur->partial_next;
+		cur->partial_next=null;
 	}
-	// Insufficient system resources.
-	return null;
+	return &cur->lockers[index];
+}
+
+i32 static cdecl nvc_compare_locker_records(const void* a,const void* b)
+{
+	const noir_cvm_locker_record_p lr_a=(noir_cvm_locker_record_p)a,lr_b=(noir_cvm_locker_record_p)b;
+	if(lr_a->hva<lr_b->hva)
+		return -1;
+	else if(lr_a->hva>lr_b->hva)
+		return 1;
+	return 0;
+}
+
+// The item is the range to be covered. A miss due to overlapping lockers only costs an extra locker.
+i32 static cdecl nvc_bst_search_locker_record(avl_node_p node,const void* item)
+{
+	noir_cvm_locker_record_p lr=(noir_cvm_locker_record_p)node;
+	const u64p range=(u64p)item;
+	if(range[0]<lr->hva)
+		return -1;
+	else if(range[0]>=lr->hva+lr->bytes)
+		return 1;
+	else if(range[1]>lr->hva+lr->bytes)
+		return -1;
+	return 0;
+}
+
+// The HVA range may be freed and reallocated while the locker still pins the old pages.
+// Share the locker only if the pinned pages are still mapped at the HVAs.
+bool static nvc_verify_locked_pages(noir_cvm_address_mapping_p mapping_info,u64p phys_array)
+{
+	for(u32 i=0;i<mapping_info->pages;i++)
+		if(noir_get_user_physical_address((void*)(mapping_info->hva+page_4kb_mult((u64)i)))!=phys_array[i])
+			return false;
+	return true;
+}
+
+// Lock the HVA range of the mapping. The new record is not yet published in the tree.
+noir_cvm_locker_record_p static nvc_lock_mapping_pages(noir_cvm_address_mapping_p mapping_info,u64p phys_array)
+{
+	noir_cvm_locker_record_p record=noir_alloc_nonpg_memory(sizeof(noir_cvm_locker_record));
+	if(record)
+	{
+		record->hva=mapping_info->hva;
+		record->bytes=page_4kb_mult(mapping_info->pages);
+		record->locker=noir_lock_pages((void*)mapping_info->hva,record->bytes,phys_array);
+		if(record->locker==null)
+		{
+			noir_free_nonpg_memory(record);
+			record=null;
+		}
+	}
+	return record;
 }
 
 noir_status nvc_set_mapping(noir_cvm_virtual_machine_p virtual_machine,noir_cvm_address_mapping_p mapping_info)
@@ -1102,31 +1524,54 @@ noir_status nvc_set_mapping(noir_cvm_virtual_machine_p virtual_machine,noir_cvm_
 		if(mapping_info->attributes.present || mapping_info->attributes.write || mapping_info->attributes.execute)
 		{
 			// This is mapping memories to the guest.
-			void** locker_slot=nvc_alloc_locker_slot(virtual_machine);
+			const u64 range[2]={mapping_info->hva,mapping_info->hva+page_4kb_mult((u64)mapping_info->pages)};
+			noir_cvm_locker_record_p *locker_slot=null,record;
 			u64p phys_array=noir_alloc_nonpg_memory(mapping_info->pages<<3);
-			if(locker_slot && phys_array)
+			st=noir_insufficient_resources;
+			if(phys_array)
 			{
-				*locker_slot=noir_lock_pages((void*)mapping_info->hva,page_4kb_mult(mapping_info->pages),phys_array);
-				if(!*locker_slot)goto alloc_failure;
-				st=noir_unknown_processor;
-				if(hvm_p->selected_core==use_vt_core)
-					st=nvc_vtc_set_mapping(virtual_machine,mapping_info);
-				else if(hvm_p->selected_core==use_svm_core)
-					st=nvc_svmc_set_mapping(virtual_machine,mapping_info,phys_array);
-				if(st!=noir_success)
+				noir_acquire_pushlock_exclusive(&virtual_machine->locker_lock);
+				// Share the locker if the HVA range is already locked.
+				record=(noir_cvm_locker_record_p)noir_search_avl_node((avl_node_p)virtual_machine->locker_root,range,nvc_bst_search_locker_record);
+				if(record)
+				{
+					noir_get_locked_pages(record->locker,(u32)page_4kb_count(range[0]-page_4kb_base(record->hva)),mapping_info->pages,phys_array);
+					if(!nvc_verify_locked_pages(mapping_info,phys_array))record=null;
+				}
+				if(!record)
+				{
+					locker_slot=nvc_alloc_locker_slot(virtual_machine);
+					if(locker_slot)record=nvc_lock_mapping_pages(mapping_info,phys_array);
+				}
+				if(record)
+				{
+					st=noir_unknown_processor;
+					if(hvm_p->selected_core==use_vt_core)
+						st=nvc_vtc_set_mapping(virtual_machine,mapping_info);
+					else if(hvm_p->selected_core==use_svm_core)
+						st=nvc_svmc_set_mapping(virtual_machine,mapping_info,phys_array);
+				}
+				if(locker_slot)
 				{
-					noir_unlock_pages(*locker_slot);
-					nvc_free_locker_slot(locker_slot);
+					if(st==noir_success)
+					{
+						// Publish the new locker.
+						*locker_slot=record;
+						virtual_machine->locker_root=(noir_cvm_locker_record_p)noir_insert_avl_node((avl_node_p)virtual_machine->locker_root,(avl_node_p)record,nvc_compare_locker_records);
+					}
+					else
+					{
+						if(record)
+						{
+							noir_unlock_pages(record->locker);
+							noir_free_nonpg_memory(record);
+						}
+						nvc_free_locker_slot(virtual_machine,locker_slot);
+					}
 				}
+				noir_release_pushlock_exclusive(&virtual_machine->locker_lock);
 				noir_free_nonpg_memory(phys_array);
 			}
-			else
-			{
-alloc_failure:
-				if(locker_slot)nvc_free_locker_slot(locker_slot);
-				if(phys_array)noir_free_nonpg_memory(phys_array);
-				st=noir_insufficient_resources;
-			}
 		}
 		else
 		{
@@ -1138,11 +1583,58 @@ alloc_failure:
 			else
 				st=noir_unknown_processor;
 		}
+		// Translations cached in the software TLBs of vCPUs may be stale.
+		if(st==noir_success)noir_locked_inc(&virtual_machine->gva_tlb_generation);
 		noir_release_reslock(virtual_machine->vcpu_list_lock);
 	}
 	return st;
 }
 
+noir_status nvc_register_coalesced_mmio_zone(noir_cvm_virtual_machine_p virtual_machine,u64 gpa,u64 size)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		st=noir_invalid_parameter;
+		if(size && gpa+size>gpa)
+		{
+			while(noir_locked_cmpxchg(&virtual_machine->coalesced_mmio_lock,-1,0)!=0)noir_pause();
+			st=noir_insufficient_resources;
+			if(virtual_machine->coalesced_mmio_zone_count<noir_cvm_coalesced_mmio_zone_limit)
+			{
+				const u32 i=virtual_machine->coalesced_mmio_zone_count++;
+				virtual_machine->coalesced_mmio_zones[i].gpa=gpa;
+				virtual_machine->coalesced_mmio_zones[i].size=size;
+				st=noir_success;
+			}
+			noir_locked_xchg(&virtual_machine->coalesced_mmio_lock,0);
+		}
+	}
+	return st;
+}
+
+noir_status nvc_unregister_coalesced_mmio_zone(noir_cvm_virtual_machine_p virtual_machine,u64 gpa,u64 size)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		st=noir_invalid_parameter;
+		while(noir_locked_cmpxchg(&virtual_machine->coalesced_mmio_lock,-1,0)!=0)noir_pause();
+		for(u32 i=0;i<virtual_machine->coalesced_mmio_zone_count;i++)
+		{
+			if(virtual_machine->coalesced_mmio_zones[i].gpa==gpa && virtual_machine->coalesced_mmio_zones[i].size==size)
+			{
+				// Move the last zone to the removed slot.
+				virtual_machine->coalesced_mmio_zones[i]=virtual_machine->coalesced_mmio_zones[--virtual_machine->coalesced_mmio_zone_count];
+				st=noir_success;
+				break;
+			}
+		}
+		noir_locked_xchg(&virtual_machine->coalesced_mmio_lock,0);
+	}
+	return st;
+}
+
 noir_status nvc_query_gpa_accessing_bitmap(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size)
 {
 	noir_status st=noir_hypervision_absent;
@@ -1161,6 +1653,24 @@ noir_status nvc_query_gpa_accessing_bitmap(noir_cvm_virtual_machine_p virtual_ma
 	return st;
 }
 
+// Query and clear the accessing bits in one pass. No updates from hardware would be lost in between.
+noir_status nvc_query_and_clear_gpa_accessing_bitmap(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count,void* bitmap,u32 bitmap_size)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		noir_acquire_reslock_shared(virtual_machine->vcpu_list_lock);
+		if(hvm_p->selected_core==use_vt_core)
+			st=noir_not_implemented;
+		else if(hvm_p->selected_core==use_svm_core)
+			st=nvc_svmc_query_and_clear_gpa_accessing_bitmap(virtual_machine,gpa_start,page_count,bitmap,bitmap_size);
+		else
+			st=noir_unknown_processor;
+		noir_release_reslock(virtual_machine->vcpu_list_lock);
+	}
+	return st;
+}
+
 noir_status nvc_clear_gpa_accessing_bits(noir_cvm_virtual_machine_p virtual_machine,u64 gpa_start,u32 page_count)
 {
 	noir_status st=noir_hypervision_absent;
@@ -1179,6 +1689,28 @@ noir_status nvc_clear_gpa_accessing_bits(noir_cvm_virtual_machine_p virtual_mach
 	return st;
 }
 
+// This is meant to be called periodically by the VMM, e.g.: from a background thread.
+noir_status nvc_promote_page_mappings(noir_cvm_virtual_machine_p virtual_machine,u32p promoted)
+{
+	noir_status st=noir_hypervision_absent;
+	if(hvm_p)
+	{
+		noir_acquire_reslock_shared(virtual_machine->vcpu_list_lock);
+		*promoted=0;
+		if(hvm_p->selected_core==use_vt_core)
+			st=noir_not_implemented;
+		else if(hvm_p->selected_core==use_svm_core)
+		{
+			*promoted=nvc_svmc_promote_page_mappings(virtual_machine);
+			st=noir_success;
+		}
+		else
+			st=noir_unknown_processor;
+		noir_release_reslock(virtual_machine->vcpu_list_lock);
+	}
+	return st;
+}
+
 noir_status nvc_release_vm(noir_cvm_virtual_machine_p vm)
 {
 	noir_status st=noir_hypervision_absent;
@@ -1198,6 +1730,12 @@ noir_status nvc_release_vm(noir_cvm_virtual_machine_p vm)
 			st=noir_unknown_processor;
 		// Release lockers...
 		nvc_release_lockers(vm);
+		// Release PIO device models.
+		if(vm->pio_device_root)nvc_cleanup_io_hooks(vm->pio_device_root);
+		// Release CPUID model.
+		if(vm->cpuid_model.table)noir_free_nonpg_memory(vm->cpuid_model.table);
+		// Release decoded-instruction cache.
+		if(vm->decode_cache)noir_free_nonpg_memory(vm->decode_cache);
 		// Remove the vCPU list Resource Lock.
 		if(vm->vcpu_list_lock)noir_finalize_reslock(vm->vcpu_list_lock);
 		noir_release_reslock(noir_vm_list_lock);
@@ -1240,8 +1778,10 @@ noir_status nvc_create_vm_ex(noir_cvm_virtual_machine_p* vm,u32 process_id,noir_
 				noir_insert_to_prev(&noir_idle_vm.active_vm_list,&(*vm)->active_vm_list);
 				noir_release_reslock(noir_vm_list_lock);
 				// Allocate Locker list.
-				(*vm)->locker_head=(*vm)->locker_tail=noir_alloc_nonpg_memory(page_size);
+				(*vm)->locker_head=(*vm)->locker_tail=(*vm)->locker_partial=nvc_alloc_lockers_list();
 				if((*vm)->locker_head)st=noir_success;
+				// Allocate the decoded-instruction cache. MMIO instructions are decoded from scratch if this fails.
+				(*vm)->decode_cache=noir_alloc_nonpg_memory(sizeof(noir_cvm_decode_cache));
 			}
 			if(st!=noir_success)
 				nvc_release_vm(*vm);
@@ -1381,92 +1921,137 @@ void nvc_print_vm_list()
 }
 #endif
 
-void nvc_configure_reverse_mapping(u64 hpa,u64 gpa,u32 asid,bool shared,u8 ownership)
+noir_rmt_directory_entry_p static nvc_search_rmt_directory(u64 hpa)
 {
 	noir_rmt_directory_entry_p rmt_dir=(noir_rmt_directory_entry_p)hvm_p->rmd.directory.virt;
+	u32p index=(u32p)hvm_p->rmd.index.virt;
+	const u64 slot=page_1gb_count(hpa);
 	u64 hi=hvm_p->rmd.dir_count,lo=0;
-	// Use binary search to reduce time complexity.
-	while(hi>=lo)
+	if(index)
+	{
+		// Only the few ranges sharing the 1GiB page are examined.
+		if(slot<hvm_p->rmd.index_count)
+			for(u64 i=index[slot];i<hi && rmt_dir[i].hpa_start<=hpa;i++)
+				if(hpa<rmt_dir[i].hpa_end)
+					return &rmt_dir[i];
+		return null;
+	}
+	// Use binary search if the index is absent.
+	// The higher bound is exclusive so that it never underflows.
+	while(hi>lo)
 	{
 		const u64 mid=(hi+lo)>>1;
 		if(hpa<rmt_dir[mid].hpa_start)		// If HPA is lower than median range,
-			hi=mid-1;						// Reduce the higher bound.
+			hi=mid;							// Reduce the higher bound.
 		else if(hpa>=rmt_dir[mid].hpa_end)	// If HPA is higher than median range,
 			lo=mid+1;						// Raise the lower bound.
 		else
-		{
-			noir_rmt_entry_p rm_table=(noir_rmt_entry_p)rmt_dir[mid].table.virt;
-			const u64 i=page_4kb_count(hpa-rmt_dir[mid].hpa_start);
-			rm_table[i].low.asid=asid;
-			rm_table[i].low.shared=shared;
-			rm_table[i].low.ownership=ownership;
-			rm_table[i].low.reserved=0;
-			rm_table[i].high.value=gpa;
-			rm_table[i].high.reserved=0;
-			break;
-		}
+			return &rmt_dir[mid];
 	}
+	return null;
 }
 
-bool nvc_validate_single_rmt_reassignment(u64 hpa,u64 gpa,u32 asid,bool shared,u8 ownership)
+// Sorted or contiguous HPA lists mostly hit the directory entry of the previous page.
+noir_rmt_entry_p static nvc_get_rmt_entry_cached(u64 hpa,noir_rmt_directory_entry_p *cache)
 {
-	noir_rmt_directory_entry_p rmt_dir=(noir_rmt_directory_entry_p)hvm_p->rmd.directory.virt;
-	u64 hi=hvm_p->rmd.dir_count,lo=0;
-	// Use binary search to reduce time complexity.
-	while(hi>=lo)
+	noir_rmt_directory_entry_p dir_entry=*cache;
+	if(dir_entry==null || hpa<dir_entry->hpa_start || hpa>=dir_entry->hpa_end)
 	{
-		const u64 mid=(hi+lo)>>1;
-		if(hpa<rmt_dir[mid].hpa_start)		// If HPA is lower than median range,
-			hi=mid-1;						// Reduce the higher bound.
-		else if(hpa>=rmt_dir[mid].hpa_end)	// If HPA is higher than median range,
-			lo=mid+1;						// Raise the lower bound.
-		else
-		{
-			noir_rmt_entry_p rm_table=(noir_rmt_entry_p)rmt_dir[mid].table.virt;
-			const u64 i=page_4kb_count(hpa-rmt_dir[mid].hpa_start);
-			if(rm_table[i].low.ownership==noir_nsv_rmt_noirvisor)
-				return false;	// If the page was assigned to NoirVisor, fail the validation.
-			else if(rm_table[i].low.ownership==noir_nsv_rmt_secure_guest && ownership==noir_nsv_rmt_secure_guest)
-				return false;	// Secure Memory are not allowed to be remapped in one shot.
-			else if(ownership==noir_nsv_rmt_secure_guest && shared)
-				return false;	// Secure Memory are not allowed to be shared.
-			return true;
-		}
+		dir_entry=nvc_search_rmt_directory(hpa);
+		if(dir_entry==null)return null;
+		*cache=dir_entry;
+	}
+	return &((noir_rmt_entry_p)dir_entry->table.virt)[page_4kb_count(hpa-dir_entry->hpa_start)];
+}
+
+noir_rmt_entry_p nvc_get_rmt_entry(u64 hpa)
+{
+	noir_rmt_directory_entry_p cache=null;
+	return nvc_get_rmt_entry_cached(hpa,&cache);
+}
+
+void static nvc_set_rmt_entry(noir_rmt_entry_p entry,u64 gpa,u32 asid,bool shared,u8 ownership)
+{
+	entry->low.asid=asid;
+	entry->low.shared=shared;
+	entry->low.ownership=ownership;
+	entry->low.reserved=0;
+	entry->high.value=gpa;
+	entry->high.reserved=0;
+}
+
+bool static nvc_validate_rmt_entry(noir_rmt_entry_p entry,bool shared,u8 ownership)
+{
+	if(entry->low.ownership==noir_nsv_rmt_noirvisor)
+		return false;	// If the page was assigned to NoirVisor, fail the validation.
+	else if(entry->low.ownership==noir_nsv_rmt_secure_guest && ownership==noir_nsv_rmt_secure_guest)
+		return false;	// Secure Memory are not allowed to be remapped in one shot.
+	else if(ownership==noir_nsv_rmt_secure_guest && shared)
+		return false;	// Secure Memory are not allowed to be shared.
+	return true;
+}
+
+void nvc_configure_reverse_mapping(u64 hpa,u64 gpa,u32 asid,bool shared,u8 ownership)
+{
+	noir_rmt_entry_p entry=nvc_get_rmt_entry(hpa);
+	if(entry)nvc_set_rmt_entry(entry,gpa,asid,shared,ownership);
+}
+
+void nvc_configure_reverse_mapping_batch(u64p hpa,u64p gpa,u32 pages,u32 asid,bool shared,u8 ownership)
+{
+	noir_rmt_directory_entry_p cache=null;
+	for(u32 i=0;i<pages;i++)
+	{
+		noir_rmt_entry_p entry=nvc_get_rmt_entry_cached(hpa[i],&cache);
+		if(entry)nvc_set_rmt_entry(entry,gpa[i],asid,shared,ownership);
 	}
-	// This HPA is not pointing to physical RAM.
-	return false;
+}
+
+bool nvc_validate_single_rmt_reassignment(u64 hpa,u64 gpa,u32 asid,bool shared,u8 ownership)
+{
+	noir_rmt_entry_p entry=nvc_get_rmt_entry(hpa);
+	// If the entry is absent, this HPA is not pointing to physical RAM.
+	return entry?nvc_validate_rmt_entry(entry,shared,ownership):false;
 }
 
 bool nvc_validate_rmt_reassignment(u64p hpa,u64p gpa,u32 pages,u32 asid,bool shared,u8 ownership)
 {
+	noir_rmt_directory_entry_p cache=null;
+	// Secure Memory are not allowed to be shared.
+	if(ownership==noir_nsv_rmt_secure_guest && shared)return false;
 	for(u32 i=0;i<pages;i++)
 	{
-		bool result=nvc_validate_single_rmt_reassignment(hpa[i],gpa[i],asid,shared,ownership);
-		if(!result)return false;
+		noir_rmt_entry_p entry=nvc_get_rmt_entry_cached(hpa[i],&cache);
+		if(entry==null)return false;
+		if(!nvc_validate_rmt_entry(entry,shared,ownership))return false;
 	}
 	return true;
 }
 
-noir_rmt_entry_p nvc_get_rmt_entry(u64 hpa)
+// The index must be rebuilt whenever the directory is changed.
+bool nvc_build_rmt_index()
 {
 	noir_rmt_directory_entry_p rmt_dir=(noir_rmt_directory_entry_p)hvm_p->rmd.directory.virt;
-	u64 hi=hvm_p->rmd.dir_count,lo=0;
-	// Use binary search to reduce time complexity.
-	while(hi>=lo)
+	const u64 count=hvm_p->rmd.dir_count;
+	if(count)
 	{
-		const u64 mid=(hi+lo)>>1;
-		if(hpa<rmt_dir[mid].hpa_start)		// If HPA is lower than median range,
-			hi=mid-1;						// Reduce the higher bound.
-		else if(hpa>=rmt_dir[mid].hpa_end)	// If HPA is higher than median range,
-			lo=mid+1;						// Raise the lower bound.
-		else
+		const u64 slots=page_1gb_count(rmt_dir[count-1].hpa_end-1)+1;
+		u32p index=noir_alloc_contd_memory(slots<<2);
+		if(index)
 		{
-			const u64 index=page_4kb_count(hpa-rmt_dir[mid].hpa_start);
-			noir_rmt_entry_p rm_table=rmt_dir[mid].table.virt;
-			return &rm_table[index];
+			u64 j=0;
+			for(u64 i=0;i<slots;i++)
+			{
+				while(j<count && rmt_dir[j].hpa_end<=page_1gb_mult(i))j++;
+				index[i]=(u32)j;
+			}
+			hvm_p->rmd.index.phys=noir_get_physical_address(index);
+			hvm_p->rmd.index_count=slots;
+			hvm_p->rmd.index.virt=index;
+			return true;
 		}
 	}
-	return null;
+	return false;
 }
 
 void static nvc_enum_physical_range_callback(u64 start,u64 length,void* context)
@@ -1506,6 +2091,8 @@ bool nvc_build_reverse_mapping_table()
 		{
 			noir_rmt_directory_entry_p rmt_dir=(noir_rmt_directory_entry_p)hvm_p->rmd.directory.virt;
 			for(u64 i=0;i<alloc_count;i++)nv_dprintf("[Memory Map] Start: 0x%016llX, End: 0x%016llX\n",rmt_dir[i].hpa_start,rmt_dir[i].hpa_end);
+			// The index is optional. Binary search will be used without it.
+			if(!nvc_build_rmt_index())nv_dprintf("Failed to build the index of Reverse-Mapping Directory!\n");
 			return true;
 		}
 		nv_dprintf("Failed to allocate all tables for reverse-mapping! Failed directory entries: %u\n",hvm_p->rmd.dir_count-alloc_count);
@@ -1645,30 +2232,75 @@ bool static nvc_translate_guest_virtual_address_routine64(u64 np_base,u64 pt,u32
 	}
 }
 
+bool static nvc_walk_guest_paging_structures(noir_cvm_virtual_cpu_p vcpu,u64 gva,u32 access,u64p gpa,u32p error_code)
+{
+	const u64 np_base=noir_get_custom_vcpu_np_base(vcpu);
+	const u64 cr3=vcpu->crs.cr3;
+	// Check if Long-Mode Paging is active.
+	if(vcpu->msrs.efer&amd64_efer_lma_bit)
+	{
+		// Long-Mode Paging is active.
+		// Check number of levels.
+		const u32 levels=noir_bt64(&vcpu->crs.cr4,amd64_cr4_la57)+4;
+		return nvc_translate_guest_virtual_address_routine64(np_base,page_base(cr3),levels,gva,access,gpa,error_code);
+	}
+	else
+	{
+		// Long-Mode Paging is inactive.
+		// Check if PAE.
+		if(vcpu->crs.cr4&amd64_cr4_pae_bit)
+			return nvc_translate_guest_virtual_address_routine64(np_base,page_pae_base(cr3),3,gva,access,gpa,error_code);
+		else
+			return nvc_translate_guest_virtual_address_routine32(np_base,page_base(cr3),gva,access,gpa,error_code);
+	}
+}
+
+noir_cvm_gva_tlb_entry_p static nvc_search_gva_tlb(noir_cvm_virtual_cpu_p vcpu,u64 gva,u32 access)
+{
+	const u64 gva_page=page_4kb_count(gva);
+	noir_cvm_gva_tlb_entry_p entry=&vcpu->gva_tlb.entries[gva_page%noir_cvm_gva_tlb_entries];
+	if(entry->access && (entry->access&access)==access && entry->gva_page==gva_page && entry->cr3==vcpu->crs.cr3)
+		if(entry->generation==vcpu->gva_tlb.generation && entry->vm_generation==vcpu->vm->gva_tlb_generation)
+			return entry;
+	return null;
+}
+
+void static nvc_insert_gva_tlb(noir_cvm_virtual_cpu_p vcpu,u64 gva,u32 access,u64 gpa,u32 vm_generation)
+{
+	const u64 gva_page=page_4kb_count(gva);
+	noir_cvm_gva_tlb_entry_p entry=&vcpu->gva_tlb.entries[gva_page%noir_cvm_gva_tlb_entries];
+	entry->cr3=vcpu->crs.cr3;
+	entry->gva_page=gva_page;
+	entry->gpa_page=page_4kb_count(gpa);
+	entry->hpa_page=0;
+	// Reading is always granted if other accesses are granted.
+	entry->access=access|noir_cvm_map_va_read_bit;
+	entry->generation=vcpu->gva_tlb.generation;
+	entry->vm_generation=vm_generation;
+}
+
 bool nvc_translate_guest_virtual_address(noir_cvm_virtual_cpu_p vcpu,u64 gva,u32 access,u64p gpa,u32p error_code)
 {
 	// Check if paging is enabled
 	if(vcpu->crs.cr0&amd64_cr0_pg_bit)
 	{
-		// Paging is enabled.
-		const u64 np_base=noir_get_custom_vcpu_np_base(vcpu);
-		const u64 cr3=vcpu->crs.cr3;
-		// Check if Long-Mode Paging is active.
-		if(vcpu->msrs.efer&amd64_efer_lma_bit)
+		// Paging is enabled. Search the software TLB first.
+		noir_cvm_gva_tlb_entry_p entry=nvc_search_gva_tlb(vcpu,gva,access);
+		if(entry)
 		{
-			// Long-Mode Paging is active.
-			// Check number of levels.
-			const u32 levels=noir_bt64(vcpu->crs.cr4,amd64_cr4_la57)+4;
-			return nvc_translate_guest_virtual_address_routine64(np_base,page_base(cr3),levels,gva,access,gpa,error_code);
+			vcpu->statistics.gva_tlb.hits++;
+			*gpa=page_4kb_mult(entry->gpa_page)+page_offset(gva);
+			*error_code=0;
+			return true;
 		}
 		else
 		{
-			// Long-Mode Paging is inactive.
-			// Check if PAE.
-			if(vcpu->crs.cr4&amd64_cr4_pae_bit)
-				return nvc_translate_guest_virtual_address_routine64(np_base,page_pae_base(cr3),3,gva,access,gpa,error_code);
-			else
-				return nvc_translate_guest_virtual_address_routine32(np_base,page_base(cr3),gva,access,gpa,error_code);
+			// Sample the VM generation before walking so that a concurrent mapping change is not missed.
+			const u32 vm_generation=vcpu->vm->gva_tlb_generation;
+			const bool success=nvc_walk_guest_paging_structures(vcpu,gva,access,gpa,error_code);
+			vcpu->statistics.gva_tlb.misses++;
+			if(success)nvc_insert_gva_tlb(vcpu,gva,access,*gpa,vm_generation);
+			return success;
 		}
 	}
 	else
@@ -1680,47 +2312,92 @@ bool nvc_translate_guest_virtual_address(noir_cvm_virtual_cpu_p vcpu,u64 gva,u32
 	}
 }
 
-size_t static nvc_copy_guest_virtual_memory_in_page(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code)
+// Translate the GVA into HPA through the software TLB, or through both guest paging and nested paging.
+bool static nvc_translate_guest_virtual_address_to_host(noir_cvm_virtual_cpu_p vcpu,u64 gva,bool write,u64p hpa,u32p error_code,bool* np_fault)
 {
-	u64 gpa,hpa;
+	u64 gpa;
 	u32 flags=noir_cvm_map_va_read_bit;
+	noir_cvm_gva_tlb_entry_p entry;
+	bool success;
 	if(write)flags|=noir_cvm_map_va_write_bit;
-	// Translate GVA to GPA.
-	bool success=nvc_translate_guest_virtual_address(vcpu,gva,flags,&gpa,error_code);
-	if(success)
+	// If the software TLB has the HPA, skip both translations.
+	entry=nvc_search_gva_tlb(vcpu,gva,flags);
+	if(entry && entry->hpa_page)
 	{
-		// Translate GPA to HPA.
-		const u64 np_base=noir_get_custom_vcpu_np_base(vcpu);
-		noir_page_fault_error_code np_err;
-		success=noir_translate_custom_gpa(np_base,4,gpa,flags,&hpa,&np_err);
-		if(!success)
-		{
-			nvd_printf("Failed to translate GPA 0x%016llX! Error Code: 0x%X\n",gpa,np_err.value);
-			noir_int3();
-		}
-		else
+		vcpu->statistics.gva_tlb.hits++;
+		*hpa=page_4kb_mult(entry->hpa_page)+page_offset(gva);
+		success=true;
+	}
+	else
+	{
+		// Translate GVA to GPA.
+		const u32 vm_generation=vcpu->vm->gva_tlb_generation;
+		success=nvc_translate_guest_virtual_address(vcpu,gva,flags,&gpa,error_code);
+		if(success)
 		{
-			if(write)
-				noir_movsb((u8p)hpa,buffer,length);
+			// Translate GPA to HPA.
+			const u64 np_base=noir_get_custom_vcpu_np_base(vcpu);
+			noir_page_fault_error_code np_err;
+			success=noir_translate_custom_gpa(np_base,4,gpa,flags,hpa,&np_err);
+			if(!success)
+			{
+				// Report the #NPF error code instead of the #PF error code.
+				*error_code=np_err.value;
+				*np_fault=true;
+			}
 			else
-				noir_movsb(buffer,(u8p)hpa,length);
-			return length;
+			{
+				// Do not cache the HPA if the mapping is changed during translation.
+				entry=nvc_search_gva_tlb(vcpu,gva,flags);
+				if(entry && entry->vm_generation==vm_generation)entry->hpa_page=page_4kb_count(*hpa);
+			}
 		}
 	}
+	return success;
+}
+
+size_t static nvc_copy_guest_virtual_memory_in_page(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code,bool* np_fault)
+{
+	u64 hpa;
+	if(nvc_translate_guest_virtual_address_to_host(vcpu,gva,write,&hpa,error_code,np_fault))
+	{
+		if(write)
+			noir_movsb((u8p)hpa,buffer,length);
+		else
+			noir_movsb(buffer,(u8p)hpa,length);
+		return length;
+	}
 	return 0;
 }
 
-size_t nvc_copy_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code)
+// Returns the length of the accessible prefix of the range. Nothing is copied.
+size_t nvc_probe_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,size_t length,bool write)
+{
+	const u64 end_va=gva+length;
+	size_t probed_size=0;
+	for(u64 cur_va=gva;cur_va<end_va;cur_va+=page_size-page_offset(cur_va))
+	{
+		u64 hpa;
+		u32 error_code;
+		bool np_fault=false;
+		if(!nvc_translate_guest_virtual_address_to_host(vcpu,cur_va,write,&hpa,&error_code,&np_fault))break;
+		probed_size+=page_size-page_offset(cur_va);
+	}
+	return probed_size<length?probed_size:length;
+}
+
+// If the copied length is less than requested length, np_fault indicates whether error_code is a #NPF error code.
+size_t nvc_copy_guest_virtual_memory_ex(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code,bool* np_fault)
 {
 	const u64 end_va=gva+length;
 	u64 copy_size=0,copied_size=0,real_size=0;
+	*np_fault=false;
 	for(u64 cur_va=gva;cur_va<end_va;cur_va+=copy_size)
 	{
-		const u64 end_len=page_size-page_offset(gva);
+		const u64 end_len=page_size-page_offset(cur_va);
 		const u64 rem_len=end_va-cur_va;
 		copy_size=end_len<rem_len?end_len:rem_len;
-		nvd_printf("[Copy] Copying %u bytes at VA 0x%016llX!\n",copy_size,cur_va);
-		real_size+=nvc_copy_guest_virtual_memory_in_page(vcpu,cur_va,(void*)((ulong_ptr)buffer+copied_size),copy_size,write,error_code);
+		real_size+=nvc_copy_guest_virtual_memory_in_page(vcpu,cur_va,(void*)((ulong_ptr)buffer+copied_size),copy_size,write,error_code,np_fault);
 		copied_size+=copy_size;
 		// Let hypervisor know which address caused page fault!
 		if(real_size<copied_size)break;
@@ -1728,6 +2405,79 @@ size_t nvc_copy_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* b
 	return real_size;
 }
 
+size_t nvc_copy_guest_virtual_memory(noir_cvm_virtual_cpu_p vcpu,u64 gva,void* buffer,size_t length,bool write,u32p error_code)
+{
+	bool np_fault;
+	return nvc_copy_guest_virtual_memory_ex(vcpu,gva,buffer,length,write,error_code,&np_fault);
+}
+
+// The last translated GPA page is kept so that adjacent descriptors do not walk the nested paging structures again.
+size_t static nvc_copy_guest_physical_memory(noir_cvm_virtual_cpu_p vcpu,u64 gpa,void* buffer,size_t length,bool write,u32p error_code,u64p last_translation)
+{
+	const u64 np_base=noir_get_custom_vcpu_np_base(vcpu);
+	u32 flags=noir_cvm_map_va_read_bit;
+	size_t copied_size=0;
+	if(write)flags|=noir_cvm_map_va_write_bit;
+	while(copied_size<length)
+	{
+		const u64 cur_pa=gpa+copied_size;
+		const size_t end_len=page_size-page_offset(cur_pa);
+		const size_t copy_size=length-copied_size<end_len?length-copied_size:end_len;
+		u64 hpa;
+		// The cached translation is granted for writes only if it was translated for writes.
+		if(last_translation[0]==page_4kb_count(cur_pa) && last_translation[1] && (!write || (last_translation[1]&1)))
+			hpa=page_4kb_mult(last_translation[1]>>1)+page_offset(cur_pa);
+		else
+		{
+			noir_page_fault_error_code np_err;
+			if(!noir_translate_custom_gpa(np_base,4,cur_pa,flags,&hpa,&np_err))
+			{
+				*error_code=np_err.value;
+				break;
+			}
+			last_translation[0]=page_4kb_count(cur_pa);
+			last_translation[1]=(page_4kb_count(hpa)<<1)|write;
+		}
+		if(write)
+			noir_movsb((u8p)hpa,(u8p)buffer+copied_size,copy_size);
+		else
+			noir_movsb((u8p)buffer+copied_size,(u8p)hpa,copy_size);
+		copied_size+=copy_size;
+	}
+	return copied_size;
+}
+
+// Returns the status of the first failed descriptor, or noir_success if all descriptors are serviced.
+noir_status nvc_access_guest_memory_vector(noir_cvm_virtual_cpu_p vcpu,noir_cvm_guest_memory_descriptor_p descriptors,u32 count)
+{
+	noir_status st=noir_invalid_parameter;
+	if(count<=noir_cvm_guest_memory_vector_limit)
+	{
+		u64 last_translation[2]={0,0};
+		st=noir_success;
+		// The vCPU must not run while its memory is being accessed. Lock once for all descriptors.
+		noir_acquire_pushlock_exclusive(&vcpu->vcpu_lock);
+		if(!vcpu->state_cache.synchronized)nvc_synchronize_vcpu_state(vcpu);
+		for(u32 i=0;i<count;i++)
+		{
+			noir_cvm_guest_memory_descriptor_p desc=&descriptors[i];
+			size_t copied;
+			bool np_fault=false;
+			desc->error_code=0;
+			// GVA translations are shared through the software TLB of the vCPU.
+			if(desc->use_va)
+				copied=nvc_copy_guest_virtual_memory_ex(vcpu,desc->guest_address,desc->buffer,desc->size,desc->write_op,&desc->error_code,&np_fault);
+			else
+				copied=nvc_copy_guest_physical_memory(vcpu,desc->guest_address,desc->buffer,desc->size,desc->write_op,&desc->error_code,last_translation);
+			desc->np_fault=np_fault;
+			desc->status=copied==desc->size?noir_success:noir_guest_page_absent;
+			if(st==noir_success)st=desc->status;
+		}
+		noir_release_pushlock_exclusive(&vcpu->vcpu_lock);
+	}
+	return st;
+}
+
 // Caveat: this routine currently does not consider shadow-stack and protection-key.
 // Use this routine only when Identity-Mapping is enabled.
 // Use recursive logic to reduce code size.
@@ -1848,7 +2598,7 @@ i32 static cdecl nvc_bst_search_pio_region(avl_node_p node,const void* item)
 	u16 port=*(u16p)item;
 	if(port<pr->pio.port)
 		return -1;
-	else if(port>pr->pio.port+pr->pio.size)
+	else if((u32)port>=(u32)pr->pio.port+pr->pio.size)
 		return 1;
 	return 0;
 }
@@ -1859,7 +2609,7 @@ i32 static cdecl nvc_bst_search_mmio_region(avl_node_p node,const void* item)
 	u64 phys=*(u64p)item;
 	if(phys<mr->mmio.phys)
 		return -1;
-	else if(phys>mr->mmio.phys+mr->mmio.size)
+	else if(phys>=mr->mmio.phys+mr->mmio.size)
 		return 1;
 	return 0;
 }
@@ -1882,7 +2632,7 @@ noir_status nvc_register_pio_region(noir_pio_region_p pr)
 		avl_node->pio.handler=pr->handler;
 		avl_node->pio.context=pr->context;
 		avl_node->pio.port=pr->port;
-		avl_node->pio.size=pr->port;
+		avl_node->pio.size=pr->size;
 		// Insert to tree.
 		avl_node->avl.height=1;
 		hvm_p->pio_hooks.root=(noir_io_avl_node_p)noir_insert_avl_node((avl_node_p)hvm_p->pio_hooks.root,(avl_node_p)avl_node,nvc_compare_pio_region_avl_nodes);
@@ -1922,6 +2672,429 @@ void nvc_call_rw_pio_region(bool direction,u16 port,u16 size,u32p value)
 	}
 }
 
+// Registration of PIO devices to a CVM must exclude the exit handlers.
+void static nvc_acquire_vm_pio_registry_exclusive(noir_cvm_virtual_machine_p vm)
+{
+	while(noir_locked_cmpxchg(&vm->pio_device_lock,-1,0)!=0)noir_pause();
+}
+
+void static nvc_acquire_vm_pio_registry_shared(noir_cvm_virtual_machine_p vm)
+{
+	while(1)
+	{
+		const i32 lock=vm->pio_device_lock;
+		if(lock>=0 && noir_locked_cmpxchg(&vm->pio_device_lock,lock+1,lock)==lock)break;
+		noir_pause();
+	}
+}
+
+// Regions in the tree never overlap, so a single descent is enough.
+bool static nvc_check_pio_region_overlap(noir_io_avl_node_p root,u16 port,u16 size)
+{
+	const u32 end=(u32)port+size;
+	noir_io_avl_node_p cur=root;
+	while(cur)
+	{
+		if(end<=cur->pio.port)
+			cur=(noir_io_avl_node_p)cur->avl.left;
+		else if(port>=(u32)cur->pio.port+cur->pio.size)
+			cur=(noir_io_avl_node_p)cur->avl.right;
+		else
+			return true;
+	}
+	return false;
+}
+
+noir_status static nvc_insert_vm_pio_node(noir_cvm_virtual_machine_p vm,noir_io_avl_node_p avl_node)
+{
+	noir_status st=noir_invalid_parameter;
+	if(avl_node->pio.size && (u32)avl_node->pio.port+avl_node->pio.size<=0x10000)
+	{
+		nvc_acquire_vm_pio_registry_exclusive(vm);
+		if(!nvc_check_pio_region_overlap(vm->pio_device_root,avl_node->pio.port,avl_node->pio.size))
+		{
+			avl_node->avl.height=1;
+			vm->pio_device_root=(noir_io_avl_node_p)noir_insert_avl_node((avl_node_p)vm->pio_device_root,(avl_node_p)avl_node,nvc_compare_pio_region_avl_nodes);
+			st=noir_success;
+		}
+		noir_locked_xchg(&vm->pio_device_lock,0);
+	}
+	return st;
+}
+
+// Register a PIO region whose handler is to be invoked from the exit handler of a CVM.
+// The handler must be safe to run in host context.
+noir_status nvc_register_vm_pio_region(noir_cvm_virtual_machine_p vm,noir_pio_region_p pr)
+{
+	noir_status st=noir_insufficient_resources;
+	noir_io_avl_node_p avl_node=noir_alloc_nonpg_memory(sizeof(noir_io_avl_node));
+	if(avl_node)
+	{
+		avl_node->pio.handler=pr->handler;
+		avl_node->pio.context=pr->context;
+		avl_node->pio.port=pr->port;
+		avl_node->pio.size=pr->size;
+		st=nvc_insert_vm_pio_node(vm,avl_node);
+		if(st!=noir_success)noir_free_nonpg_memory(avl_node);
+	}
+	return st;
+}
+
+void static nvc_pio_device_put_output(noir_cvm_pio_device_p device,u32 value,u16 size)
+{
+	for(u16 i=0;i<size;i++)
+	{
+		const u32 tail=device->tail;
+		// Bytes are discarded if the User Hypervisor does not drain the ring in time.
+		if(tail-device->head<noir_cvm_pio_device_output_size)
+		{
+			device->output[tail%noir_cvm_pio_device_output_size]=(u8)(value>>(i<<3));
+			// Make sure the consumer sees the byte before the tail moves.
+			noir_compiler_barrier();
+			device->tail=tail+1;
+		}
+	}
+}
+
+void static nvc_pio_device_sink_handler(bool direction,u16 port,u16 size,u32p value,void* context)
+{
+	noir_cvm_pio_device_p device=(noir_cvm_pio_device_p)context;
+	if(direction)
+		device->regs.latch=*value;
+	else
+		*value=device->regs.latch;
+}
+
+void static nvc_pio_device_debugcon_handler(bool direction,u16 port,u16 size,u32p value,void* context)
+{
+	noir_cvm_pio_device_p device=(noir_cvm_pio_device_p)context;
+	if(direction)
+	{
+		while(noir_locked_cmpxchg(&device->lock,1,0))noir_pause();
+		nvc_pio_device_put_output(device,*value,size);
+		noir_locked_xchg(&device->lock,0);
+	}
+	else
+		*value=0xE9;
+}
+
+void static nvc_pio_device_uart16550_handler(bool direction,u16 port,u16 size,u32p value,void* context)
+{
+	noir_cvm_pio_device_p device=(noir_cvm_pio_device_p)context;
+	const bool dlab=(device->regs.uart.lcr&0x80)!=0;
+	u8 val=(u8)*value;
+	while(noir_locked_cmpxchg(&device->lock,1,0))noir_pause();
+	switch(port-device->node.pio.port)
+	{
+		case 0:
+		{
+			// Transmitter Holding Register or Receiver Buffer Register.
+			if(dlab)
+			{
+				if(direction)device->regs.uart.dll=val;
+				val=device->regs.uart.dll;
+			}
+			else if(direction)
+				nvc_pio_device_put_output(device,val,1);
+			else
+				val=0;
+			break;
+		}
+		case 1:
+		{
+			// Interrupt Enable Register.
+			if(dlab)
+			{
+				if(direction)device->regs.uart.dlm=val;
+				val=device->regs.uart.dlm;
+			}
+			else
+			{
+				if(direction)device->regs.uart.ier=val&0xF;
+				val=device->regs.uart.ier;
+			}
+			break;
+		}
+		case 2:
+		{
+			// FIFO Control Register or Interrupt Identification Register. No interrupts are pending.
+			if(direction)device->regs.uart.fcr=val&0xC9;
+			val=(device->regs.uart.fcr&1)?0xC1:0x01;
+			break;
+		}
+		case 3:
+		{
+			// Line Control Register.
+			if(direction)device->regs.uart.lcr=val;
+			val=device->regs.uart.lcr;
+			break;
+		}
+		case 4:
+		{
+			// Modem Control Register.
+			if(direction)device->regs.uart.mcr=val&0x1F;
+			val=device->regs.uart.mcr;
+			break;
+		}
+		case 5:
+		{
+			// Line Status Register: Transmitter is always empty. Nothing is received.
+			val=0x60;
+			break;
+		}
+		case 6:
+		{
+			// Modem Status Register: Loopback mode reflects the Modem Control Register.
+			if(device->regs.uart.mcr&0x10)
+				val=(u8)(((device->regs.uart.mcr&0x2)<<3)|((device->regs.uart.mcr&0x1)<<5)|((device->regs.uart.mcr&0xC)<<4));
+			else
+				val=0xB0;
+			break;
+		}
+		case 7:
+		{
+			// Scratch Register.
+			if(direction)device->regs.uart.scr=val;
+			val=device->regs.uart.scr;
+			break;
+		}
+	}
+	noir_locked_xchg(&device->lock,0);
+	if(!direction)*value=val;
+}
+
+noir_status nvc_create_vm_pio_device(noir_cvm_virtual_machine_p vm,noir_cvm_pio_device_model model,u16 port)
+{
+	noir_status st=noir_invalid_parameter;
+	if(model<noir_cvm_pio_device_maximum)
+	{
+		noir_cvm_pio_device_p device=noir_alloc_nonpg_memory(sizeof(noir_cvm_pio_device));
+		st=noir_insufficient_resources;
+		if(device)
+		{
+			device->model=model;
+			device->node.pio.context=device;
+			device->node.pio.port=port;
+			switch(model)
+			{
+				case noir_cvm_pio_device_sink:
+				{
+					device->node.pio.handler=nvc_pio_device_sink_handler;
+					device->node.pio.size=1;
+					device->regs.latch=0xFF;
+					break;
+				}
+				case noir_cvm_pio_device_debugcon:
+				{
+					device->node.pio.handler=nvc_pio_device_debugcon_handler;
+					device->node.pio.size=1;
+					break;
+				}
+				case noir_cvm_pio_device_uart16550:
+				{
+					device->node.pio.handler=nvc_pio_device_uart16550_handler;
+					device->node.pio.size=8;
+					break;
+				}
+			}
+			st=nvc_insert_vm_pio_node(vm,&device->node);
+			if(st!=noir_success)noir_free_nonpg_memory(device);
+		}
+	}
+	return st;
+}
+
+// Drain the output of a debug console or an UART device model.
+noir_status nvc_read_vm_pio_device_output(noir_cvm_virtual_machine_p vm,u16 port,void* buffer,u32 buffer_size,u32p read_size)
+{
+	noir_status st=noir_invalid_parameter;
+	noir_io_avl_node_p avl_node;
+	*read_size=0;
+	nvc_acquire_vm_pio_registry_shared(vm);
+	avl_node=(noir_io_avl_node_p)noir_search_avl_node((avl_node_p)vm->pio_device_root,&port,nvc_bst_search_pio_region);
+	if(avl_node)
+	{
+		if(avl_node->pio.handler==nvc_pio_device_debugcon_handler || avl_node->pio.handler==nvc_pio_device_uart16550_handler)
+		{
+			noir_cvm_pio_device_p device=(noir_cvm_pio_device_p)avl_node;
+			u32 head,count;
+			while(noir_locked_cmpxchg(&device->drain_lock,1,0))noir_pause();
+			head=device->head;
+			count=device->tail-head;
+			if(count>buffer_size)count=buffer_size;
+			for(u32 i=0;i<count;i++)((u8p)buffer)[i]=device->output[(head+i)%noir_cvm_pio_device_output_size];
+			noir_compiler_barrier();
+			device->head=head+count;
+			noir_locked_xchg(&device->drain_lock,0);
+			*read_size=count;
+			st=noir_success;
+		}
+	}
+	noir_locked_dec(&vm->pio_device_lock);
+	return st;
+}
+
+// This function is called by exit handlers. It returns false if the User Hypervisor should handle the I/O.
+bool noir_hvcode fastcall nvc_emulate_vm_pio_device(noir_cvm_virtual_machine_p vm,bool input,u16 port,u16 size,u64p rax)
+{
+	bool handled=false;
+	const i32 lock=vm->pio_device_lock;
+	// Exit handlers do not wait for the registration. Deliver the I/O to the User Hypervisor instead.
+	if(vm->pio_device_root && lock>=0 && noir_locked_cmpxchg(&vm->pio_device_lock,lock+1,lock)==lock)
+	{
+		noir_io_avl_node_p avl_node=(noir_io_avl_node_p)noir_search_avl_node((avl_node_p)vm->pio_device_root,&port,nvc_bst_search_pio_region);
+		// Accesses crossing the end of the region are not emulated.
+		if(avl_node && (u32)port+size<=(u32)avl_node->pio.port+avl_node->pio.size)
+		{
+			u32 value=(u32)*rax;
+			avl_node->pio.handler(!input,port,size,&value,avl_node->pio.context);
+			if(input)
+			{
+				// The in instruction with 32-bit operand clears the upper half of rax.
+				if(size==4)
+					*rax=value;
+				else if(size==2)
+					*(u16p)rax=(u16)value;
+				else
+					*(u8p)rax=(u8)value;
+			}
+			handled=true;
+		}
+		noir_locked_dec(&vm->pio_device_lock);
+	}
+	return handled;
+}
+
+u32 static noir_hvcode fastcall nvc_hash_cpuid_leaf(u32 leaf,u32 subleaf)
+{
+	// Leaves are clustered around a few bases (e.g.: 0x0, 0x40000000, 0x80000000). Mix them up.
+	u32 h=(leaf^(subleaf*0x9E3779B9))*0x85EBCA6B;
+	return h^(h>>16);
+}
+
+noir_cvm_cpuid_entry_p static noir_hvcode fastcall nvc_search_cpuid_entries(noir_cvm_cpuid_entry_p entries,u32 mask,u32 leaf,u32 subleaf)
+{
+	// Entries with specified subleaf take precedence over entries covering the whole leaf.
+	for(u32 i=nvc_hash_cpuid_leaf(leaf,subleaf)&mask;entries[i].options.active;i=(i+1)&mask)
+		if(entries[i].leaf==leaf && entries[i].options.has_subleaf && entries[i].subleaf==subleaf)
+			return &entries[i];
+	// Entries covering the whole leaf are hashed with zero subleaf.
+	for(u32 i=nvc_hash_cpuid_leaf(leaf,0)&mask;entries[i].options.active;i=(i+1)&mask)
+		if(entries[i].leaf==leaf && !entries[i].options.has_subleaf)
+			return &entries[i];
+	return null;
+}
+
+// Latter entries overwrite former entries with the same leaf and subleaf.
+// The caller must make sure there is at least one vacant slot in the table.
+void static nvc_insert_cpuid_entry(noir_cvm_cpuid_entry_p entries,u32 mask,noir_cvm_cpuid_entry_p entry)
+{
+	const u32 subleaf=entry->options.has_subleaf?entry->subleaf:0;
+	u32 i=nvc_hash_cpuid_leaf(entry->leaf,subleaf)&mask;
+	for(;entries[i].options.active;i=(i+1)&mask)
+		if(entries[i].leaf==entry->leaf && entries[i].options.has_subleaf==entry->options.has_subleaf && entries[i].subleaf==subleaf)
+			break;
+	entries[i]=*entry;
+	entries[i].subleaf=subleaf;
+	entries[i].options.active=true;
+	entries[i].options.reserved=0;
+}
+
+noir_cvm_cpuid_table_p nvc_build_cpuid_table(noir_cvm_cpuid_entry_p entries,u32 count)
+{
+	noir_cvm_cpuid_table_p table=null;
+	if(count<=noir_cvm_cpuid_model_limit)
+	{
+		// Keep the table at most half full.
+		u32 slots=16;
+		while(slots<count*2)slots<<=1;
+		table=noir_alloc_nonpg_memory(sizeof(noir_cvm_cpuid_table)+slots*sizeof(noir_cvm_cpuid_entry));
+		if(table)
+		{
+			table->mask=slots-1;
+			table->count=count;
+			for(u32 i=0;i<count;i++)nvc_insert_cpuid_entry(table->entries,table->mask,&entries[i]);
+		}
+	}
+	return table;
+}
+
+void nvc_build_cpuid_overrides(noir_cvm_virtual_cpu_p vcpu,noir_cvm_cpuid_entry_p entries,u32 count)
+{
+	noir_stosb(vcpu->cpuid_overrides,0,sizeof(vcpu->cpuid_overrides));
+	for(u32 i=0;i<count;i++)nvc_insert_cpuid_entry(vcpu->cpuid_overrides,noir_cvm_cpuid_override_slots-1,&entries[i]);
+}
+
+// Load the CPUID model to be answered by exit handlers. Specify zero count to unload the model.
+// A loaded model answers the CPUID even if the vCPU intercepts CPUID instructions.
+noir_status nvc_load_cpuid_model(noir_cvm_virtual_machine_p vm,noir_cvm_cpuid_entry_p entries,u32 count)
+{
+	noir_status st=noir_invalid_parameter;
+	if(count<=noir_cvm_cpuid_model_limit)
+	{
+		noir_cvm_cpuid_table_p table=null,old_table;
+		if(count)
+		{
+			table=nvc_build_cpuid_table(entries,count);
+			if(table==null)return noir_insufficient_resources;
+		}
+		noir_acquire_reslock_exclusive(vm->vcpu_list_lock);
+		old_table=(noir_cvm_cpuid_table_p)noir_locked_xchg64((i64*)&vm->cpuid_model.table,(i64)table);
+		vm->cpuid_model.user_loaded=table!=null;
+		noir_release_reslock(vm->vcpu_list_lock);
+		// Exit handlers that entered after the exchange can only see the new table.
+		while(vm->cpuid_model.readers)noir_pause();
+		if(old_table)noir_free_nonpg_memory(old_table);
+		st=noir_success;
+	}
+	return st;
+}
+
+noir_status nvc_set_vcpu_cpuid_overrides(noir_cvm_virtual_cpu_p vcpu,noir_cvm_cpuid_entry_p entries,u32 count)
+{
+	noir_status st=noir_invalid_parameter;
+	if(count<=noir_cvm_cpuid_override_limit)
+	{
+		// The vCPU lock is held while the vCPU is running.
+		noir_acquire_pushlock_exclusive(&vcpu->vcpu_lock);
+		nvc_build_cpuid_overrides(vcpu,entries,count);
+		noir_release_pushlock_exclusive(&vcpu->vcpu_lock);
+		st=noir_success;
+	}
+	return st;
+}
+
+// This function is called by exit handlers. It returns false if no entries are matched.
+bool noir_hvcode fastcall nvc_query_cpuid_model(noir_cvm_virtual_cpu_p vcpu,u32 leaf,u32 subleaf,noir_cpuid_general_info_p info)
+{
+	noir_cvm_virtual_machine_p vm=vcpu->vm;
+	bool hit=false;
+	// Search the per-vCPU overrides first.
+	noir_cvm_cpuid_entry_p entry=nvc_search_cpuid_entries(vcpu->cpuid_overrides,noir_cvm_cpuid_override_slots-1,leaf,subleaf);
+	// Built-in overrides must not shadow the model loaded by the User Hypervisor.
+	if(entry && entry->options.builtin && vm->cpuid_model.user_loaded)entry=null;
+	if(entry)
+	{
+		noir_movsd(info,&entry->eax,4);
+		hit=true;
+	}
+	else if(vm->cpuid_model.table)
+	{
+		// Exit handlers never wait for the model to be loaded.
+		noir_cvm_cpuid_table_p table;
+		noir_locked_inc(&vm->cpuid_model.readers);
+		table=vm->cpuid_model.table;
+		if(table)entry=nvc_search_cpuid_entries(table->entries,table->mask,leaf,subleaf);
+		if(entry)
+		{
+			noir_movsd(info,&entry->eax,4);
+			hit=true;
+		}
+		noir_locked_dec(&vm->cpuid_model.readers);
+	}
+	return hit;
+}
+
 void static nvc_call_rw_mmio_region_aligned(bool direction,u64 address,u64 size,u64p value)
 {
 	// BST-Search does not require recursive operation.
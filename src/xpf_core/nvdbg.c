@@ -88,6 +88,164 @@ void noir_dbgport_release_lock()
 	noir_locked_xchg(&nvdbg.port_lock,0);
 }
 
+// Trace Rings
+// Recording a trace does not format anything and does not acquire any lock.
+// It is therefore suitable for logging in VM-Exit context.
+void cdecl nvd_tracef_fn(const char* src_file,const u32 src_ln,const char* format,const u32 argc,...)
+{
+	if(nvdbg.trace.rings)
+	{
+		noir_trace_ring_p ring=&nvdbg.trace.rings[noir_get_current_processor()%nvdbg.trace.ring_count];
+		noir_trace_record_p record;
+		va_list arg_list;
+		u64 head;
+		// Reserve a slot. Other producers on this ring may race if the caller is preemptible.
+		do
+		{
+			head=ring->head;
+			if(head-ring->tail>=noir_trace_ring_records)
+			{
+				noir_locked_inc64((i64vp)&ring->dropped);
+				return;
+			}
+		}while((u64)noir_locked_cmpxchg64((i64vp)&ring->head,head+1,head)!=head);
+		record=&ring->records[head&(noir_trace_ring_records-1)];
+		record->tsc=noir_rdtsc();
+		record->format=format;
+		record->src_file=src_file;
+		record->src_ln=src_ln;
+		record->argc=argc>noir_trace_max_arguments?noir_trace_max_arguments:argc;
+		va_start(arg_list,argc);
+		for(u32 i=0;i<record->argc;i++)record->args[i]=va_arg(arg_list,u64);
+		va_end(arg_list);
+		// Publish the record only after it is completely written.
+		noir_compiler_barrier();
+		record->sequence=head+1;
+	}
+}
+
+// The caller must hold the debug port lock.
+u32 static nvd_drain_trace_rings_unsafe()
+{
+	u32 drained=0;
+	if(nvdbg.trace.rings==null || nvdbg.mode==noir_debug_interactive)return 0;
+	for(u32 i=0;i<nvdbg.trace.ring_count;i++)
+	{
+		noir_trace_ring_p ring=&nvdbg.trace.rings[i];
+		const u64 head=ring->head;
+		const u64 dropped=ring->dropped;
+		char buffer[512];
+		u64 tail;
+		i32 len;
+		for(tail=ring->tail;tail<head;tail++)
+		{
+			noir_trace_record_p record=&ring->records[tail&(noir_trace_ring_records-1)];
+			i32 prefix_len;
+			// Stop at the first record reserved but not yet published.
+			if(record->sequence!=tail+1)break;
+			// Do not read the record before its sequence is observed.
+			noir_compiler_barrier();
+			prefix_len=nv_snprintf(buffer,sizeof(buffer),"[NoirVisor | (%s@%u) | Processor %u | TSC %llu] ",record->src_file,record->src_ln,i,record->tsc);
+			// Surplus arguments are ignored by the formatter.
+			len=nv_snprintf(&buffer[prefix_len],sizeof(buffer)-prefix_len,record->format,record->args[0],record->args[1],record->args[2],record->args[3],record->args[4],record->args[5]);
+			noir_dbgport_write(buffer,prefix_len+len);
+			drained++;
+		}
+		// Release the slots to the producer only after they are consumed.
+		noir_compiler_barrier();
+		ring->tail=tail;
+		if(dropped!=ring->reported_dropped)
+		{
+			len=nv_snprintf(buffer,sizeof(buffer),"[NoirVisor] Processor %u dropped %llu trace records!\n",i,dropped-ring->reported_dropped);
+			noir_dbgport_write(buffer,len);
+			ring->reported_dropped=dropped;
+		}
+	}
+	return drained;
+}
+
+u32 nvd_drain_trace_rings()
+{
+	u32 drained;
+	noir_dbgport_acquire_lock();
+	drained=nvd_drain_trace_rings_unsafe();
+	noir_dbgport_release_lock();
+	return drained;
+}
+
+u64 nvd_query_dropped_trace_records()
+{
+	u64 dropped=0;
+	if(nvdbg.trace.rings)
+		for(u32 i=0;i<nvdbg.trace.ring_count;i++)
+			dropped+=nvdbg.trace.rings[i].dropped;
+	return dropped;
+}
+
+#if !defined(_hv_type1)
+u32 static noir_hvcode stdcall nvd_trace_drain_worker(void* context)
+{
+	// Check exit signal.
+	while(noir_locked_cmpxchg(&nvdbg.trace.stop_signal,1,1)==0)
+	{
+		nvd_drain_trace_rings();
+		noir_sleep(trace_drain_delay);
+	}
+	// Thread is about to exit.
+	noir_exit_thread(0);
+	return 0;
+}
+#endif
+
+bool nvd_initialize_trace_rings()
+{
+	const u32 count=noir_get_processor_count();
+	// There is nowhere to drain the records to if debugger is deactivated.
+	if(nvdbg.medium_type==noir_debug_unknown_medium || nvdbg.trace.rings)return false;
+	nvdbg.trace.rings=noir_alloc_nonpg_memory(sizeof(noir_trace_ring)*count);
+	if(nvdbg.trace.rings)
+	{
+		nvdbg.trace.ring_count=count;
+		nvdbg.trace.stop_signal=0;
+#if !defined(_hv_type1)
+		// In Type-I hypervisor, trace records are drained by the printing facilities.
+		nvdbg.trace.drain_thread=noir_create_thread(nvd_trace_drain_worker,null);
+		if(nvdbg.trace.drain_thread==null)
+		{
+			noir_free_nonpg_memory(nvdbg.trace.rings);
+			nvdbg.trace.rings=null;
+			return false;
+		}
+#endif
+		return true;
+	}
+	return false;
+}
+
+void nvd_finalize_trace_rings()
+{
+	if(nvdbg.trace.rings)
+	{
+#if !defined(_hv_type1)
+		if(nvdbg.trace.drain_thread)
+		{
+			// Set the signal.
+			noir_locked_xchg(&nvdbg.trace.stop_signal,1);
+			// Wake up thread if sleeping.
+			noir_alert_thread(nvdbg.trace.drain_thread);
+			// Wait for exit.
+			noir_join_thread(nvdbg.trace.drain_thread);
+			nvdbg.trace.drain_thread=null;
+		}
+#endif
+		// Ship the remaining records before the rings are released.
+		nvd_drain_trace_rings();
+		noir_free_nonpg_memory(nvdbg.trace.rings);
+		nvdbg.trace.rings=null;
+		nvdbg.trace.ring_count=0;
+	}
+}
+
 // Printing facilities
 void cdecl nvd_vprintf_fn(const char* src_file,const u32 src_ln,const char* format,va_list arg_list)
 {
@@ -100,7 +258,14 @@ void cdecl nvd_vprintf_fn(const char* src_file,const u32 src_ln,const char* form
 	content_len=nv_vsnprintf(&buffer[prefix_len],sizeof(buffer)-prefix_len,format,arg_list);
 	noir_dbgport_acquire_lock();
 	if(nvdbg.mode!=noir_debug_interactive)
+	{
+#if defined(_hv_type1)
+		// There is no drain worker in Type-I hypervisor.
+		// Keep the output in order with trace records recorded earlier.
+		nvd_drain_trace_rings_unsafe();
+#endif
 		noir_dbgport_write(buffer,prefix_len+content_len);
+	}
 	noir_dbgport_release_lock();
 }
 
@@ -0,0 +1,49 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file emulates the debug ports on POSIX user-mode environments.
+  Serial ports and QEMU Debug-Console are redirected to standard I/O.
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: ./xpf_core/posix/dbgport.c
+*/
+
+#include <unistd.h>
+#include <nvdef.h>
+#include <nvbdk.h>
+#include <nvstatus.h>
+
+noir_status nvc_io_serial_init(u8 port_number,u16 port_base,u32 baudrate)
+{
+	return noir_success;
+}
+
+noir_status nvc_io_serial_read(u8 port_number,u8p buffer,size_t length)
+{
+	return read(STDIN_FILENO,buffer,length)==(ssize_t)length?noir_success:noir_unsuccessful;
+}
+
+noir_status nvc_io_serial_write(u8 port_number,u8p buffer,size_t length)
+{
+	return write(STDERR_FILENO,buffer,length)==(ssize_t)length?noir_success:noir_unsuccessful;
+}
+
+noir_status nvc_io_qemu_debugcon_init(u16 port_number)
+{
+	return noir_success;
+}
+
+noir_status nvc_io_qemu_debugcon_read(u8p buffer,size_t length)
+{
+	return read(STDIN_FILENO,buffer,length)==(ssize_t)length?noir_success:noir_unsuccessful;
+}
+
+noir_status nvc_io_qemu_debugcon_write(u8p buffer,size_t length)
+{
+	return write(STDERR_FILENO,buffer,length)==(ssize_t)length?noir_success:noir_unsuccessful;
+}
@@ -0,0 +1,491 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This file is the NoirVisor's System Function assets of XPF-Core
+  on POSIX user-mode environments (e.g.: Linux).
+  It is not meant to run a hypervisor. Instead, it hosts the
+  hypervisor-independent core for benchmarking and testing.
+  Facilities are implemented in this file, including:
+  Debugging facilities...
+  Memory Management...
+  Processor Management...
+  Multithreading Management...
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: ./xpf_core/posix/nvsys.c
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <malloc.h>
+#include "nvsys.h"
+
+#define page_size		0x1000
+#define page_mask		0xFFF
+
+// Simple Memory Introspection Counters
+int32_t volatile noir_allocated_nonpg_pools=0;
+int32_t volatile noir_allocated_paged_pools=0;
+int32_t volatile noir_allocated_contd_memory_count=0;
+int64_t volatile noir_allocated_bytes=0;
+int64_t volatile noir_allocated_peak_bytes=0;
+
+// Debugging Facility
+void static noir_vprint_prefixed(const char* prefix,const char* format,va_list arg_list)
+{
+	char buffer[512];
+	int len=snprintf(buffer,sizeof(buffer),"%s",prefix);
+	vsnprintf(&buffer[len],sizeof(buffer)-len,format,arg_list);
+	fputs(buffer,stderr);
+}
+
+void nv_dprintf(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	noir_vprint_prefixed("[NoirVisor] ",format,arg_list);
+	va_end(arg_list);
+}
+
+void nv_dprintf_unprefixed(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	vfprintf(stderr,format,arg_list);
+	va_end(arg_list);
+}
+
+void nv_dprintf2(noir_bool datetime,noir_bool proc_id,const char* func_name,const char* format,...)
+{
+	char prefix[96];
+	int len=0;
+	va_list arg_list;
+	if(proc_id)
+		len=snprintf(prefix,sizeof(prefix),"[NoirVisor - Core %03d] ",sched_getcpu());
+	else
+		len=snprintf(prefix,sizeof(prefix),"[NoirVisor] ");
+	if(datetime)
+	{
+		struct timespec ts;
+		struct tm lt;
+		clock_gettime(CLOCK_REALTIME,&ts);
+		localtime_r(&ts.tv_sec,&lt);
+		snprintf(&prefix[len],sizeof(prefix)-len,"%04d-%02d-%02d %02d:%02d:%02d.%03ld | ",lt.tm_year+1900,lt.tm_mon+1,lt.tm_mday,lt.tm_hour,lt.tm_min,lt.tm_sec,ts.tv_nsec/1000000);
+	}
+	va_start(arg_list,format);
+	noir_vprint_prefixed(prefix,format,arg_list);
+	va_end(arg_list);
+}
+
+void nv_tracef(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	noir_vprint_prefixed("[NoirVisor - Trace] ",format,arg_list);
+	va_end(arg_list);
+}
+
+void nv_panicf(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	noir_vprint_prefixed("[NoirVisor - Panic] ",format,arg_list);
+	va_end(arg_list);
+}
+
+void nvci_tracef(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	noir_vprint_prefixed("[NoirVisor - CI Log]\t| ",format,arg_list);
+	va_end(arg_list);
+}
+
+void nvci_panicf(const char* format,...)
+{
+	va_list arg_list;
+	va_start(arg_list,format);
+	noir_vprint_prefixed("[NoirVisor - CI Panic]\t| ",format,arg_list);
+	va_end(arg_list);
+}
+
+void noir_hbreak(void)
+{
+	__builtin_trap();
+}
+
+// The c99-snprintf library is unnecessary in user mode.
+int rpl_vsnprintf(char *str,size_t size,const char *format,va_list args)
+{
+	return vsnprintf(str,size,format,args);
+}
+
+void noir_report_memory_introspection_counter()
+{
+	nv_dprintf("============NoirVisor Memory Introspection Report Start============\n");
+	nv_dprintf("Unreleased NonPaged Pools: %d\n",noir_allocated_nonpg_pools);
+	nv_dprintf("Unreleased Paged Pools: %d\n",noir_allocated_paged_pools);
+	nv_dprintf("Unreleased Contiguous Memory Count: %d\n",noir_allocated_contd_memory_count);
+	nv_dprintf("Unreleased Bytes: %lld, Peak Bytes: %lld\n",(long long)noir_allocated_bytes,(long long)noir_allocated_peak_bytes);
+	noir_report_arena_counters();
+	if(noir_allocated_nonpg_pools || noir_allocated_paged_pools || noir_allocated_contd_memory_count)
+		nv_dprintf("Memory Leak is detected!\n");
+	else
+		nv_dprintf("No Memory Leaks...\n");
+	nv_dprintf("=============NoirVisor Memory Introspection Report End=============\n");
+}
+
+// Memory Management
+void static noir_account_allocation(void* p,int32_t volatile *counter)
+{
+	int64_t bytes=(int64_t)malloc_usable_size(p);
+	int64_t cur=__atomic_add_fetch(&noir_allocated_bytes,bytes,__ATOMIC_SEQ_CST);
+	int64_t peak=__atomic_load_n(&noir_allocated_peak_bytes,__ATOMIC_RELAXED);
+	while(cur>peak)
+		if(__atomic_compare_exchange_n(&noir_allocated_peak_bytes,&peak,cur,0,__ATOMIC_SEQ_CST,__ATOMIC_RELAXED))
+			break;
+	__atomic_add_fetch(counter,1,__ATOMIC_SEQ_CST);
+}
+
+void static noir_account_release(void* p,int32_t volatile *counter)
+{
+	__atomic_sub_fetch(&noir_allocated_bytes,(int64_t)malloc_usable_size(p),__ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(counter,1,__ATOMIC_SEQ_CST);
+}
+
+// Pools no smaller than a page are page-aligned, just like Windows kernel pools.
+void static* noir_alloc_pool(size_t length,int32_t volatile *counter)
+{
+	void* p;
+	if(length>=page_size)
+		p=aligned_alloc(page_size,(length+page_mask)&~(size_t)page_mask);
+	else
+		p=malloc(length);
+	if(p)
+	{
+		memset(p,0,length);
+		noir_account_allocation(p,counter);
+	}
+	return p;
+}
+
+void* noir_alloc_contd_memory(size_t length)
+{
+	return noir_alloc_pool((length+page_mask)&~(size_t)page_mask,&noir_allocated_contd_memory_count);
+}
+
+void* noir_alloc_nonpg_memory(size_t length)
+{
+	return noir_alloc_pool(length,&noir_allocated_nonpg_pools);
+}
+
+void* noir_alloc_paged_memory(size_t length)
+{
+	return noir_alloc_pool(length,&noir_allocated_paged_pools);
+}
+
+void* noir_alloc_2mb_page()
+{
+	void* p=aligned_alloc(0x200000,0x200000);
+	if(p)memset(p,0,0x200000);
+	return p;
+}
+
+void noir_free_contd_memory(void* virtual_address,size_t length)
+{
+	noir_account_release(virtual_address,&noir_allocated_contd_memory_count);
+	free(virtual_address);
+}
+
+void noir_free_nonpg_memory(void* virtual_address)
+{
+	noir_account_release(virtual_address,&noir_allocated_nonpg_pools);
+	free(virtual_address);
+}
+
+void noir_free_paged_memory(void* virtual_address)
+{
+	noir_account_release(virtual_address,&noir_allocated_paged_pools);
+	free(virtual_address);
+}
+
+void noir_free_2mb_page(void* virtual_address)
+{
+	free(virtual_address);
+}
+
+// There is no physical memory in user mode.
+// Treat virtual addresses as physical addresses so that paging structures can be walked.
+uint64_t noir_get_physical_address(void* virtual_address)
+{
+	return (uint64_t)(uintptr_t)virtual_address;
+}
+
+uint64_t noir_get_user_physical_address(void* virtual_address)
+{
+	return (uint64_t)(uintptr_t)virtual_address;
+}
+
+void* noir_find_virt_by_phys(uint64_t physical_address)
+{
+	return (void*)(uintptr_t)physical_address;
+}
+
+void* noir_map_physical_memory(uint64_t physical_address,size_t length)
+{
+	return (void*)(uintptr_t)physical_address;
+}
+
+void* noir_map_uncached_memory(uint64_t physical_address,size_t length)
+{
+	return (void*)(uintptr_t)physical_address;
+}
+
+void noir_unmap_physical_memory(void* virtual_address,size_t length)
+{
+	;
+}
+
+uint64_t noir_get_current_process_cr3()
+{
+	return 0;
+}
+
+void* noir_lock_pages(void* virt,uint32_t bytes,uint64_t* phys)
+{
+	noir_posix_locker_p locker=malloc(sizeof(noir_posix_locker));
+	if(locker)
+	{
+		uintptr_t base=(uintptr_t)virt&~(uintptr_t)page_mask;
+		uint32_t pages=(uint32_t)((((uintptr_t)virt&page_mask)+bytes+page_mask)>>12);
+		locker->virt=virt;
+		locker->bytes=bytes;
+		for(uint32_t i=0;i<pages;i++)phys[i]=(uint64_t)(base+((uintptr_t)i<<12));
+	}
+	return locker;
+}
+
+void noir_unlock_pages(void* locker)
+{
+	free(locker);
+}
+
+void noir_get_locked_range(void* locker,void** virt,uint32_t* bytes)
+{
+	noir_posix_locker_p lk=(noir_posix_locker_p)locker;
+	*virt=lk->virt;
+	*bytes=lk->bytes;
+}
+
+void noir_get_locked_pages(void* locker,uint32_t page_index,uint32_t pages,uint64_t* phys)
+{
+	noir_posix_locker_p lk=(noir_posix_locker_p)locker;
+	uintptr_t base=((uintptr_t)lk->virt&~(uintptr_t)page_mask)+((uintptr_t)page_index<<12);
+	for(uint32_t i=0;i<pages;i++)phys[i]=(uint64_t)(base+((uintptr_t)i<<12));
+}
+
+noir_bool noir_query_page_attributes(void* virtual_address,noir_bool *valid,noir_bool *locked,noir_bool *large_page)
+{
+	*valid=1;
+	*locked=1;
+	*large_page=0;
+	return 1;
+}
+
+void noir_copy_memory(void* dest,void* src,uint32_t cch)
+{
+	memcpy(dest,src,cch);
+}
+
+void noir_enum_physical_memory_ranges(noir_physical_range_callback callback_routine,void* context)
+{
+	;
+}
+
+// Processor Management
+uint32_t noir_get_processor_count()
+{
+	return (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+uint32_t noir_get_current_processor()
+{
+	int cpu=sched_getcpu();
+	return cpu<0?0:(uint32_t)cpu;
+}
+
+// User mode cannot broadcast IPIs. Invoke the worker for each processor in turn.
+void noir_generic_call(noir_broadcast_worker worker,void* context)
+{
+	uint32_t n=noir_get_processor_count();
+	for(uint32_t i=0;i<n;i++)worker(context,i);
+}
+
+// Hardware virtualization is never available to user-mode programs.
+noir_bool nvc_is_vt_supported()
+{
+	return 0;
+}
+
+uint64_t noir_query_enabled_features_in_system()
+{
+	return 0;
+}
+
+uint64_t noir_get_system_time()
+{
+	// Keep the Windows semantics: 100ns units.
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return (uint64_t)ts.tv_sec*10000000+(uint64_t)ts.tv_nsec/100;
+}
+
+// Essential Multi-Threading Facility.
+void static* noir_thread_entry(void* context)
+{
+	noir_posix_thread_p t=(noir_posix_thread_p)context;
+	return (void*)(uintptr_t)t->procedure(t->context);
+}
+
+void* noir_create_thread(noir_thread_procedure procedure,void* context)
+{
+	noir_posix_thread_p t=malloc(sizeof(noir_posix_thread));
+	if(t)
+	{
+		t->procedure=procedure;
+		t->context=context;
+		if(pthread_create(&t->thread,NULL,noir_thread_entry,t))
+		{
+			free(t);
+			t=NULL;
+		}
+	}
+	return t;
+}
+
+void noir_exit_thread(uint32_t status)
+{
+	pthread_exit((void*)(uintptr_t)status);
+}
+
+noir_bool noir_join_thread(void* thread)
+{
+	noir_posix_thread_p t=(noir_posix_thread_p)thread;
+	if(t==NULL)return 0;
+	if(pthread_join(t->thread,NULL)==0)
+	{
+		free(t);
+		return 1;
+	}
+	return 0;
+}
+
+noir_bool noir_alert_thread(void* thread)
+{
+	// There is no alertable wait in POSIX threads.
+	return 0;
+}
+
+void noir_sleep(uint64_t ms)
+{
+	struct timespec ts;
+	ts.tv_sec=ms/1000;
+	ts.tv_nsec=(ms%1000)*1000000;
+	nanosleep(&ts,NULL);
+}
+
+// Resource Lock (R/W Lock)
+void* noir_initialize_reslock()
+{
+	pthread_rwlock_t* lock=noir_alloc_nonpg_memory(sizeof(pthread_rwlock_t));
+	if(lock)
+	{
+		if(pthread_rwlock_init(lock,NULL))
+		{
+			noir_free_nonpg_memory(lock);
+			lock=NULL;
+		}
+	}
+	return lock;
+}
+
+void noir_finalize_reslock(void* lock)
+{
+	if(lock)
+	{
+		pthread_rwlock_destroy(lock);
+		noir_free_nonpg_memory(lock);
+	}
+}
+
+void noir_acquire_reslock_shared(void* lock)
+{
+	pthread_rwlock_rdlock(lock);
+}
+
+void noir_acquire_reslock_shared_ex(void* lock)
+{
+	pthread_rwlock_rdlock(lock);
+}
+
+void noir_acquire_reslock_exclusive(void* lock)
+{
+	pthread_rwlock_wrlock(lock);
+}
+
+void noir_release_reslock(void* lock)
+{
+	pthread_rwlock_unlock(lock);
+}
+
+// Push Lock is implemented as a spinning R/W lock on a pointer-sized word.
+// Bit 0 indicates exclusive ownership. The rest counts shared owners.
+void noir_acquire_pushlock_exclusive(noir_pushlock *lock)
+{
+	noir_pushlock expected=0;
+	while(!__atomic_compare_exchange_n(lock,&expected,1,1,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+	{
+		expected=0;
+		__builtin_ia32_pause();
+	}
+}
+
+void noir_acquire_pushlock_shared(noir_pushlock *lock)
+{
+	noir_pushlock cur=__atomic_load_n(lock,__ATOMIC_RELAXED);
+	while(1)
+	{
+		if(!(cur&1))
+			if(__atomic_compare_exchange_n(lock,&cur,cur+2,1,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+				break;
+		__builtin_ia32_pause();
+		cur=__atomic_load_n(lock,__ATOMIC_RELAXED);
+	}
+}
+
+void noir_release_pushlock_exclusive(noir_pushlock *lock)
+{
+	__atomic_store_n(lock,0,__ATOMIC_RELEASE);
+}
+
+void noir_release_pushlock_shared(noir_pushlock *lock)
+{
+	__atomic_sub_fetch(lock,2,__ATOMIC_RELEASE);
+}
+
+// Standard I/O
+void noir_qsort(void* base,uint32_t num,uint32_t width,noir_sorting_comparator comparator)
+{
+	qsort(base,num,width,(int(*)(const void*,const void*))comparator);
+}
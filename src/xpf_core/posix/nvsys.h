@@ -0,0 +1,49 @@
+/*
+  NoirVisor - Hardware-Accelerated Hypervisor solution
+
+  Copyright 2018-2024, Zero Tang. All rights reserved.
+
+  This header file is for NoirVisor's System Function assets of XPF-Core
+  on POSIX user-mode environments (e.g.: Linux).
+
+  This program is distributed in the hope that it will be useful, but
+  without any warranty (no matter implied warranty or merchantability
+  or fitness for a particular purpose, etc.).
+
+  File Location: /xpf_core/posix/nvsys.h
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Types here must be binary-compatible with the definitions in nvbdk.h.
+typedef void (*noir_broadcast_worker)(void* context,uint32_t processor_id);
+typedef int32_t (*noir_sorting_comparator)(const void* a,const void*b);
+typedef uint32_t (*noir_thread_procedure)(void* context);
+typedef void (*noir_physical_range_callback)(uint64_t start,uint64_t length,void* context);
+typedef uintptr_t noir_pushlock;
+typedef int noir_bool;
+
+typedef struct _noir_posix_thread
+{
+	pthread_t thread;
+	noir_thread_procedure procedure;
+	void* context;
+}noir_posix_thread,*noir_posix_thread_p;
+
+typedef struct _noir_posix_locker
+{
+	void* virt;
+	uint32_t bytes;
+}noir_posix_locker,*noir_posix_locker_p;
+
+// Simple Memory Introspection Counters
+extern int32_t volatile noir_allocated_nonpg_pools;
+extern int32_t volatile noir_allocated_paged_pools;
+extern int32_t volatile noir_allocated_contd_memory_count;
+extern int64_t volatile noir_allocated_bytes;
+extern int64_t volatile noir_allocated_peak_bytes;
+
+void noir_report_memory_introspection_counter();
+void noir_report_arena_counters();
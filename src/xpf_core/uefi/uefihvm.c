@@ -47,9 +47,11 @@ void NoirTestCpuid()
 
 UINT32 NoirBuildHypervisor()
 {
+	nvd_initialize_trace_rings();
 	DisableInterrupts();
 	UINT32 st=nvc_build_hypervisor();
 	EnableInterrupts();
+	if(st)nvd_finalize_trace_rings();
 	NoirTestCpuid();
 	return st;
 }
@@ -57,6 +59,7 @@ UINT32 NoirBuildHypervisor()
 void NoirTeardownHypervisor()
 {
 	nvc_teardown_hypervisor();
+	nvd_finalize_trace_rings();
 }
 
 UINT64 noir_query_enabled_features_in_system()
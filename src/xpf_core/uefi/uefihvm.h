@@ -69,4 +69,6 @@ void nvc_teardown_hypervisor();
 UINT32 nvc_acpi_initialize();
 UINT32 nvc_hpet_initialize();
 UINT32 noir_configure_serial_port_debugger(UINT8 PortNumber,UINT16 PortBase,UINT32 BaudRate);
-UINT32 noir_configure_qemu_debug_console(UINT16 port);
\ No newline at end of file
+UINT32 noir_configure_qemu_debug_console(UINT16 port);
+BOOLEAN nvd_initialize_trace_rings();
+void nvd_finalize_trace_rings();
\ No newline at end of file
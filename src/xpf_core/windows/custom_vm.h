@@ -293,11 +293,23 @@ NOIR_STATUS nvc_deref_vm(IN PVOID VirtualMachine);
 NOIR_STATUS nvc_set_mapping(IN PVOID VirtualMachine,IN PNOIR_ADDRESS_MAPPING MappingInformation);
 NOIR_STATUS nvc_query_gpa_accessing_bitmap(IN PVOID VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
 NOIR_STATUS nvc_clear_gpa_accessing_bits(IN PVOID VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages);
+NOIR_STATUS nvc_promote_page_mappings(IN PVOID VirtualMachine,OUT PULONG32 Promoted);
+NOIR_STATUS nvc_query_and_clear_gpa_accessing_bitmap(IN PVOID VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
+NOIR_STATUS nvc_create_vm_pio_device(IN PVOID VirtualMachine,IN ULONG32 Model,IN USHORT Port);
+NOIR_STATUS nvc_read_vm_pio_device_output(IN PVOID VirtualMachine,IN USHORT Port,OUT PVOID Buffer,IN ULONG32 BufferSize,OUT PULONG32 ReadSize);
+NOIR_STATUS nvc_register_coalesced_mmio_zone(IN PVOID VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS nvc_unregister_coalesced_mmio_zone(IN PVOID VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS nvc_load_cpuid_model(IN PVOID VirtualMachine,IN PVOID Entries,IN ULONG32 Count);
+NOIR_STATUS nvc_set_vcpu_cpuid_overrides(IN PVOID VirtualProcessor,IN PVOID Entries,IN ULONG32 Count);
 NOIR_STATUS nvc_create_vcpu(IN PVOID VirtualMachine,OUT PVOID *VirtualProcessor,IN ULONG32 VpIndex);
 NOIR_STATUS nvc_release_vcpu(IN PVOID VirtualProcessor);
 NOIR_STATUS nvc_ref_vcpu(IN PVOID VirtualProcessor);
 NOIR_STATUS nvc_deref_vcpu(IN PVOID VirtualProcessor);
 NOIR_STATUS nvc_run_vcpu(IN PVOID VirtualProcessor,OUT PVOID ExitContext);
+NOIR_STATUS nvc_run_vcpu_ex(IN PVOID VirtualProcessor,OUT PVOID ExitContext,IN PVOID ImportSet OPTIONAL,OUT PVOID ExportSet OPTIONAL);
+NOIR_STATUS nvc_set_vcpu_export_set(IN PVOID VirtualProcessor,IN ULONG32 InterceptCode,IN PULONG32 RegisterNames,IN ULONG32 RegisterCount);
+NOIR_STATUS nvc_complete_memory_access(IN PVOID VirtualProcessor,IN ULONG64 Data,OUT PVOID Result);
+NOIR_STATUS nvc_access_guest_memory_vector(IN PVOID VirtualProcessor,IN OUT PVOID Descriptors,IN ULONG32 Count);
 NOIR_STATUS nvc_rescind_vcpu(IN PVOID VirtualProcessor);
 NOIR_STATUS nvc_query_vcpu_statistics(IN PVOID VirtualProcessor,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS nvc_view_vcpu_registers(IN PVOID VirtualProcessor,IN NOIR_CVM_REGISTER_TYPE RegisterType,OUT PVOID Buffer,IN ULONG32 BufferSize);
@@ -328,13 +340,25 @@ NOIR_STATUS NoirIncrementVirtualMachineReference(IN CVM_HANDLE VirtualMachine);
 NOIR_STATUS NoirDecrementVirtualMachineReference(IN CVM_HANDLE VirtualMachine);
 NOIR_STATUS NoirQueryGpaAccessingBitmap(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
 NOIR_STATUS NoirClearGpaAccessingBits(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages);
+NOIR_STATUS NoirPromotePageMappings(IN CVM_HANDLE VirtualMachine,OUT PULONG32 Promoted);
+NOIR_STATUS NoirQueryAndClearGpaAccessingBitmap(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize);
 NOIR_STATUS NoirSetMapping(IN CVM_HANDLE VirtualMachine,IN PNOIR_ADDRESS_MAPPING MappingInformation);
+NOIR_STATUS NoirCreatePioDevice(IN CVM_HANDLE VirtualMachine,IN ULONG32 Model,IN USHORT Port);
+NOIR_STATUS NoirReadPioDeviceOutput(IN CVM_HANDLE VirtualMachine,IN USHORT Port,OUT PVOID Buffer,IN ULONG32 BufferSize,OUT PULONG32 ReadSize);
+NOIR_STATUS NoirRegisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS NoirUnregisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size);
+NOIR_STATUS NoirLoadCpuidModel(IN CVM_HANDLE VirtualMachine,IN PVOID Entries,IN ULONG32 Count);
+NOIR_STATUS NoirSetVirtualProcessorCpuidOverrides(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN PVOID Entries,IN ULONG32 Count);
 NOIR_STATUS NoirQueryVirtualProcessorStatistics(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirViewVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,OUT PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirEditVirtualProcessorRegisters(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN NOIR_CVM_REGISTER_TYPE RegisterType,IN PVOID Buffer,IN ULONG32 BufferSize);
 NOIR_STATUS NoirSetEventInjection(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 InjectedEvent);
 NOIR_STATUS NoirSetVirtualProcessorOptions(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 OptionType,IN ULONG32 Options);
 NOIR_STATUS NoirRunVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext);
+NOIR_STATUS NoirRunVirtualProcessorEx(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext,IN PVOID ImportSet OPTIONAL,OUT PVOID ExportSet OPTIONAL);
+NOIR_STATUS NoirSetVirtualProcessorExportSet(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 InterceptCode,IN PULONG32 RegisterNames,IN ULONG32 RegisterCount);
+NOIR_STATUS NoirCompleteMemoryAccess(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 Data,OUT PVOID Result);
+NOIR_STATUS NoirAccessGuestMemoryVector(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN OUT PVOID Descriptors,IN ULONG32 Count);
 NOIR_STATUS NoirRescindVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
 NOIR_STATUS NoirCreateVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
 NOIR_STATUS NoirReleaseVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex);
@@ -284,6 +284,75 @@ NOIR_STATUS NoirClearGpaAccessingBits(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gp
 	return st;
 }
 
+NOIR_STATUS NoirPromotePageMappings(IN CVM_HANDLE VirtualMachine,OUT PULONG32 Promoted)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_promote_page_mappings(VM,Promoted);
+	return st;
+}
+
+NOIR_STATUS NoirQueryAndClearGpaAccessingBitmap(IN CVM_HANDLE VirtualMachine,IN ULONG64 GpaStart,IN ULONG32 NumberOfPages,OUT PVOID Bitmap,IN ULONG32 BitmapSize)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_query_and_clear_gpa_accessing_bitmap(VM,GpaStart,NumberOfPages,Bitmap,BitmapSize);
+	return st;
+}
+
+NOIR_STATUS NoirCreatePioDevice(IN CVM_HANDLE VirtualMachine,IN ULONG32 Model,IN USHORT Port)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_create_vm_pio_device(VM,Model,Port);
+	return st;
+}
+
+NOIR_STATUS NoirReadPioDeviceOutput(IN CVM_HANDLE VirtualMachine,IN USHORT Port,OUT PVOID Buffer,IN ULONG32 BufferSize,OUT PULONG32 ReadSize)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	*ReadSize=0;
+	if(VM)st=nvc_read_vm_pio_device_output(VM,Port,Buffer,BufferSize,ReadSize);
+	return st;
+}
+
+NOIR_STATUS NoirRegisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_register_coalesced_mmio_zone(VM,Gpa,Size);
+	return st;
+}
+
+NOIR_STATUS NoirUnregisterCoalescedMmioZone(IN CVM_HANDLE VirtualMachine,IN ULONG64 Gpa,IN ULONG64 Size)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_unregister_coalesced_mmio_zone(VM,Gpa,Size);
+	return st;
+}
+
+NOIR_STATUS NoirLoadCpuidModel(IN CVM_HANDLE VirtualMachine,IN PVOID Entries,IN ULONG32 Count)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)st=nvc_load_cpuid_model(VM,Entries,Count);
+	return st;
+}
+
+NOIR_STATUS NoirSetVirtualProcessorCpuidOverrides(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN PVOID Entries,IN ULONG32 Count)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)
+	{
+		PVOID VP=nvc_reference_vcpu(VM,VpIndex);
+		st=VP==NULL?NOIR_VCPU_NOT_EXIST:nvc_set_vcpu_cpuid_overrides(VP,Entries,Count);
+	}
+	return st;
+}
+
 NOIR_STATUS NoirSetMapping(IN CVM_HANDLE VirtualMachine,IN PNOIR_ADDRESS_MAPPING MappingInformation)
 {
 	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
@@ -388,6 +457,54 @@ NOIR_STATUS NoirRunVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIn
 	return st;
 }
 
+NOIR_STATUS NoirRunVirtualProcessorEx(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,OUT PVOID ExitContext,IN PVOID ImportSet OPTIONAL,OUT PVOID ExportSet OPTIONAL)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)
+	{
+		PVOID VP=nvc_reference_vcpu(VM,VpIndex);
+		st=VP==NULL?NOIR_VCPU_NOT_EXIST:nvc_run_vcpu_ex(VP,ExitContext,ImportSet,ExportSet);
+	}
+	return st;
+}
+
+NOIR_STATUS NoirSetVirtualProcessorExportSet(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG32 InterceptCode,IN PULONG32 RegisterNames,IN ULONG32 RegisterCount)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)
+	{
+		PVOID VP=nvc_reference_vcpu(VM,VpIndex);
+		st=VP==NULL?NOIR_VCPU_NOT_EXIST:nvc_set_vcpu_export_set(VP,InterceptCode,RegisterNames,RegisterCount);
+	}
+	return st;
+}
+
+NOIR_STATUS NoirCompleteMemoryAccess(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN ULONG64 Data,OUT PVOID Result)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)
+	{
+		PVOID VP=nvc_reference_vcpu(VM,VpIndex);
+		st=VP==NULL?NOIR_VCPU_NOT_EXIST:nvc_complete_memory_access(VP,Data,Result);
+	}
+	return st;
+}
+
+NOIR_STATUS NoirAccessGuestMemoryVector(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex,IN OUT PVOID Descriptors,IN ULONG32 Count)
+{
+	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
+	PVOID VM=NoirReferenceVirtualMachineByHandle(VirtualMachine);
+	if(VM)
+	{
+		PVOID VP=nvc_reference_vcpu(VM,VpIndex);
+		st=VP==NULL?NOIR_VCPU_NOT_EXIST:nvc_access_guest_memory_vector(VP,Descriptors,Count);
+	}
+	return st;
+}
+
 NOIR_STATUS NoirRescindVirtualProcessor(IN CVM_HANDLE VirtualMachine,IN ULONG32 VpIndex)
 {
 	NOIR_STATUS st=NOIR_UNSUCCESSFUL;
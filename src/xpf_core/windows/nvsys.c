@@ -138,6 +138,7 @@ void NoirReportMemoryIntrospectionCounter()
 	NoirDebugPrint("Unreleased NonPaged Pools: %d\n",NoirAllocatedNonPagedPools);
 	NoirDebugPrint("Unreleased Paged Pools: %d\n",NoirAllocatedPagedPools);
 	NoirDebugPrint("Unreleased Contiguous Memory Count: %d\n",NoirAllocatedContiguousMemoryCount);
+	noir_report_arena_counters();
 	if(NoirAllocatedNonPagedPools || NoirAllocatedPagedPools || NoirAllocatedContiguousMemoryCount)
 		NoirDebugPrint("Memory Leak is detected!\n");
 	else
@@ -474,6 +475,12 @@ void noir_get_locked_range(PMDL Mdl,void** virt,PULONG bytes)
 	*bytes=MmGetMdlByteCount(Mdl);
 }
 
+void noir_get_locked_pages(PMDL Mdl,ULONG32 PageIndex,ULONG32 Pages,PULONG64 phys)
+{
+	PPFN_NUMBER PfnArray=MmGetMdlPfnArray(Mdl);
+	for(ULONG32 i=0;i<Pages;i++)phys[i]=PfnArray[PageIndex+i]<<PAGE_SHIFT;
+}
+
 void noir_unlock_pages(PMDL Mdl)
 {
 	MmUnlockPages(Mdl);
@@ -139,6 +139,7 @@ typedef LONG(__cdecl *noir_sorting_comparator)(const void* a,const void*b);
 
 #define NoirSaveProcessorState		noir_save_processor_state
 void noir_save_processor_state(OUT PNOIR_PROCESSOR_STATE State);
+void noir_report_arena_counters();
 
 NTKERNELAPI void __fastcall ExfAcquirePushLockExclusive(IN OUT PEX_PUSH_LOCK PushLock);
 NTKERNELAPI void __fastcall ExfAcquirePushLockShared(IN OUT PEX_PUSH_LOCK PushLock);
@@ -420,12 +420,16 @@ ULONG NoirBuildHypervisor()
 {
 	if(NoirHypervisorStarted==FALSE)
 	{
-		ULONG r=nvc_build_hypervisor();
+		ULONG r;
+		nvd_initialize_trace_rings();
+		r=nvc_build_hypervisor();
 		if(r==0)
 		{
 			NoirHypervisorStarted=TRUE;
 			NoirDebugPrint("NoirVisor CVM Initialization Status: 0x%X\n",NoirInitializeCvmModule());
 		}
+		else
+			nvd_finalize_trace_rings();
 		return r;
 	}
 	return 0;
@@ -437,6 +441,7 @@ void NoirTeardownHypervisor()
 	{
 		NoirFinalizeCvmModule();
 		nvc_teardown_hypervisor();
+		nvd_finalize_trace_rings();
 		NoirHypervisorStarted=FALSE;
 	}
 }